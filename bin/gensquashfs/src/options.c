@@ -23,6 +23,13 @@ static struct option long_opts[] = {
 	{ "pack-dir", required_argument, NULL, 'D' },
 	{ "num-jobs", required_argument, NULL, 'j' },
 	{ "queue-backlog", required_argument, NULL, 'Q' },
+	{ "mem-limit", required_argument, NULL, 'M' },
+	{ "io-thread", no_argument, NULL, 'W' },
+	{ "strong-hash", no_argument, NULL, 'Z' },
+	{ "pre-dedup", no_argument, NULL, 'P' },
+	{ "skip-incompressible", no_argument, NULL, 'I' },
+	{ "block-cache", required_argument, NULL, 'C' },
+	{ "block-cache-size", required_argument, NULL, 'L' },
 	{ "keep-time", no_argument, NULL, 'k' },
 #ifdef HAVE_SYS_XATTR_H
 	{ "keep-xattr", no_argument, NULL, 'x' },
@@ -43,7 +50,7 @@ static struct option long_opts[] = {
 	{ NULL, 0, NULL, 0 },
 };
 
-static const char *short_opts = "HF:D:X:c:b:B:d:u:g:j:Q:S:A:kxoefqThV"
+static const char *short_opts = "HF:D:X:c:b:B:d:u:g:j:Q:M:WZPIC:L:S:A:kxoefqThV"
 #ifdef WITH_SELINUX
 "s:"
 #endif
@@ -81,6 +88,28 @@ static const char *pack_options =
 "                              worker queue before the packer starts waiting\n"
 "                              for the block processors to catch up.\n"
 "                              Defaults to 10 times the number of jobs.\n"
+"  --mem-limit, -M <size>      Maximum amount of memory to use for data\n"
+"                              blocks in flight. Default: no limit besides\n"
+"                              the queue backlog.\n"
+"  --io-thread, -W             Write the data blocks from a separate thread,\n"
+"                              so reading input and submitting blocks can\n"
+"                              continue while blocks are being written.\n"
+"  --strong-hash, -Z           Deduplicate blocks using a strong hash,\n"
+"                              instead of reading the output back.\n"
+"  --pre-dedup, -P             Do not compress data blocks again that are\n"
+"                              identical to a recently compressed block,\n"
+"                              going by their 128 bit hash.\n"
+"  --skip-incompressible, -I   Store data blocks that look random (e.g.\n"
+"                              already compressed) without trying to\n"
+"                              compress them.\n"
+"  --block-cache, -C <dir>     Keep compressed data blocks in a directory\n"
+"                              and reuse them in later runs, instead of\n"
+"                              compressing the same data again.\n"
+"  --block-cache-size, -L <size>\n"
+"                              Remove the least recently used entries from\n"
+"                              the block cache if it grows larger than\n"
+"                              this. Defaults to 1G, 0 means that the cache\n"
+"                              is never cleaned up.\n"
 "  --block-size, -b <size>     Block size to use for Squashfs image.\n"
 "                              Defaults to %u.\n"
 "  --dev-block-size, -B <size> Device block size to padd the image to.\n"
@@ -265,6 +294,33 @@ void process_command_line(options_t *opt, int argc, char **argv)
 		case 'Q':
 			opt->cfg.max_backlog = strtol(optarg, NULL, 0);
 			break;
+		case 'M':
+			if (parse_size("Memory limit", &opt->cfg.mem_limit,
+				       optarg, 0)) {
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'W':
+			opt->cfg.io_thread = true;
+			break;
+		case 'Z':
+			opt->cfg.strong_hash = true;
+			break;
+		case 'P':
+			opt->cfg.pre_dedup = true;
+			break;
+		case 'I':
+			opt->cfg.skip_incompressible = true;
+			break;
+		case 'C':
+			opt->cfg.block_cache = optarg;
+			break;
+		case 'L':
+			if (parse_size("Block cache size",
+				       &opt->cfg.block_cache_size, optarg, 0)) {
+				exit(EXIT_FAILURE);
+			}
+			break;
 		case 'B':
 			if (parse_size("Device block size",
 				       &opt->cfg.devblksize, optarg, 0)) {
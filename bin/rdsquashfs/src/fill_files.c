@@ -5,6 +5,10 @@
  * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
  */
 #include "rdsquashfs.h"
+#include "util/threadpool.h"
+
+/* each worker gets a few chunks, so uneven chunks balance out */
+#define CHUNKS_PER_JOB (8)
 
 static struct file_ent {
 	char *path;
@@ -14,6 +18,14 @@ static struct file_ent {
 static size_t num_files = 0, max_files = 0;
 static size_t block_size = 0;
 
+/* a contiguous range of the sorted file list, unpacked by one worker */
+struct fill_chunk {
+	size_t first;
+	size_t count;
+	int flags;
+	int status;
+};
+
 static int compare_files(const void *l, const void *r)
 {
 	sqfs_u32 lhs_frag_idx, lhs_frag_off, rhs_frag_idx, rhs_frag_off;
@@ -133,7 +145,8 @@ static int gen_file_list_dfs(const sqfs_tree_node_t *n)
 	return 0;
 }
 
-static int fill_files(sqfs_data_reader_t *data, int flags)
+static int fill_files(sqfs_data_reader_t *data, size_t first, size_t count,
+		      int flags)
 {
 	int ret, openflags;
 	sqfs_ostream_t *fp;
@@ -145,7 +158,7 @@ static int fill_files(sqfs_data_reader_t *data, int flags)
 	if (flags & UNPACK_NO_SPARSE)
 		openflags |= SQFS_FILE_OPEN_NO_SPARSE;
 
-	for (i = 0; i < num_files; ++i) {
+	for (i = first; i < first + count; ++i) {
 		ret = sqfs_ostream_open_file(&fp, files[i].path, openflags);
 		if (ret) {
 			sqfs_perror(files[i].path, NULL, ret);
@@ -184,8 +197,128 @@ static int fill_files(sqfs_data_reader_t *data, int flags)
 	return 0;
 }
 
+static int fill_chunk_worker(void *user, void *item)
+{
+	struct fill_chunk *chunk = item;
+
+	chunk->status = fill_files(user, chunk->first, chunk->count,
+				   chunk->flags);
+	return 0;
+}
+
+/*
+  Split the sorted file list into contiguous chunks of roughly the same
+  amount of data. Neighbouring files tend to share fragment blocks or have
+  adjacent data blocks, so keeping them together preserves that locality.
+ */
+static struct fill_chunk *split_file_list(size_t max_chunks, int flags,
+					  size_t *out_count)
+{
+	sqfs_u64 size, total = 0, target, used = 0;
+	struct fill_chunk *chunks;
+	size_t i, count = 0;
+
+	chunks = alloc_array(sizeof(chunks[0]), max_chunks);
+	if (chunks == NULL) {
+		perror("splitting file list");
+		return NULL;
+	}
+
+	for (i = 0; i < num_files; ++i) {
+		sqfs_inode_get_file_size(files[i].inode, &size);
+		total += size;
+	}
+
+	target = total / max_chunks;
+
+	for (i = 0; i < num_files; ++i) {
+		if (count == 0 || (used >= target && count < max_chunks)) {
+			chunks[count].first = i;
+			chunks[count].flags = flags;
+			count += 1;
+			used = 0;
+		}
+
+		sqfs_inode_get_file_size(files[i].inode, &size);
+		chunks[count - 1].count += 1;
+		used += size;
+	}
+
+	*out_count = count;
+	return chunks;
+}
+
+static int fill_files_parallel(sqfs_data_reader_t *data, int flags,
+			       size_t num_jobs)
+{
+	sqfs_data_reader_t **readers = NULL;
+	struct fill_chunk *chunks, *chunk;
+	size_t i, count, num_chunks;
+	thread_pool_t *pool;
+	int status = -1;
+
+	chunks = split_file_list(num_jobs * CHUNKS_PER_JOB, flags, &num_chunks);
+	if (chunks == NULL)
+		return -1;
+
+	pool = thread_pool_create(num_jobs, fill_chunk_worker);
+	if (pool == NULL) {
+		fputs("Error creating thread pool\n", stderr);
+		goto out_chunks;
+	}
+
+	count = pool->get_worker_count(pool);
+
+	readers = alloc_array(sizeof(readers[0]), count);
+	if (readers == NULL) {
+		perror("creating data readers");
+		goto out_pool;
+	}
+
+	for (i = 0; i < count; ++i) {
+		readers[i] = sqfs_copy(data);
+		if (readers[i] == NULL) {
+			sqfs_perror(NULL, "creating data readers",
+				    SQFS_ERROR_ALLOC);
+			goto out_pool;
+		}
+
+		pool->set_worker_ptr(pool, i, readers[i]);
+	}
+
+	status = 0;
+
+	for (i = 0; i < num_chunks; ++i) {
+		if (pool->submit(pool, chunks + i)) {
+			fputs("Error submitting work to thread pool\n",
+			      stderr);
+			status = -1;
+			break;
+		}
+	}
+
+	/* on error, destroying the pool stops the remaining chunks */
+	while ((chunk = pool->dequeue(pool)) != NULL) {
+		if (chunk->status) {
+			status = -1;
+			break;
+		}
+	}
+out_pool:
+	pool->destroy(pool);
+
+	if (readers != NULL) {
+		for (i = 0; i < count; ++i)
+			sqfs_drop(readers[i]);
+		free(readers);
+	}
+out_chunks:
+	free(chunks);
+	return status;
+}
+
 int fill_unpacked_files(size_t blk_sz, const sqfs_tree_node_t *root,
-			sqfs_data_reader_t *data, int flags)
+			sqfs_data_reader_t *data, int flags, size_t num_jobs)
 {
 	int status;
 
@@ -198,7 +331,12 @@ int fill_unpacked_files(size_t blk_sz, const sqfs_tree_node_t *root,
 
 	qsort(files, num_files, sizeof(files[0]), compare_files);
 
-	status = fill_files(data, flags);
+	if (num_jobs > 1 && num_files > 1) {
+		status = fill_files_parallel(data, flags, num_jobs);
+	} else {
+		status = fill_files(data, 0, num_files, flags);
+	}
+
 	clear_file_list();
 	return status;
 }
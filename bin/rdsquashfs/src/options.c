@@ -26,6 +26,8 @@ static struct option long_opts[] = {
 	{ "describe", no_argument, NULL, 'd' },
 	{ "chmod", no_argument, NULL, 'C' },
 	{ "chown", no_argument, NULL, 'O' },
+	{ "read-ahead", required_argument, NULL, 'R' },
+	{ "num-jobs", required_argument, NULL, 'j' },
 	{ "quiet", no_argument, NULL, 'q' },
 	{ "help", no_argument, NULL, 'h' },
 	{ "version", no_argument, NULL, 'V' },
@@ -33,7 +35,7 @@ static struct option long_opts[] = {
 };
 
 static const char *short_opts =
-	"l:c:u:p:x:s:DSFLCOEZTj:dqhV"
+	"l:c:u:p:x:s:DSFLCOEZTj:R:dqhV"
 #ifdef HAVE_SYS_XATTR_H
 	"X"
 #endif
@@ -82,6 +84,11 @@ static const char *help_string =
 "                            those store in the squashfs image.\n"
 "  --chown, -O               Change ownership of unpacked files to the\n"
 "                            UID/GID set in the squashfs image.\n"
+"  --read-ahead, -R <count>  Decompress upcoming data blocks of a file in\n"
+"                            the background while unpacking it, using the\n"
+"                            given number of worker threads.\n"
+"  --num-jobs, -j <count>    Unpack several files at once, using the given\n"
+"                            number of worker threads.\n"
 "  --quiet, -q               Do not print out progress while unpacking.\n"
 "\n"
 "  --help, -h                Print help text and exit.\n"
@@ -119,6 +126,8 @@ void process_command_line(options_t *opt, int argc, char **argv)
 	opt->cmdpath = NULL;
 	opt->unpack_root = NULL;
 	opt->image_name = NULL;
+	opt->read_ahead = 0;
+	opt->num_jobs = 1;
 
 	for (;;) {
 		i = getopt_long(argc, argv, short_opts, long_opts, NULL);
@@ -186,6 +195,24 @@ void process_command_line(options_t *opt, int argc, char **argv)
 			opt->op = OP_UNPACK;
 			opt->cmdpath = get_path(opt->cmdpath, optarg);
 			break;
+		case 'R':
+			i = strtol(optarg, NULL, 0);
+			if (i < 0) {
+				fprintf(stderr, "Invalid read-ahead count "
+					"'%s'.\n", optarg);
+				goto fail_arg;
+			}
+			opt->read_ahead = i;
+			break;
+		case 'j':
+			i = strtol(optarg, NULL, 0);
+			if (i < 1) {
+				fprintf(stderr, "Invalid number of jobs "
+					"'%s'.\n", optarg);
+				goto fail_arg;
+			}
+			opt->num_jobs = i;
+			break;
 		case 'q':
 			opt->flags |= UNPACK_QUIET;
 			break;
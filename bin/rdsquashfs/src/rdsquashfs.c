@@ -191,6 +191,12 @@ int main(int argc, char **argv)
 		goto out;
 	}
 
+	ret = sqfs_data_reader_set_read_ahead(data, opt.read_ahead, 0);
+	if (ret) {
+		sqfs_perror(opt.image_name, "configuring read-ahead", ret);
+		goto out;
+	}
+
 	ret = sqfs_dir_reader_get_full_hierarchy(dirrd, idtbl, opt.cmdpath,
 						 opt.rdtree_flags, &n);
 	if (ret) {
@@ -253,7 +259,8 @@ int main(int argc, char **argv)
 		if (restore_fstree(n, opt.flags))
 			goto out;
 
-		if (fill_unpacked_files(super.block_size, n, data, opt.flags))
+		if (fill_unpacked_files(super.block_size, n, data, opt.flags,
+					opt.num_jobs))
 			goto out;
 
 		if (update_tree_attribs(xattr, n, opt.flags))
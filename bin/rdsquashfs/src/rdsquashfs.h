@@ -59,6 +59,8 @@ typedef struct {
 	char *cmdpath;
 	const char *unpack_root;
 	const char *image_name;
+	size_t read_ahead;
+	size_t num_jobs;
 } options_t;
 
 void list_files(const sqfs_tree_node_t *node);
@@ -71,7 +73,7 @@ int update_tree_attribs(sqfs_xattr_reader_t *xattr,
 			const sqfs_tree_node_t *root, int flags);
 
 int fill_unpacked_files(size_t blk_sz, const sqfs_tree_node_t *root,
-			sqfs_data_reader_t *data, int flags);
+			sqfs_data_reader_t *data, int flags, size_t num_jobs);
 
 int describe_tree(const sqfs_tree_node_t *root, const char *unpack_root);
 
@@ -218,7 +218,8 @@ static int read_xattr(sqfs_dir_iterator_t *base, sqfs_xattr_t **out)
 	return it->src->read_xattr(it->src, out);
 }
 
-sqfs_dir_iterator_t *tar_compat_iterator_create(const char *filename)
+sqfs_dir_iterator_t *tar_compat_iterator_create(const char *filename,
+					       size_t *block_size)
 {
 	sqfs_dir_iterator_t *base = NULL;
 	sqfs_id_table_t *idtbl = NULL;
@@ -302,6 +303,12 @@ sqfs_dir_iterator_t *tar_compat_iterator_create(const char *filename)
 		goto fail;
 	}
 
+	ret = sqfs_data_reader_set_read_ahead(data, read_ahead, 0);
+	if (ret) {
+		sqfs_perror(filename, "configuring read-ahead", ret);
+		goto fail;
+	}
+
 	/* create xattr reader */
 	if (!no_xattr && !(it->super.flags & SQFS_FLAG_NO_XATTRS)) {
 		xr = sqfs_xattr_reader_create(0);
@@ -372,6 +379,8 @@ sqfs_dir_iterator_t *tar_compat_iterator_create(const char *filename)
 	}
 
 	/* finish up initialization */
+	*block_size = it->super.block_size;
+
 	sqfs_object_init(it, destroy, NULL);
 	((sqfs_dir_iterator_t *)it)->next = next;
 	((sqfs_dir_iterator_t *)it)->read_link = read_link;
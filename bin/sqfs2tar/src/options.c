@@ -14,12 +14,14 @@ static struct option long_opts[] = {
 	{ "no-skip", no_argument, NULL, 's' },
 	{ "no-xattr", no_argument, NULL, 'X' },
 	{ "no-hard-links", no_argument, NULL, 'L' },
+	{ "read-ahead", required_argument, NULL, 'R' },
+	{ "num-jobs", required_argument, NULL, 'j' },
 	{ "help", no_argument, NULL, 'h' },
 	{ "version", no_argument, NULL, 'V' },
 	{ NULL, 0, NULL, 0 },
 };
 
-static const char *short_opts = "c:d:kr:sXLhV";
+static const char *short_opts = "c:d:kr:sXLR:j:hV";
 
 static const char *usagestr =
 "Usage: sqfs2tar [OPTIONS...] <sqfsfile>\n"
@@ -31,6 +33,12 @@ static const char *usagestr =
 "\n"
 "  --compressor, -c <name>   If set, stream compress the resulting tarball.\n"
 "                            By default, the tarball is uncompressed.\n"
+"  --num-jobs, -j <count>    Compress the tarball on the given number of\n"
+"                            threads. The data is split into chunks that\n"
+"                            are compressed independently, similar to\n"
+"                            pigz. The default is a single thread.\n"
+"                            Each thread needs about 36 MiB of buffers for\n"
+"                            xz and zstd, about 4.5 MiB for other formats.\n"
 "\n"
 "  --subdir, -d <dir>        Unpack the given sub directory instead of the\n"
 "                            filesystem root. Can be specified more than\n"
@@ -54,6 +62,11 @@ static const char *usagestr =
 "  --no-xattr, -X            Do not copy extended attributes.\n"
 "  --no-hard-links, -L       Do not generate hard links. Produce duplicate\n"
 "                            entries instead.\n"
+"  --read-ahead, -R <count>  Decompress upcoming file data blocks in the\n"
+"                            background, in archive order, using the given\n"
+"                            number of worker threads. By default, blocks\n"
+"                            are decompressed one at a time while writing\n"
+"                            the archive.\n"
 "\n"
 "  --no-skip, -s             Abort if a file cannot be stored in a tar\n"
 "                            archive. By default, it is simply skipped\n"
@@ -72,6 +85,8 @@ bool no_links = false;
 char *root_becomes = NULL;
 strlist_t subdirs = { 0, 0, 0 };
 int compressor = 0;
+size_t read_ahead = 0;
+size_t num_jobs = 1;
 
 const char *filename = NULL;
 
@@ -132,6 +147,24 @@ void process_args(int argc, char **argv)
 		case 'L':
 			no_links = true;
 			break;
+		case 'R':
+			i = strtol(optarg, NULL, 0);
+			if (i < 0) {
+				fprintf(stderr, "Invalid read-ahead count "
+					"'%s'.\n", optarg);
+				goto fail_arg;
+			}
+			read_ahead = i;
+			break;
+		case 'j':
+			i = strtol(optarg, NULL, 0);
+			if (i < 1) {
+				fprintf(stderr, "Invalid number of jobs "
+					"'%s'.\n", optarg);
+				goto fail_arg;
+			}
+			num_jobs = i;
+			break;
 		case 'h':
 			fputs(usagestr, stdout);
 
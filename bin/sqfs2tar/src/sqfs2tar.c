@@ -17,61 +17,169 @@ static int terminate_archive(void)
 	return out_file->append(out_file, buffer, sizeof(buffer));
 }
 
-static int write_file_data(sqfs_dir_iterator_t *it, const sqfs_dir_entry_t *ent)
+/*
+  An entry that has been read from the image, but not written to the
+  archive yet. Errors from reading it are reported once it is its turn.
+ */
+typedef struct {
+	sqfs_dir_entry_t *ent;
+	sqfs_xattr_t *xattr;
+	char *target;
+	sqfs_istream_t *data;
+
+	const char *err_what;
+	int status;
+} pending_t;
+
+/* upper bound for entries read ahead, e.g. a long run of empty files */
+#define MAX_PENDING (1024)
+
+static pending_t *pending = NULL;
+static size_t pending_max = 0;
+static size_t pending_first = 0;
+static size_t pending_count = 0;
+
+/* file data of the pending entries, except for the first one */
+static sqfs_u64 pending_bytes = 0;
+static sqfs_u64 max_pending_bytes = 0;
+
+static sqfs_u64 data_size(const sqfs_dir_entry_t *ent)
+{
+	return S_ISREG(ent->mode) ? ent->size : 0;
+}
+
+static void pending_cleanup(pending_t *p)
 {
-	sqfs_istream_t *in;
+	sqfs_drop(p->data);
+	sqfs_xattr_list_free(p->xattr);
+	sqfs_free(p->target);
+	sqfs_free(p->ent);
+	memset(p, 0, sizeof(*p));
+}
+
+static void read_entry(sqfs_dir_iterator_t *it, pending_t *p)
+{
+	const sqfs_dir_entry_t *ent = p->ent;
 	int ret;
 
-	ret = it->open_file_ro(it, &in);
-	if (ret)
-		return ret;
+	if (S_ISLNK(ent->mode) ||
+	    (ent->flags & SQFS_DIR_ENTRY_FLAG_HARD_LINK)) {
+		ret = it->read_link(it, &p->target);
+		if (ret != 0) {
+			p->err_what = "reading link target";
+			p->status = ret;
+			return;
+		}
+	}
+
+	ret = it->read_xattr(it, &p->xattr);
+	if (ret != 0) {
+		p->err_what = "reading xattr data";
+		p->status = ret;
+		return;
+	}
+
+	/* with read-ahead, this already starts decompressing the data */
+	if (S_ISREG(ent->mode))
+		p->status = it->open_file_ro(it, &p->data);
+}
+
+/*
+  Returns true if another entry should be read before writing out the
+  first pending one. This keeps the read-ahead workers busy with the data
+  of upcoming files, in archive order, while the current one is written.
+ */
+static bool want_more(void)
+{
+	if (pending_count == 0)
+		return true;
+
+	return pending_count < pending_max &&
+		pending_bytes < max_pending_bytes;
+}
+
+static void pending_push(sqfs_dir_iterator_t *it, sqfs_dir_entry_t *ent)
+{
+	pending_t *p;
+
+	p = pending + (pending_first + pending_count) % pending_max;
+	p->ent = ent;
+	read_entry(it, p);
+
+	if (pending_count > 0)
+		pending_bytes += data_size(ent);
+
+	pending_count += 1;
+}
+
+static void pending_pop(void)
+{
+	pending_cleanup(pending + pending_first);
+	pending_first = (pending_first + 1) % pending_max;
+	pending_count -= 1;
+
+	if (pending_count > 0)
+		pending_bytes -= data_size(pending[pending_first].ent);
+}
+
+static int pending_init(size_t block_size)
+{
+	pending_max = read_ahead > 0 ? MAX_PENDING : 1;
+	max_pending_bytes = (sqfs_u64)read_ahead * 2 * block_size;
+
+	pending = alloc_array(sizeof(pending[0]), pending_max);
+	if (pending == NULL) {
+		perror("creating read-ahead queue");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void pending_free(void)
+{
+	while (pending_count > 0)
+		pending_pop();
+
+	free(pending);
+	pending = NULL;
+}
+
+static int write_file_data(sqfs_istream_t *in, const sqfs_dir_entry_t *ent)
+{
+	int ret;
 
 	do {
 		ret = sqfs_istream_splice(in, out_file,
 					  SQFS_DEFAULT_BLOCK_SIZE);
 	} while (ret > 0);
 
-	in = sqfs_drop(in);
-
 	if (ret == 0)
 		ret = padd_file(out_file, ent->size);
 
 	return ret;
 }
 
-static int write_entry(sqfs_dir_iterator_t *it, const sqfs_dir_entry_t *ent)
+static int write_entry(const pending_t *p)
 {
 	static unsigned int record_counter;
-	sqfs_xattr_t *xattr = NULL;
-	char *target = NULL;
+	const sqfs_dir_entry_t *ent = p->ent;
 	int ret;
 
-	if (S_ISLNK(ent->mode) ||
-	    (ent->flags & SQFS_DIR_ENTRY_FLAG_HARD_LINK)) {
-		ret = it->read_link(it, &target);
-
-		if (ret != 0) {
-			sqfs_perror(ent->name, "reading link target", ret);
-			return ret;
-		}
-	}
-
-	ret = it->read_xattr(it, &xattr);
-	if (ret != 0) {
-		sqfs_perror(ent->name, "reading xattr data", ret);
-		sqfs_free(target);
-		return ret;
+	if (p->status != 0) {
+		if (p->err_what != NULL)
+			sqfs_perror(ent->name, p->err_what, p->status);
+		return p->status;
 	}
 
-	ret = write_tar_header(out_file, ent, target, xattr, record_counter++);
+	ret = write_tar_header(out_file, ent, p->target, p->xattr,
+			       record_counter++);
 	if (ret)
 		sqfs_perror(ent->name, "writing tar header", ret);
 
 	if (S_ISREG(ent->mode) && ret == 0)
-		ret = write_file_data(it, ent);
+		ret = write_file_data(p->data, ent);
 
-	sqfs_xattr_list_free(xattr);
-	sqfs_free(target);
 	return ret;
 }
 
@@ -79,6 +187,8 @@ int main(int argc, char **argv)
 {
 	int ret, status = EXIT_FAILURE;
 	sqfs_dir_iterator_t *it = NULL;
+	size_t block_size;
+	bool eof = false;
 
 	process_args(argc, argv);
 
@@ -88,7 +198,17 @@ int main(int argc, char **argv)
 		goto out;
 	}
 
-	if (compressor > 0) {
+	if (compressor > 0 && num_jobs > 1) {
+		sqfs_ostream_t *strm;
+
+		strm = ostream_xfrm_create_mt(out_file, compressor, NULL,
+					      num_jobs);
+		sqfs_drop(out_file);
+		out_file = strm;
+
+		if (out_file == NULL)
+			goto out;
+	} else if (compressor > 0) {
 		xfrm_stream_t *xfrm = compressor_stream_create(compressor,NULL);
 		sqfs_ostream_t *strm;
 
@@ -104,7 +224,7 @@ int main(int argc, char **argv)
 			goto out;
 	}
 
-	it = tar_compat_iterator_create(filename);
+	it = tar_compat_iterator_create(filename, &block_size);
 	if (it == NULL)
 		goto out;
 
@@ -122,39 +242,52 @@ int main(int argc, char **argv)
 		it = hl;
 	}
 
+	if (pending_init(block_size))
+		goto out;
+
 	for (;;) {
 		sqfs_dir_entry_t *ent;
 
-		ret = it->next(it, &ent);
-		if (ret > 0)
-			break;
-		if (ret < 0) {
-			sqfs_perror(filename, "reading directory entry", ret);
-			goto out;
+		while (!eof && want_more()) {
+			ret = it->next(it, &ent);
+			if (ret > 0) {
+				eof = true;
+				break;
+			}
+			if (ret < 0) {
+				sqfs_perror(filename, "reading directory entry",
+					    ret);
+				goto out;
+			}
+
+			pending_push(it, ent);
 		}
 
-		ret = write_entry(it, ent);
+		if (pending_count == 0)
+			break;
+
+		ent = pending[pending_first].ent;
+
+		ret = write_entry(pending + pending_first);
 		if (ret == SQFS_ERROR_UNSUPPORTED) {
 			fprintf(stderr, "WARNING: %s: unsupported file type\n",
 				ent->name);
 			if (dont_skip) {
 				fputs("Not allowed to skip files, aborting!\n",
 				      stderr);
-				sqfs_free(ent);
 				goto out;
 			}
 			fprintf(stderr, "Skipping %s\n", ent->name);
-			sqfs_free(ent);
+			pending_pop();
 			continue;
 		}
 
 		if (ret) {
 			sqfs_perror(ent->name, NULL, ret);
-			sqfs_free(ent);
 			goto out;
 		}
 
-		sqfs_free(ent);
+		pending_pop();
 	}
 
 	if (terminate_archive())
@@ -168,6 +301,7 @@ int main(int argc, char **argv)
 
 	status = EXIT_SUCCESS;
 out:
+	pending_free();
 	sqfs_drop(it);
 	sqfs_drop(out_file);
 	strlist_cleanup(&subdirs);
@@ -33,12 +33,15 @@ extern bool no_links;
 extern char *root_becomes;
 extern strlist_t subdirs;
 extern int compressor;
+extern size_t read_ahead;
+extern size_t num_jobs;
 
 extern const char *filename;
 
 void process_args(int argc, char **argv);
 
 /* iterator.c */
-sqfs_dir_iterator_t *tar_compat_iterator_create(const char *filename);
+sqfs_dir_iterator_t *tar_compat_iterator_create(const char *filename,
+					       size_t *block_size);
 
 #endif /* SQFS2TAR_H */
@@ -14,6 +14,13 @@ static struct option long_opts[] = {
 	{ "defaults", required_argument, NULL, 'd' },
 	{ "num-jobs", required_argument, NULL, 'j' },
 	{ "queue-backlog", required_argument, NULL, 'Q' },
+	{ "mem-limit", required_argument, NULL, 'M' },
+	{ "io-thread", no_argument, NULL, 'W' },
+	{ "strong-hash", no_argument, NULL, 'Z' },
+	{ "pre-dedup", no_argument, NULL, 'P' },
+	{ "skip-incompressible", no_argument, NULL, 'I' },
+	{ "block-cache", required_argument, NULL, 'C' },
+	{ "block-cache-size", required_argument, NULL, 'L' },
 	{ "comp-extra", required_argument, NULL, 'X' },
 	{ "no-skip", no_argument, NULL, 's' },
 	{ "no-xattr", no_argument, NULL, 'x' },
@@ -29,7 +36,7 @@ static struct option long_opts[] = {
 	{ NULL, 0, NULL, 0 },
 };
 
-static const char *short_opts = "r:c:b:B:d:X:j:Q:sxekfqE:SThV";
+static const char *short_opts = "r:c:b:B:d:X:j:Q:M:WZPIC:L:sxekfqE:SThV";
 
 static const char *usagestr =
 "Usage: tar2sqfs [OPTIONS...] <sqfsfile>\n"
@@ -48,17 +55,45 @@ static const char *usagestr =
 "                              adjusted if they are prefixed by the root\n"
 "                              path. If this flag is set, symlinks are left\n"
 "                              untouched and only hard links are changed.\n"
-"\n"
+"\n";
+
+static const char *pack_options =
 "  --compressor, -c <name>     Select the compressor to use.\n"
 "                              A list of available compressors is below.\n"
 "  --comp-extra, -X <options>  A comma separated list of extra options for\n"
 "                              the selected compressor. Specify 'help' to\n"
 "                              get a list of available options.\n"
-"  --num-jobs, -j <count>      Number of compressor jobs to create.\n"
+"  --num-jobs, -j <count>      Number of compressor jobs to create. If set,\n"
+"                              a compressed input archive is also\n"
+"                              decompressed on separate threads, in\n"
+"                              parallel if it consists of several\n"
+"                              independently compressed members.\n"
 "  --queue-backlog, -Q <count> Maximum number of data blocks in the thread\n"
 "                              worker queue before the packer starts waiting\n"
 "                              for the block processors to catch up.\n"
 "                              Defaults to 10 times the number of jobs.\n"
+"  --mem-limit, -M <size>      Maximum amount of memory to use for data\n"
+"                              blocks in flight. Default: no limit besides\n"
+"                              the queue backlog.\n"
+"  --io-thread, -W             Write the data blocks from a separate thread,\n"
+"                              so reading input and submitting blocks can\n"
+"                              continue while blocks are being written.\n"
+"  --strong-hash, -Z           Deduplicate blocks using a strong hash,\n"
+"                              instead of reading the output back.\n"
+"  --pre-dedup, -P             Do not compress data blocks again that are\n"
+"                              identical to a recently compressed block,\n"
+"                              going by their 128 bit hash.\n"
+"  --skip-incompressible, -I   Store data blocks that look random (e.g.\n"
+"                              already compressed) without trying to\n"
+"                              compress them.\n"
+"  --block-cache, -C <dir>     Keep compressed data blocks in a directory\n"
+"                              and reuse them in later runs, instead of\n"
+"                              compressing the same data again.\n"
+"  --block-cache-size, -L <size>\n"
+"                              Remove the least recently used entries from\n"
+"                              the block cache if it grows larger than\n"
+"                              this. Defaults to 1G, 0 means that the cache\n"
+"                              is never cleaned up.\n"
 "  --block-size, -b <size>     Block size to use for Squashfs image.\n"
 "                              Defaults to %u.\n"
 "  --dev-block-size, -B <size> Device block size to padd the image to.\n"
@@ -94,6 +129,7 @@ bool no_symlink_retarget = false;
 sqfs_writer_cfg_t cfg;
 char *root_becomes = NULL;
 strlist_t excludedirs = { 0, 0, 0 };
+bool num_jobs_given = false;
 
 static void input_compressor_print_available(void)
 {
@@ -173,10 +209,38 @@ void process_args(int argc, char **argv)
 			break;
 		case 'j':
 			cfg.num_jobs = strtol(optarg, NULL, 0);
+			num_jobs_given = true;
 			break;
 		case 'Q':
 			cfg.max_backlog = strtol(optarg, NULL, 0);
 			break;
+		case 'M':
+			if (parse_size("Memory limit", &cfg.mem_limit,
+				       optarg, 0)) {
+				goto fail;
+			}
+			break;
+		case 'W':
+			cfg.io_thread = true;
+			break;
+		case 'Z':
+			cfg.strong_hash = true;
+			break;
+		case 'P':
+			cfg.pre_dedup = true;
+			break;
+		case 'I':
+			cfg.skip_incompressible = true;
+			break;
+		case 'C':
+			cfg.block_cache = optarg;
+			break;
+		case 'L':
+			if (parse_size("Block cache size",
+				       &cfg.block_cache_size, optarg, 0)) {
+				goto fail;
+			}
+			break;
 		case 'X':
 			cfg.comp_extra = optarg;
 			break;
@@ -224,7 +288,8 @@ void process_args(int argc, char **argv)
 			}
 			break;
 		case 'h':
-			printf(usagestr, SQFS_DEFAULT_BLOCK_SIZE,
+			fputs(usagestr, stdout);
+			printf(pack_options, SQFS_DEFAULT_BLOCK_SIZE,
 			       SQFS_DEVBLK_SIZE);
 			compressor_print_available();
 			input_compressor_print_available();
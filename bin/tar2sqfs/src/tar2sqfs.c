@@ -26,6 +26,10 @@ int main(int argc, char **argv)
 	topts.excludedirs = excludedirs.strings;
 	topts.num_excludedirs = excludedirs.count;
 
+	/* only decompress on separate threads if explicitly asked to */
+	if (num_jobs_given)
+		topts.num_jobs = cfg.num_jobs;
+
 	tar = tar_open_stream(input_file, &topts);
 	sqfs_drop(input_file);
 	if (tar == NULL) {
@@ -31,6 +31,7 @@ extern bool no_symlink_retarget;
 extern sqfs_writer_cfg_t cfg;
 extern char *root_becomes;
 extern strlist_t excludedirs;
+extern bool num_jobs_given;
 
 void process_args(int argc, char **argv);
 
@@ -218,9 +218,9 @@ static void change_directory(const char *dirname)
 static void list_directory(const char *dirname)
 {
 	sqfs_dir_reader_state_t state, init_state;
-	size_t i, max_len, len, col_count;
+	size_t i, max_len, len, col_count, ent_size = 0;
 	sqfs_inode_generic_t *inode;
-	sqfs_dir_node_t *ent;
+	sqfs_dir_node_t *ent = NULL;
 	sqfs_u64 ref;
 	int ret;
 
@@ -248,14 +248,14 @@ static void list_directory(const char *dirname)
 	init_state = state;
 
 	for (max_len = 0; ; max_len = len > max_len ? len : max_len) {
-		ret = sqfs_dir_reader_read(dr, &state, &ent);
+		ret = sqfs_dir_reader_read_buffered(dr, &state, &ent,
+						    &ent_size);
 		if (ret > 0)
 			break;
 		if (ret < 0)
 			goto fail_read;
 
 		len = ent->size + 1;
-		sqfs_free(ent);
 	}
 
 	col_count = 79 / (max_len + 1);
@@ -266,7 +266,8 @@ static void list_directory(const char *dirname)
 
 	/* second pass for printing directory contents */
 	for (;;) {
-		ret = sqfs_dir_reader_read(dr, &state, &ent);
+		ret = sqfs_dir_reader_read_buffered(dr, &state, &ent,
+						    &ent_size);
 		if (ret > 0)
 			break;
 		if (ret < 0)
@@ -300,7 +301,6 @@ static void list_directory(const char *dirname)
 
 		printf("%.*s", ent->size + 1, ent->name);
 		fputs("\033[0m", stdout);
-		sqfs_free(ent);
 
 		++i;
 		if (i == col_count) {
@@ -316,8 +316,10 @@ static void list_directory(const char *dirname)
 	if (i != 0)
 		fputc('\n', stdout);
 
+	sqfs_free(ent);
 	return;
 fail_read:
+	sqfs_free(ent);
 	fputs("Error while reading directory list\n", stderr);
 	return;
 fail_open:
@@ -709,7 +711,9 @@ int main(int argc, char **argv)
 
 	/* create a directory reader and get the root inode */
 	dr = sqfs_dir_reader_create(&super, cmp, file,
-				    SQFS_DIR_READER_DOT_ENTRIES);
+				    SQFS_DIR_READER_DOT_ENTRIES |
+				    SQFS_DIR_READER_DENTRY_CACHE |
+				    SQFS_DIR_READER_INODE_INDEX);
 	if (dr == NULL) {
 		fprintf(stderr, "%s: error creating directory reader.\n",
 			argv[1]);
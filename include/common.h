@@ -60,4 +60,17 @@ int ostream_open_stdout(sqfs_ostream_t **out);
 sqfs_istream_t *istream_memory_create(const char *name, size_t bufsz,
 				      const void *data, size_t size);
 
+/*
+  Create a block cache for the block processor that stores every entry as
+  a separate file in a directory, which is created if it does not exist.
+  If max_size is not zero, the least recently used entries are removed
+  once the files in the directory grow larger than that.
+  The version string is made part of every key, so that entries produced
+  by a different compression library version are never looked up.
+  Prints an error message to stderr and returns NULL on failure.
+ */
+sqfs_block_cache_t *block_cache_create_dir(const char *path,
+					   sqfs_u64 max_size,
+					   const char *version);
+
 #endif /* COMMON_H */
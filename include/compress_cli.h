@@ -27,6 +27,13 @@ int compressor_cfg_init_options(sqfs_compressor_config_t *cfg,
 
 void compressor_print_help(SQFS_COMPRESSOR id);
 
+/*
+  Get a string describing the compression library used for a compressor,
+  including its version. Returns an empty string if the compressor is not
+  available.
+ */
+const char *compressor_lib_version(SQFS_COMPRESSOR id);
+
 /*
   Create an liblzo2 based LZO compressor.
 
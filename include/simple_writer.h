@@ -22,6 +22,8 @@
 
 #include "fstree.h"
 
+#define BLOCK_CACHE_DEFAULT_SIZE (1024 * 1024 * 1024)
+
 typedef struct {
 	const char *filename;
 	sqfs_block_writer_t *blkwr;
@@ -37,15 +39,19 @@ typedef struct {
 	sqfs_super_t super;
 	fstree_t fs;
 	sqfs_xattr_writer_t *xwr;
+	sqfs_block_cache_t *cache;
 } sqfs_writer_t;
 
 typedef struct {
 	const char *filename;
 	char *fs_defaults;
 	char *comp_extra;
+	const char *block_cache;
+	size_t block_cache_size;
 	size_t block_size;
 	size_t devblksize;
 	size_t max_backlog;
+	size_t mem_limit;
 	size_t num_jobs;
 
 	int outmode;
@@ -54,6 +60,10 @@ typedef struct {
 	bool exportable;
 	bool no_xattr;
 	bool quiet;
+	bool io_thread;
+	bool strong_hash;
+	bool pre_dedup;
+	bool skip_incompressible;
 } sqfs_writer_cfg_t;
 
 #ifdef __cplusplus
@@ -108,8 +108,174 @@ struct sqfs_block_processor_stats_t {
 	 * eliminated by deduplication.
 	 */
 	sqfs_u64 actual_frag_count;
+
+	/**
+	 * @brief The largest amount of memory, in bytes, that was used for
+	 *        block data at any one time.
+	 *
+	 * This covers the same things as the max_memory field of
+	 * @ref sqfs_block_processor_desc_t. This field was added in
+	 * libsquashfs version 1.3.
+	 */
+	sqfs_u64 peak_memory_used;
+
+	/**
+	 * @brief Number of data blocks that were not even passed to the
+	 *        compressor, because they looked incompressible.
+	 *
+	 * Only counted if @ref SQFS_BLOCK_PROCESSOR_SKIP_INCOMPRESSIBLE is
+	 * set. This field was added in libsquashfs version 1.3.
+	 */
+	sqfs_u64 incompressible_block_count;
+};
+
+/**
+ * @interface sqfs_block_cache_t
+ *
+ * @extends sqfs_object_t
+ *
+ * @brief A persistent store for compressed data blocks.
+ *
+ * If a block cache is given to the block processor, the worker threads
+ * look up every block in it before compressing it, using a key derived
+ * from a 128 bit hash of the uncompressed data and the configuration of
+ * the compressor. If an entry is found, it is used instead of compressing
+ * the block. After a block has been compressed, the result is stored under
+ * the same key.
+ *
+ * The lookup function is called concurrently from all worker threads, the
+ * store function only from the thread that uses the block processor.
+ *
+ * Before an entry is used, the worker thread decompresses it and compares
+ * the result with the block, so damaged entries or hash collisions only
+ * cost the time for decompressing them. For that, the worker threads use
+ * copies of the decompressor from @ref sqfs_block_processor_desc_t, or
+ * create one from the compressor configuration if it is not set.
+ */
+struct sqfs_block_cache_t {
+	sqfs_object_t base;
+
+	/**
+	 * @brief Look up the compressed version of a block.
+	 *
+	 * @param cache A pointer to the cache object.
+	 * @param key A pointer to the key to look up.
+	 * @param key_size The number of bytes in the key.
+	 * @param out A buffer to copy the compressed data to.
+	 * @param out_max The size of the output buffer. Entries that are
+	 *                larger are treated as not found.
+	 * @param out_size Returns the size of the compressed data. Zero
+	 *                 means that the compressor could not shrink the
+	 *                 block and it should be stored uncompressed.
+	 *
+	 * @return Zero if the key was not found, a positive number if it was
+	 *         found, an @ref SQFS_ERROR value on failure.
+	 */
+	int (*lookup)(sqfs_block_cache_t *cache, const sqfs_u8 *key,
+		      size_t key_size, sqfs_u8 *out, size_t out_max,
+		      size_t *out_size);
+
+	/**
+	 * @brief Store the compressed version of a block.
+	 *
+	 * @param cache A pointer to the cache object.
+	 * @param key A pointer to the key to store the data under.
+	 * @param key_size The number of bytes in the key.
+	 * @param data A pointer to the compressed data.
+	 * @param size The size of the compressed data. Zero if the compressor
+	 *             could not shrink the block.
+	 *
+	 * @return Zero on success, an @ref SQFS_ERROR value on failure.
+	 */
+	int (*store)(sqfs_block_cache_t *cache, const sqfs_u8 *key,
+		     size_t key_size, const sqfs_u8 *data, size_t size);
 };
 
+/**
+ * @enum SQFS_BLOCK_PROCESSOR_FLAGS
+ *
+ * @brief Flags that can be set in @ref sqfs_block_processor_desc_t
+ */
+typedef enum {
+	/**
+	 * @brief Write blocks from a dedicated I/O thread.
+	 *
+	 * By default, the thread that submits data to the block processor
+	 * also passes the finished blocks on to the block writer, i.e. it
+	 * cannot read more input or submit more work while a block is
+	 * being written.
+	 *
+	 * If this flag is set, the block processor creates an additional
+	 * thread that exclusively owns the block writer and the file to
+	 * read fragment blocks back from. Blocks are still handed to it in
+	 * the exact same order, so the output does not change.
+	 *
+	 * While data is being processed, the block writer and the
+	 * underlying file are only ever used from the I/O thread. They can
+	 * be used by the caller again, after @ref sqfs_block_processor_sync
+	 * or @ref sqfs_block_processor_finish returned. This means, the
+	 * file implementation must not care which thread it is used from,
+	 * as long as only one thread at a time uses it.
+	 */
+	SQFS_BLOCK_PROCESSOR_IO_THREAD = 0x01,
+
+	/**
+	 * @brief Deduplicate fragments using a strong hash.
+	 *
+	 * The worker threads compute a 128 bit hash of each fragment, which
+	 * is then treated as sufficient to decide that two fragments are
+	 * identical. Fragment blocks are never read back from the file
+	 * during deduplication, even if a file and decompressor are set.
+	 */
+	SQFS_BLOCK_PROCESSOR_STRONG_HASH = 0x02,
+
+	/**
+	 * @brief Deduplicate data blocks before compressing them.
+	 *
+	 * The block processor hashes each data block before handing it to
+	 * the worker threads and keeps a bounded cache of recently compressed
+	 * blocks. If a block has the same size and 128 bit hash as a cached
+	 * one, it is not compressed again, but the cached result is used.
+	 *
+	 * Since the lookup is done in the order the blocks are submitted,
+	 * the output is exactly the same as without this flag, barring a
+	 * hash collision.
+	 */
+	SQFS_BLOCK_PROCESSOR_PRE_DEDUP = 0x04,
+
+	/**
+	 * @brief Try to back the memory for data blocks with huge pages.
+	 *
+	 * Data blocks are allocated from larger memory regions, instead of
+	 * individually. If this flag is set, those regions are allocated
+	 * from the pre-reserved huge pages if possible, or marked as
+	 * candidates for transparent huge pages otherwise. This has no
+	 * effect if the platform does not support either of them, or if
+	 * libsquashfs was built without custom allocators.
+	 */
+	SQFS_BLOCK_PROCESSOR_HUGE_PAGES = 0x08,
+
+	/**
+	 * @brief Do not try to compress data blocks that look random.
+	 *
+	 * Before compressing a data block, the worker threads build a byte
+	 * histogram from samples of the block. If the byte values are close
+	 * to uniformly distributed, e.g. because the data is already
+	 * compressed or encrypted, the block is stored uncompressed, as if
+	 * @ref SQFS_BLK_DONT_COMPRESS had been set.
+	 *
+	 * This is a heuristic. In rare cases, a block that the compressor
+	 * could have shrunk a little is stored uncompressed, so the output
+	 * may differ from what is produced without this flag.
+	 */
+	SQFS_BLOCK_PROCESSOR_SKIP_INCOMPRESSIBLE = 0x10,
+
+	/**
+	 * @brief A combination of all valid flags.
+	 */
+	SQFS_BLOCK_PROCESSOR_ALL_FLAGS = 0x1F
+} SQFS_BLOCK_PROCESSOR_FLAGS;
+
 /**
  * @struct sqfs_block_processor_desc_t
  *
@@ -186,6 +352,47 @@ struct sqfs_block_processor_desc_t {
 	 * @copydoc file
 	 */
 	sqfs_compressor_t *uncmp;
+
+	/**
+	 * @brief A combination of @ref SQFS_BLOCK_PROCESSOR_FLAGS.
+	 *
+	 * This field was added in libsquashfs version 1.3. A structure with
+	 * the size of the previous version is still accepted, in which case
+	 * the flags are treated as being zero.
+	 */
+	sqfs_u32 flags;
+
+	/**
+	 * @brief Rough upper bound for the memory used for block data.
+	 *
+	 * The limit is in bytes. It covers the blocks currently in flight,
+	 * copies of fragment blocks kept for deduplication, the cached
+	 * fragment block read back from disk and the cache used by
+	 * @ref SQFS_BLOCK_PROCESSOR_PRE_DEDUP. If more memory would be
+	 * needed, enqueueing blocks waits for in-flight blocks to complete
+	 * first, in addition to the max_backlog limit.
+	 *
+	 * The block processor always needs at least 3 blocks worth of
+	 * memory, about twice that if fragment blocks are copied, so smaller
+	 * values are effectively rounded up. Zero means there is no limit
+	 * besides max_backlog.
+	 *
+	 * This field was added in libsquashfs version 1.3, together with
+	 * the flags. If the structure has the size of the previous version,
+	 * it is treated as being zero.
+	 */
+	sqfs_u64 max_memory;
+
+	/**
+	 * @brief An optional cache to look up compressed blocks in.
+	 *
+	 * If set, the block processor grabs a reference to it. See
+	 * @ref sqfs_block_cache_t for details.
+	 *
+	 * This field was added in libsquashfs version 1.3. If the structure
+	 * has the size of the previous version, it is treated as being NULL.
+	 */
+	sqfs_block_cache_t *cache;
 };
 
 #ifdef __cplusplus
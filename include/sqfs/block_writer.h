@@ -105,10 +105,28 @@ typedef enum {
 	 */
 	SQFS_BLOCK_WRITER_HASH_COMPARE_ONLY = 0x01,
 
+	/**
+	 * @brief If set, verify deduplication candidates using a strong hash.
+	 *
+	 * Instead of reading a potential match back from the output file,
+	 * the block writer records a 128 bit XXH3 hash of the data of every
+	 * block it writes and compares those. The output file is never read
+	 * from, which helps if reading it back is slow (e.g. network storage),
+	 * at the cost of 16 bytes of memory per block. The hash is not
+	 * cryptographic, so input crafted to collide can cause a block to be
+	 * replaced with a different one. Only use this for trusted input.
+	 *
+	 * If @ref SQFS_BLOCK_WRITER_HASH_COMPARE_ONLY is also set, that flag
+	 * takes precedence.
+	 *
+	 * This flag was added in libsquashfs version 1.3.
+	 */
+	SQFS_BLOCK_WRITER_STRONG_HASH = 0x02,
+
 	/**
 	 * @brief A combination of all valid flags.
 	 */
-	SQFS_BLOCK_WRITER_ALL_FLAGS = 0x01
+	SQFS_BLOCK_WRITER_ALL_FLAGS = 0x03
 } SQFS_BLOCK_WRITER_FLAGS;
 
 #ifdef __cplusplus
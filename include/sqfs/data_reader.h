@@ -47,7 +47,85 @@
  *
  * The data reader abstracts all of this away in a simple interface that allows
  * reading file data through an inode description and a location in the file.
+ *
+ * Decompressed data and fragment blocks are kept in a cache with a least
+ * recently used replacement policy, so that interleaved reads from several
+ * files, or seeking back and forth within a file, do not decompress the
+ * same blocks over and over again. The number of cached blocks can be
+ * changed with @ref sqfs_data_reader_set_cache_size.
+ *
+ * A copy created with @ref sqfs_copy starts out with an empty cache and has
+ * its own copy of the compressor and, if the file supports it, of the file,
+ * so it can be used from a different thread than the original. Files that
+ * cannot be copied are shared between the copies, in which case the file
+ * has to support concurrent calls to read_at. The native file
+ * implementation supports both; a copy of it may share the underlying
+ * handle, but it reads at absolute positions, without seeking first.
+ */
+
+/**
+ * @enum SQFS_DATA_READER_FLAGS
+ *
+ * @brief Flags for @ref sqfs_data_reader_create
  */
+typedef enum {
+	/**
+	 * @brief Allow several threads to use the reader at the same time.
+	 *
+	 * By default, a data reader must only be used by one thread at a
+	 * time and each thread needs its own copy. If this flag is set, the
+	 * block cache is split into several independently locked shards, so
+	 * that all threads can share the decompressed blocks. If several
+	 * threads want a block that is not cached yet, only one of them
+	 * decompresses it, while the others wait for the result. Each thread
+	 * decompresses blocks with its own copy of the compressor.
+	 *
+	 * The functions that read data, i.e. @ref sqfs_data_reader_read,
+	 * the get, borrow and release functions, as well as reading from
+	 * streams, may be used concurrently. The file interface has to
+	 * support concurrent calls to read_at, which is the case for the
+	 * native implementation. Loading the fragment
+	 * table and changing the cache size are not thread safe and have
+	 * to be done before sharing the reader. Reference counting is not
+	 * thread safe either, so creating and destroying streams has to be
+	 * serialized by the caller. Read-ahead is not supported.
+	 *
+	 * Creating the reader fails if libsquashfs was compiled without
+	 * thread support.
+	 */
+	SQFS_DATA_READER_THREAD_SAFE = 0x00000001,
+
+	SQFS_DATA_READER_ALL_FLAGS = 0x00000001,
+} SQFS_DATA_READER_FLAGS;
+
+/**
+ * @struct sqfs_data_reader_stats_t
+ *
+ * @brief Used to store runtime statistics about a @ref sqfs_data_reader_t.
+ *
+ * This structure was added in libsquashfs version 1.3.
+ */
+struct sqfs_data_reader_stats_t {
+	/**
+	 * @brief Holds the size of the structure.
+	 *
+	 * If a later version of libsquashfs expands this structure, the value
+	 * of this field can be used to check at runtime whether the newer
+	 * fields are avaialable or not.
+	 */
+	size_t size;
+
+	/**
+	 * @brief Number of block lookups that were served from the cache.
+	 */
+	sqfs_u64 cache_hits;
+
+	/**
+	 * @brief Number of block lookups that had to read and decompress
+	 *        a block from disk.
+	 */
+	sqfs_u64 cache_misses;
+};
 
 #ifdef __cplusplus
 extern "C" {
@@ -62,7 +140,8 @@ extern "C" {
  *             underlying filesystem image.
  * @param block_size The data block size from the super block.
  * @param cmp A compressor to use for uncompressing blocks read from disk.
- * @param flags Currently must be 0 or the function will fail.
+ * @param flags A combination of @ref SQFS_DATA_READER_FLAGS. Unknown
+ *              flags cause the function to fail.
  *
  * @return A pointer to a new data reader object. NULL means
  *         allocation failure.
@@ -72,6 +151,75 @@ SQFS_API sqfs_data_reader_t *sqfs_data_reader_create(sqfs_file_t *file,
 						     sqfs_compressor_t *cmp,
 						     sqfs_u32 flags);
 
+/**
+ * @brief Change the number of decompressed blocks the reader can cache.
+ *
+ * @memberof sqfs_data_reader_t
+ *
+ * The default is to cache up to 8 blocks. Each cached block uses up a
+ * block sized buffer. When shrinking the cache, the least recently used
+ * blocks are dropped. Blocks that are currently borrowed are kept until
+ * they are released.
+ *
+ * For a reader created with @ref SQFS_DATA_READER_THREAD_SAFE, the count
+ * is split evenly between the cache shards and rounded up.
+ *
+ * @param data A pointer to a data reader object.
+ * @param count The maximum number of data and fragment blocks to cache.
+ *
+ * @return Zero on succcess, an @ref SQFS_ERROR value on failure, in which
+ *         case the current cache is left untouched.
+ */
+SQFS_API int sqfs_data_reader_set_cache_size(sqfs_data_reader_t *data,
+					     size_t count);
+
+/**
+ * @brief Get accumulated runtime statistics from a data reader.
+ *
+ * @memberof sqfs_data_reader_t
+ *
+ * @param data A pointer to a data reader object.
+ *
+ * @return A pointer to a @ref sqfs_data_reader_stats_t structure.
+ */
+SQFS_API const sqfs_data_reader_stats_t
+*sqfs_data_reader_get_stats(const sqfs_data_reader_t *data);
+
+/**
+ * @brief Configure asynchronous read-ahead for data reader streams.
+ *
+ * @memberof sqfs_data_reader_t
+ *
+ * By default, a stream created through @ref sqfs_data_reader_create_stream
+ * decompresses one block at a time, whenever the previous one has been
+ * consumed. With read-ahead enabled, a stream keeps a number of upcoming
+ * blocks in flight, which are decompressed by a pool of worker threads
+ * while the caller is still processing the current one.
+ *
+ * The worker pool is shared by all streams of a data reader, each worker
+ * uses its own copy of the compressor. The pool is created when the first
+ * stream needs it. Each stream uses two block sized buffers for every
+ * block it reads ahead. Data is still read from the underlying file by the
+ * thread that uses the stream, so the usual restrictions apply: a data
+ * reader and its streams must not be used by several threads at once.
+ *
+ * If the library was compiled without thread support, the blocks are still
+ * read ahead, but decompressed on demand.
+ *
+ * @param data A pointer to a data reader object.
+ * @param num_workers The number of worker threads to use. Zero disables
+ *                    read-ahead, which is the default.
+ * @param num_blocks The maximum number of blocks a stream reads ahead. If
+ *                   this is zero, twice the number of workers is used.
+ *
+ * @return Zero on success, @ref SQFS_ERROR_SEQUENCE if there are still
+ *         streams using read-ahead, @ref SQFS_ERROR_UNSUPPORTED if the
+ *         reader was created with @ref SQFS_DATA_READER_THREAD_SAFE.
+ */
+SQFS_API int sqfs_data_reader_set_read_ahead(sqfs_data_reader_t *data,
+					     size_t num_workers,
+					     size_t num_blocks);
+
 /**
  * @brief Read and decode the fragment table from disk.
  *
@@ -121,6 +269,70 @@ SQFS_API int sqfs_data_reader_get_block(sqfs_data_reader_t *data,
 					size_t index, size_t *size,
 					sqfs_u8 **out);
 
+/**
+ * @brief Get a read-only pointer to a full sized data block of a file.
+ *
+ * @memberof sqfs_data_reader_t
+ *
+ * This works like @ref sqfs_data_reader_get_block, but instead of copying
+ * the data into a newly allocated buffer, it returns a pointer into the
+ * internal block cache of the reader. The block is pinned in the cache
+ * and stays valid, until it is given back using
+ * @ref sqfs_data_reader_release. A block can be borrowed several times,
+ * it has to be released equally often.
+ *
+ * As long as a block is borrowed, it cannot be recycled for other blocks,
+ * so the cache grows beyond its configured size if more blocks are held.
+ * All borrowed blocks must be released before the reader is destroyed.
+ *
+ * @param data A pointer to a data reader object.
+ * @param inode A pointer to the inode describing the file.
+ * @param index The block index in the inodes block list.
+ * @param size Returns the size of the data block.
+ * @param out Returns a pointer to the data block.
+ *
+ * @return Zero on succcess, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_data_reader_borrow_block(sqfs_data_reader_t *data,
+					   const sqfs_inode_generic_t *inode,
+					   size_t index, size_t *size,
+					   const sqfs_u8 **out);
+
+/**
+ * @brief Get a read-only pointer to the tail end of a file.
+ *
+ * @memberof sqfs_data_reader_t
+ *
+ * This works like @ref sqfs_data_reader_get_fragment, but returns a
+ * pointer into the cached fragment block, which has to be given back
+ * using @ref sqfs_data_reader_release. See
+ * @ref sqfs_data_reader_borrow_block for details.
+ *
+ * @param data A pointer to a data reader object.
+ * @param inode A pointer to the inode describing the file.
+ * @param size Returns the size of the tail end.
+ * @param out Returns a pointer to the data, or NULL if the file has
+ *            no tail end stored in a fragment block.
+ *
+ * @return Zero on succcess, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_data_reader_borrow_fragment(sqfs_data_reader_t *data,
+					      const sqfs_inode_generic_t *inode,
+					      size_t *size,
+					      const sqfs_u8 **out);
+
+/**
+ * @brief Give back a block obtained from one of the borrow functions.
+ *
+ * @memberof sqfs_data_reader_t
+ *
+ * @param data A pointer to a data reader object.
+ * @param ptr The pointer returned by @ref sqfs_data_reader_borrow_block or
+ *            @ref sqfs_data_reader_borrow_fragment. NULL is ignored.
+ */
+SQFS_API void sqfs_data_reader_release(sqfs_data_reader_t *data,
+				       const sqfs_u8 *ptr);
+
 /**
  * @brief A simple UNIX-read-like function to read data from a file.
  *
@@ -154,6 +366,15 @@ SQFS_API sqfs_s32 sqfs_data_reader_read(sqfs_data_reader_t *data,
  * reads data from a file in a SquashFS image. The reader is grabbed, the inode
  * and filename are copied internally and not needed after creation.
  *
+ * If read-ahead was enabled with @ref sqfs_data_reader_set_read_ahead, the
+ * stream starts decompressing its first blocks in the background right
+ * away. The worker pool processes blocks in the order they were submitted,
+ * so a caller can open streams for upcoming files ahead of time, in the
+ * order it is going to read them, and have their data decompressed while
+ * it is still busy with a previous file. A stream that failed, or is
+ * destroyed before reaching the end of the file, waits for its outstanding
+ * blocks first.
+ *
  * @param data A pointer to a data reader object.
  * @param inode A pointer to the inode describing the file.
  * @param filename A file name that the stream should return when asked.
@@ -75,7 +75,41 @@ typedef enum {
 	 */
 	SQFS_DIR_READER_DOT_ENTRIES = 0x00000001,
 
-	SQFS_DIR_READER_ALL_FLAGS = 0x00000001,
+	/**
+	 * @brief Remember the results of path lookups.
+	 *
+	 * If this flag is set, @ref sqfs_dir_reader_resolve_path keeps a
+	 * bounded cache that maps a directory inode reference and an entry
+	 * name to the inode reference of the entry. Resolving paths that
+	 * share a prefix with a previously resolved path then only costs a
+	 * hash table lookup for every component that was already seen,
+	 * instead of reading the directory listing and inode.
+	 *
+	 * If the cache is full, the least recently used entry is dropped.
+	 *
+	 * This flag was added in libsquashfs version 1.3.
+	 */
+	SQFS_DIR_READER_DENTRY_CACHE = 0x00000002,
+
+	/**
+	 * @brief Keep a table that maps every inode number to its inode
+	 *        reference.
+	 *
+	 * If this flag is set, the directory reader allocates an array with
+	 * one entry per inode in the filesystem. It is filled in with the
+	 * locations of all inodes that are read, or listed in a directory
+	 * that is read, through the directory reader. If the filesystem has
+	 * an export table, the entire table is loaded in one go the first
+	 * time an unknown inode number is looked up.
+	 *
+	 * This allows @ref sqfs_dir_reader_resolve_inum to find any kind of
+	 * inode, not only directories, in constant time.
+	 *
+	 * This flag was added in libsquashfs version 1.3.
+	 */
+	SQFS_DIR_READER_INODE_INDEX = 0x00000004,
+
+	SQFS_DIR_READER_ALL_FLAGS = 0x00000007,
 } SQFS_DIR_READER_FLAGS;
 
 /**
@@ -169,6 +203,23 @@ SQFS_API sqfs_dir_reader_t *sqfs_dir_reader_create(const sqfs_super_t *super,
 						   sqfs_file_t *file,
 						   sqfs_u32 flags);
 
+/**
+ * @brief Get statistics about the meta data block cache of a directory reader.
+ *
+ * @memberof sqfs_dir_reader_t
+ *
+ * The directory reader internally uses a @ref sqfs_meta_cache_t that is
+ * shared between the inode and directory table readers, so interleaved
+ * inode and directory lookups do not uncompress the same blocks over and
+ * over again. A copy of a directory reader gets its own, empty cache.
+ *
+ * @param rd A pointer to a directory reader.
+ *
+ * @return A pointer to a @ref sqfs_meta_cache_stats_t structure.
+ */
+SQFS_API const sqfs_meta_cache_stats_t
+*sqfs_dir_reader_get_cache_stats(const sqfs_dir_reader_t *rd);
+
 /**
  * @brief Navigate a directory reader to the location of a directory
  *        represented by an inode.
@@ -224,6 +275,37 @@ SQFS_API int sqfs_dir_reader_read(sqfs_dir_reader_t *rd,
 				  sqfs_dir_reader_state_t *state,
 				  sqfs_dir_node_t **out);
 
+/**
+ * @brief Read a directory entry into a reusable buffer and advance the
+ *        internal position indicator to the next one.
+ *
+ * @memberof sqfs_dir_reader_t
+ *
+ * This works like @ref sqfs_dir_reader_read, but instead of allocating a
+ * new entry every time, the entry is decoded into a buffer that is only
+ * grown if an entry does not fit, so iterating over a directory does not
+ * require an allocation for every entry.
+ *
+ * The buffer can be initialized to NULL with a size of 0 and has to be
+ * released with a single @ref sqfs_free call once it is no longer used,
+ * even if this function fails.
+ *
+ * This function was added in libsquashfs version 1.3.
+ *
+ * @param rd A pointer to a directory reader.
+ * @param state A pointer to the state of the directory being read.
+ * @param out A pointer to the buffer, which may be replaced with a larger
+ *            one. On success, it contains the directory entry.
+ * @param size A pointer to the size of the buffer in bytes, which is
+ *             updated if the buffer is replaced.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure, a positive
+ *         number if the end of the current directory listing has been reached.
+ */
+SQFS_API int sqfs_dir_reader_read_buffered(sqfs_dir_reader_t *rd,
+					   sqfs_dir_reader_state_t *state,
+					   sqfs_dir_node_t **out, size_t *size);
+
 /**
  * @brief Resolve and deserialize an inode using an inode reference
  *
@@ -264,6 +346,12 @@ SQFS_API int sqfs_dir_reader_get_root_inode(sqfs_dir_reader_t *rd,
  * inode references. This is used to lookup the parent inode of directory.
  * This function can be used to query the cache directly.
  *
+ * If the reader was created with the @ref SQFS_DIR_READER_INODE_INDEX flag,
+ * the inode number is looked up in a flat table first, which works for all
+ * kinds of inodes. If the number is unknown and the filesystem has an export
+ * table, the table is loaded on the first call, so this function can fail
+ * with an I/O or decompression error.
+ *
  * @param rd A pointer to a directory reader.
  * @param inode An inode number.
  * @param ref Retrns an inode reference on success.
@@ -278,6 +366,11 @@ SQFS_API int sqfs_dir_reader_resolve_inum(sqfs_dir_reader_t *rd,
  *
  * @memberof sqfs_dir_reader_t
  *
+ * Directory entries are expected to be sorted by name, as required by the
+ * SquashFS format. If a directory inode has an index, it is used to skip
+ * directly to the header that can contain an entry and the search stops
+ * as soon as an entry with a greater name is encountered.
+ *
  * @param rd A pointer to a directory reader.
  * @param path A path to resolve, NULL is interpreted as empty path.
  * @param root A directory inode to start from or NULL for the filesystem root.
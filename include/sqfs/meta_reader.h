@@ -48,6 +48,54 @@
  * from disk and reading transparently across block boarders if required.
  */
 
+/**
+ * @struct sqfs_meta_cache_t
+ *
+ * @implements sqfs_object_t
+ *
+ * @brief A cache of uncompressed meta data blocks.
+ *
+ * A meta data reader only holds the block it is currently reading from.
+ * Code that alternates between different parts of the meta data, like
+ * reading inodes and directory listings, would decompress the same blocks
+ * over and over again. With a cache attached, a meta data reader looks up
+ * blocks there first and adds every block it decompresses, replacing the
+ * least recently used one if the cache is full.
+ *
+ * Blocks are identified by their location in the image, so a cache can be
+ * shared by several meta data readers, e.g. one for the inode table and
+ * one for the directory table, as long as they all read from the same
+ * image. A cache is not thread safe.
+ */
+
+/**
+ * @struct sqfs_meta_cache_stats_t
+ *
+ * @brief Used to store runtime statistics about a @ref sqfs_meta_cache_t.
+ *
+ * This structure was added in libsquashfs version 1.3.
+ */
+struct sqfs_meta_cache_stats_t {
+	/**
+	 * @brief Holds the size of the structure.
+	 *
+	 * If a later version of libsquashfs expands this structure, the value
+	 * of this field can be used to check at runtime whether the newer
+	 * fields are avaialable or not.
+	 */
+	size_t size;
+
+	/**
+	 * @brief Number of block lookups that were served from the cache.
+	 */
+	sqfs_u64 hits;
+
+	/**
+	 * @brief Number of block lookups that had to read the block from disk.
+	 */
+	sqfs_u64 misses;
+};
+
 /**
  * @struct sqfs_readdir_state_t
  *
@@ -86,13 +134,56 @@ SQFS_API sqfs_meta_reader_t *sqfs_meta_reader_create(sqfs_file_t *file,
 						     sqfs_u64 start,
 						     sqfs_u64 limit);
 
+/**
+ * @brief Create a meta data block cache.
+ *
+ * @memberof sqfs_meta_cache_t
+ *
+ * Copying a cache creates a new, empty cache of the same size.
+ *
+ * @param max_blocks The maximum number of blocks to cache. Each block uses
+ *                   up about 8 KiB of memory. Must not be zero.
+ *
+ * @return A pointer to a cache on success, NULL on allocation failure
+ *         or if the size is zero.
+ */
+SQFS_API sqfs_meta_cache_t *sqfs_meta_cache_create(size_t max_blocks);
+
+/**
+ * @brief Get accumulated runtime statistics from a meta data block cache.
+ *
+ * @memberof sqfs_meta_cache_t
+ *
+ * @param cache A pointer to a cache object.
+ *
+ * @return A pointer to a @ref sqfs_meta_cache_stats_t structure.
+ */
+SQFS_API const sqfs_meta_cache_stats_t
+*sqfs_meta_cache_get_stats(const sqfs_meta_cache_t *cache);
+
+/**
+ * @brief Attach a block cache to a meta data reader.
+ *
+ * @memberof sqfs_meta_reader_t
+ *
+ * The reader grabs a reference to the cache and drops the one it
+ * previously had, if any. Copies of a meta data reader do not share
+ * its cache and start out without one.
+ *
+ * @param m A pointer to a meta data reader.
+ * @param cache A pointer to a cache or NULL to stop using a cache.
+ */
+SQFS_API void sqfs_meta_reader_set_cache(sqfs_meta_reader_t *m,
+					 sqfs_meta_cache_t *cache);
+
 /**
  * @brief Seek to a specific meta data block and offset.
  *
  * @memberof sqfs_meta_reader_t
  *
  * The underlying block is fetched from disk and uncompressed, unless it
- * already is the current block.
+ * already is the current block, or is found in the block cache of the
+ * reader.
  *
  * @param m A pointer to a meta data reader.
  * @param block_start Absolute position where the block header can be found.
@@ -167,6 +258,31 @@ SQFS_API int sqfs_meta_reader_read_dir_header(sqfs_meta_reader_t *m,
 SQFS_API int sqfs_meta_reader_read_dir_ent(sqfs_meta_reader_t *m,
 					   sqfs_dir_node_t **ent);
 
+/**
+ * @brief Read and decode a directory entry into a reusable buffer.
+ *
+ * @memberof sqfs_meta_reader_t
+ *
+ * This works like @ref sqfs_meta_reader_read_dir_ent, but instead of
+ * allocating a new entry every time, a buffer is reused that is only
+ * grown if an entry does not fit. The buffer can be initialized to NULL
+ * with a size of 0 and has to be released with a single @ref sqfs_free
+ * call once it is no longer used, even if this function fails.
+ *
+ * This function was added in libsquashfs version 1.3.
+ *
+ * @param m A pointer to a meta data reader.
+ * @param ent A pointer to the buffer, which may be replaced with a larger
+ *            one. On success, it contains the directory entry.
+ * @param size A pointer to the size of the buffer in bytes, which is
+ *             updated if the buffer is replaced.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_meta_reader_read_dir_ent_buffered(sqfs_meta_reader_t *m,
+						    sqfs_dir_node_t **ent,
+						    size_t *size);
+
 /**
  * @brief Initialize a state object for reading a directory
  *
@@ -218,6 +334,34 @@ SQFS_API int sqfs_meta_reader_readdir(sqfs_meta_reader_t *m,
 				      sqfs_dir_node_t **ent,
 				      sqfs_u32 *inum, sqfs_u64 *iref);
 
+/**
+ * @brief Simple directory reading interface, using a reusable buffer
+ *
+ * @memberof sqfs_meta_reader_t
+ *
+ * This works like @ref sqfs_meta_reader_readdir, but decodes the entries
+ * into a buffer that is reused, as described for
+ * @ref sqfs_meta_reader_read_dir_ent_buffered, so iterating over a
+ * directory does not require an allocation for every entry.
+ *
+ * This function was added in libsquashfs version 1.3.
+ *
+ * @param m A pointer to a meta data reader.
+ * @param s A pointer to a directory state that is used and updated.
+ * @param ent A pointer to the buffer for the directory entry.
+ * @param ent_size A pointer to the size of the buffer in bytes.
+ * @param inum If not NULL, returns the decoded inode number.
+ * @param iref If not NULL, returns a reference to the inode.
+ *
+ * @return Zero on success, a negative @ref SQFS_ERROR number on failure,
+ *         a positive number if the end of the directory is reached.
+ */
+SQFS_API int sqfs_meta_reader_readdir_buffered(sqfs_meta_reader_t *m,
+					       sqfs_readdir_state_t *s,
+					       sqfs_dir_node_t **ent,
+					       size_t *ent_size,
+					       sqfs_u32 *inum, sqfs_u64 *iref);
+
 /**
  * @brief Read and decode an inode from a meta data reader.
  *
@@ -83,11 +83,14 @@ typedef struct sqfs_dir_reader_t sqfs_dir_reader_t;
 typedef struct sqfs_dir_reader_state_t sqfs_dir_reader_state_t;
 typedef struct sqfs_id_table_t sqfs_id_table_t;
 typedef struct sqfs_meta_reader_t sqfs_meta_reader_t;
+typedef struct sqfs_meta_cache_t sqfs_meta_cache_t;
+typedef struct sqfs_meta_cache_stats_t sqfs_meta_cache_stats_t;
 typedef struct sqfs_meta_writer_t sqfs_meta_writer_t;
 typedef struct sqfs_xattr_reader_t sqfs_xattr_reader_t;
 typedef struct sqfs_file_t sqfs_file_t;
 typedef struct sqfs_tree_node_t sqfs_tree_node_t;
 typedef struct sqfs_data_reader_t sqfs_data_reader_t;
+typedef struct sqfs_data_reader_stats_t sqfs_data_reader_stats_t;
 typedef struct sqfs_block_hooks_t sqfs_block_hooks_t;
 typedef struct sqfs_xattr_writer_t sqfs_xattr_writer_t;
 typedef struct sqfs_frag_table_t sqfs_frag_table_t;
@@ -95,6 +98,7 @@ typedef struct sqfs_block_writer_t sqfs_block_writer_t;
 typedef struct sqfs_block_writer_stats_t sqfs_block_writer_stats_t;
 typedef struct sqfs_block_processor_stats_t sqfs_block_processor_stats_t;
 typedef struct sqfs_block_processor_desc_t sqfs_block_processor_desc_t;
+typedef struct sqfs_block_cache_t sqfs_block_cache_t;
 typedef struct sqfs_readdir_state_t sqfs_readdir_state_t;
 typedef struct sqfs_xattr_t sqfs_xattr_t;
 typedef struct sqfs_istream_t sqfs_istream_t;
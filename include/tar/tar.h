@@ -41,6 +41,15 @@ typedef struct {
 typedef struct {
 	char **excludedirs;
 	size_t num_excludedirs;
+
+	/*
+	  If non-zero, a compressed input stream is decompressed on a
+	  separate thread, instead of the one reading from the iterator.
+	  If greater than one, a stream that consists of several
+	  independently compressed members is decompressed on up to that
+	  many threads in parallel.
+	 */
+	size_t num_jobs;
 } tar_iterator_opts;
 
 #ifdef __cplusplus
@@ -12,18 +12,47 @@
 
 typedef struct mem_pool_t mem_pool_t;
 
+enum {
+	/* Try to back the pools with huge pages. */
+	MEM_POOL_HUGE_PAGES = 0x01,
+
+	/*
+	  Do not clear objects to zero on allocation. For buffers that
+	  the caller always overwrites anyway.
+	 */
+	MEM_POOL_NO_CLEAR = 0x02,
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 SQFS_INTERNAL mem_pool_t *mem_pool_create(size_t obj_size);
 
+/*
+  Create a pool allocator where each of the underlying memory regions can
+  hold at least min_count objects. Intended for large objects.
+ */
+SQFS_INTERNAL mem_pool_t *mem_pool_create_ex(size_t obj_size,
+					     size_t min_count, int flags);
+
 SQFS_INTERNAL void mem_pool_destroy(mem_pool_t *mem);
 
 SQFS_INTERNAL void *mem_pool_allocate(mem_pool_t *mem);
 
+/*
+  Give an object back to the pool. Once a memory region is completely
+  unused, it is returned to the OS, except for a single spare region
+  that is kept around for the next allocation.
+ */
 SQFS_INTERNAL void mem_pool_free(mem_pool_t *mem, void *ptr);
 
+/* Return the spare memory region, if any, to the OS. */
+SQFS_INTERNAL void mem_pool_trim(mem_pool_t *mem);
+
+/* Number of bytes of memory currently mapped by the pool. */
+SQFS_INTERNAL size_t mem_pool_mapped_size(const mem_pool_t *mem);
+
 #ifdef __cplusplus
 }
 #endif
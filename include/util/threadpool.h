@@ -104,6 +104,26 @@ extern "C" {
 SQFS_INTERNAL thread_pool_t *thread_pool_create(size_t num_jobs,
 						thread_pool_worker_t worker);
 
+/**
+ * @brief Create a lock-free, ring buffer based thread pool instance.
+ *
+ * This returns a @ref thread_pool_t implementation that hands out tickets
+ * from a fixed size ring buffer using atomic operations instead of a shared
+ * mutex. Completed items are picked up from the ring in ticket order, so
+ * dequeueing does not have to search through a list of completed items.
+ *
+ * The mutex & condition variables are only used to put threads to sleep
+ * when there is nothing to do.
+ *
+ * @param num_jobs The number of worker threads to launch.
+ * @param worker A function to call from the worker threads to process
+ *               the work items.
+ *
+ * @return A pointer to a thread pool on success, NULL on failure.
+ */
+SQFS_INTERNAL thread_pool_t *thread_pool_create_ring(size_t num_jobs,
+						     thread_pool_worker_t worker);
+
 /**
  * @brief Create a serial mockup thread pool implementation.
  *
@@ -28,8 +28,38 @@ void *alloc_flex(size_t base_size, size_t item_size, size_t nmemb);
 SQFS_INTERNAL
 void *alloc_array(size_t item_size, size_t nmemb);
 
+/*
+  Allocate uninitialized memory, aligned to 'alignment' bytes, which must be
+  a power of two and a multiple of the pointer size. The result has to be
+  freed with free_aligned.
+ */
+SQFS_INTERNAL
+void *alloc_aligned(size_t alignment, size_t size);
+
+SQFS_INTERNAL
+void free_aligned(void *ptr);
+
 SQFS_INTERNAL sqfs_u32 xxh32(const void *input, const size_t len);
 
+/*
+  A 128 bit content hash (XXH3-128 with the default secret and no seed).
+  Used for deciding that two blocks are identical without comparing them
+  byte for byte. It is fast and well distributed, but not cryptographic,
+  i.e. collisions can be constructed deliberately.
+ */
+typedef struct {
+	sqfs_u64 low;
+	sqfs_u64 high;
+} hash128_t;
+
+SQFS_INTERNAL void hash128(const void *input, const size_t len,
+			   hash128_t *out);
+
+static SQFS_INLINE bool hash128_equal(const hash128_t *a, const hash128_t *b)
+{
+	return a->low == b->low && a->high == b->high;
+}
+
 /*
   Returns true if the given region of memory is filled with zero-bytes only.
  */
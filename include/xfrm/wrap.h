@@ -9,6 +9,7 @@
 
 #include "sqfs/predef.h"
 #include "xfrm/stream.h"
+#include "xfrm/compress.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,6 +32,84 @@ extern "C" {
 SQFS_INTERNAL sqfs_istream_t *istream_xfrm_create(sqfs_istream_t *strm,
 						  xfrm_stream_t *xfrm);
 
+/**
+ * @brief Create an input stream that decodes data on a background thread.
+ *
+ * @memberof sqfs_istream_t
+ *
+ * This works like @ref istream_xfrm_create, but reading from the wrapped
+ * stream and decoding the data is done on a separate thread, using two
+ * buffers that are alternately filled by the thread and drained by the
+ * reader. This way, decoding overlaps with processing the decoded data.
+ *
+ * The wrapped stream and the transformation stream must not be used by the
+ * caller while the returned stream exists.
+ *
+ * @param strm A pointer to another stream that should be wrapped.
+ * @param xfrm The transformation stream to use.
+ *
+ * @return A pointer to an input stream on success, NULL on failure.
+ */
+SQFS_INTERNAL
+sqfs_istream_t *istream_xfrm_create_threaded(sqfs_istream_t *strm,
+					     xfrm_stream_t *xfrm);
+
+/**
+ * @brief Create an input stream that decodes data on several threads.
+ *
+ * @memberof sqfs_istream_t
+ *
+ * Some tools (e.g. pbzip2, or zstd in its seekable format) produce a
+ * sequence of independently compressed members, which can be decompressed
+ * in parallel. This function creates a decoding input stream that splits
+ * the input at possible member headers and decompresses the pieces on a
+ * pool of worker threads.
+ *
+ * A piece is only used if its data ends exactly on a member boundary,
+ * because a header could also appear by chance in the compressed data. If
+ * that is not the case, the pieces are decompressed serially on the
+ * reading thread, until a member ends exactly at the end of a piece. From
+ * there on, the parallel results are used again. If no member header turns
+ * up at all for a while, the rest of the input is decompressed serially,
+ * on a single background thread as with @ref istream_xfrm_create_threaded.
+ *
+ * For bzip2, only complete stream headers are used as split points, as
+ * written by pbzip2 or lbzip2 for every block. A single bzip2 stream with
+ * several blocks, as written by the bzip2 program, is not split at its
+ * (not byte aligned) block headers and decompressed serially.
+ *
+ * @param strm A pointer to another stream that should be wrapped.
+ * @param comp_id A compressor ID, as returned by
+ *                @ref xfrm_compressor_id_from_magic.
+ * @param num_jobs The number of worker threads to use. The expected
+ *                 output of a piece is reserved against a fixed memory
+ *                 limit before it is submitted. Above the limit, no
+ *                 further pieces are submitted until some of them have
+ *                 been consumed. A piece that needs more output than
+ *                 reserved and does not fit into the limit anymore is
+ *                 decompressed serially instead.
+ *
+ * @return A pointer to an input stream on success, NULL on failure.
+ */
+SQFS_INTERNAL
+sqfs_istream_t *istream_xfrm_create_mt(sqfs_istream_t *strm, int comp_id,
+				       size_t num_jobs);
+
+/**
+ * @brief Get the number of pieces a stream from @ref istream_xfrm_create_mt
+ *        has decompressed on its worker threads so far.
+ *
+ * @memberof sqfs_istream_t
+ *
+ * Data that is decompressed serially after splitting failed is not
+ * counted.
+ *
+ * @param strm A pointer to a stream created by @ref istream_xfrm_create_mt.
+ *
+ * @return The number of pieces that were decompressed in parallel.
+ */
+SQFS_INTERNAL size_t istream_xfrm_mt_get_chunk_count(sqfs_istream_t *strm);
+
 /**
  * @brief Create an output stream that transparently encodes data.
  *
@@ -48,6 +127,36 @@ SQFS_INTERNAL sqfs_istream_t *istream_xfrm_create(sqfs_istream_t *strm,
 SQFS_INTERNAL sqfs_ostream_t *ostream_xfrm_create(sqfs_ostream_t *strm,
 						  xfrm_stream_t *xfrm);
 
+/**
+ * @brief Create an output stream that compresses data on several threads.
+ *
+ * @memberof sqfs_ostream_t
+ *
+ * This works like @ref ostream_xfrm_create, but the data appended to the
+ * stream is split into large chunks that are compressed independently by
+ * a pool of worker threads, similar to pigz. Every chunk is a complete
+ * stream of the selected format, all of which are written to the wrapped
+ * stream in order. Decompressors treat such a sequence like a single
+ * stream, but the output differs from what a single compressor produces.
+ * Since the chunk size only depends on the format, the output does not
+ * depend on the number of threads.
+ *
+ * @param strm A pointer to another stream that should be wrapped.
+ * @param comp_id A compressor ID, as used by @ref compressor_stream_create.
+ * @param cfg An optional compressor configuration, NULL for the defaults.
+ * @param num_jobs The number of worker threads to use. Every worker keeps
+ *                 two chunks in flight, with an input and an output
+ *                 buffer each. For xz and zstd (8 MiB chunks), this is
+ *                 about 36 MiB per worker, for the other formats
+ *                 (1 MiB chunks) about 4.5 MiB.
+ *
+ * @return A pointer to an output stream on success, NULL on failure.
+ */
+SQFS_INTERNAL
+sqfs_ostream_t *ostream_xfrm_create_mt(sqfs_ostream_t *strm, int comp_id,
+				       const compressor_config_t *cfg,
+				       size_t num_jobs);
+
 #ifdef __cplusplus
 }
 #endif
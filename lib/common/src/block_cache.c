@@ -0,0 +1,379 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * block_cache.c
+ *
+ * Copyright (C) 2026 The squashfs-tools-ng contributors
+ */
+#include "config.h"
+#include "compat.h"
+#include "common.h"
+#include "util/util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(_WIN32) || defined(__WINDOWS__)
+#include <sys/utime.h>
+#include <direct.h>
+#include <process.h>
+#define mkdir(path, mode) _mkdir(path)
+#define getpid _getpid
+#define realpath(path, resolved) _fullpath(resolved, path, 0)
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+/*
+  Every entry is stored in a separate file, named after the hex encoded
+  hash of the compressor library version, followed by the hex encoded key.
+  The file starts with a header, followed by the compressed data.
+ */
+#define CACHE_MAGIC "SQBC"
+
+typedef struct {
+	char magic[4];
+	sqfs_u32 size;
+	sqfs_u32 checksum;
+} cache_header_t;
+
+typedef struct {
+	sqfs_block_cache_t base;
+
+	/* total size of the entry files, as far as this process knows */
+	sqfs_u64 used;
+	sqfs_u64 max_size;
+
+	/* hash of the compressor library version string */
+	sqfs_u32 version;
+
+	size_t dir_len;
+	char dir[];
+} dir_block_cache_t;
+
+typedef struct {
+	sqfs_s64 mtime;
+	sqfs_u64 size;
+	char *path;
+} cache_file_t;
+
+static char *get_entry_path(const dir_block_cache_t *cache, const sqfs_u8 *key,
+			    size_t key_size, const char *suffix)
+{
+	static const char *hexdigits = "0123456789abcdef";
+	size_t i, len;
+	char *path, *ptr;
+
+	len = cache->dir_len + 1 + 2 * (sizeof(cache->version) + key_size) +
+		strlen(suffix) + 1;
+
+	path = malloc(len);
+	if (path == NULL)
+		return NULL;
+
+	memcpy(path, cache->dir, cache->dir_len);
+	ptr = path + cache->dir_len;
+	*(ptr++) = '/';
+
+	for (i = 0; i < 2 * sizeof(cache->version); ++i) {
+		*(ptr++) = hexdigits[(cache->version >>
+				      (4 * (2 * sizeof(cache->version) - 1 - i)))
+				     & 0x0F];
+	}
+
+	for (i = 0; i < key_size; ++i) {
+		*(ptr++) = hexdigits[key[i] >> 4];
+		*(ptr++) = hexdigits[key[i] & 0x0F];
+	}
+
+	strcpy(ptr, suffix);
+	return path;
+}
+
+static int compare_files(const void *lhs, const void *rhs)
+{
+	const cache_file_t *a = lhs, *b = rhs;
+
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? -1 : 1;
+
+	return strcmp(a->path, b->path);
+}
+
+static int scan_files(dir_block_cache_t *cache, cache_file_t **out,
+		      size_t *out_count)
+{
+	size_t count = 0, max = 0, len;
+	cache_file_t *list = NULL, *new;
+	sqfs_dir_iterator_t *dir;
+	char *path;
+	sqfs_dir_entry_t *ent;
+	int ret;
+
+	ret = sqfs_dir_iterator_create_native(&dir, cache->dir, 0);
+	if (ret)
+		return ret;
+
+	for (;;) {
+		ret = dir->next(dir, &ent);
+		if (ret)
+			break;
+
+		/* skips ".", ".." and temporary files that are being written */
+		if (!S_ISREG(ent->mode) || strchr(ent->name, '.') != NULL) {
+			sqfs_free(ent);
+			continue;
+		}
+
+		if (count == max) {
+			max = max ? 2 * max : 64;
+			new = realloc(list, max * sizeof(list[0]));
+
+			if (new == NULL) {
+				sqfs_free(ent);
+				ret = SQFS_ERROR_ALLOC;
+				break;
+			}
+
+			list = new;
+		}
+
+		len = strlen(ent->name);
+		path = malloc(cache->dir_len + len + 2);
+		if (path == NULL) {
+			sqfs_free(ent);
+			ret = SQFS_ERROR_ALLOC;
+			break;
+		}
+
+		memcpy(path, cache->dir, cache->dir_len);
+		path[cache->dir_len] = '/';
+		memcpy(path + cache->dir_len + 1, ent->name, len + 1);
+
+		list[count].path = path;
+		list[count].mtime = ent->mtime;
+		list[count].size = ent->size;
+		count += 1;
+		sqfs_free(ent);
+	}
+
+	sqfs_drop(dir);
+
+	if (ret < 0) {
+		while (count > 0)
+			free(list[--count].path);
+		free(list);
+		return ret;
+	}
+
+	*out = list;
+	*out_count = count;
+	return 0;
+}
+
+/*
+  Entries are marked as used by touching them on every hit. The directory
+  is only rescanned once the size accounting exceeds the limit, which also
+  accounts for entries added or removed by other builds sharing it. If the
+  files are larger than the given limit, the least recently used ones are
+  removed, until the cache only uses 3/4 of the maximum.
+ */
+static void trim_cache(dir_block_cache_t *cache, sqfs_u64 limit)
+{
+	sqfs_u64 total = 0, low_mark;
+	cache_file_t *list;
+	size_t i, count;
+
+	if (scan_files(cache, &list, &count))
+		return;
+
+	for (i = 0; i < count; ++i)
+		total += list[i].size;
+
+	low_mark = cache->max_size - cache->max_size / 4;
+
+	if (total > limit) {
+		qsort(list, count, sizeof(list[0]), compare_files);
+
+		for (i = 0; i < count && total > low_mark; ++i) {
+			if (remove(list[i].path) == 0)
+				total -= list[i].size;
+		}
+	}
+
+	cache->used = total;
+
+	for (i = 0; i < count; ++i)
+		free(list[i].path);
+	free(list);
+}
+
+static int dir_lookup(sqfs_block_cache_t *base, const sqfs_u8 *key,
+		      size_t key_size, sqfs_u8 *out, size_t out_max,
+		      size_t *out_size)
+{
+	cache_header_t hdr;
+	int ret = 0;
+	char *path;
+	FILE *fp;
+
+	path = get_entry_path((dir_block_cache_t *)base, key, key_size, "");
+	if (path == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	/* missing or damaged entries are simply reported as not found */
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		goto out;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1)
+		goto out_fp;
+
+	hdr.size = le32toh(hdr.size);
+	hdr.checksum = le32toh(hdr.checksum);
+
+	if (memcmp(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic)) != 0 ||
+	    hdr.size > out_max) {
+		goto out_fp;
+	}
+
+	if (hdr.size > 0 && fread(out, hdr.size, 1, fp) != 1)
+		goto out_fp;
+
+	if (hdr.size > 0 && xxh32(out, hdr.size) != hdr.checksum)
+		goto out_fp;
+
+	*out_size = hdr.size;
+	ret = 1;
+
+	if (((dir_block_cache_t *)base)->max_size > 0)
+		utime(path, NULL);
+out_fp:
+	fclose(fp);
+out:
+	free(path);
+	return ret;
+}
+
+static int dir_store(sqfs_block_cache_t *base, const sqfs_u8 *key,
+		     size_t key_size, const sqfs_u8 *data, size_t size)
+{
+	dir_block_cache_t *cache = (dir_block_cache_t *)base;
+	char suffix[32], *path, *temp;
+	cache_header_t hdr;
+	FILE *fp;
+	int ret;
+
+	path = get_entry_path(cache, key, key_size, "");
+	if (path == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	sprintf(suffix, ".%lu.tmp", (unsigned long)getpid());
+
+	temp = get_entry_path(cache, key, key_size, suffix);
+	if (temp == NULL) {
+		free(path);
+		return SQFS_ERROR_ALLOC;
+	}
+
+	memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.size = htole32(size);
+	hdr.checksum = htole32(size > 0 ? xxh32(data, size) : 0);
+
+	/*
+	  Write a temporary file first and rename it, so concurrent builds
+	  sharing the cache never see partially written entries. Failing to
+	  store an entry is not an error, the cache is only an optimization.
+	 */
+	fp = fopen(temp, "wb");
+	if (fp == NULL)
+		goto out;
+
+	ret = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+
+	if (ret && size > 0)
+		ret = fwrite(data, size, 1, fp) == 1;
+
+	if (fclose(fp) != 0)
+		ret = 0;
+
+	if (!ret || rename(temp, path) != 0) {
+		remove(temp);
+		goto out;
+	}
+
+	if (cache->max_size > 0) {
+		cache->used += sizeof(hdr) + size;
+
+		/*
+		  Trim down to the low mark even if other builds already
+		  removed entries, so the next rescan is at least 1/4 of
+		  the limit away.
+		 */
+		if (cache->used > cache->max_size)
+			trim_cache(cache, cache->max_size -
+				   cache->max_size / 4);
+	}
+out:
+	free(temp);
+	free(path);
+	return 0;
+}
+
+static void dir_destroy(sqfs_object_t *obj)
+{
+	free(obj);
+}
+
+sqfs_block_cache_t *block_cache_create_dir(const char *path,
+					   sqfs_u64 max_size,
+					   const char *version)
+{
+	sqfs_block_cache_t *base;
+	dir_block_cache_t *cache;
+	char *abspath;
+	size_t len;
+
+	if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+		perror(path);
+		return NULL;
+	}
+
+	/* gensquashfs changes into the pack directory before packing data */
+	abspath = realpath(path, NULL);
+	if (abspath == NULL) {
+		perror(path);
+		return NULL;
+	}
+
+	len = strlen(abspath);
+
+	while (len > 1 && abspath[len - 1] == '/')
+		--len;
+
+	cache = calloc(1, sizeof(*cache) + len + 1);
+	base = (sqfs_block_cache_t *)cache;
+
+	if (cache == NULL) {
+		perror("creating block cache");
+		free(abspath);
+		return NULL;
+	}
+
+	sqfs_object_init(cache, dir_destroy, NULL);
+
+	memcpy(cache->dir, abspath, len);
+	cache->dir_len = len;
+	cache->max_size = max_size;
+	cache->version = xxh32(version, strlen(version));
+	free(abspath);
+
+	if (max_size > 0)
+		trim_cache(cache, max_size);
+
+	base->lookup = dir_lookup;
+	base->store = dir_store;
+	return base;
+}
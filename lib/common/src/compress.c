@@ -10,6 +10,22 @@
 #include <assert.h>
 #include <stdio.h>
 
+#ifdef WITH_GZIP
+#include <zlib.h>
+#endif
+#ifdef WITH_XZ
+#include <lzma.h>
+#endif
+#ifdef WITH_LZ4
+#include <lz4.h>
+#endif
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef WITH_LZO
+#include <lzo/lzoconf.h>
+#endif
+
 static int cmp_ids[] = {
 	SQFS_COMP_XZ,
 	SQFS_COMP_ZSTD,
@@ -86,3 +102,29 @@ void compressor_print_available(void)
 
 	fputc('\n', stdout);
 }
+
+const char *compressor_lib_version(SQFS_COMPRESSOR id)
+{
+#ifdef WITH_GZIP
+	if (id == SQFS_COMP_GZIP)
+		return "zlib-" ZLIB_VERSION;
+#endif
+#ifdef WITH_XZ
+	if (id == SQFS_COMP_XZ || id == SQFS_COMP_LZMA)
+		return "liblzma-" LZMA_VERSION_STRING;
+#endif
+#ifdef WITH_LZ4
+	if (id == SQFS_COMP_LZ4)
+		return "lz4-" LZ4_VERSION_STRING;
+#endif
+#ifdef WITH_ZSTD
+	if (id == SQFS_COMP_ZSTD)
+		return "zstd-" ZSTD_VERSION_STRING;
+#endif
+#ifdef WITH_LZO
+	if (id == SQFS_COMP_LZO)
+		return "lzo-" LZO_VERSION_STRING;
+#endif
+	(void)id;
+	return "";
+}
@@ -64,35 +64,30 @@ static sqfs_tree_node_t *create_node(sqfs_inode_generic_t *inode,
 
 static int fill_dir(sqfs_dir_reader_t *dr, sqfs_tree_node_t *root,
 		    sqfs_dir_reader_state_t *state,
-		    unsigned int flags)
+		    unsigned int flags, sqfs_dir_node_t **ent,
+		    size_t *ent_size)
 {
 	sqfs_tree_node_t *n, *prev, **tail;
 	sqfs_inode_generic_t *inode;
-	sqfs_dir_node_t *ent;
 	int err;
 
 	tail = &root->children;
 
 	for (;;) {
-		err = sqfs_dir_reader_read(dr, state, &ent);
+		err = sqfs_dir_reader_read_buffered(dr, state, ent, ent_size);
 		if (err > 0)
 			break;
 		if (err < 0)
 			return err;
 
-		if (should_skip(ent->type, flags)) {
-			free(ent);
+		if (should_skip((*ent)->type, flags))
 			continue;
-		}
 
 		err = sqfs_dir_reader_get_inode(dr, state->ent_ref, &inode);
-		if (err) {
-			free(ent);
+		if (err)
 			return err;
-		}
 
-		n = create_node(inode, (const char *)ent->name);
-		free(ent);
+		n = create_node(inode, (const char *)(*ent)->name);
 
 		if (n == NULL) {
 			free(inode);
@@ -125,7 +120,8 @@ static int fill_dir(sqfs_dir_reader_t *dr, sqfs_tree_node_t *root,
 				if (err)
 					return err;
 
-				err = fill_dir(dr, n, &nstate, flags);
+				err = fill_dir(dr, n, &nstate, flags,
+					       ent, ent_size);
 				if (err)
 					return err;
 			}
@@ -177,7 +173,8 @@ int sqfs_dir_reader_get_full_hierarchy(sqfs_dir_reader_t *rd,
 {
 	sqfs_tree_node_t *root, *tail, *new;
 	sqfs_inode_generic_t *inode;
-	sqfs_dir_node_t *ent;
+	sqfs_dir_node_t *ent = NULL;
+	size_t ent_size = 0;
 	const char *ptr;
 	int ret;
 
@@ -212,7 +209,8 @@ int sqfs_dir_reader_get_full_hierarchy(sqfs_dir_reader_t *rd,
 		ptr = strchrnul(path, '/');
 
 		for (;;) {
-			ret = sqfs_dir_reader_read(rd, &state, &ent);
+			ret = sqfs_dir_reader_read_buffered(rd, &state, &ent,
+							    &ent_size);
 			if (ret < 0)
 				goto fail;
 			if (ret > 0) {
@@ -224,17 +222,13 @@ int sqfs_dir_reader_get_full_hierarchy(sqfs_dir_reader_t *rd,
 				      path, ptr - path);
 			if (ret == 0 && ent->name[ptr - path] == '\0')
 				break;
-			free(ent);
 		}
 
 		ret = sqfs_dir_reader_get_inode(rd, state.ent_ref, &inode);
-		if (ret) {
-			free(ent);
+		if (ret)
 			goto fail;
-		}
 
 		new = create_node(inode, (const char *)ent->name);
-		free(ent);
 
 		if (new == NULL) {
 			free(inode);
@@ -264,7 +258,7 @@ int sqfs_dir_reader_get_full_hierarchy(sqfs_dir_reader_t *rd,
 		if (ret)
 			goto fail;
 
-		ret = fill_dir(rd, tail, &state, flags);
+		ret = fill_dir(rd, tail, &state, flags, &ent, &ent_size);
 		if (ret)
 			goto fail;
 	}
@@ -273,9 +267,11 @@ int sqfs_dir_reader_get_full_hierarchy(sqfs_dir_reader_t *rd,
 	if (ret)
 		goto fail;
 
+	sqfs_free(ent);
 	*out = root;
 	return 0;
 fail:
+	sqfs_free(ent);
 	sqfs_dir_tree_destroy(root);
 	return ret;
 }
@@ -16,6 +16,7 @@ void sqfs_writer_cleanup(sqfs_writer_t *sqfs, int status)
 	sqfs_drop(sqfs->im);
 	sqfs_drop(sqfs->idtbl);
 	sqfs_drop(sqfs->data);
+	sqfs_drop(sqfs->cache);
 	sqfs_drop(sqfs->blkwr);
 	sqfs_drop(sqfs->fragtbl);
 	sqfs_drop(sqfs->cmp);
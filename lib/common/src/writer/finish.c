@@ -12,7 +12,8 @@
 static void print_statistics(const sqfs_super_t *super,
 			     const sqfs_block_processor_t *blk,
 			     const sqfs_block_writer_t *wr,
-			     const fstree_stats_t *fs_stat)
+			     const fstree_stats_t *fs_stat,
+			     const sqfs_writer_cfg_t *cfg)
 {
 	const sqfs_block_processor_stats_t *proc_stats;
 	sqfs_u64 bytes_written, blocks_written;
@@ -57,6 +58,11 @@ static void print_statistics(const sqfs_super_t *super,
 
 	printf("Sparse blocks omitted: " PRI_U64 "\n",
 	       proc_stats->sparse_block_count);
+
+	if (cfg->skip_incompressible) {
+		printf("Incompressible blocks not compressed: " PRI_U64 "\n",
+		       proc_stats->incompressible_block_count);
+	}
 	fputc('\n', stdout);
 
 	printf("Fragments actually written: " PRI_U64 "\n",
@@ -184,7 +190,7 @@ int sqfs_writer_finish(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *cfg)
 		fstree_collect_stats(&sqfs->fs, &fs_stat);
 
 		print_statistics(&sqfs->super, sqfs->data,
-				 sqfs->blkwr, &fs_stat);
+				 sqfs->blkwr, &fs_stat, cfg);
 	}
 
 	return 0;
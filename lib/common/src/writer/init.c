@@ -39,6 +39,7 @@ void sqfs_writer_cfg_init(sqfs_writer_cfg_t *cfg)
 	cfg->num_jobs = os_get_num_jobs();
 	cfg->block_size = SQFS_DEFAULT_BLOCK_SIZE;
 	cfg->devblksize = SQFS_DEVBLK_SIZE;
+	cfg->block_cache_size = BLOCK_CACHE_DEFAULT_SIZE;
 	cfg->comp_id = compressor_get_default();
 }
 
@@ -124,7 +125,10 @@ int sqfs_writer_init(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *wrcfg)
 	if (ret > 0)
 		sqfs->super.flags |= SQFS_FLAG_COMPRESSOR_OPTIONS;
 
-	sqfs->blkwr = sqfs_block_writer_create(sqfs->outfile, 0);
+	sqfs->blkwr = sqfs_block_writer_create(sqfs->outfile,
+					       wrcfg->strong_hash ?
+					       SQFS_BLOCK_WRITER_STRONG_HASH :
+					       0);
 	if (sqfs->blkwr == NULL) {
 		perror("creating block writer");
 		goto fail_uncmp;
@@ -136,22 +140,44 @@ int sqfs_writer_init(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *wrcfg)
 		goto fail_blkwr;
 	}
 
+	if (wrcfg->block_cache != NULL) {
+		sqfs->cache = block_cache_create_dir(wrcfg->block_cache,
+					wrcfg->block_cache_size,
+					compressor_lib_version(wrcfg->comp_id));
+		if (sqfs->cache == NULL)
+			goto fail_fragtbl;
+	}
+
 	memset(&blkdesc, 0, sizeof(blkdesc));
 	blkdesc.size = sizeof(blkdesc);
 	blkdesc.max_block_size = wrcfg->block_size;
 	blkdesc.num_workers = wrcfg->num_jobs;
 	blkdesc.max_backlog = wrcfg->max_backlog;
+	blkdesc.max_memory = wrcfg->mem_limit;
 	blkdesc.cmp = sqfs->cmp;
 	blkdesc.wr = sqfs->blkwr;
 	blkdesc.tbl = sqfs->fragtbl;
 	blkdesc.file = sqfs->outfile;
 	blkdesc.uncmp = sqfs->uncmp;
+	blkdesc.cache = sqfs->cache;
+
+	if (wrcfg->io_thread)
+		blkdesc.flags |= SQFS_BLOCK_PROCESSOR_IO_THREAD;
+
+	if (wrcfg->strong_hash)
+		blkdesc.flags |= SQFS_BLOCK_PROCESSOR_STRONG_HASH;
+
+	if (wrcfg->pre_dedup)
+		blkdesc.flags |= SQFS_BLOCK_PROCESSOR_PRE_DEDUP;
+
+	if (wrcfg->skip_incompressible)
+		blkdesc.flags |= SQFS_BLOCK_PROCESSOR_SKIP_INCOMPRESSIBLE;
 
 	ret = sqfs_block_processor_create_ex(&blkdesc, &sqfs->data);
 	if (ret != 0) {
 		sqfs_perror(wrcfg->filename, "creating data block processor",
 			    ret);
-		goto fail_fragtbl;
+		goto fail_cache;
 	}
 
 	sqfs->idtbl = sqfs_id_table_create(0);
@@ -205,6 +231,8 @@ fail_id:
 	sqfs_drop(sqfs->idtbl);
 fail_data:
 	sqfs_drop(sqfs->data);
+fail_cache:
+	sqfs_drop(sqfs->cache);
 fail_fragtbl:
 	sqfs_drop(sqfs->fragtbl);
 fail_blkwr:
@@ -0,0 +1,300 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * block_cache.c
+ *
+ * Copyright (C) 2026 The squashfs-tools-ng contributors
+ */
+#include "config.h"
+#include "common.h"
+#include "util/util.h"
+#include "util/test.h"
+
+#include <utime.h>
+
+#define CACHE_DIR "block_cache_test"
+#define VERSION "test-1.0"
+#define HEADER_SIZE (12)
+#define DATA_SIZE (100)
+#define ENTRY_SIZE (HEADER_SIZE + DATA_SIZE)
+
+static void clean_dir(void)
+{
+	sqfs_dir_iterator_t *dir;
+	sqfs_dir_entry_t *ent;
+	char path[256];
+
+	if (sqfs_dir_iterator_create_native(&dir, CACHE_DIR, 0) != 0)
+		return;
+
+	while (dir->next(dir, &ent) == 0) {
+		if (S_ISREG(ent->mode)) {
+			sprintf(path, CACHE_DIR "/%s", ent->name);
+			TEST_EQUAL_I(remove(path), 0);
+		}
+		sqfs_free(ent);
+	}
+
+	sqfs_drop(dir);
+}
+
+static void get_path(char *path, char key)
+{
+	unsigned int x = (unsigned char)key;
+
+	sprintf(path, CACHE_DIR "/%08x%02x%02x%02x%02x",
+		(unsigned int)xxh32(VERSION, strlen(VERSION)), x, x, x, x);
+}
+
+static void make_key(sqfs_u8 *key, char c)
+{
+	memset(key, c, 4);
+}
+
+static void store(sqfs_block_cache_t *cache, char key_c)
+{
+	sqfs_u8 key[4], data[DATA_SIZE];
+	int ret;
+
+	make_key(key, key_c);
+	memset(data, key_c, sizeof(data));
+
+	ret = cache->store(cache, key, sizeof(key), data, sizeof(data));
+	TEST_EQUAL_I(ret, 0);
+}
+
+static bool lookup(sqfs_block_cache_t *cache, char key_c)
+{
+	sqfs_u8 key[4], data[2 * DATA_SIZE];
+	size_t i, size = 0;
+	int ret;
+
+	make_key(key, key_c);
+
+	ret = cache->lookup(cache, key, sizeof(key), data, sizeof(data),
+			    &size);
+	TEST_ASSERT(ret >= 0);
+
+	if (ret == 0)
+		return false;
+
+	TEST_EQUAL_UI(size, DATA_SIZE);
+	for (i = 0; i < size; ++i)
+		TEST_EQUAL_UI(data[i], (sqfs_u8)key_c);
+
+	return true;
+}
+
+static void set_mtime(char key, time_t mtime)
+{
+	struct utimbuf times;
+	char path[256];
+
+	get_path(path, key);
+	times.actime = mtime;
+	times.modtime = mtime;
+	TEST_EQUAL_I(utime(path, &times), 0);
+}
+
+/*
+  Rewrite an entry with only the first "size" bytes of it and one byte of
+  the data flipped, if flip is within that range.
+ */
+static void damage_entry(char key, size_t size, size_t flip)
+{
+	sqfs_u8 buffer[ENTRY_SIZE];
+	char path[256];
+	FILE *fp;
+
+	get_path(path, key);
+
+	fp = fopen(path, "rb");
+	TEST_NOT_NULL(fp);
+	TEST_EQUAL_UI(fread(buffer, 1, sizeof(buffer), fp), ENTRY_SIZE);
+	fclose(fp);
+
+	if (flip < size)
+		buffer[flip] ^= 0x01;
+
+	fp = fopen(path, "wb");
+	TEST_NOT_NULL(fp);
+	TEST_EQUAL_UI(fwrite(buffer, 1, size, fp), size);
+	fclose(fp);
+}
+
+/*****************************************************************************/
+
+static void test_lookup_store(void)
+{
+	sqfs_block_cache_t *cache;
+	sqfs_u8 key[4], data[DATA_SIZE];
+	size_t size;
+	int ret;
+
+	cache = block_cache_create_dir(CACHE_DIR, 0, VERSION);
+	TEST_NOT_NULL(cache);
+
+	TEST_ASSERT(!lookup(cache, 'a'));
+	store(cache, 'a');
+	store(cache, 'b');
+	TEST_ASSERT(lookup(cache, 'a'));
+	TEST_ASSERT(lookup(cache, 'b'));
+	TEST_ASSERT(!lookup(cache, 'c'));
+
+	/* an entry that does not fit the buffer is not found */
+	make_key(key, 'a');
+	ret = cache->lookup(cache, key, sizeof(key), data, DATA_SIZE - 1,
+			    &size);
+	TEST_EQUAL_I(ret, 0);
+
+	/* empty entries, i.e. blocks that could not be compressed */
+	make_key(key, 'e');
+	ret = cache->store(cache, key, sizeof(key), NULL, 0);
+	TEST_EQUAL_I(ret, 0);
+
+	size = 1234;
+	ret = cache->lookup(cache, key, sizeof(key), data, sizeof(data),
+			    &size);
+	TEST_ASSERT(ret > 0);
+	TEST_EQUAL_UI(size, 0);
+
+	/* entries persist across instances */
+	sqfs_drop(cache);
+	cache = block_cache_create_dir(CACHE_DIR, 0, VERSION);
+	TEST_NOT_NULL(cache);
+
+	TEST_ASSERT(lookup(cache, 'a'));
+	TEST_ASSERT(lookup(cache, 'b'));
+	sqfs_drop(cache);
+
+	clean_dir();
+}
+
+static void test_version(void)
+{
+	sqfs_block_cache_t *cache;
+
+	cache = block_cache_create_dir(CACHE_DIR, 0, VERSION);
+	TEST_NOT_NULL(cache);
+	store(cache, 'a');
+	sqfs_drop(cache);
+
+	/* entries of a different library version are never used */
+	cache = block_cache_create_dir(CACHE_DIR, 0, "test-2.0");
+	TEST_NOT_NULL(cache);
+	TEST_ASSERT(!lookup(cache, 'a'));
+	store(cache, 'a');
+	TEST_ASSERT(lookup(cache, 'a'));
+	sqfs_drop(cache);
+
+	cache = block_cache_create_dir(CACHE_DIR, 0, VERSION);
+	TEST_NOT_NULL(cache);
+	TEST_ASSERT(lookup(cache, 'a'));
+	sqfs_drop(cache);
+
+	clean_dir();
+}
+
+static void test_damaged(void)
+{
+	sqfs_block_cache_t *cache;
+
+	cache = block_cache_create_dir(CACHE_DIR, 0, VERSION);
+	TEST_NOT_NULL(cache);
+
+	store(cache, 'a');
+	store(cache, 'b');
+	store(cache, 'c');
+	store(cache, 'd');
+
+	/* truncated data */
+	damage_entry('a', ENTRY_SIZE - 1, ENTRY_SIZE);
+	TEST_ASSERT(!lookup(cache, 'a'));
+
+	/* truncated header */
+	damage_entry('b', HEADER_SIZE - 1, ENTRY_SIZE);
+	TEST_ASSERT(!lookup(cache, 'b'));
+
+	/* damaged data, caught by the checksum */
+	damage_entry('c', ENTRY_SIZE, HEADER_SIZE + DATA_SIZE / 2);
+	TEST_ASSERT(!lookup(cache, 'c'));
+
+	/* damaged magic */
+	damage_entry('d', ENTRY_SIZE, 0);
+	TEST_ASSERT(!lookup(cache, 'd'));
+
+	/* a damaged entry is replaced by storing it again */
+	store(cache, 'a');
+	TEST_ASSERT(lookup(cache, 'a'));
+
+	sqfs_drop(cache);
+	clean_dir();
+}
+
+static void test_eviction(void)
+{
+	sqfs_block_cache_t *cache;
+
+	cache = block_cache_create_dir(CACHE_DIR, 3 * ENTRY_SIZE,
+				       VERSION);
+	TEST_NOT_NULL(cache);
+
+	store(cache, 'a');
+	store(cache, 'b');
+	store(cache, 'c');
+
+	set_mtime('a', 1000);
+	set_mtime('b', 2000);
+	set_mtime('c', 3000);
+
+	/* a hit marks the entry as recently used */
+	TEST_ASSERT(lookup(cache, 'a'));
+
+	/* over the limit, the oldest entries go until 3/4 of it are used */
+	store(cache, 'd');
+	TEST_ASSERT(lookup(cache, 'a'));
+	TEST_ASSERT(!lookup(cache, 'b'));
+	TEST_ASSERT(!lookup(cache, 'c'));
+	TEST_ASSERT(lookup(cache, 'd'));
+	sqfs_drop(cache);
+
+	/* existing entries are counted and trimmed when opening the cache */
+	set_mtime('d', 1000);
+
+	cache = block_cache_create_dir(CACHE_DIR, 2 * ENTRY_SIZE - 1,
+				       VERSION);
+	TEST_NOT_NULL(cache);
+	TEST_ASSERT(lookup(cache, 'a'));
+	TEST_ASSERT(!lookup(cache, 'd'));
+	sqfs_drop(cache);
+
+	/* without a limit, nothing is ever removed */
+	cache = block_cache_create_dir(CACHE_DIR, 0, VERSION);
+	TEST_NOT_NULL(cache);
+	store(cache, 'b');
+	store(cache, 'c');
+	store(cache, 'd');
+	store(cache, 'e');
+	TEST_ASSERT(lookup(cache, 'a'));
+	TEST_ASSERT(lookup(cache, 'b'));
+	TEST_ASSERT(lookup(cache, 'c'));
+	TEST_ASSERT(lookup(cache, 'd'));
+	TEST_ASSERT(lookup(cache, 'e'));
+	sqfs_drop(cache);
+
+	clean_dir();
+}
+
+int main(int argc, char **argv)
+{
+	(void)argc; (void)argv;
+
+	clean_dir();
+
+	test_lookup_store();
+	test_version();
+	test_damaged();
+	test_eviction();
+
+	remove(CACHE_DIR);
+	return EXIT_SUCCESS;
+}
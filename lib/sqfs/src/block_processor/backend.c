@@ -46,42 +46,54 @@ static int set_block_size(sqfs_inode_generic_t **inode,
 
 static void release_old_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
 {
+	if (blk->flags & BLK_FLAG_COPY_RESERVED) {
+		proc->mem_used -= sizeof(*blk) + proc->max_block_size;
+		blk->flags &= ~BLK_FLAG_COPY_RESERVED;
+	}
+
 	blk->next = proc->free_list;
 	proc->free_list = blk;
 
 	proc->backlog -= 1;
 }
 
-static int process_completed_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
+static void drop_in_flight_copy(sqfs_block_processor_t *proc,
+				sqfs_block_t *blk)
 {
-	sqfs_u64 location;
-	sqfs_u32 size;
-	int err;
+	sqfs_block_t *it = proc->fblk_in_flight, *prev = NULL;
 
-	if (blk->flags & SQFS_BLK_FRAGMENT_BLOCK) {
-		sqfs_block_t *it = proc->fblk_in_flight, *prev = NULL;
+	while (it != NULL && it->index != blk->index) {
+		prev = it;
+		it = it->next;
+	}
 
-		while (it != NULL && it->index != blk->index) {
-			prev = it;
-			it = it->next;
+	if (it != NULL) {
+		if (prev == NULL) {
+			proc->fblk_in_flight = it->next;
+		} else {
+			prev->next = it->next;
 		}
 
-		if (it != NULL) {
-			if (prev == NULL) {
-				proc->fblk_in_flight = it->next;
-			} else {
-				prev->next = it->next;
-			}
-			free(it);
-		}
+		free_block(proc, it);
 	}
+}
 
-	err = proc->wr->write_data_block(proc->wr, blk->user, blk->size,
-					 blk->checksum,
-					 blk->flags & ~BLK_FLAG_INTERNAL,
-					 blk->data, &location);
-	if (err)
-		goto out;
+static int write_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
+{
+	return proc->wr->write_data_block(proc->wr, blk->user, blk->size,
+					  blk->checksum,
+					  blk->flags & ~BLK_FLAG_INTERNAL,
+					  blk->data, &blk->location);
+}
+
+static int finish_written_block(sqfs_block_processor_t *proc,
+				sqfs_block_t *blk)
+{
+	sqfs_u32 size;
+	int err = 0;
+
+	if (blk->flags & SQFS_BLK_FRAGMENT_BLOCK)
+		drop_in_flight_copy(proc, blk);
 
 	proc->stats.output_bytes_generated += blk->size;
 
@@ -103,8 +115,8 @@ static int process_completed_block(sqfs_block_processor_t *proc, sqfs_block_t *b
 		if (blk->flags & SQFS_BLK_FRAGMENT_BLOCK) {
 			if (proc->frag_tbl != NULL) {
 				err = sqfs_frag_table_set(proc->frag_tbl,
-							  blk->index, location,
-							  size);
+							  blk->index,
+							  blk->location, size);
 				if (err)
 					goto out;
 			}
@@ -117,16 +129,147 @@ static int process_completed_block(sqfs_block_processor_t *proc, sqfs_block_t *b
 					goto out;
 			}
 			proc->stats.data_block_count += 1;
+
+			if (blk->flags & BLK_FLAG_INCOMPRESSIBLE)
+				proc->stats.incompressible_block_count += 1;
 		}
 	}
 
 	if (blk->flags & SQFS_BLK_LAST_BLOCK && blk->inode != NULL)
-		sqfs_inode_set_file_block_start(*(blk->inode), location);
+		sqfs_inode_set_file_block_start(*(blk->inode), blk->location);
 out:
 	release_old_block(proc, blk);
 	return err;
 }
 
+/*****************************************************************************/
+
+int process_io_request(void *userptr, void *workitem)
+{
+	sqfs_block_processor_t *proc = userptr;
+	sqfs_block_t *blk = workitem;
+	int ret;
+
+	if (blk->flags & BLK_FLAG_READ_BACK) {
+		return proc->file->read_at(proc->file, blk->location,
+					   blk->user, blk->size);
+	}
+
+	ret = write_block(proc, blk);
+
+	__atomic_add_fetch(&proc->io_done, 1, __ATOMIC_RELEASE);
+	return ret;
+}
+
+static bool io_block_ready(sqfs_block_processor_t *proc)
+{
+	return __atomic_load_n(&proc->io_done, __ATOMIC_ACQUIRE) !=
+		proc->io_retired;
+}
+
+static int submit_io_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
+{
+	int status;
+
+	if (proc->io_pool->submit(proc->io_pool, blk) != 0) {
+		status = proc->io_pool->get_status(proc->io_pool);
+		release_old_block(proc, blk);
+		return status ? status : SQFS_ERROR_ALLOC;
+	}
+
+	blk->next = NULL;
+
+	if (proc->io_pending_last == NULL) {
+		proc->io_pending = blk;
+	} else {
+		proc->io_pending_last->next = blk;
+	}
+
+	proc->io_pending_last = blk;
+	proc->io_in_flight += 1;
+	return 0;
+}
+
+static int complete_io_block(sqfs_block_processor_t *proc)
+{
+	sqfs_block_t *blk;
+	int status;
+
+	blk = proc->io_pool->dequeue(proc->io_pool);
+	if (blk == NULL || blk != proc->io_pending)
+		return SQFS_ERROR_INTERNAL;
+
+	proc->io_pending = blk->next;
+	if (proc->io_pending == NULL)
+		proc->io_pending_last = NULL;
+
+	blk->next = NULL;
+	proc->io_in_flight -= 1;
+	proc->io_retired += 1;
+
+	status = proc->io_pool->get_status(proc->io_pool);
+	if (status != 0) {
+		release_old_block(proc, blk);
+		return status;
+	}
+
+	return finish_written_block(proc, blk);
+}
+
+int io_read_at(sqfs_block_processor_t *proc, sqfs_u64 offset,
+	       void *buffer, size_t size)
+{
+	sqfs_block_t *req = proc->io_read_req;
+	int ret;
+
+	if (proc->io_pool == NULL)
+		return proc->file->read_at(proc->file, offset, buffer, size);
+
+	while (proc->io_in_flight > 0) {
+		ret = complete_io_block(proc);
+		if (ret != 0)
+			return ret;
+	}
+
+	memset(req, 0, sizeof(*req));
+	req->flags = BLK_FLAG_READ_BACK;
+	req->location = offset;
+	req->size = size;
+	req->user = buffer;
+
+	if (proc->io_pool->submit(proc->io_pool, req) != 0) {
+		ret = proc->io_pool->get_status(proc->io_pool);
+		return ret ? ret : SQFS_ERROR_ALLOC;
+	}
+
+	if (proc->io_pool->dequeue(proc->io_pool) != req)
+		return SQFS_ERROR_INTERNAL;
+
+	return proc->io_pool->get_status(proc->io_pool);
+}
+
+/*****************************************************************************/
+
+static int process_completed_block(sqfs_block_processor_t *proc,
+				   sqfs_block_t *blk)
+{
+	int err;
+
+	if (proc->io_pool != NULL)
+		return submit_io_block(proc, blk);
+
+	err = write_block(proc, blk);
+	if (err) {
+		if (blk->flags & SQFS_BLK_FRAGMENT_BLOCK)
+			drop_in_flight_copy(proc, blk);
+
+		release_old_block(proc, blk);
+		return err;
+	}
+
+	return finish_written_block(proc, blk);
+}
+
 static int process_completed_fragment(sqfs_block_processor_t *proc,
 				      sqfs_block_t *frag)
 {
@@ -151,6 +294,7 @@ static int process_completed_fragment(sqfs_block_processor_t *proc,
 	if (!(frag->flags & SQFS_BLK_DONT_DEDUPLICATE)) {
 		search.hash = frag->checksum;
 		search.size = frag->size;
+		search.strong = frag->strong;
 
 		proc->current_frag = frag;
 		proc->fblk_lookup_error = 0;
@@ -202,7 +346,8 @@ static int process_completed_fragment(sqfs_block_processor_t *proc,
 		offset = 0;
 		proc->frag_block = frag;
 		proc->frag_block->index = index;
-		proc->frag_block->flags &= SQFS_BLK_DONT_COMPRESS;
+		proc->frag_block->flags &= SQFS_BLK_DONT_COMPRESS |
+			BLK_FLAG_COPY_RESERVED;
 		proc->frag_block->flags |= SQFS_BLK_FRAGMENT_BLOCK;
 	} else {
 		index = proc->frag_block->index;
@@ -218,7 +363,7 @@ static int process_completed_fragment(sqfs_block_processor_t *proc,
 
 	if (proc->frag_tbl != NULL) {
 		err = SQFS_ERROR_ALLOC;
-		chunk = calloc(1, sizeof(*chunk));
+		chunk = alloc_chunk_info(proc);
 		if (chunk == NULL)
 			goto fail;
 
@@ -226,6 +371,7 @@ static int process_completed_fragment(sqfs_block_processor_t *proc,
 		chunk->offset = offset;
 		chunk->size = frag->size;
 		chunk->hash = frag->checksum;
+		chunk->strong = frag->strong;
 
 		proc->current_frag = frag;
 		proc->fblk_lookup_error = 0;
@@ -251,7 +397,7 @@ static int process_completed_fragment(sqfs_block_processor_t *proc,
 	proc->stats.actual_frag_count += 1;
 	return 0;
 fail:
-	free(chunk);
+	free_chunk_info(proc, chunk);
 	if (frag != proc->frag_block)
 		release_old_block(proc, frag);
 	return err;
@@ -308,6 +454,14 @@ int dequeue_block(sqfs_block_processor_t *proc)
 			break;
 		}
 
+		if (proc->io_in_flight > 0 &&
+		    (proc->pool_in_flight == 0 || io_block_ready(proc))) {
+			status = complete_io_block(proc);
+			if (status != 0)
+				return status;
+			continue;
+		}
+
 		blk = proc->pool->dequeue(proc->pool);
 
 		if (blk == NULL) {
@@ -315,6 +469,17 @@ int dequeue_block(sqfs_block_processor_t *proc)
 			return status ? status : SQFS_ERROR_INTERNAL;
 		}
 
+		proc->pool_in_flight -= 1;
+
+		status = dedup_complete(proc, blk);
+		if (status == 0)
+			status = block_cache_store(proc, blk);
+
+		if (status != 0) {
+			release_old_block(proc, blk);
+			return status;
+		}
+
 		if (blk->flags & SQFS_BLK_IS_FRAGMENT) {
 			status = process_completed_fragment(proc, blk);
 			if (status != 0)
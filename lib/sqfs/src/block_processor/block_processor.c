@@ -7,13 +7,176 @@
 #define SQFS_BUILDING_DLL
 #include "internal.h"
 
+/* Minimum number of data blocks in each memory region of the pool. */
+#define BLOCKS_PER_POOL (4)
+
+static sqfs_u8 *alloc_buffer(sqfs_block_processor_t *proc)
+{
+#ifdef NO_CUSTOM_ALLOC
+	return malloc(proc->max_block_size);
+#else
+	return mem_pool_allocate(proc->buf_pool);
+#endif
+}
+
+static void free_buffer(sqfs_block_processor_t *proc, sqfs_u8 *buffer)
+{
+	if (buffer == NULL)
+		return;
+#ifdef NO_CUSTOM_ALLOC
+	(void)proc;
+	free(buffer);
+#else
+	mem_pool_free(proc->buf_pool, buffer);
+#endif
+}
+
+void trim_block_memory(sqfs_block_processor_t *proc)
+{
+#ifdef NO_CUSTOM_ALLOC
+	(void)proc;
+#else
+	mem_pool_trim(proc->buf_pool);
+	mem_pool_trim(proc->blk_pool);
+#endif
+}
+
+void add_mem_used(sqfs_block_processor_t *proc, size_t size)
+{
+	proc->mem_used += size;
+
+	if (proc->mem_used > proc->stats.peak_memory_used)
+		proc->stats.peak_memory_used = proc->mem_used;
+}
+
+sqfs_block_t *alloc_block(sqfs_block_processor_t *proc)
+{
+	sqfs_block_t *blk;
+
+#ifdef NO_CUSTOM_ALLOC
+	blk = calloc(1, sizeof(*blk));
+#else
+	blk = mem_pool_allocate(proc->blk_pool);
+#endif
+	if (blk == NULL)
+		return NULL;
+
+	blk->data = alloc_buffer(proc);
+	if (blk->data == NULL) {
+#ifdef NO_CUSTOM_ALLOC
+		free(blk);
+#else
+		mem_pool_free(proc->blk_pool, blk);
+#endif
+		return NULL;
+	}
+
+	add_mem_used(proc, sizeof(*blk) + proc->max_block_size);
+	return blk;
+}
+
+void free_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
+{
+	if (blk == NULL)
+		return;
+
+	proc->mem_used -= sizeof(*blk) + proc->max_block_size;
+	free_buffer(proc, blk->data);
+
+#ifdef NO_CUSTOM_ALLOC
+	free(blk);
+#else
+	mem_pool_free(proc->blk_pool, blk);
+#endif
+}
+
+chunk_info_t *alloc_chunk_info(sqfs_block_processor_t *proc)
+{
+#ifdef NO_CUSTOM_ALLOC
+	(void)proc;
+	return calloc(1, sizeof(chunk_info_t));
+#else
+	return mem_pool_allocate(proc->chunk_pool);
+#endif
+}
+
+void free_chunk_info(sqfs_block_processor_t *proc, chunk_info_t *chunk)
+{
+	if (chunk == NULL)
+		return;
+#ifdef NO_CUSTOM_ALLOC
+	(void)proc;
+	free(chunk);
+#else
+	mem_pool_free(proc->chunk_pool, chunk);
+#endif
+}
+
+/*
+  The entropy check samples SAMPLE_COUNT chunks of SAMPLE_SIZE bytes,
+  evenly spread over a block. Blocks smaller than that are checked as a
+  whole, blocks smaller than SAMPLE_MIN_SIZE are not checked at all.
+ */
+#define SAMPLE_COUNT (32)
+#define SAMPLE_SIZE (256)
+#define SAMPLE_MIN_SIZE (1024)
+
+/*
+  Using the collision probability of the byte histogram (i.e. Renyi
+  entropy of order 2), a block is considered random if it has at least
+  ~7.8 bits per byte, i.e. sum(p^2) <= 1/223. Uniformly random data gives
+  about 8 bits, the output of general purpose compressors comes close.
+  Text or executable code is typically well below 6 bits.
+
+  The collision probability is estimated from the number of byte pairs
+  with the same value, sum(h * (h - 1)) / (n * (n - 1)). Unlike the plain
+  sum of the squared frequencies, this does not depend on the sample
+  count, which would otherwise push small blocks below the threshold.
+ */
+#define ENTROPY_DIVISOR (223)
+
+static bool is_incompressible(const sqfs_u8 *data, size_t size)
+{
+	sqfs_u32 histogram[256];
+	sqfs_u64 sum = 0, count = 0;
+	size_t i, j, stride;
+
+	if (size < SAMPLE_MIN_SIZE)
+		return false;
+
+	memset(histogram, 0, sizeof(histogram));
+
+	if (size <= (SAMPLE_COUNT * SAMPLE_SIZE)) {
+		for (i = 0; i < size; ++i)
+			histogram[data[i]] += 1;
+
+		count = size;
+	} else {
+		stride = (size - SAMPLE_SIZE) / (SAMPLE_COUNT - 1);
+
+		for (i = 0; i < SAMPLE_COUNT; ++i) {
+			const sqfs_u8 *ptr = data + i * stride;
+
+			for (j = 0; j < SAMPLE_SIZE; ++j)
+				histogram[ptr[j]] += 1;
+		}
+
+		count = SAMPLE_COUNT * SAMPLE_SIZE;
+	}
+
+	for (i = 0; i < 256; ++i)
+		sum += (sqfs_u64)histogram[i] * (histogram[i] - 1);
+
+	return (sum * ENTROPY_DIVISOR) <= (count * (count - 1));
+}
+
 static int process_block(void *userptr, void *workitem)
 {
 	worker_data_t *worker = userptr;
 	sqfs_block_t *block = workitem;
 	sqfs_s32 ret;
 
-	if (block->size == 0)
+	if (block->size == 0 || (block->flags & BLK_FLAG_DEDUP_HIT))
 		return 0;
 
 	if (!(block->flags & SQFS_BLK_IGNORE_SPARSE) &&
@@ -28,16 +191,37 @@ static int process_block(void *userptr, void *workitem)
 		block->checksum = xxh32(block->data, block->size);
 	}
 
+	if ((block->flags & SQFS_BLK_IS_FRAGMENT) && worker->strong_hash)
+		hash128(block->data, block->size, &block->strong);
+
 	if (block->flags & (SQFS_BLK_IS_FRAGMENT | SQFS_BLK_DONT_COMPRESS))
 		return 0;
 
+	if (worker->skip_incompressible &&
+	    !(block->flags & SQFS_BLK_FRAGMENT_BLOCK) &&
+	    is_incompressible(block->data, block->size)) {
+		block->flags |= SQFS_BLK_DONT_COMPRESS;
+		block->flags |= BLK_FLAG_INCOMPRESSIBLE;
+		return 0;
+	}
+
+	if (worker->cache != NULL) {
+		ret = block_cache_lookup(worker, block);
+		if (ret != 0)
+			return ret < 0 ? ret : 0;
+	}
+
 	ret = worker->cmp->do_block(worker->cmp, block->data, block->size,
 				    worker->scratch, worker->scratch_size);
 	if (ret < 0)
 		return ret;
 
 	if (ret > 0) {
-		memcpy(block->data, worker->scratch, ret);
+		sqfs_u8 *temp = block->data;
+
+		block->data = worker->scratch;
+		worker->scratch = temp;
+
 		block->size = ret;
 		block->flags |= SQFS_BLK_IS_COMPRESSED;
 	}
@@ -50,17 +234,10 @@ static int load_frag_block(sqfs_block_processor_t *proc, sqfs_u32 index)
 	size_t size;
 	int ret;
 
-	if (proc->cached_frag_blk == NULL) {
-		size = sizeof(*proc->cached_frag_blk);
-
-		proc->cached_frag_blk = alloc_flex(size, 1,
-						   proc->max_block_size);
-
-		if (proc->cached_frag_blk == NULL)
-			return SQFS_ERROR_ALLOC;
-	} else {
-		if (proc->cached_frag_blk->index == index)
-			return 0;
+	/* allocated up front, so it is covered by the memory limit */
+	if (proc->cached_frag_blk->size > 0 &&
+	    proc->cached_frag_blk->index == index) {
+		return 0;
 	}
 
 	ret = sqfs_frag_table_lookup(proc->frag_tbl, index, &info);
@@ -72,8 +249,7 @@ static int load_frag_block(sqfs_block_processor_t *proc, sqfs_u32 index)
 		return SQFS_ERROR_CORRUPTED;
 
 	if (SQFS_IS_BLOCK_COMPRESSED(info.size)) {
-		ret = proc->file->read_at(proc->file, info.start_offset,
-					  proc->scratch, size);
+		ret = io_read_at(proc, info.start_offset, proc->scratch, size);
 		if (ret != 0)
 			return ret;
 
@@ -85,8 +261,8 @@ static int load_frag_block(sqfs_block_processor_t *proc, sqfs_u32 index)
 
 		size = ret;
 	} else {
-		ret = proc->file->read_at(proc->file, info.start_offset,
-					  proc->cached_frag_blk->data, size);
+		ret = io_read_at(proc, info.start_offset,
+				 proc->cached_frag_blk->data, size);
 		if (ret != 0)
 			return ret;
 	}
@@ -106,6 +282,9 @@ static bool chunk_info_equals(void *user, const void *k, const void *c)
 	if (key->size != cmp->size || key->hash != cmp->hash)
 		return false;
 
+	if (proc->flags & SQFS_BLOCK_PROCESSOR_STRONG_HASH)
+		return hash128_equal(&key->strong, &cmp->strong);
+
 	if (proc->uncmp == NULL || proc->file == NULL)
 		return true;
 
@@ -149,17 +328,21 @@ static bool chunk_info_equals(void *user, const void *k, const void *c)
 		      proc->current_frag->data, cmp->size) == 0;
 }
 
+#ifdef NO_CUSTOM_ALLOC
 static void ht_delete_function(struct hash_entry *entry)
 {
 	free(entry->data);
 }
+#else
+#define ht_delete_function NULL
+#endif
 
-static void free_block_list(sqfs_block_t *list)
+static void free_block_list(sqfs_block_processor_t *proc, sqfs_block_t *list)
 {
 	while (list != NULL) {
 		sqfs_block_t *it = list;
 		list = it->next;
-		free(it);
+		free_block(proc, it);
 	}
 }
 
@@ -167,13 +350,20 @@ static void block_processor_destroy(sqfs_object_t *base)
 {
 	sqfs_block_processor_t *proc = (sqfs_block_processor_t *)base;
 
-	free(proc->frag_block);
-	free(proc->blk_current);
-	free(proc->cached_frag_blk);
+	/* the I/O thread may still be reading into blocks we are about to free */
+	if (proc->io_pool != NULL)
+		proc->io_pool->destroy(proc->io_pool);
+
+	free_block(proc, proc->frag_block);
+	free_block(proc, proc->blk_current);
+	free_block(proc, proc->cached_frag_blk);
+	free(proc->io_read_req);
 
-	free_block_list(proc->free_list);
-	free_block_list(proc->io_queue);
-	free_block_list(proc->fblk_in_flight);
+	free_block_list(proc, proc->io_pending);
+	free_block_list(proc, proc->free_list);
+	free_block_list(proc, proc->io_queue);
+	free_block_list(proc, proc->fblk_in_flight);
+	dedup_cleanup(proc);
 
 	if (proc->frag_ht != NULL)
 		hash_table_destroy(proc->frag_ht, ht_delete_function);
@@ -187,13 +377,26 @@ static void block_processor_destroy(sqfs_object_t *base)
 		proc->workers = worker->next;
 
 		sqfs_drop(worker->cmp);
+		sqfs_drop(worker->uncmp);
+		free_buffer(proc, worker->scratch);
+		free_buffer(proc, worker->verify);
 		free(worker);
 	}
 
+#ifndef NO_CUSTOM_ALLOC
+	if (proc->blk_pool != NULL)
+		mem_pool_destroy(proc->blk_pool);
+	if (proc->buf_pool != NULL)
+		mem_pool_destroy(proc->buf_pool);
+	if (proc->chunk_pool != NULL)
+		mem_pool_destroy(proc->chunk_pool);
+#endif
+
 	sqfs_drop(proc->frag_tbl);
 	sqfs_drop(proc->wr);
 	sqfs_drop(proc->file);
 	sqfs_drop(proc->uncmp);
+	sqfs_drop(proc->cache);
 	free(proc);
 }
 
@@ -255,15 +458,27 @@ const sqfs_block_processor_stats_t
 	return &proc->stats;
 }
 
-int sqfs_block_processor_create_ex(const sqfs_block_processor_desc_t *desc,
+int sqfs_block_processor_create_ex(const sqfs_block_processor_desc_t *user_desc,
 				   sqfs_block_processor_t **out)
 {
+	const sqfs_block_processor_desc_t *desc = user_desc;
 	size_t i, count, scratch_size = 0;
+	sqfs_block_processor_desc_t copy;
+	sqfs_compressor_config_t cache_cfg;
 	sqfs_block_processor_t *proc;
 	int ret;
 
-	if (desc->size != sizeof(sqfs_block_processor_desc_t))
+	/* older versions of the struct did not have the fields from flags on */
+	if (user_desc->size == offsetof(sqfs_block_processor_desc_t, flags)) {
+		memset(&copy, 0, sizeof(copy));
+		memcpy(&copy, user_desc, user_desc->size);
+		desc = &copy;
+	} else if (user_desc->size != sizeof(sqfs_block_processor_desc_t)) {
 		return SQFS_ERROR_ARG_INVALID;
+	}
+
+	if (desc->flags & ~SQFS_BLOCK_PROCESSOR_ALL_FLAGS)
+		return SQFS_ERROR_UNSUPPORTED;
 
 	if (desc->file != NULL && desc->uncmp != NULL)
 		scratch_size = desc->max_block_size;
@@ -276,18 +491,48 @@ int sqfs_block_processor_create_ex(const sqfs_block_processor_desc_t *desc,
 
 	proc->max_backlog = desc->max_backlog;
 	proc->max_block_size = desc->max_block_size;
+	proc->flags = desc->flags;
+	proc->max_memory = desc->max_memory;
 	proc->frag_tbl = sqfs_grab(desc->tbl);
 	proc->wr = sqfs_grab(desc->wr);
 	proc->file = sqfs_grab(desc->file);
 	proc->uncmp = sqfs_grab(desc->uncmp);
+	proc->cache = sqfs_grab(desc->cache);
 	proc->stats.size = sizeof(proc->stats);
+	proc->copy_frag_blocks = desc->file != NULL && desc->uncmp != NULL &&
+		!(desc->flags & SQFS_BLOCK_PROCESSOR_STRONG_HASH);
+
+	memset(&cache_cfg, 0, sizeof(cache_cfg));
+
+	if (proc->cache != NULL) {
+		desc->cmp->get_configuration(desc->cmp, &cache_cfg);
+		hash128(&cache_cfg, sizeof(cache_cfg), &proc->cache_cfg);
+		cache_cfg.flags |= SQFS_COMP_FLAG_UNCOMPRESS;
+	}
 
 	/* we need at least one current data block + one fragment block */
 	if (proc->max_backlog < 3)
 		proc->max_backlog = 3;
 
+#ifndef NO_CUSTOM_ALLOC
+	proc->blk_pool = mem_pool_create(sizeof(sqfs_block_t));
+	proc->buf_pool = mem_pool_create_ex(desc->max_block_size,
+					    BLOCKS_PER_POOL,
+					    MEM_POOL_NO_CLEAR |
+					    ((desc->flags &
+					      SQFS_BLOCK_PROCESSOR_HUGE_PAGES) ?
+					     MEM_POOL_HUGE_PAGES : 0));
+	proc->chunk_pool = mem_pool_create(sizeof(chunk_info_t));
+
+	if (proc->blk_pool == NULL || proc->buf_pool == NULL ||
+	    proc->chunk_pool == NULL) {
+		ret = SQFS_ERROR_ALLOC;
+		goto fail_pool;
+	}
+#endif
+
 	/* create the thread pool */
-	proc->pool = thread_pool_create(desc->num_workers, process_block);
+	proc->pool = thread_pool_create_ring(desc->num_workers, process_block);
 	if (proc->pool == NULL) {
 		ret = SQFS_ERROR_INTERNAL;
 		goto fail_pool;
@@ -297,23 +542,55 @@ int sqfs_block_processor_create_ex(const sqfs_block_processor_desc_t *desc,
 	count = proc->pool->get_worker_count(proc->pool);
 
 	for (i = 0; i < count; ++i) {
-		worker_data_t *worker = alloc_flex(sizeof(*worker), 1,
-						   desc->max_block_size);
+		worker_data_t *worker = calloc(1, sizeof(*worker));
 		if (worker == NULL) {
 			ret = SQFS_ERROR_ALLOC;
 			goto fail_pool;
 		}
 
 		worker->scratch_size = desc->max_block_size;
+		worker->strong_hash =
+			(desc->flags & SQFS_BLOCK_PROCESSOR_STRONG_HASH) != 0;
+		worker->skip_incompressible =
+			(desc->flags &
+			 SQFS_BLOCK_PROCESSOR_SKIP_INCOMPRESSIBLE) != 0;
+		worker->cache = proc->cache;
+		worker->cache_cfg = &proc->cache_cfg;
 		worker->next = proc->workers;
 		proc->workers = worker;
 
+		worker->scratch = alloc_buffer(proc);
+		if (worker->scratch == NULL) {
+			ret = SQFS_ERROR_ALLOC;
+			goto fail_pool;
+		}
+
 		worker->cmp = sqfs_copy(desc->cmp);
 		if (worker->cmp == NULL) {
 			ret = SQFS_ERROR_ALLOC;
 			goto fail_pool;
 		}
 
+		if (proc->cache != NULL) {
+			worker->verify = alloc_buffer(proc);
+			if (worker->verify == NULL) {
+				ret = SQFS_ERROR_ALLOC;
+				goto fail_pool;
+			}
+
+			if (desc->uncmp != NULL) {
+				worker->uncmp = sqfs_copy(desc->uncmp);
+				ret = worker->uncmp == NULL ?
+					SQFS_ERROR_ALLOC : 0;
+			} else {
+				ret = sqfs_compressor_create(&cache_cfg,
+							     &worker->uncmp);
+			}
+
+			if (ret != 0)
+				goto fail_pool;
+		}
+
 		proc->pool->set_worker_ptr(proc->pool, i, worker);
 	}
 
@@ -325,6 +602,40 @@ int sqfs_block_processor_create_ex(const sqfs_block_processor_desc_t *desc,
 	}
 
 	proc->frag_ht->user = proc;
+
+	if (proc->copy_frag_blocks) {
+		proc->cached_frag_blk = alloc_block(proc);
+		if (proc->cached_frag_blk == NULL) {
+			ret = SQFS_ERROR_ALLOC;
+			goto fail_pool;
+		}
+
+		proc->cached_frag_blk->size = 0;
+	}
+
+	if (desc->flags & SQFS_BLOCK_PROCESSOR_PRE_DEDUP) {
+		ret = dedup_init(proc);
+		if (ret != 0)
+			goto fail_pool;
+	}
+
+	/* create the I/O thread */
+	if (desc->flags & SQFS_BLOCK_PROCESSOR_IO_THREAD) {
+		proc->io_read_req = calloc(1, sizeof(*proc->io_read_req));
+		if (proc->io_read_req == NULL) {
+			ret = SQFS_ERROR_ALLOC;
+			goto fail_pool;
+		}
+
+		proc->io_pool = thread_pool_create_ring(1, process_io_request);
+		if (proc->io_pool == NULL) {
+			ret = SQFS_ERROR_INTERNAL;
+			goto fail_pool;
+		}
+
+		proc->io_pool->set_worker_ptr(proc->io_pool, 0, proc);
+	}
+
 	*out = proc;
 	return 0;
 fail_pool:
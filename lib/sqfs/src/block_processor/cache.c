@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * cache.c
+ *
+ * Copyright (C) 2026 The squashfs-tools-ng contributors
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+/*
+  The key is the hash of the compressor configuration, followed by the
+  hash of the uncompressed block, stored in little endian byte order.
+ */
+#define CACHE_KEY_SIZE (4 * sizeof(sqfs_u64))
+
+static void store_u64(sqfs_u8 *out, sqfs_u64 value)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(value); ++i) {
+		out[i] = value & 0xFF;
+		value >>= 8;
+	}
+}
+
+static void make_key(sqfs_u8 *key, const hash128_t *cfg,
+		     const hash128_t *data)
+{
+	store_u64(key, cfg->low);
+	store_u64(key + 8, cfg->high);
+	store_u64(key + 16, data->low);
+	store_u64(key + 24, data->high);
+}
+
+int block_cache_lookup(worker_data_t *worker, sqfs_block_t *blk)
+{
+	sqfs_u8 key[CACHE_KEY_SIZE];
+	sqfs_u8 *temp;
+	size_t size;
+	int ret;
+
+	hash128(blk->data, blk->size, &blk->strong);
+	make_key(key, worker->cache_cfg, &blk->strong);
+
+	ret = worker->cache->lookup(worker->cache, key, sizeof(key),
+				    worker->scratch, worker->scratch_size,
+				    &size);
+	if (ret < 0)
+		return ret;
+
+	/* a valid entry is always smaller than the input, or empty */
+	if (ret == 0 || size >= blk->size)
+		goto out_miss;
+
+	/*
+	  The key is only a non-cryptographic hash and the cache may be
+	  shared or tampered with, so make sure the entry really is the
+	  compressed version of this block before using it.
+	 */
+	if (size > 0) {
+		ret = worker->uncmp->do_block(worker->uncmp, worker->scratch,
+					     size, worker->verify,
+					     worker->scratch_size);
+
+		if (ret < 0 || (size_t)ret != blk->size ||
+		    memcmp(worker->verify, blk->data, blk->size) != 0) {
+			goto out_miss;
+		}
+
+		temp = blk->data;
+		blk->data = worker->scratch;
+		worker->scratch = temp;
+
+		blk->size = size;
+		blk->flags |= SQFS_BLK_IS_COMPRESSED;
+	}
+
+	return 1;
+out_miss:
+	blk->flags |= BLK_FLAG_CACHE_STORE;
+	return 0;
+}
+
+int block_cache_store(sqfs_block_processor_t *proc, sqfs_block_t *blk)
+{
+	sqfs_u8 key[CACHE_KEY_SIZE];
+	size_t size = 0;
+
+	if (!(blk->flags & BLK_FLAG_CACHE_STORE))
+		return 0;
+
+	blk->flags &= ~BLK_FLAG_CACHE_STORE;
+
+	if (blk->flags & SQFS_BLK_IS_COMPRESSED)
+		size = blk->size;
+
+	make_key(key, &proc->cache_cfg, &blk->strong);
+
+	return proc->cache->store(proc->cache, key, sizeof(key),
+				  blk->data, size);
+}
@@ -0,0 +1,159 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * dedup.c
+ *
+ * Copyright (C) 2026 The squashfs-tools-ng contributors
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+/*
+  Rough upper bound for the memory used by the cache. The number of slots
+  is derived from this and the block size, each slot has a buffer for one
+  compressed block, allocated when the slot is first used. If the block
+  processor has a memory limit, the cache gets at most a quarter of it.
+ */
+#define DEDUP_CACHE_SIZE (32 * 1024 * 1024)
+
+#define DEDUP_MIN_SLOTS (16)
+#define DEDUP_MAX_SLOTS (1024)
+
+/* Input flags that affect what the worker threads do with a block. */
+#define DEDUP_KEY_FLAGS (SQFS_BLK_DONT_HASH | SQFS_BLK_IGNORE_SPARSE)
+
+/* What the worker threads found out about a block, copied to the hits. */
+#define DEDUP_RESULT_FLAGS (SQFS_BLK_IS_COMPRESSED | SQFS_BLK_IS_SPARSE | \
+			    SQFS_BLK_DONT_COMPRESS | BLK_FLAG_INCOMPRESSIBLE)
+
+/* Blocks that are never compressed individually or have been already. */
+#define DEDUP_SKIP_FLAGS (SQFS_BLK_DONT_COMPRESS | SQFS_BLK_IS_FRAGMENT | \
+			  SQFS_BLK_FRAGMENT_BLOCK | SQFS_BLK_IS_SPARSE | \
+			  SQFS_BLK_IS_COMPRESSED)
+
+int dedup_init(sqfs_block_processor_t *proc)
+{
+	sqfs_u64 limit = DEDUP_CACHE_SIZE;
+	size_t count = DEDUP_MIN_SLOTS;
+
+	if (proc->max_memory > 0 && (proc->max_memory / 4) < limit)
+		limit = proc->max_memory / 4;
+
+	while (count < DEDUP_MAX_SLOTS &&
+	       (2 * count * proc->max_block_size) <= limit) {
+		count *= 2;
+	}
+
+	proc->dedup_slots = calloc(count, sizeof(proc->dedup_slots[0]));
+	if (proc->dedup_slots == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	proc->dedup_mask = count - 1;
+	proc->dedup_max_buffers = limit / proc->max_block_size;
+	return 0;
+}
+
+void dedup_cleanup(sqfs_block_processor_t *proc)
+{
+	size_t i;
+
+	if (proc->dedup_slots == NULL)
+		return;
+
+	for (i = 0; i <= proc->dedup_mask; ++i)
+		free(proc->dedup_slots[i].data);
+
+	free(proc->dedup_slots);
+	proc->dedup_slots = NULL;
+}
+
+void dedup_lookup(sqfs_block_processor_t *proc, sqfs_block_t *blk)
+{
+	sqfs_u32 in_flags = blk->flags & DEDUP_KEY_FLAGS;
+	dedup_slot_t *slot;
+	hash128_t key;
+
+	if (proc->dedup_slots == NULL || blk->size == 0)
+		return;
+
+	if (blk->flags & DEDUP_SKIP_FLAGS)
+		return;
+
+	hash128(blk->data, blk->size, &key);
+	slot = proc->dedup_slots + (key.low & proc->dedup_mask);
+
+	if (slot->used && slot->in_size == blk->size &&
+	    slot->in_flags == in_flags && hash128_equal(&slot->key, &key)) {
+		slot->refcount += 1;
+		blk->dedup = slot;
+		blk->flags |= BLK_FLAG_DEDUP_HIT;
+		return;
+	}
+
+	/* keep the slot if there are still blocks in flight that need it */
+	if (slot->refcount > 0)
+		return;
+
+	/* caching is optional, if there is no memory, just don't do it */
+	if (slot->data == NULL) {
+		if (proc->dedup_buffers >= proc->dedup_max_buffers)
+			return;
+
+		if (proc->max_memory > 0 &&
+		    (proc->mem_used + proc->max_block_size) > proc->max_memory) {
+			return;
+		}
+
+		slot->data = malloc(proc->max_block_size);
+		if (slot->data == NULL)
+			return;
+
+		add_mem_used(proc, proc->max_block_size);
+		proc->dedup_buffers += 1;
+	}
+
+	slot->key = key;
+	slot->in_size = blk->size;
+	slot->in_flags = in_flags;
+	slot->refcount = 1;
+	slot->used = true;
+	slot->pending = true;
+	blk->dedup = slot;
+}
+
+int dedup_complete(sqfs_block_processor_t *proc, sqfs_block_t *blk)
+{
+	dedup_slot_t *slot = blk->dedup;
+	(void)proc;
+
+	if (slot == NULL)
+		return 0;
+
+	blk->dedup = NULL;
+	slot->refcount -= 1;
+
+	if (blk->flags & BLK_FLAG_DEDUP_HIT) {
+		/* blocks are dequeued in order, the source is always done */
+		if (slot->pending)
+			return SQFS_ERROR_INTERNAL;
+
+		blk->flags &= ~BLK_FLAG_DEDUP_HIT;
+		blk->flags |= slot->flags;
+		blk->checksum = slot->checksum;
+
+		if (slot->flags & SQFS_BLK_IS_COMPRESSED) {
+			memcpy(blk->data, slot->data, slot->size);
+			blk->size = slot->size;
+		}
+		return 0;
+	}
+
+	slot->flags = blk->flags & DEDUP_RESULT_FLAGS;
+	slot->checksum = blk->checksum;
+	slot->size = blk->size;
+	slot->pending = false;
+
+	if (blk->flags & SQFS_BLK_IS_COMPRESSED)
+		memcpy(slot->data, blk->data, blk->size);
+
+	return 0;
+}
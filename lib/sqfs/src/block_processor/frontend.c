@@ -7,11 +7,68 @@
 #define SQFS_BUILDING_DLL
 #include "internal.h"
 
+static bool over_memory_limit(const sqfs_block_processor_t *proc)
+{
+	size_t size = sizeof(sqfs_block_t) + proc->max_block_size;
+
+	return proc->max_memory > 0 &&
+		(proc->mem_used + size) > proc->max_memory;
+}
+
+static bool need_more_memory(const sqfs_block_processor_t *proc)
+{
+	/* we need at least one current data block + one fragment block */
+	return proc->backlog >= 3 && over_memory_limit(proc);
+}
+
+/*
+  A fragment may become the start of a new fragment block, which is copied
+  once it is full and submitted for compression. That happens while
+  dequeueing blocks, where we cannot wait for memory, so it is reserved
+  here for every fragment and given back if it turns out to be unneeded.
+ */
+static int reserve_fragment_copy(sqfs_block_processor_t *proc,
+				 sqfs_block_t *blk)
+{
+	sqfs_block_t *it;
+	int ret;
+
+	if (!proc->copy_frag_blocks)
+		return 0;
+
+	while (over_memory_limit(proc)) {
+		if (proc->free_list != NULL) {
+			while (proc->free_list != NULL &&
+			       over_memory_limit(proc)) {
+				it = proc->free_list;
+				proc->free_list = it->next;
+				free_block(proc, it);
+			}
+
+			trim_block_memory(proc);
+			continue;
+		}
+
+		if (!need_more_memory(proc))
+			break;
+
+		ret = dequeue_block(proc);
+		if (ret != 0)
+			return ret;
+	}
+
+	add_mem_used(proc, sizeof(*blk) + proc->max_block_size);
+	blk->flags |= BLK_FLAG_COPY_RESERVED;
+	return 0;
+}
+
 static int get_new_block(sqfs_block_processor_t *proc, sqfs_block_t **out)
 {
 	sqfs_block_t *blk;
+	sqfs_u8 *data;
 
-	while (proc->backlog >= proc->max_backlog) {
+	while (proc->backlog >= proc->max_backlog ||
+	       (proc->free_list == NULL && need_more_memory(proc))) {
 		int ret = dequeue_block(proc);
 		if (ret != 0)
 			return ret;
@@ -21,12 +78,14 @@ static int get_new_block(sqfs_block_processor_t *proc, sqfs_block_t **out)
 		blk = proc->free_list;
 		proc->free_list = blk->next;
 	} else {
-		blk = malloc(sizeof(*blk) + proc->max_block_size);
+		blk = alloc_block(proc);
 		if (blk == NULL)
 			return SQFS_ERROR_ALLOC;
 	}
 
+	data = blk->data;
 	memset(blk, 0, sizeof(*blk));
+	blk->data = data;
 	*out = blk;
 
 	proc->backlog += 1;
@@ -52,9 +111,15 @@ int enqueue_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
 {
 	int status;
 
-	if ((blk->flags & SQFS_BLK_FRAGMENT_BLOCK) &&
-	    proc->file != NULL && proc->uncmp != NULL) {
-		sqfs_block_t *copy = alloc_flex(sizeof(*copy), 1, blk->size);
+	if ((blk->flags & SQFS_BLK_FRAGMENT_BLOCK) && proc->copy_frag_blocks) {
+		sqfs_block_t *copy;
+
+		if (blk->flags & BLK_FLAG_COPY_RESERVED) {
+			proc->mem_used -= sizeof(*blk) + proc->max_block_size;
+			blk->flags &= ~BLK_FLAG_COPY_RESERVED;
+		}
+
+		copy = alloc_block(proc);
 
 		if (copy == NULL)
 			return SQFS_ERROR_ALLOC;
@@ -67,6 +132,8 @@ int enqueue_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
 		proc->fblk_in_flight = copy;
 	}
 
+	dedup_lookup(proc, blk);
+
 	if (proc->pool->submit(proc->pool, blk) != 0) {
 		status = proc->pool->get_status(proc->pool);
 
@@ -78,6 +145,7 @@ int enqueue_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
 		return status;
 	}
 
+	proc->pool_in_flight += 1;
 	return 0;
 }
 
@@ -204,6 +272,10 @@ int sqfs_block_processor_end_file(sqfs_block_processor_t *proc)
 			}
 
 			proc->blk_current->flags |= SQFS_BLK_IS_FRAGMENT;
+
+			err = reserve_fragment_copy(proc, proc->blk_current);
+			if (err)
+				return err;
 		}
 
 		err = enqueue_block(proc, proc->blk_current);
@@ -245,5 +317,11 @@ int sqfs_block_processor_submit_block(sqfs_block_processor_t *proc, void *user,
 	blk->size = size;
 	memcpy(blk->data, data, size);
 
+	if (flags & (SQFS_BLK_IS_FRAGMENT | SQFS_BLK_FRAGMENT_BLOCK)) {
+		ret = reserve_fragment_copy(proc, blk);
+		if (ret != 0)
+			return ret;
+	}
+
 	return enqueue_block(proc, blk);
 }
@@ -21,6 +21,7 @@
 
 #include "util/hash_table.h"
 #include "util/threadpool.h"
+#include "util/mempool.h"
 #include "util/util.h"
 
 #include <string.h>
@@ -31,13 +32,43 @@ typedef struct {
 	sqfs_u32 offset;
 	sqfs_u32 size;
 	sqfs_u32 hash;
+	hash128_t strong;
 } chunk_info_t;
 
 enum {
+	BLK_FLAG_COPY_RESERVED = 0x02000000,
+	BLK_FLAG_CACHE_STORE = 0x04000000,
+	BLK_FLAG_INCOMPRESSIBLE = 0x08000000,
 	BLK_FLAG_MANUAL_SUBMISSION = 0x10000000,
-	BLK_FLAG_INTERNAL = 0x10000000,
+	BLK_FLAG_READ_BACK = 0x20000000,
+	BLK_FLAG_DEDUP_HIT = 0x40000000,
+	BLK_FLAG_INTERNAL = 0x7E000000,
 };
 
+/*
+  A slot in the pre-compression deduplication cache. Remembers what the
+  worker threads turned a block into, identified by a hash of the
+  uncompressed data.
+ */
+typedef struct {
+	hash128_t key;
+	sqfs_u32 in_size;
+	sqfs_u32 in_flags;
+
+	/* result of processing the first block with this key */
+	sqfs_u32 size;
+	sqfs_u32 flags;
+	sqfs_u32 checksum;
+
+	/* number of blocks in flight that refer to this slot */
+	sqfs_u32 refcount;
+	bool used;
+	bool pending;
+
+	/* max_block_size bytes, for the compressed data */
+	sqfs_u8 *data;
+} dedup_slot_t;
+
 typedef struct sqfs_block_t {
 	struct sqfs_block_t *next;
 	sqfs_inode_generic_t **inode;
@@ -51,18 +82,43 @@ typedef struct sqfs_block_t {
 	   For fragment fragment blocks: fragment table index. */
 	sqfs_u32 index;
 
+	/* Set by the block writer. For read back requests to the I/O
+	   thread, the location to read from. */
+	sqfs_u64 location;
+
+	/* For fragments, if strong hashing is enabled, and for blocks
+	   looked up in the block cache. */
+	hash128_t strong;
+
+	/* Pre-compression dedup slot, if the block is a source or a hit */
+	dedup_slot_t *dedup;
+
 	/* User data pointer */
 	void *user;
 
-	sqfs_u8 data[];
+	/*
+	  A buffer of max_block_size bytes. The worker threads compress into
+	  their own scratch buffer and then swap it with this one, so the
+	  buffer a block points to can change while it is being processed.
+	 */
+	sqfs_u8 *data;
 } sqfs_block_t;
 
 typedef struct worker_data_t {
 	struct worker_data_t *next;
 	sqfs_compressor_t *cmp;
+	bool strong_hash;
+	bool skip_incompressible;
+
+	sqfs_block_cache_t *cache;
+	const hash128_t *cache_cfg;
+
+	/* decompressor & buffer for checking block cache hits */
+	sqfs_compressor_t *uncmp;
+	sqfs_u8 *verify;
 
 	size_t scratch_size;
-	sqfs_u8 scratch[];
+	sqfs_u8 *scratch;
 } worker_data_t;
 
 struct sqfs_block_processor_t {
@@ -83,12 +139,26 @@ struct sqfs_block_processor_t {
 	struct hash_table *frag_ht;
 	sqfs_block_t *free_list;
 
+#ifndef NO_CUSTOM_ALLOC
+	mem_pool_t *blk_pool;
+	mem_pool_t *buf_pool;
+	mem_pool_t *chunk_pool;
+#endif
+
 	size_t max_block_size;
 	size_t max_backlog;
 	size_t backlog;
+	sqfs_u32 flags;
+
+	/* bytes allocated for block data and the configured limit */
+	sqfs_u64 mem_used;
+	sqfs_u64 max_memory;
 
 	bool begin_called;
 
+	/* set if fragment blocks are copied before they are compressed */
+	bool copy_frag_blocks;
+
 	sqfs_file_t *file;
 	sqfs_compressor_t *uncmp;
 
@@ -99,6 +169,23 @@ struct sqfs_block_processor_t {
 	sqfs_u32 io_seq_num;
 	sqfs_u32 io_deq_seq_num;
 
+	thread_pool_t *io_pool;
+	sqfs_block_t *io_pending;
+	sqfs_block_t *io_pending_last;
+	sqfs_block_t *io_read_req;
+	size_t pool_in_flight;
+	size_t io_in_flight;
+	size_t io_retired;
+	size_t io_done;
+
+	dedup_slot_t *dedup_slots;
+	size_t dedup_mask;
+	size_t dedup_buffers;
+	size_t dedup_max_buffers;
+
+	sqfs_block_cache_t *cache;
+	hash128_t cache_cfg;
+
 	sqfs_block_t *current_frag;
 	sqfs_block_t *cached_frag_blk;
 	sqfs_block_t *fblk_in_flight;
@@ -107,9 +194,45 @@ struct sqfs_block_processor_t {
 	sqfs_u8 scratch[];
 };
 
+SQFS_INTERNAL void add_mem_used(sqfs_block_processor_t *proc, size_t size);
+
+/* Give unused pool memory back to the OS after freeing blocks. */
+SQFS_INTERNAL void trim_block_memory(sqfs_block_processor_t *proc);
+
+SQFS_INTERNAL sqfs_block_t *alloc_block(sqfs_block_processor_t *proc);
+
+SQFS_INTERNAL void free_block(sqfs_block_processor_t *proc,
+			      sqfs_block_t *blk);
+
+SQFS_INTERNAL chunk_info_t *alloc_chunk_info(sqfs_block_processor_t *proc);
+
+SQFS_INTERNAL void free_chunk_info(sqfs_block_processor_t *proc,
+				   chunk_info_t *chunk);
+
 SQFS_INTERNAL int enqueue_block(sqfs_block_processor_t *proc,
 				sqfs_block_t *blk);
 
 SQFS_INTERNAL int dequeue_block(sqfs_block_processor_t *proc);
 
+SQFS_INTERNAL int dedup_init(sqfs_block_processor_t *proc);
+
+SQFS_INTERNAL void dedup_cleanup(sqfs_block_processor_t *proc);
+
+SQFS_INTERNAL void dedup_lookup(sqfs_block_processor_t *proc,
+				sqfs_block_t *blk);
+
+SQFS_INTERNAL int dedup_complete(sqfs_block_processor_t *proc,
+				 sqfs_block_t *blk);
+
+SQFS_INTERNAL int block_cache_lookup(worker_data_t *worker,
+				     sqfs_block_t *blk);
+
+SQFS_INTERNAL int block_cache_store(sqfs_block_processor_t *proc,
+				    sqfs_block_t *blk);
+
+SQFS_INTERNAL int process_io_request(void *userptr, void *workitem);
+
+SQFS_INTERNAL int io_read_at(sqfs_block_processor_t *proc, sqfs_u64 offset,
+			     void *buffer, size_t size);
+
 #endif /* INTERNAL_H */
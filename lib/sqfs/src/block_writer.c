@@ -12,6 +12,7 @@
 #include "sqfs/block.h"
 #include "sqfs/io.h"
 
+#include "util/hash_table.h"
 #include "util/array.h"
 #include "util/util.h"
 
@@ -26,16 +27,31 @@
 #define INIT_BLOCK_COUNT (128)
 #define SCRATCH_SIZE (8192)
 
+#define NO_BLOCK (~((size_t)0))
+
 typedef struct {
 	sqfs_u64 offset;
 	sqfs_u64 hash;
+
+	/* previous block with the same hash or NO_BLOCK */
+	size_t prev_same;
 } blk_info_t;
 
+typedef struct {
+	sqfs_u64 hash;
+
+	/* most recently written block with this hash or NO_BLOCK */
+	size_t head;
+} blk_index_t;
+
 typedef struct {
 	sqfs_block_writer_t base;
 	sqfs_file_t *file;
 
 	array_t blocks;
+	array_t strong;
+	array_t candidates;
+	struct hash_table *index;
 
 	size_t file_start;
 
@@ -44,19 +60,197 @@ typedef struct {
 	sqfs_u8 scratch[];
 } block_writer_default_t;
 
+static sqfs_u32 index_hash(sqfs_u64 hash)
+{
+	return (sqfs_u32)(hash >> 32) ^ (sqfs_u32)hash;
+}
+
+static bool index_equals(void *user, const void *k, const void *c)
+{
+	const blk_index_t *key = k, *cmp = c;
+	(void)user;
+
+	return key->hash == cmp->hash;
+}
+
+static void index_delete_function(struct hash_entry *entry)
+{
+	free(entry->data);
+}
+
+static blk_index_t *index_lookup(block_writer_default_t *wr, sqfs_u64 hash)
+{
+	struct hash_entry *entry;
+	blk_index_t search;
+
+	search.hash = hash;
+	entry = hash_table_search_pre_hashed(wr->index, index_hash(hash),
+					     &search);
+
+	return entry == NULL ? NULL : entry->data;
+}
+
 static int store_block_location(block_writer_default_t *wr, sqfs_u64 offset,
-				sqfs_u32 size, sqfs_u32 chksum)
+				sqfs_u32 size, sqfs_u32 chksum,
+				const sqfs_u8 *data, size_t data_size)
+{
+	blk_info_t info = { offset, MK_BLK_HASH(chksum, size), NO_BLOCK };
+	blk_index_t *idx;
+	hash128_t strong;
+	int ret;
+
+	idx = index_lookup(wr, info.hash);
+
+	if (idx == NULL) {
+		idx = calloc(1, sizeof(*idx));
+		if (idx == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		idx->hash = info.hash;
+		idx->head = NO_BLOCK;
+
+		if (hash_table_insert_pre_hashed(wr->index,
+						 index_hash(idx->hash),
+						 idx, idx) == NULL) {
+			free(idx);
+			return SQFS_ERROR_ALLOC;
+		}
+	}
+
+	info.prev_same = idx->head;
+
+	if (wr->flags & SQFS_BLOCK_WRITER_STRONG_HASH) {
+		hash128(data, data_size, &strong);
+
+		ret = array_append(&(wr->strong), &strong);
+		if (ret != 0)
+			return ret;
+	}
+
+	ret = array_append(&(wr->blocks), &info);
+	if (ret != 0) {
+		if (wr->flags & SQFS_BLOCK_WRITER_STRONG_HASH)
+			wr->strong.used -= 1;
+		return ret;
+	}
+
+	idx->head = wr->blocks.used - 1;
+	return 0;
+}
+
+static void drop_block_locations(block_writer_default_t *wr, size_t new_used)
+{
+	const blk_info_t *blocks = wr->blocks.data;
+	blk_index_t *idx;
+
+	/* blocks are removed from the end, so they are always the head */
+	while (wr->blocks.used > new_used) {
+		wr->blocks.used -= 1;
+
+		idx = index_lookup(wr, blocks[wr->blocks.used].hash);
+		if (idx != NULL)
+			idx->head = blocks[wr->blocks.used].prev_same;
+	}
+
+	if (wr->flags & SQFS_BLOCK_WRITER_STRONG_HASH)
+		wr->strong.used = new_used;
+}
+
+static bool hash_sequence_equal(const blk_info_t *blocks, size_t a, size_t b,
+				size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; ++i) {
+		if (blocks[a + i].hash != blocks[b + i].hash)
+			return false;
+	}
+
+	return true;
+}
+
+static bool strong_sequence_equal(const hash128_t *strong, size_t a, size_t b,
+				  size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; ++i) {
+		if (!hash128_equal(strong + a + i, strong + b + i))
+			return false;
+	}
+
+	return true;
+}
+
+static int find_duplicate(block_writer_default_t *wr, size_t count,
+			  sqfs_u64 sz, size_t *out)
 {
-	blk_info_t info = { offset, MK_BLK_HASH(chksum, size) };
+	const blk_info_t *blocks = wr->blocks.data;
+	const blk_index_t *idx;
+	const size_t *list;
+	size_t i, start;
+	int ret;
+
+	*out = wr->file_start;
+	wr->candidates.used = 0;
+
+	idx = index_lookup(wr, blocks[wr->file_start].hash);
+	if (idx == NULL)
+		return 0;
+
+	/* the index yields the blocks with matching hash in reverse order */
+	for (i = idx->head; i != NO_BLOCK; i = blocks[i].prev_same) {
+		if (i >= wr->file_start)
+			continue;
+
+		if (!hash_sequence_equal(blocks, i, wr->file_start, count))
+			continue;
+
+		ret = array_append(&(wr->candidates), &i);
+		if (ret != 0)
+			return ret;
+	}
+
+	/* prefer the earliest match in the file */
+	list = wr->candidates.data;
+
+	for (i = wr->candidates.used; i > 0; --i) {
+		start = list[i - 1];
+
+		if (wr->flags & SQFS_BLOCK_WRITER_HASH_COMPARE_ONLY) {
+			*out = start;
+			break;
+		}
+
+		if (wr->flags & SQFS_BLOCK_WRITER_STRONG_HASH) {
+			if (strong_sequence_equal(wr->strong.data, start,
+						  wr->file_start, count)) {
+				*out = start;
+				break;
+			}
+			continue;
+		}
+
+		ret = check_file_range_equal(wr->file, wr->scratch,
+					     SCRATCH_SIZE,
+					     blocks[wr->file_start].offset,
+					     blocks[start].offset, sz);
+		if (ret == 0) {
+			*out = start;
+			break;
+		}
+		if (ret < 0)
+			return ret;
+	}
 
-	return array_append(&(wr->blocks), &info);
+	return 0;
 }
 
 static int deduplicate_blocks(block_writer_default_t *wr, sqfs_u32 flags, sqfs_u64 *out)
 {
 	const blk_info_t *blocks = wr->blocks.data;
-	sqfs_u64 loc_a, loc_b, sz;
-	size_t i, j, count;
+	size_t i, count, new_used;
+	sqfs_u64 sz;
 	int ret;
 
 	count = wr->blocks.used - wr->file_start;
@@ -71,54 +265,43 @@ static int deduplicate_blocks(block_writer_default_t *wr, sqfs_u32 flags, sqfs_u
 	}
 
 	sz = 0;
-	loc_a = blocks[wr->file_start].offset;
 
 	for (i = 0; i < count; ++i)
 		sz += SIZE_FROM_HASH(blocks[wr->file_start + i].hash);
 
-	for (i = 0; i < wr->file_start; ++i) {
-		for (j = 0; j < count; ++j) {
-			if (blocks[i + j].hash !=
-			    blocks[wr->file_start + j].hash)
-				break;
-		}
-
-		if (j != count)
-			continue;
-
-		if (wr->flags & SQFS_BLOCK_WRITER_HASH_COMPARE_ONLY)
-			break;
-
-		loc_b = blocks[i].offset;
-
-		ret = check_file_range_equal(wr->file, wr->scratch,
-					     SCRATCH_SIZE, loc_a, loc_b, sz);
-		if (ret == 0)
-			break;
-		if (ret < 0)
-			return ret;
-	}
+	ret = find_duplicate(wr, count, sz, &i);
+	if (ret != 0)
+		return ret;
 
 	*out = blocks[i].offset;
 	if (i >= wr->file_start)
 		return 0;
 
 	if (count >= (wr->file_start - i)) {
-		wr->blocks.used = i + count;
+		new_used = i + count;
 	} else {
-		wr->blocks.used = wr->file_start;
+		new_used = wr->file_start;
 	}
 
+	drop_block_locations(wr, new_used);
+
 	sz = blocks[wr->blocks.used - 1].offset +
 		SIZE_FROM_HASH(blocks[wr->blocks.used - 1].hash);
 
 	return wr->file->truncate(wr->file, sz);
 }
 
-static void block_writer_destroy(sqfs_object_t *wr)
+static void block_writer_destroy(sqfs_object_t *base)
 {
-	sqfs_drop(((block_writer_default_t *)wr)->file);
-	array_cleanup(&(((block_writer_default_t *)wr)->blocks));
+	block_writer_default_t *wr = (block_writer_default_t *)base;
+
+	if (wr->index != NULL)
+		hash_table_destroy(wr->index, index_delete_function);
+
+	sqfs_drop(wr->file);
+	array_cleanup(&wr->candidates);
+	array_cleanup(&wr->strong);
+	array_cleanup(&wr->blocks);
 	free(wr);
 }
 
@@ -140,7 +323,8 @@ static int write_data_block(sqfs_block_writer_t *base, void *user,
 		if (!(flags & SQFS_BLK_IS_COMPRESSED))
 			out |= 1 << 24;
 
-		err = store_block_location(wr, *location, out, checksum);
+		err = store_block_location(wr, *location, out, checksum,
+					   data, size);
 		if (err)
 			return err;
 
@@ -167,7 +351,8 @@ sqfs_block_writer_t *sqfs_block_writer_create(sqfs_file_t *file, sqfs_u32 flags)
 	if (flags & ~SQFS_BLOCK_WRITER_ALL_FLAGS)
 		return NULL;
 
-	if (flags & SQFS_BLOCK_WRITER_HASH_COMPARE_ONLY) {
+	if (flags & (SQFS_BLOCK_WRITER_HASH_COMPARE_ONLY |
+		     SQFS_BLOCK_WRITER_STRONG_HASH)) {
 		wr = calloc(1, sizeof(*wr));
 	} else {
 		wr = alloc_flex(sizeof(*wr), 1, SCRATCH_SIZE);
@@ -183,11 +368,25 @@ sqfs_block_writer_t *sqfs_block_writer_create(sqfs_file_t *file, sqfs_u32 flags)
 	wr->flags = flags;
 	wr->file = sqfs_grab(file);
 
-	if (array_init(&(wr->blocks), sizeof(blk_info_t), INIT_BLOCK_COUNT)) {
-		sqfs_drop(wr->file);
-		free(wr);
-		return NULL;
+	if (array_init(&(wr->blocks), sizeof(blk_info_t), INIT_BLOCK_COUNT))
+		goto fail;
+
+	if (array_init(&(wr->candidates), sizeof(size_t), 0))
+		goto fail;
+
+	if (flags & SQFS_BLOCK_WRITER_STRONG_HASH) {
+		if (array_init(&(wr->strong), sizeof(hash128_t),
+			       INIT_BLOCK_COUNT)) {
+			goto fail;
+		}
 	}
 
+	wr->index = hash_table_create(NULL, index_equals);
+	if (wr->index == NULL)
+		goto fail;
+
 	return (sqfs_block_writer_t *)wr;
+fail:
+	block_writer_destroy((sqfs_object_t *)wr);
+	return NULL;
 }
@@ -0,0 +1,435 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * cache.c
+ *
+ * Copyright (C) 2026 The squashfs-tools-ng contributors
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+static size_t hash_location(const dr_cache_t *cache, sqfs_u64 location)
+{
+	location *= 0x9E3779B97F4A7C15ULL;
+
+	return (size_t)(location >> 32) & cache->bucket_mask;
+}
+
+static void lru_unlink(dr_cache_t *cache, dr_cache_entry_t *ent)
+{
+	if (ent->lru_prev == NULL) {
+		cache->lru_head = ent->lru_next;
+	} else {
+		ent->lru_prev->lru_next = ent->lru_next;
+	}
+
+	if (ent->lru_next == NULL) {
+		cache->lru_tail = ent->lru_prev;
+	} else {
+		ent->lru_next->lru_prev = ent->lru_prev;
+	}
+
+	ent->lru_prev = ent->lru_next = NULL;
+}
+
+static void lru_push_front(dr_cache_t *cache, dr_cache_entry_t *ent)
+{
+	ent->lru_prev = NULL;
+	ent->lru_next = cache->lru_head;
+
+	if (cache->lru_head == NULL) {
+		cache->lru_tail = ent;
+	} else {
+		cache->lru_head->lru_prev = ent;
+	}
+
+	cache->lru_head = ent;
+}
+
+static void hash_remove(dr_cache_t *cache, dr_cache_entry_t *ent)
+{
+	dr_cache_entry_t **it;
+
+	it = cache->buckets + hash_location(cache, ent->location);
+
+	while (*it != NULL && *it != ent)
+		it = &((*it)->hash_next);
+
+	if (*it != NULL)
+		*it = ent->hash_next;
+
+	ent->hash_next = NULL;
+}
+
+static void hash_insert(dr_cache_t *cache, dr_cache_entry_t *ent)
+{
+	size_t idx = hash_location(cache, ent->location);
+
+	ent->hash_next = cache->buckets[idx];
+	cache->buckets[idx] = ent;
+}
+
+#ifdef NO_THREAD_IMPL
+#define map_lock(map) (void)0
+#define map_unlock(map) (void)0
+#else
+#define map_lock(map) \
+	do { \
+		if ((map)->thread_safe) \
+			pthread_mutex_lock(&(map)->mtx); \
+	} while (0)
+
+#define map_unlock(map) \
+	do { \
+		if ((map)->thread_safe) \
+			pthread_mutex_unlock(&(map)->mtx); \
+	} while (0)
+#endif
+
+static size_t map_slot(const dr_ptr_map_t *map, const sqfs_u8 *ptr)
+{
+	return (size_t)((uintptr_t)ptr >> map->slot_shift);
+}
+
+static size_t map_first_slot(const dr_ptr_map_t *map,
+			     const dr_cache_entry_t *ent)
+{
+	return map_slot(map, ent->data);
+}
+
+static size_t map_last_slot(const dr_ptr_map_t *map,
+			    const dr_cache_entry_t *ent)
+{
+	return map_slot(map, ent->data + map->block_size - 1);
+}
+
+/* the link of an entry that belongs to the chain of the given bucket */
+static dr_cache_entry_t **map_link(const dr_ptr_map_t *map,
+				   dr_cache_entry_t *ent, size_t bucket)
+{
+	if ((map_first_slot(map, ent) & map->bucket_mask) == bucket)
+		return &ent->ptr_next[0];
+
+	return &ent->ptr_next[1];
+}
+
+static void map_link_entry(dr_ptr_map_t *map, dr_cache_entry_t *ent)
+{
+	size_t first = map_first_slot(map, ent) & map->bucket_mask;
+	size_t last = map_last_slot(map, ent) & map->bucket_mask;
+
+	ent->ptr_next[0] = map->buckets[first];
+	map->buckets[first] = ent;
+
+	if (last != first) {
+		ent->ptr_next[1] = map->buckets[last];
+		map->buckets[last] = ent;
+	}
+}
+
+static void map_unlink_bucket(dr_ptr_map_t *map, dr_cache_entry_t *ent,
+			      size_t bucket)
+{
+	dr_cache_entry_t **it = map->buckets + bucket;
+
+	while (*it != NULL && *it != ent)
+		it = map_link(map, *it, bucket);
+
+	if (*it != NULL)
+		*it = *map_link(map, ent, bucket);
+}
+
+static int map_grow(dr_ptr_map_t *map)
+{
+	size_t i, j, count = (map->bucket_mask + 1) * 2;
+	dr_cache_entry_t **buckets, **list, *ent;
+
+	buckets = alloc_array(sizeof(buckets[0]), count);
+	list = alloc_array(sizeof(list[0]), map->count);
+
+	if (buckets == NULL || list == NULL) {
+		free(buckets);
+		free(list);
+		return SQFS_ERROR_ALLOC;
+	}
+
+	/*
+	  Relinking an entry overwrites its links into both chains, so
+	  collect all of them first. Each entry is taken from the chain
+	  of its first slot only.
+	 */
+	for (i = 0, j = 0; i <= map->bucket_mask; ++i) {
+		for (ent = map->buckets[i]; ent != NULL;
+		     ent = *map_link(map, ent, i)) {
+			if ((map_first_slot(map, ent) & map->bucket_mask) == i)
+				list[j++] = ent;
+		}
+	}
+
+	free(map->buckets);
+	map->buckets = buckets;
+	map->bucket_mask = count - 1;
+
+	for (i = 0; i < j; ++i)
+		map_link_entry(map, list[i]);
+
+	free(list);
+	return 0;
+}
+
+static int map_insert(dr_ptr_map_t *map, dr_cache_entry_t *ent)
+{
+	int ret = 0;
+
+	map_lock(map);
+
+	if (map->count >= map->bucket_mask + 1)
+		ret = map_grow(map);
+
+	if (ret == 0) {
+		map_link_entry(map, ent);
+		map->count += 1;
+	}
+
+	map_unlock(map);
+	return ret;
+}
+
+static void map_remove(dr_ptr_map_t *map, dr_cache_entry_t *ent)
+{
+	size_t first = map_first_slot(map, ent) & map->bucket_mask;
+	size_t last = map_last_slot(map, ent) & map->bucket_mask;
+
+	map_lock(map);
+
+	map_unlink_bucket(map, ent, first);
+	if (last != first)
+		map_unlink_bucket(map, ent, last);
+
+	map->count -= 1;
+	map_unlock(map);
+}
+
+int dr_ptr_map_init(dr_ptr_map_t *map, size_t block_size, bool thread_safe)
+{
+	memset(map, 0, sizeof(*map));
+
+	map->buckets = alloc_array(sizeof(map->buckets[0]), 16);
+	if (map->buckets == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	map->bucket_mask = 15;
+	map->block_size = block_size;
+
+	while (((size_t)1 << map->slot_shift) < block_size)
+		map->slot_shift += 1;
+
+#ifndef NO_THREAD_IMPL
+	map->thread_safe = thread_safe;
+	if (thread_safe)
+		pthread_mutex_init(&map->mtx, NULL);
+#else
+	(void)thread_safe;
+#endif
+	return 0;
+}
+
+void dr_ptr_map_cleanup(dr_ptr_map_t *map)
+{
+#ifndef NO_THREAD_IMPL
+	if (map->thread_safe)
+		pthread_mutex_destroy(&map->mtx);
+#endif
+	free(map->buckets);
+	memset(map, 0, sizeof(*map));
+}
+
+dr_cache_entry_t *dr_ptr_map_find(dr_ptr_map_t *map, const sqfs_u8 *ptr)
+{
+	uintptr_t addr = (uintptr_t)ptr, start;
+	size_t bucket;
+	dr_cache_entry_t *ent;
+
+	map_lock(map);
+	bucket = map_slot(map, ptr) & map->bucket_mask;
+
+	for (ent = map->buckets[bucket]; ent != NULL;
+	     ent = *map_link(map, ent, bucket)) {
+		start = (uintptr_t)ent->data;
+
+		if (addr >= start && (addr - start) < map->block_size)
+			break;
+	}
+
+	map_unlock(map);
+	return ent;
+}
+
+static dr_cache_entry_t *alloc_entry(dr_cache_t *cache)
+{
+	dr_cache_entry_t *ent;
+	sqfs_u8 *data;
+
+	data = alloc_aligned(DR_DATA_ALIGN, cache->entry_offset + sizeof(*ent));
+	if (data == NULL)
+		return NULL;
+
+	ent = (void *)(data + cache->entry_offset);
+	memset(ent, 0, sizeof(*ent));
+	ent->data = data;
+
+	if (map_insert(cache->ptr_map, ent)) {
+		free_aligned(data);
+		return NULL;
+	}
+
+	return ent;
+}
+
+static void free_entry(dr_cache_t *cache, dr_cache_entry_t *ent)
+{
+	map_remove(cache->ptr_map, ent);
+	free_aligned(ent->data);
+}
+
+static void trim(dr_cache_t *cache)
+{
+	dr_cache_entry_t *ent = cache->lru_tail, *prev;
+
+	while (ent != NULL && cache->count > cache->max_count) {
+		prev = ent->lru_prev;
+
+		if (ent->refcount == 0)
+			dr_cache_discard(cache, ent);
+
+		ent = prev;
+	}
+}
+
+static size_t bucket_count(size_t max_count)
+{
+	size_t count = 1;
+
+	while (count < 2 * max_count)
+		count <<= 1;
+
+	return count;
+}
+
+int dr_cache_init(dr_cache_t *cache, dr_ptr_map_t *map, size_t block_size,
+		  size_t max_count)
+{
+	size_t count = bucket_count(max_count);
+
+	memset(cache, 0, sizeof(*cache));
+
+	cache->buckets = alloc_array(sizeof(cache->buckets[0]), count);
+	if (cache->buckets == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	cache->bucket_mask = count - 1;
+	cache->max_count = max_count;
+	cache->block_size = block_size;
+	cache->ptr_map = map;
+
+	cache->entry_offset = block_size + sizeof(void *) - 1;
+	cache->entry_offset -= cache->entry_offset % sizeof(void *);
+	return 0;
+}
+
+void dr_cache_cleanup(dr_cache_t *cache)
+{
+	dr_cache_entry_t *ent;
+
+	while (cache->lru_head != NULL) {
+		ent = cache->lru_head;
+		cache->lru_head = ent->lru_next;
+		free_entry(cache, ent);
+	}
+
+	free(cache->buckets);
+	memset(cache, 0, sizeof(*cache));
+}
+
+int dr_cache_resize(dr_cache_t *cache, size_t max_count)
+{
+	size_t count = bucket_count(max_count);
+	dr_cache_entry_t **buckets, *ent;
+
+	buckets = alloc_array(sizeof(buckets[0]), count);
+	if (buckets == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	free(cache->buckets);
+	cache->buckets = buckets;
+	cache->bucket_mask = count - 1;
+	cache->max_count = max_count;
+
+	for (ent = cache->lru_head; ent != NULL; ent = ent->lru_next)
+		hash_insert(cache, ent);
+
+	trim(cache);
+	return 0;
+}
+
+dr_cache_entry_t *dr_cache_lookup(dr_cache_t *cache, sqfs_u64 location)
+{
+	dr_cache_entry_t *ent;
+
+	ent = cache->buckets[hash_location(cache, location)];
+
+	while (ent != NULL && ent->location != location)
+		ent = ent->hash_next;
+
+	if (ent != NULL && ent != cache->lru_head) {
+		lru_unlink(cache, ent);
+		lru_push_front(cache, ent);
+	}
+
+	return ent;
+}
+
+dr_cache_entry_t *dr_cache_insert(dr_cache_t *cache, sqfs_u64 location)
+{
+	dr_cache_entry_t *ent = NULL;
+
+	if (cache->count >= cache->max_count) {
+		ent = cache->lru_tail;
+
+		while (ent != NULL && ent->refcount > 0)
+			ent = ent->lru_prev;
+	}
+
+	if (ent == NULL) {
+		ent = alloc_entry(cache);
+		if (ent == NULL)
+			return NULL;
+
+		cache->count += 1;
+	} else {
+		lru_unlink(cache, ent);
+		hash_remove(cache, ent);
+	}
+
+	ent->location = location;
+	ent->size = 0;
+
+	hash_insert(cache, ent);
+	lru_push_front(cache, ent);
+	return ent;
+}
+
+void dr_cache_discard(dr_cache_t *cache, dr_cache_entry_t *ent)
+{
+	lru_unlink(cache, ent);
+	hash_remove(cache, ent);
+	cache->count -= 1;
+	free_entry(cache, ent);
+}
+
+void dr_cache_release(dr_cache_t *cache, dr_cache_entry_t *ent)
+{
+	if (ent->refcount > 0)
+		ent->refcount -= 1;
+
+	trim(cache);
+}
@@ -0,0 +1,666 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * data_reader.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+static int read_block(sqfs_data_reader_t *data, sqfs_u64 off, sqfs_u32 size,
+		      sqfs_u32 max_size, sqfs_u8 *out, size_t *out_sz)
+{
+	sqfs_u32 on_disk_size;
+	dr_decoder_t *dec;
+	sqfs_s32 ret;
+	int err;
+
+	on_disk_size = SQFS_ON_DISK_BLOCK_SIZE(size);
+
+	if (on_disk_size > max_size)
+		return SQFS_ERROR_OVERFLOW;
+
+	if (SQFS_IS_BLOCK_COMPRESSED(size)) {
+		dec = dr_get_decoder(data);
+		if (dec == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		err = data->file->read_at(data->file, off,
+					  dec->scratch, on_disk_size);
+		if (err) {
+			dr_put_decoder(data, dec);
+			return err;
+		}
+
+		ret = dec->cmp->do_block(dec->cmp, dec->scratch,
+					 on_disk_size, out, max_size);
+		dr_put_decoder(data, dec);
+
+		if (ret <= 0)
+			return ret < 0 ? ret : SQFS_ERROR_OVERFLOW;
+
+		*out_sz = ret;
+	} else {
+		err = data->file->read_at(data->file, off, out, on_disk_size);
+		if (err)
+			return err;
+
+		*out_sz = on_disk_size;
+	}
+
+	return 0;
+}
+
+static dr_shard_t *get_shard(sqfs_data_reader_t *data, sqfs_u64 location)
+{
+	if (data->num_shards == 1)
+		return data->shards;
+
+	location *= 0x9E3779B97F4A7C15ULL;
+	return data->shards + (location >> 32) % data->num_shards;
+}
+
+/* drops a reference to an entry, with the shard locked */
+static void unref_entry(dr_shard_t *shard, dr_cache_entry_t *ent)
+{
+	if (ent->error != 0 && ent->refcount <= 1) {
+		dr_cache_discard(&shard->cache, ent);
+	} else {
+		dr_cache_release(&shard->cache, ent);
+	}
+}
+
+int precache_block(sqfs_data_reader_t *data, sqfs_u64 location,
+		   sqfs_u32 size, dr_cache_entry_t **out)
+{
+	dr_shard_t *shard = get_shard(data, location);
+	dr_cache_entry_t *ent;
+	int ret;
+
+	*out = NULL;
+	dr_lock(data, &shard->mtx);
+
+	ent = dr_cache_lookup(&shard->cache, location);
+	if (ent != NULL) {
+		ent->refcount += 1;
+
+		while (ent->loading)
+			dr_wait(data, shard);
+
+		ret = ent->error;
+		if (ret == 0) {
+			dr_count(data, cache_hits);
+			*out = ent;
+		} else {
+			unref_entry(shard, ent);
+		}
+
+		dr_unlock(data, &shard->mtx);
+		return ret;
+	}
+
+	dr_count(data, cache_misses);
+
+	ent = dr_cache_insert(&shard->cache, location);
+	if (ent == NULL) {
+		dr_unlock(data, &shard->mtx);
+		return SQFS_ERROR_ALLOC;
+	}
+
+	ent->refcount = 1;
+	ent->loading = true;
+	ent->error = 0;
+	dr_unlock(data, &shard->mtx);
+
+	ret = read_block(data, location, size, data->block_size,
+			 ent->data, &ent->size);
+
+	dr_lock(data, &shard->mtx);
+	ent->loading = false;
+
+	if (ret != 0) {
+		ent->error = ret;
+		unref_entry(shard, ent);
+	} else {
+		*out = ent;
+	}
+
+	dr_wake(data, shard);
+	dr_unlock(data, &shard->mtx);
+	return ret;
+}
+
+int precache_fragment_block(sqfs_data_reader_t *data, size_t idx,
+			    dr_cache_entry_t **out)
+{
+	sqfs_fragment_t ent;
+	int ret;
+
+	ret = sqfs_frag_table_lookup(data->frag_tbl, idx, &ent);
+	if (ret != 0)
+		return ret;
+
+	return precache_block(data, ent.start_offset, ent.size, out);
+}
+
+void dr_release_entry(sqfs_data_reader_t *data, dr_cache_entry_t *ent)
+{
+	dr_shard_t *shard = get_shard(data, ent->location);
+
+	dr_lock(data, &shard->mtx);
+	unref_entry(shard, ent);
+	dr_unlock(data, &shard->mtx);
+}
+
+dr_decoder_t *dr_get_decoder(sqfs_data_reader_t *data)
+{
+	dr_decoder_t *dec;
+
+	dr_lock(data, &data->mtx);
+	dec = data->decoders;
+	if (dec != NULL)
+		data->decoders = dec->next;
+	dr_unlock(data, &data->mtx);
+
+	if (dec != NULL)
+		return dec;
+
+	dec = alloc_flex(sizeof(*dec), 1, data->block_size);
+	if (dec == NULL)
+		return NULL;
+
+	/* a thread safe reader does not share its compressor */
+	if (data->flags & SQFS_DATA_READER_THREAD_SAFE) {
+		dec->cmp = sqfs_copy(data->cmp);
+	} else {
+		dec->cmp = sqfs_grab(data->cmp);
+	}
+
+	if (dec->cmp == NULL) {
+		free(dec);
+		return NULL;
+	}
+
+	return dec;
+}
+
+void dr_put_decoder(sqfs_data_reader_t *data, dr_decoder_t *dec)
+{
+	dr_lock(data, &data->mtx);
+	dec->next = data->decoders;
+	data->decoders = dec;
+	dr_unlock(data, &data->mtx);
+}
+
+/* splits the requested cache size up between the shards */
+static size_t shard_cache_size(const sqfs_data_reader_t *data, size_t count)
+{
+	return (count + data->num_shards - 1) / data->num_shards;
+}
+
+static void free_shards(sqfs_data_reader_t *data, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; ++i) {
+		dr_cache_cleanup(&data->shards[i].cache);
+#ifndef NO_THREAD_IMPL
+		if (data->flags & SQFS_DATA_READER_THREAD_SAFE) {
+			pthread_mutex_destroy(&data->shards[i].mtx);
+			pthread_cond_destroy(&data->shards[i].cond);
+		}
+#endif
+	}
+
+	free(data->shards);
+}
+
+static void data_reader_cleanup(sqfs_data_reader_t *data)
+{
+	dr_decoder_t *dec;
+
+	dr_read_ahead_cleanup(data);
+	dr_index_cleanup(data);
+
+	while (data->decoders != NULL) {
+		dec = data->decoders;
+		data->decoders = dec->next;
+
+		sqfs_drop(dec->cmp);
+		free(dec);
+	}
+
+	free_shards(data, data->num_shards);
+	dr_ptr_map_cleanup(&data->ptr_map);
+
+#ifndef NO_THREAD_IMPL
+	if (data->flags & SQFS_DATA_READER_THREAD_SAFE)
+		pthread_mutex_destroy(&data->mtx);
+#endif
+
+	sqfs_drop(data->cmp);
+	sqfs_drop(data->file);
+	sqfs_drop(data->frag_tbl);
+	free(data->zero_block);
+}
+
+static void data_reader_destroy(sqfs_object_t *obj)
+{
+	data_reader_cleanup((sqfs_data_reader_t *)obj);
+	free(obj);
+}
+
+static int data_reader_init(sqfs_data_reader_t *data, sqfs_file_t *file,
+			    size_t block_size, sqfs_compressor_t *cmp,
+			    sqfs_u32 flags, size_t cache_size)
+{
+	size_t i, count = 1;
+
+	data->file = sqfs_grab(file);
+	data->cmp = sqfs_grab(cmp);
+	data->block_size = block_size;
+	data->flags = flags;
+	data->cache_size = cache_size;
+	data->stats.size = sizeof(data->stats);
+
+	if (flags & SQFS_DATA_READER_THREAD_SAFE) {
+#ifdef NO_THREAD_IMPL
+		return SQFS_ERROR_UNSUPPORTED;
+#else
+		count = DR_SHARD_COUNT;
+		pthread_mutex_init(&data->mtx, NULL);
+
+		/* don't waste a block sized buffer on a race later */
+		data->zero_block = alloc_array(1, block_size);
+		if (data->zero_block == NULL)
+			return SQFS_ERROR_ALLOC;
+#endif
+	}
+
+	if (dr_ptr_map_init(&data->ptr_map, block_size,
+			    (flags & SQFS_DATA_READER_THREAD_SAFE) != 0)) {
+		return SQFS_ERROR_ALLOC;
+	}
+
+	data->shards = alloc_array(sizeof(data->shards[0]), count);
+	if (data->shards == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	data->num_shards = count;
+
+	for (i = 0; i < count; ++i) {
+		if (dr_cache_init(&data->shards[i].cache, &data->ptr_map,
+				  block_size, shard_cache_size(data, cache_size))) {
+			free_shards(data, i);
+			data->shards = NULL;
+			data->num_shards = 0;
+			return SQFS_ERROR_ALLOC;
+		}
+#ifndef NO_THREAD_IMPL
+		if (flags & SQFS_DATA_READER_THREAD_SAFE) {
+			pthread_mutex_init(&data->shards[i].mtx, NULL);
+			pthread_cond_init(&data->shards[i].cond, NULL);
+		}
+#endif
+	}
+
+	data->frag_tbl = sqfs_frag_table_create(0);
+	if (data->frag_tbl == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	return 0;
+}
+
+static sqfs_object_t *data_reader_copy(const sqfs_object_t *obj)
+{
+	const sqfs_data_reader_t *data = (const sqfs_data_reader_t *)obj;
+	sqfs_frag_table_t *frag_tbl;
+	sqfs_data_reader_t *copy;
+	sqfs_compressor_t *cmp;
+	sqfs_file_t *file;
+	int ret;
+
+	copy = calloc(1, sizeof(*copy));
+	if (copy == NULL)
+		return NULL;
+
+	sqfs_object_init(copy, data_reader_destroy, data_reader_copy);
+
+	/*
+	  The copy may be handed to a different thread, so it gets its own
+	  compressor and, if possible, its own file object. Files that cannot
+	  be copied are shared, so like with a thread safe reader, read_at
+	  has to support concurrent calls. The native implementation does,
+	  as it uses positional reads (pread, or ReadFile with an offset).
+	 */
+	cmp = sqfs_copy(data->cmp);
+	if (cmp == NULL)
+		goto fail;
+
+	file = sqfs_copy(data->file);
+	if (file == NULL)
+		file = sqfs_grab(data->file);
+
+	/* the copy starts out with an empty cache of the same size */
+	ret = data_reader_init(copy, file, data->block_size, cmp,
+			       data->flags, data->cache_size);
+	sqfs_drop(file);
+	sqfs_drop(cmp);
+
+	if (ret)
+		goto fail;
+
+	frag_tbl = sqfs_copy(data->frag_tbl);
+	if (frag_tbl == NULL)
+		goto fail;
+
+	sqfs_drop(copy->frag_tbl);
+	copy->frag_tbl = frag_tbl;
+
+	/* the read-ahead pool is recreated on demand */
+	copy->ra_workers = data->ra_workers;
+	copy->ra_blocks = data->ra_blocks;
+	return (sqfs_object_t *)copy;
+fail:
+	data_reader_destroy((sqfs_object_t *)copy);
+	return NULL;
+}
+
+sqfs_data_reader_t *sqfs_data_reader_create(sqfs_file_t *file,
+					    size_t block_size,
+					    sqfs_compressor_t *cmp,
+					    sqfs_u32 flags)
+{
+	sqfs_data_reader_t *data;
+
+	if (flags & ~SQFS_DATA_READER_ALL_FLAGS)
+		return NULL;
+
+	data = calloc(1, sizeof(*data));
+	if (data == NULL)
+		return NULL;
+
+	sqfs_object_init(data, data_reader_destroy, data_reader_copy);
+
+	if (data_reader_init(data, file, block_size, cmp, flags,
+			     DR_CACHE_DEFAULT_SIZE)) {
+		data_reader_destroy((sqfs_object_t *)data);
+		return NULL;
+	}
+
+	return data;
+}
+
+int sqfs_data_reader_set_cache_size(sqfs_data_reader_t *data, size_t count)
+{
+	size_t i, shard_size;
+	int ret = 0;
+
+	if (count == 0)
+		return SQFS_ERROR_ARG_INVALID;
+
+	shard_size = shard_cache_size(data, count);
+
+	for (i = 0; ret == 0 && i < data->num_shards; ++i) {
+		dr_lock(data, &data->shards[i].mtx);
+		ret = dr_cache_resize(&data->shards[i].cache, shard_size);
+		dr_unlock(data, &data->shards[i].mtx);
+	}
+
+	if (ret == 0)
+		data->cache_size = count;
+
+	return ret;
+}
+
+const sqfs_data_reader_stats_t
+*sqfs_data_reader_get_stats(const sqfs_data_reader_t *data)
+{
+	return &data->stats;
+}
+
+int sqfs_data_reader_load_fragment_table(sqfs_data_reader_t *data,
+					 const sqfs_super_t *super)
+{
+	return sqfs_frag_table_read(data->frag_tbl, data->file,
+				    super, data->cmp);
+}
+
+int sqfs_data_reader_borrow_block(sqfs_data_reader_t *data,
+				  const sqfs_inode_generic_t *inode,
+				  size_t index, size_t *size,
+				  const sqfs_u8 **out)
+{
+	dr_cache_entry_t *ent;
+	sqfs_u64 off, filesz;
+	size_t unpacked_size;
+	int ret;
+
+	*size = 0;
+	*out = NULL;
+
+	ret = dr_get_block_location(data, inode, index, &off);
+	if (ret != 0)
+		return ret;
+
+	sqfs_inode_get_file_size(inode, &filesz);
+
+	if ((sqfs_u64)index * data->block_size >= filesz)
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	filesz -= (sqfs_u64)index * data->block_size;
+	unpacked_size = filesz < data->block_size ? filesz : data->block_size;
+
+	if (SQFS_IS_SPARSE_BLOCK(inode->extra[index])) {
+		if (data->zero_block == NULL) {
+			data->zero_block = alloc_array(1, data->block_size);
+			if (data->zero_block == NULL)
+				return SQFS_ERROR_ALLOC;
+		}
+
+		*out = data->zero_block;
+		*size = unpacked_size;
+		return 0;
+	}
+
+	ret = precache_block(data, off, inode->extra[index], &ent);
+	if (ret != 0)
+		return ret;
+
+	if (ent->size > unpacked_size) {
+		dr_release_entry(data, ent);
+		return SQFS_ERROR_OVERFLOW;
+	}
+
+	*out = ent->data;
+	*size = ent->size;
+	return 0;
+}
+
+int sqfs_data_reader_borrow_fragment(sqfs_data_reader_t *data,
+				     const sqfs_inode_generic_t *inode,
+				     size_t *size, const sqfs_u8 **out)
+{
+	sqfs_u32 frag_idx, frag_off, frag_sz;
+	dr_cache_entry_t *ent;
+	size_t block_count;
+	sqfs_u64 filesz;
+	int err;
+
+	sqfs_inode_get_file_size(inode, &filesz);
+	sqfs_inode_get_frag_location(inode, &frag_idx, &frag_off);
+	*size = 0;
+	*out = NULL;
+
+	block_count = sqfs_inode_get_file_block_count(inode);
+
+	if (block_count > (UINT64_MAX / data->block_size))
+		return SQFS_ERROR_OVERFLOW;
+
+	if ((sqfs_u64)block_count * data->block_size >= filesz)
+		return 0;
+
+	frag_sz = filesz % data->block_size;
+
+	err = precache_fragment_block(data, frag_idx, &ent);
+	if (err)
+		return err;
+
+	if (frag_off + frag_sz > data->block_size) {
+		dr_release_entry(data, ent);
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+	}
+
+	*out = ent->data + frag_off;
+	*size = frag_sz;
+	return 0;
+}
+
+void sqfs_data_reader_release(sqfs_data_reader_t *data, const sqfs_u8 *ptr)
+{
+	dr_cache_entry_t *ent;
+	dr_shard_t *shard;
+
+	if (ptr == NULL || ptr == data->zero_block)
+		return;
+
+	/*
+	  The entry is still borrowed, so it cannot be recycled for a
+	  different location meanwhile.
+	 */
+	ent = dr_ptr_map_find(&data->ptr_map, ptr);
+	shard = get_shard(data, ent->location);
+
+	dr_lock(data, &shard->mtx);
+	unref_entry(shard, ent);
+	dr_unlock(data, &shard->mtx);
+}
+
+int sqfs_data_reader_get_block(sqfs_data_reader_t *data,
+			       const sqfs_inode_generic_t *inode,
+			       size_t index, size_t *size, sqfs_u8 **out)
+{
+	const sqfs_u8 *ptr;
+	int ret;
+
+	ret = sqfs_data_reader_borrow_block(data, inode, index, size, &ptr);
+	if (ret != 0)
+		return ret;
+
+	*out = alloc_array(1, *size);
+	if (*out != NULL)
+		memcpy(*out, ptr, *size);
+
+	sqfs_data_reader_release(data, ptr);
+	return *out == NULL ? SQFS_ERROR_ALLOC : 0;
+}
+
+int sqfs_data_reader_get_fragment(sqfs_data_reader_t *data,
+				  const sqfs_inode_generic_t *inode,
+				  size_t *size, sqfs_u8 **out)
+{
+	const sqfs_u8 *ptr;
+	int ret;
+
+	*out = NULL;
+
+	ret = sqfs_data_reader_borrow_fragment(data, inode, size, &ptr);
+	if (ret != 0 || ptr == NULL)
+		return ret;
+
+	*out = alloc_array(1, *size);
+	if (*out != NULL)
+		memcpy(*out, ptr, *size);
+
+	sqfs_data_reader_release(data, ptr);
+	return *out == NULL ? SQFS_ERROR_ALLOC : 0;
+}
+
+sqfs_s32 sqfs_data_reader_read(sqfs_data_reader_t *data,
+			       const sqfs_inode_generic_t *inode,
+			       sqfs_u64 offset, void *buffer, sqfs_u32 size)
+{
+	sqfs_u32 frag_idx, frag_off, diff, total = 0;
+	dr_cache_entry_t *ent;
+	size_t i, block_count;
+	sqfs_u64 off, filesz;
+	char *ptr;
+	int err;
+
+	if (size >= 0x7FFFFFFF)
+		size = 0x7FFFFFFE;
+
+	/* work out file location and size */
+	sqfs_inode_get_file_size(inode, &filesz);
+	sqfs_inode_get_frag_location(inode, &frag_idx, &frag_off);
+	sqfs_inode_get_file_block_start(inode, &off);
+	block_count = sqfs_inode_get_file_block_count(inode);
+
+	if (offset >= filesz)
+		return 0;
+
+	if ((filesz - offset) < (sqfs_u64)size)
+		size = filesz - offset;
+
+	if (size == 0)
+		return 0;
+
+	/* find location of the first block */
+	if ((offset / data->block_size) < block_count) {
+		i = offset / data->block_size;
+
+		err = dr_get_block_location(data, inode, i, &off);
+		if (err)
+			return err;
+
+		offset %= data->block_size;
+	} else {
+		i = block_count;
+		offset -= (sqfs_u64)block_count * data->block_size;
+	}
+
+	/* copy data from blocks */
+	while (i < block_count && size > 0) {
+		diff = data->block_size - offset;
+		if (size < diff)
+			diff = size;
+
+		if (SQFS_IS_SPARSE_BLOCK(inode->extra[i])) {
+			memset(buffer, 0, diff);
+		} else {
+			err = precache_block(data, off, inode->extra[i], &ent);
+			if (err)
+				return err;
+
+			memcpy(buffer, (char *)ent->data + offset, diff);
+			dr_release_entry(data, ent);
+			off += SQFS_ON_DISK_BLOCK_SIZE(inode->extra[i]);
+		}
+
+		++i;
+		offset = 0;
+		size -= diff;
+		total += diff;
+		buffer = (char *)buffer + diff;
+	}
+
+	/* copy from fragment */
+	if (size > 0) {
+		err = precache_fragment_block(data, frag_idx, &ent);
+		if (err)
+			return err;
+
+		if ((frag_off + offset) >= ent->size ||
+		    (ent->size - (frag_off + offset)) < size) {
+			dr_release_entry(data, ent);
+			return SQFS_ERROR_OUT_OF_BOUNDS;
+		}
+
+		ptr = (char *)ent->data + frag_off + offset;
+		memcpy(buffer, ptr, size);
+		dr_release_entry(data, ent);
+		total += size;
+	}
+
+	return total;
+}
@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * index.c
+ *
+ * Copyright (C) 2026 The squashfs-tools-ng contributors
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+static size_t index_slot(sqfs_u32 inode_number, sqfs_u64 start)
+{
+	sqfs_u64 key = ((sqfs_u64)inode_number << 32) ^ start;
+
+	key *= 0x9E3779B97F4A7C15ULL;
+
+	return (size_t)(key >> 32) % DR_INDEX_SLOTS;
+}
+
+/*
+  The size and block count are compared as well, in case the inodes
+  were not read from an image and the numbers are not unique.
+ */
+static bool index_matches(const dr_index_t *idx, sqfs_u32 inode_number,
+			  sqfs_u64 start, sqfs_u64 filesz, size_t count)
+{
+	return idx != NULL && idx->inode_number == inode_number &&
+		idx->blocks_start == start && idx->file_size == filesz &&
+		idx->count == count;
+}
+
+static dr_index_t *index_create(const sqfs_inode_generic_t *inode,
+				sqfs_u64 start, sqfs_u64 filesz, size_t count)
+{
+	dr_index_t *idx;
+	size_t i;
+
+	idx = alloc_flex(sizeof(*idx), sizeof(idx->offsets[0]), count);
+	if (idx == NULL)
+		return NULL;
+
+	idx->inode_number = inode->base.inode_number;
+	idx->blocks_start = start;
+	idx->file_size = filesz;
+	idx->count = count;
+
+	for (i = 0; i < count; ++i) {
+		idx->offsets[i] = start;
+		start += SQFS_ON_DISK_BLOCK_SIZE(inode->extra[i]);
+	}
+
+	return idx;
+}
+
+void dr_index_cleanup(sqfs_data_reader_t *data)
+{
+	size_t i;
+
+	for (i = 0; i < DR_INDEX_SLOTS; ++i) {
+		free(data->index[i]);
+		data->index[i] = NULL;
+	}
+}
+
+int dr_get_block_location(sqfs_data_reader_t *data,
+			  const sqfs_inode_generic_t *inode,
+			  size_t index, sqfs_u64 *out)
+{
+	sqfs_u64 start, filesz;
+	dr_index_t *idx, *old;
+	size_t i, count, slot;
+
+	sqfs_inode_get_file_block_start(inode, &start);
+	sqfs_inode_get_file_size(inode, &filesz);
+	count = sqfs_inode_get_file_block_count(inode);
+
+	if (index >= count)
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	/* for small files, simply adding up the sizes is cheaper */
+	if (count < DR_INDEX_MIN_BLOCKS) {
+		for (i = 0; i < index; ++i)
+			start += SQFS_ON_DISK_BLOCK_SIZE(inode->extra[i]);
+
+		*out = start;
+		return 0;
+	}
+
+	slot = index_slot(inode->base.inode_number, start);
+
+	dr_lock(data, &data->mtx);
+	idx = data->index[slot];
+
+	if (index_matches(idx, inode->base.inode_number, start,
+			  filesz, count)) {
+		*out = idx->offsets[index];
+		dr_unlock(data, &data->mtx);
+		return 0;
+	}
+	dr_unlock(data, &data->mtx);
+
+	/* build the table outside the lock, the slot may change meanwhile */
+	idx = index_create(inode, start, filesz, count);
+	if (idx == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	*out = idx->offsets[index];
+
+	dr_lock(data, &data->mtx);
+	old = data->index[slot];
+	data->index[slot] = idx;
+	dr_unlock(data, &data->mtx);
+
+	free(old);
+	return 0;
+}
@@ -0,0 +1,315 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * internal.h
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef DATA_READER_INTERNAL_H
+#define DATA_READER_INTERNAL_H
+
+#include "config.h"
+
+#include "sqfs/data_reader.h"
+#include "sqfs/compressor.h"
+#include "sqfs/frag_table.h"
+#include "sqfs/block.h"
+#include "sqfs/error.h"
+#include "sqfs/table.h"
+#include "sqfs/inode.h"
+#include "sqfs/io.h"
+#include "util/threadpool.h"
+#include "util/util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef NO_THREAD_IMPL
+#if defined(_WIN32) || defined(__WINDOWS__)
+#include "util/w32threadwrap.h"
+#else
+#include <pthread.h>
+#endif
+#endif
+
+/* Number of decompressed blocks cached by default. */
+#define DR_CACHE_DEFAULT_SIZE (8)
+
+/*
+  Number of independently locked cache shards of a thread safe reader.
+  A block always goes into the same shard, based on its location.
+ */
+#define DR_SHARD_COUNT (8)
+
+/*
+  An uncompressed data or fragment block, identified by its location
+  on disk. Entries are kept in a hash table for lookup and in a doubly
+  linked list, ordered from most to least recently used.
+
+  Entries that are borrowed by a user have a non-zero reference count and
+  are never recycled. If all entries are borrowed, the cache temporarily
+  grows beyond its maximum size and shrinks again as they are released.
+
+  The data buffer and the entry are allocated together, aligned to a cache
+  line, with the entry after the data. Every data buffer is also recorded
+  in a pointer map shared by all shards (see below), so the entry can be
+  found from any pointer into the data that is handed out to a user.
+ */
+typedef struct dr_cache_entry_t {
+	struct dr_cache_entry_t *lru_prev;
+	struct dr_cache_entry_t *lru_next;
+	struct dr_cache_entry_t *hash_next;
+
+	/* pointer map chains, for the first and the last slot of the data */
+	struct dr_cache_entry_t *ptr_next[2];
+
+	sqfs_u64 location;
+	size_t size;
+	size_t refcount;
+
+	/*
+	  Set while a thread is reading the block. Other threads that want
+	  the same block wait for it instead of decompressing it as well.
+	  If loading fails, the error code is stored for them.
+	 */
+	bool loading;
+	int error;
+
+	sqfs_u8 *data;
+} dr_cache_entry_t;
+
+/*
+  Files with at least this many blocks get a table with the on-disk
+  location of every block, so random reads do not have to add up all
+  the block sizes up to the one they want.
+
+  The tables are kept in a small direct mapped cache, keyed by the inode
+  number and the start of the blocks. Different files can share the
+  start, e.g. if they have the same data, but a different sparse layout,
+  but not the inode number. A table that is mapped to a slot that is
+  already in use replaces the one in there.
+ */
+#define DR_INDEX_MIN_BLOCKS (16)
+#define DR_INDEX_SLOTS (16)
+
+typedef struct {
+	sqfs_u32 inode_number;
+	sqfs_u64 blocks_start;
+	sqfs_u64 file_size;
+	size_t count;
+
+	sqfs_u64 offsets[];
+} dr_index_t;
+
+/* Alignment of the cache entry data buffers. */
+#define DR_DATA_ALIGN (64)
+
+/*
+  Maps pointers into the data buffers of cache entries back to the
+  entries. The address space is divided into slots of the block size,
+  rounded up to a power of two. A data buffer covers at most two slots
+  and is linked into the hash chains of both, so a lookup only has to
+  check the entries in the chain of the slot the pointer is in.
+
+  The map has its own lock, so a pointer can be resolved without knowing
+  which shard the entry belongs to.
+ */
+typedef struct {
+	dr_cache_entry_t **buckets;
+	size_t bucket_mask;
+	size_t count;
+
+	size_t block_size;
+	unsigned int slot_shift;
+
+	bool thread_safe;
+#ifndef NO_THREAD_IMPL
+	pthread_mutex_t mtx;
+#endif
+} dr_ptr_map_t;
+
+typedef struct {
+	dr_cache_entry_t **buckets;
+	size_t bucket_mask;
+
+	dr_ptr_map_t *ptr_map;
+
+	dr_cache_entry_t *lru_head;
+	dr_cache_entry_t *lru_tail;
+
+	size_t count;
+	size_t max_count;
+	size_t block_size;
+
+	/* offset of the entry behind the data buffer */
+	size_t entry_offset;
+} dr_cache_t;
+
+typedef struct {
+	dr_cache_t cache;
+#ifndef NO_THREAD_IMPL
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+#endif
+} dr_shard_t;
+
+/* A compressor and a block sized scratch buffer for compressed data. */
+typedef struct dr_decoder_t {
+	struct dr_decoder_t *next;
+
+	sqfs_compressor_t *cmp;
+
+	sqfs_u8 scratch[];
+} dr_decoder_t;
+
+struct sqfs_data_reader_t {
+	sqfs_object_t obj;
+
+	sqfs_frag_table_t *frag_tbl;
+	sqfs_compressor_t *cmp;
+	sqfs_file_t *file;
+
+	sqfs_u32 flags;
+
+	dr_ptr_map_t ptr_map;
+
+	/* a single shard, unless the reader is thread safe */
+	dr_shard_t *shards;
+	size_t num_shards;
+	size_t cache_size;
+
+	/*
+	  Unused decoders. A thread safe reader creates additional ones with
+	  a copy of the compressor, if all of them are in use.
+	 */
+	dr_decoder_t *decoders;
+
+	sqfs_data_reader_stats_t stats;
+
+	dr_index_t *index[DR_INDEX_SLOTS];
+
+	/*
+	  Worker pool for stream read-ahead, created when the first stream
+	  needs it. Each worker has its own copy of the compressor.
+	 */
+	thread_pool_t *ra_pool;
+	sqfs_compressor_t **ra_cmp;
+	size_t ra_workers;
+	size_t ra_blocks;
+	size_t ra_streams;
+
+	/* handed out when borrowing sparse blocks */
+	sqfs_u8 *zero_block;
+
+	sqfs_u32 block_size;
+
+#ifndef NO_THREAD_IMPL
+	/* protects the decoder list and the block location tables */
+	pthread_mutex_t mtx;
+#endif
+};
+
+#ifdef NO_THREAD_IMPL
+#define dr_lock(data, mtx) (void)0
+#define dr_unlock(data, mtx) (void)0
+#define dr_wait(data, shard) (void)0
+#define dr_wake(data, shard) (void)0
+#else
+#define dr_lock(data, mtx) \
+	do { \
+		if ((data)->flags & SQFS_DATA_READER_THREAD_SAFE) \
+			pthread_mutex_lock(mtx); \
+	} while (0)
+
+#define dr_unlock(data, mtx) \
+	do { \
+		if ((data)->flags & SQFS_DATA_READER_THREAD_SAFE) \
+			pthread_mutex_unlock(mtx); \
+	} while (0)
+
+#define dr_wait(data, shard) \
+	pthread_cond_wait(&(shard)->cond, &(shard)->mtx)
+
+#define dr_wake(data, shard) \
+	do { \
+		if ((data)->flags & SQFS_DATA_READER_THREAD_SAFE) \
+			pthread_cond_broadcast(&(shard)->cond); \
+	} while (0)
+#endif
+
+#define dr_count(data, counter) \
+	__atomic_add_fetch(&(data)->stats.counter, 1, __ATOMIC_RELAXED)
+
+SQFS_INTERNAL int dr_ptr_map_init(dr_ptr_map_t *map, size_t block_size,
+				  bool thread_safe);
+
+SQFS_INTERNAL void dr_ptr_map_cleanup(dr_ptr_map_t *map);
+
+/*
+  Finds the entry whose data buffer contains the given pointer. The entry
+  must be borrowed, so that it cannot be freed during the lookup.
+ */
+SQFS_INTERNAL dr_cache_entry_t *dr_ptr_map_find(dr_ptr_map_t *map,
+						const sqfs_u8 *ptr);
+
+SQFS_INTERNAL int dr_cache_init(dr_cache_t *cache, dr_ptr_map_t *map,
+				size_t block_size, size_t max_count);
+
+SQFS_INTERNAL void dr_cache_cleanup(dr_cache_t *cache);
+
+/* Keeps all entries, but drops unused ones if the new size is smaller. */
+SQFS_INTERNAL int dr_cache_resize(dr_cache_t *cache, size_t max_count);
+
+/* Looks up a block and marks it as most recently used. */
+SQFS_INTERNAL dr_cache_entry_t *dr_cache_lookup(dr_cache_t *cache,
+						sqfs_u64 location);
+
+/*
+  Returns an entry for a block that is not in the cache yet. If the cache
+  is full, the least recently used entry is recycled. The entry is already
+  inserted and marked as most recently used, but holds no data yet. If
+  filling it in fails, it has to be removed again with dr_cache_discard.
+ */
+SQFS_INTERNAL dr_cache_entry_t *dr_cache_insert(dr_cache_t *cache,
+						sqfs_u64 location);
+
+SQFS_INTERNAL void dr_cache_discard(dr_cache_t *cache,
+				    dr_cache_entry_t *ent);
+
+/* Drops a reference and shrinks the cache back to size if possible. */
+SQFS_INTERNAL void dr_cache_release(dr_cache_t *cache,
+				    dr_cache_entry_t *ent);
+
+/*
+  Get the on-disk location of a data block of a file, using a cached block
+  location table for large files.
+ */
+SQFS_INTERNAL int dr_get_block_location(sqfs_data_reader_t *data,
+					const sqfs_inode_generic_t *inode,
+					size_t index, sqfs_u64 *out);
+
+SQFS_INTERNAL void dr_index_cleanup(sqfs_data_reader_t *data);
+
+/*
+  Get a cache entry for a block, reading it from disk if necessary. The
+  entry is returned with an extra reference that has to be dropped with
+  dr_release_entry once it is no longer used.
+ */
+SQFS_INTERNAL int precache_block(sqfs_data_reader_t *data, sqfs_u64 location,
+				 sqfs_u32 size, dr_cache_entry_t **out);
+
+SQFS_INTERNAL int precache_fragment_block(sqfs_data_reader_t *data,
+					  size_t idx, dr_cache_entry_t **out);
+
+SQFS_INTERNAL void dr_release_entry(sqfs_data_reader_t *data,
+				    dr_cache_entry_t *ent);
+
+/* Get an unused decoder, NULL on allocation failure. */
+SQFS_INTERNAL dr_decoder_t *dr_get_decoder(sqfs_data_reader_t *data);
+
+SQFS_INTERNAL void dr_put_decoder(sqfs_data_reader_t *data,
+				  dr_decoder_t *dec);
+
+/* Shuts down the read-ahead worker pool, if there is one. */
+SQFS_INTERNAL void dr_read_ahead_cleanup(sqfs_data_reader_t *data);
+
+#endif /* DATA_READER_INTERNAL_H */
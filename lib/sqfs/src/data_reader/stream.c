@@ -0,0 +1,526 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * stream.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+/*
+  A data block that a stream reads ahead of its current position. The
+  compressed data is read by the thread that uses the stream, only the
+  decompression is handed off to the worker pool of the data reader.
+ */
+typedef struct {
+	sqfs_u8 *in;
+	sqfs_u8 *out;
+
+	sqfs_u32 in_size;
+	sqfs_u32 out_size;
+	sqfs_s32 result;
+
+	bool pending;
+} dr_ahead_t;
+
+typedef struct {
+	sqfs_istream_t base;
+
+	sqfs_data_reader_t *rd;
+	const char *filename;
+	const sqfs_u32 *blocks;
+
+	sqfs_u8 *buffer;
+	size_t buf_used;
+	size_t buf_off;
+
+	sqfs_u64 filesz;
+	sqfs_u64 disk_offset;
+
+	sqfs_u32 frag_idx;
+	sqfs_u32 frag_off;
+
+	sqfs_u32 blk_idx;
+	sqfs_u32 blk_count;
+
+	/* ring buffer of blocks read ahead, NULL if disabled */
+	dr_ahead_t *ahead;
+	size_t ahead_count;
+	size_t ahead_first;
+	size_t ahead_used;
+	sqfs_u32 ahead_idx;
+	sqfs_u64 ahead_filesz;
+
+	sqfs_u32 inodata[];
+} data_reader_istream_t;
+
+static int ra_worker(void *user, void *item)
+{
+	sqfs_compressor_t *cmp = user;
+	dr_ahead_t *blk = item;
+
+	/* the reader checks the result once it gets to this block */
+	blk->result = cmp->do_block(cmp, blk->in, blk->in_size,
+				    blk->out, blk->out_size);
+	return 0;
+}
+
+static int ra_pool_init(sqfs_data_reader_t *rd)
+{
+	size_t i, count;
+
+	rd->ra_pool = thread_pool_create(rd->ra_workers, ra_worker);
+	if (rd->ra_pool == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	count = rd->ra_pool->get_worker_count(rd->ra_pool);
+
+	rd->ra_cmp = alloc_array(sizeof(rd->ra_cmp[0]), count);
+	if (rd->ra_cmp == NULL)
+		goto fail;
+
+	for (i = 0; i < count; ++i) {
+		rd->ra_cmp[i] = sqfs_copy(rd->cmp);
+		if (rd->ra_cmp[i] == NULL)
+			goto fail;
+
+		rd->ra_pool->set_worker_ptr(rd->ra_pool, i, rd->ra_cmp[i]);
+	}
+
+	return 0;
+fail:
+	dr_read_ahead_cleanup(rd);
+	return SQFS_ERROR_ALLOC;
+}
+
+void dr_read_ahead_cleanup(sqfs_data_reader_t *data)
+{
+	size_t i, count;
+
+	if (data->ra_pool == NULL)
+		return;
+
+	count = data->ra_pool->get_worker_count(data->ra_pool);
+	data->ra_pool->destroy(data->ra_pool);
+	data->ra_pool = NULL;
+
+	if (data->ra_cmp != NULL) {
+		for (i = 0; i < count; ++i)
+			sqfs_drop(data->ra_cmp[i]);
+
+		free(data->ra_cmp);
+		data->ra_cmp = NULL;
+	}
+}
+
+int sqfs_data_reader_set_read_ahead(sqfs_data_reader_t *data,
+				    size_t num_workers, size_t num_blocks)
+{
+	if (data->flags & SQFS_DATA_READER_THREAD_SAFE)
+		return num_workers > 0 ? SQFS_ERROR_UNSUPPORTED : 0;
+
+	if (data->ra_streams > 0)
+		return SQFS_ERROR_SEQUENCE;
+
+	dr_read_ahead_cleanup(data);
+
+	if (num_workers > 0 && num_blocks == 0)
+		num_blocks = 2 * num_workers;
+
+	data->ra_workers = num_workers;
+	data->ra_blocks = num_workers > 0 ? num_blocks : 0;
+	return 0;
+}
+
+/*****************************************************************************/
+
+static int ra_fill(data_reader_istream_t *stream)
+{
+	sqfs_data_reader_t *rd = stream->rd;
+	sqfs_u32 blkword, disksz;
+	dr_ahead_t *blk;
+	size_t idx;
+	int ret;
+
+	while (stream->ahead_used < stream->ahead_count &&
+	       stream->ahead_idx < stream->blk_count &&
+	       stream->ahead_filesz > 0) {
+		idx = (stream->ahead_first + stream->ahead_used) %
+			stream->ahead_count;
+		blk = stream->ahead + idx;
+
+		blkword = stream->blocks[stream->ahead_idx];
+		disksz = SQFS_ON_DISK_BLOCK_SIZE(blkword);
+
+		if (disksz > rd->block_size)
+			return SQFS_ERROR_CORRUPTED;
+
+		blk->out_size = rd->block_size;
+		if (stream->ahead_filesz < (sqfs_u64)blk->out_size)
+			blk->out_size = stream->ahead_filesz;
+
+		blk->result = blk->out_size;
+
+		if (disksz == 0) {
+			memset(blk->out, 0, blk->out_size);
+		} else if (SQFS_IS_BLOCK_COMPRESSED(blkword)) {
+			ret = rd->file->read_at(rd->file, stream->disk_offset,
+						blk->in, disksz);
+			if (ret)
+				return ret;
+
+			blk->in_size = disksz;
+			blk->pending = true;
+
+			ret = rd->ra_pool->submit(rd->ra_pool, blk);
+			if (ret) {
+				blk->pending = false;
+				return ret;
+			}
+		} else {
+			ret = rd->file->read_at(rd->file, stream->disk_offset,
+						blk->out, disksz);
+			if (ret)
+				return ret;
+			if (disksz < blk->out_size) {
+				memset(blk->out + disksz, 0,
+				       blk->out_size - disksz);
+			}
+		}
+
+		stream->disk_offset += disksz;
+		stream->ahead_filesz -= blk->out_size;
+		stream->ahead_idx += 1;
+		stream->ahead_used += 1;
+	}
+
+	return 0;
+}
+
+static int ra_next_block(data_reader_istream_t *stream)
+{
+	sqfs_data_reader_t *rd = stream->rd;
+	dr_ahead_t *blk, *done;
+	sqfs_u8 *temp;
+	int ret;
+
+	ret = ra_fill(stream);
+	if (ret)
+		return ret;
+
+	if (stream->ahead_used == 0)
+		return SQFS_ERROR_CORRUPTED;
+
+	blk = stream->ahead + stream->ahead_first;
+
+	/*
+	  The pool is shared by all streams of the reader and hands items
+	  back in submission order, which may include those of other streams.
+	 */
+	while (blk->pending) {
+		done = rd->ra_pool->dequeue(rd->ra_pool);
+		if (done == NULL)
+			return SQFS_ERROR_INTERNAL;
+
+		done->pending = false;
+	}
+
+	if (blk->result <= 0)
+		return blk->result < 0 ? blk->result : SQFS_ERROR_OVERFLOW;
+
+	if ((size_t)blk->result < stream->buf_used) {
+		memset(blk->out + blk->result, 0,
+		       stream->buf_used - blk->result);
+	}
+
+	temp = stream->buffer;
+	stream->buffer = blk->out;
+	blk->out = temp;
+
+	stream->ahead_first = (stream->ahead_first + 1) % stream->ahead_count;
+	stream->ahead_used -= 1;
+
+	/* keep the workers busy while the caller processes this block */
+	return ra_fill(stream);
+}
+
+static int read_next_block(data_reader_istream_t *stream)
+{
+	sqfs_data_reader_t *rd = stream->rd;
+	sqfs_u32 blkword = stream->blocks[stream->blk_idx];
+	sqfs_u32 disksz = SQFS_ON_DISK_BLOCK_SIZE(blkword);
+	int ret;
+
+	if (disksz > rd->block_size)
+		return SQFS_ERROR_CORRUPTED;
+
+	if (disksz == 0) {
+		memset(stream->buffer, 0, stream->buf_used);
+	} else if (SQFS_IS_BLOCK_COMPRESSED(blkword)) {
+		dr_decoder_t *dec = dr_get_decoder(rd);
+
+		if (dec == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		ret = rd->file->read_at(rd->file, stream->disk_offset,
+					dec->scratch, disksz);
+		if (ret == 0) {
+			ret = dec->cmp->do_block(dec->cmp, dec->scratch,
+						 disksz, stream->buffer,
+						 stream->buf_used);
+		}
+
+		dr_put_decoder(rd, dec);
+
+		if (ret <= 0)
+			return ret < 0 ? ret : SQFS_ERROR_OVERFLOW;
+
+		if ((size_t)ret < stream->buf_used) {
+			memset(stream->buffer + ret, 0,
+			       stream->buf_used - ret);
+		}
+	} else {
+		ret = rd->file->read_at(rd->file, stream->disk_offset,
+					stream->buffer, disksz);
+		if (ret)
+			return ret;
+		if (disksz < stream->buf_used) {
+			memset(stream->buffer + disksz, 0,
+			       stream->buf_used - disksz);
+		}
+	}
+
+	stream->disk_offset += disksz;
+	return 0;
+}
+
+static int dr_stream_get_buffered_data(sqfs_istream_t *base,
+				       const sqfs_u8 **out,
+				       size_t *size, size_t want)
+{
+	data_reader_istream_t *stream = (data_reader_istream_t *)base;
+	sqfs_data_reader_t *rd = stream->rd;
+	int ret;
+	(void)want;
+
+	if (stream->buf_off < stream->buf_used) {
+		*out = stream->buffer + stream->buf_off;
+		*size = stream->buf_used - stream->buf_off;
+		return 0;
+	}
+
+	if (stream->filesz == 0) {
+		ret = 1;
+		goto fail;
+	}
+
+	stream->buf_off = 0;
+	stream->buf_used = rd->block_size;
+	if (stream->filesz < (sqfs_u64)stream->buf_used)
+		stream->buf_used = stream->filesz;
+
+	if (stream->blk_idx < stream->blk_count) {
+		if (stream->ahead != NULL) {
+			ret = ra_next_block(stream);
+		} else {
+			ret = read_next_block(stream);
+		}
+
+		if (ret)
+			goto fail;
+
+		stream->blk_idx += 1;
+	} else {
+		dr_cache_entry_t *ent;
+
+		ret = precache_fragment_block(rd, stream->frag_idx, &ent);
+		if (ret)
+			return ret;
+
+		if (ent->size < stream->frag_off ||
+		    (ent->size - stream->frag_off) < stream->buf_used) {
+			dr_release_entry(rd, ent);
+			ret = SQFS_ERROR_CORRUPTED;
+			goto fail;
+		}
+
+		memcpy(stream->buffer, ent->data + stream->frag_off,
+		       stream->buf_used);
+		dr_release_entry(rd, ent);
+	}
+
+	stream->filesz -= stream->buf_used;
+	*out = stream->buffer;
+	*size = stream->buf_used;
+	return 0;
+fail:
+	free(stream->buffer);
+	stream->buffer = NULL;
+	stream->buf_used = 0;
+	stream->buf_off = 0;
+	stream->filesz = 0;
+	*out = NULL;
+	*size = 0;
+	return ret;
+}
+
+static void dr_stream_advance_buffer(sqfs_istream_t *base, size_t count)
+{
+	data_reader_istream_t *stream = (data_reader_istream_t *)base;
+	size_t diff = stream->buf_used - stream->buf_off;
+
+	stream->buf_off += (diff < count ? diff : count);
+}
+
+static const char *dr_stream_get_filename(sqfs_istream_t *base)
+{
+	return ((data_reader_istream_t *)base)->filename;
+}
+
+static void ra_stream_cleanup(data_reader_istream_t *stream)
+{
+	sqfs_data_reader_t *rd = stream->rd;
+	dr_ahead_t *done;
+	size_t i;
+
+	/* wait for the workers to let go of our buffers */
+	for (i = 0; i < stream->ahead_count; ++i) {
+		while (stream->ahead[i].pending) {
+			done = rd->ra_pool->dequeue(rd->ra_pool);
+			if (done == NULL)
+				break;
+
+			done->pending = false;
+		}
+
+		free(stream->ahead[i].in);
+		free(stream->ahead[i].out);
+	}
+
+	free(stream->ahead);
+	stream->ahead = NULL;
+	rd->ra_streams -= 1;
+}
+
+static int ra_stream_init(data_reader_istream_t *stream)
+{
+	sqfs_data_reader_t *rd = stream->rd;
+	size_t i, count = rd->ra_blocks;
+	int ret;
+
+	if (rd->ra_pool == NULL) {
+		ret = ra_pool_init(rd);
+		if (ret)
+			return ret;
+	}
+
+	if (count > stream->blk_count)
+		count = stream->blk_count;
+
+	stream->ahead = alloc_array(sizeof(stream->ahead[0]), count);
+	if (stream->ahead == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	stream->ahead_count = count;
+	stream->ahead_filesz = stream->filesz;
+	rd->ra_streams += 1;
+
+	for (i = 0; i < count; ++i) {
+		stream->ahead[i].in = malloc(rd->block_size);
+		stream->ahead[i].out = malloc(rd->block_size);
+
+		if (stream->ahead[i].in == NULL ||
+		    stream->ahead[i].out == NULL) {
+			ra_stream_cleanup(stream);
+			return SQFS_ERROR_ALLOC;
+		}
+	}
+
+	return 0;
+}
+
+static void dr_stream_destroy(sqfs_object_t *obj)
+{
+	data_reader_istream_t *stream = (data_reader_istream_t *)obj;
+
+	if (stream->ahead != NULL)
+		ra_stream_cleanup(stream);
+
+	sqfs_drop(stream->rd);
+	free(stream->buffer);
+	free(stream);
+}
+
+int sqfs_data_reader_create_stream(sqfs_data_reader_t *data,
+				   const sqfs_inode_generic_t *inode,
+				   const char *filename, sqfs_istream_t **out)
+{
+	data_reader_istream_t *stream;
+	size_t ino_sz, namelen, sz;
+	sqfs_u64 filesz;
+	char *nameptr;
+	int ret;
+
+	*out = NULL;
+
+	ret = sqfs_inode_get_file_size(inode, &filesz);
+	if (ret != 0)
+		return ret;
+
+	ino_sz = inode->payload_bytes_used;
+	namelen = strlen(filename) + 1;
+
+	if (SZ_ADD_OV(ino_sz, namelen, &sz))
+		return SQFS_ERROR_ALLOC;
+	if (SZ_ADD_OV(sz, sizeof(*stream), &sz))
+		return SQFS_ERROR_ALLOC;
+
+	stream = calloc(1, sz);
+	if (stream == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	stream->buffer = malloc(data->block_size);
+	if (stream->buffer == NULL) {
+		free(stream);
+		return SQFS_ERROR_ALLOC;
+	}
+
+	sqfs_object_init(stream, dr_stream_destroy, NULL);
+
+	memcpy(stream->inodata, inode->extra, ino_sz);
+	stream->blocks = stream->inodata;
+	stream->blk_count = ino_sz / sizeof(stream->blocks[0]);
+	stream->filesz = filesz;
+
+	nameptr = (char *)stream->inodata + ino_sz;
+	memcpy(nameptr, filename, namelen);
+	stream->filename = nameptr;
+
+	sqfs_inode_get_file_block_start(inode, &stream->disk_offset);
+	sqfs_inode_get_frag_location(inode, &stream->frag_idx,
+				     &stream->frag_off);
+	stream->rd = sqfs_grab(data);
+
+	/*
+	  Start right away, even for a single block. The caller may open
+	  streams for upcoming files while still busy with a previous one.
+	 */
+	if (data->ra_workers > 0 && stream->blk_count > 0) {
+		ret = ra_stream_init(stream);
+		if (ret == 0)
+			ret = ra_fill(stream);
+
+		if (ret) {
+			sqfs_drop(stream);
+			return ret;
+		}
+	}
+
+	((sqfs_istream_t *)stream)->advance_buffer = dr_stream_advance_buffer;
+	((sqfs_istream_t *)stream)->get_filename = dr_stream_get_filename;
+	((sqfs_istream_t *)stream)->get_buffered_data =
+		dr_stream_get_buffered_data;
+
+	*out = (sqfs_istream_t *)stream;
+	return 0;
+}
@@ -28,6 +28,7 @@ typedef struct {
 	sqfs_u32 xattr_idx;
 	sqfs_inode_generic_t *inode;
 	sqfs_dir_node_t *dent;
+	size_t dent_size;
 
 	sqfs_xattr_reader_t *xattr;
 	sqfs_data_reader_t *data;
@@ -42,11 +43,10 @@ static int it_next(sqfs_dir_iterator_t *base, sqfs_dir_entry_t **out)
 	int ret;
 
 	sqfs_free(it->inode);
-	sqfs_free(it->dent);
 	it->inode = NULL;
-	it->dent = NULL;
 
-	ret = sqfs_dir_reader_read(it->rd, &it->state, &it->dent);
+	ret = sqfs_dir_reader_read_buffered(it->rd, &it->state, &it->dent,
+					    &it->dent_size);
 	if (ret != 0)
 		return ret;
 
@@ -67,10 +67,8 @@ static int it_next(sqfs_dir_iterator_t *base, sqfs_dir_entry_t **out)
 	return 0;
 fail:
 	sqfs_free(it->inode);
-	sqfs_free(it->dent);
 	sqfs_free(ent);
 	it->inode = NULL;
-	it->dent = NULL;
 	return ret;
 }
 
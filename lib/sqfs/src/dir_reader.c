@@ -5,18 +5,29 @@
  * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
  */
 #define SQFS_BUILDING_DLL
+#include "config.h"
+
 #include "sqfs/meta_reader.h"
 #include "sqfs/dir_reader.h"
 #include "sqfs/super.h"
+#include "sqfs/block.h"
 #include "sqfs/inode.h"
 #include "sqfs/error.h"
+#include "sqfs/table.h"
 #include "sqfs/dir.h"
 #include "util/rbtree.h"
 #include "util/util.h"
+#include "compat.h"
 
 #include <string.h>
 #include <stdlib.h>
 
+/* Number of meta data blocks cached, shared by inode & directory table */
+#define META_CACHE_SIZE (32)
+
+/* Number of path components remembered with SQFS_DIR_READER_DENTRY_CACHE */
+#define DENTRY_CACHE_SIZE (4096)
+
 enum {
 	DIR_STATE_NONE = 0,
 	DIR_STATE_OPENED = 1,
@@ -24,18 +35,249 @@ enum {
 	DIR_STATE_ENTRIES = 3,
 };
 
+/*
+  A path component that was resolved before, i.e. the name of an entry in
+  a directory with a known inode reference. Entries are kept in a hash
+  table for lookup and in a doubly linked list, ordered from most to least
+  recently used.
+ */
+typedef struct dentry_t {
+	struct dentry_t *lru_prev;
+	struct dentry_t *lru_next;
+	struct dentry_t *hash_next;
+
+	sqfs_u64 parent_ref;
+	sqfs_u64 ref;
+	sqfs_u32 hash;
+	size_t len;
+
+	char name[];
+} dentry_t;
+
+typedef struct {
+	dentry_t **buckets;
+	size_t bucket_mask;
+
+	dentry_t *lru_head;
+	dentry_t *lru_tail;
+
+	size_t count;
+} dentry_cache_t;
+
 struct sqfs_dir_reader_t {
 	sqfs_object_t base;
 
 	sqfs_meta_reader_t *meta_dir;
 	sqfs_meta_reader_t *meta_inode;
+	sqfs_meta_cache_t *cache;
 	sqfs_super_t super;
 
 	sqfs_u32 flags;
 
 	rbtree_t dcache;
+
+	dentry_cache_t dentries;
+
+	/*
+	  Inode references indexed by inode number - 1, if the reader has
+	  the SQFS_DIR_READER_INODE_INDEX flag set. References are stored
+	  plus one, so zero means unknown. The file and compressor are
+	  kept around for loading the export table.
+	 */
+	sqfs_u64 *inode_refs;
+	bool export_loaded;
+	sqfs_compressor_t *cmp;
+	sqfs_file_t *file;
 };
 
+static void inode_index_add(sqfs_dir_reader_t *rd, sqfs_u32 inum,
+			    sqfs_u64 ref)
+{
+	if (rd->inode_refs != NULL && inum >= 1 &&
+	    inum <= rd->super.inode_count) {
+		rd->inode_refs[inum - 1] = ref + 1;
+	}
+}
+
+static int inode_index_load_export(sqfs_dir_reader_t *rd)
+{
+	sqfs_u64 *raw, ref;
+	size_t i, size;
+	int ret;
+
+	/* only try this once, even if it fails */
+	rd->export_loaded = true;
+
+	if (!(rd->super.flags & SQFS_FLAG_EXPORTABLE))
+		return 0;
+
+	if (SZ_MUL_OV(rd->super.inode_count, sizeof(raw[0]), &size))
+		return SQFS_ERROR_OVERFLOW;
+
+	ret = sqfs_read_table(rd->file, rd->cmp, size,
+			      rd->super.export_table_start,
+			      rd->super.directory_table_start,
+			      rd->super.export_table_start, (void **)&raw);
+	if (ret)
+		return ret;
+
+	/* unused inode numbers are set to all ones, which wraps to zero */
+	for (i = 0; i < rd->super.inode_count; ++i) {
+		ref = le64toh(raw[i]);
+		rd->inode_refs[i] = ref + 1;
+	}
+
+	free(raw);
+	return 0;
+}
+
+static void inode_index_cleanup(sqfs_dir_reader_t *rd)
+{
+	free(rd->inode_refs);
+	sqfs_drop(rd->cmp);
+	sqfs_drop(rd->file);
+}
+
+static sqfs_u32 dentry_hash(sqfs_u64 parent_ref, const char *name, size_t len)
+{
+	parent_ref *= 0x9E3779B97F4A7C15ULL;
+
+	return xxh32(name, len) ^ (sqfs_u32)(parent_ref >> 32);
+}
+
+static void dentry_unlink(dentry_cache_t *cache, dentry_t *ent)
+{
+	dentry_t **it;
+
+	if (ent->lru_prev == NULL) {
+		cache->lru_head = ent->lru_next;
+	} else {
+		ent->lru_prev->lru_next = ent->lru_next;
+	}
+
+	if (ent->lru_next == NULL) {
+		cache->lru_tail = ent->lru_prev;
+	} else {
+		ent->lru_next->lru_prev = ent->lru_prev;
+	}
+
+	it = cache->buckets + (ent->hash & cache->bucket_mask);
+
+	while (*it != NULL && *it != ent)
+		it = &((*it)->hash_next);
+
+	if (*it != NULL)
+		*it = ent->hash_next;
+
+	ent->lru_prev = ent->lru_next = ent->hash_next = NULL;
+}
+
+static void dentry_link(dentry_cache_t *cache, dentry_t *ent)
+{
+	size_t idx = ent->hash & cache->bucket_mask;
+
+	ent->hash_next = cache->buckets[idx];
+	cache->buckets[idx] = ent;
+
+	ent->lru_prev = NULL;
+	ent->lru_next = cache->lru_head;
+
+	if (cache->lru_head == NULL) {
+		cache->lru_tail = ent;
+	} else {
+		cache->lru_head->lru_prev = ent;
+	}
+
+	cache->lru_head = ent;
+}
+
+static int dentry_cache_init(dentry_cache_t *cache)
+{
+	size_t count = 1;
+
+	memset(cache, 0, sizeof(*cache));
+
+	while (count < 2 * DENTRY_CACHE_SIZE)
+		count <<= 1;
+
+	cache->buckets = alloc_array(sizeof(cache->buckets[0]), count);
+	if (cache->buckets == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	cache->bucket_mask = count - 1;
+	return 0;
+}
+
+static void dentry_cache_cleanup(dentry_cache_t *cache)
+{
+	dentry_t *ent;
+
+	while (cache->lru_head != NULL) {
+		ent = cache->lru_head;
+		cache->lru_head = ent->lru_next;
+		free(ent);
+	}
+
+	free(cache->buckets);
+	memset(cache, 0, sizeof(*cache));
+}
+
+static bool dentry_lookup(dentry_cache_t *cache, sqfs_u64 parent_ref,
+			  const char *name, size_t len, sqfs_u64 *ref)
+{
+	sqfs_u32 hash = dentry_hash(parent_ref, name, len);
+	dentry_t *ent;
+
+	ent = cache->buckets[hash & cache->bucket_mask];
+
+	while (ent != NULL) {
+		if (ent->hash == hash && ent->parent_ref == parent_ref &&
+		    ent->len == len && memcmp(ent->name, name, len) == 0) {
+			break;
+		}
+
+		ent = ent->hash_next;
+	}
+
+	if (ent == NULL)
+		return false;
+
+	if (ent != cache->lru_head) {
+		dentry_unlink(cache, ent);
+		dentry_link(cache, ent);
+	}
+
+	*ref = ent->ref;
+	return true;
+}
+
+/* failing to remember a lookup result is not an error */
+static void dentry_add(dentry_cache_t *cache, sqfs_u64 parent_ref,
+		       const char *name, size_t len, sqfs_u64 ref)
+{
+	dentry_t *ent;
+
+	if (cache->count >= DENTRY_CACHE_SIZE) {
+		ent = cache->lru_tail;
+		dentry_unlink(cache, ent);
+		free(ent);
+		cache->count -= 1;
+	}
+
+	ent = alloc_flex(sizeof(*ent), 1, len);
+	if (ent == NULL)
+		return;
+
+	ent->parent_ref = parent_ref;
+	ent->ref = ref;
+	ent->hash = dentry_hash(parent_ref, name, len);
+	ent->len = len;
+	memcpy(ent->name, name, len);
+
+	dentry_link(cache, ent);
+	cache->count += 1;
+}
+
 static int dcache_key_compare(const void *ctx, const void *l, const void *r)
 {
 	sqfs_u32 lhs = *((const sqfs_u32 *)l), rhs = *((const sqfs_u32 *)r);
@@ -70,8 +312,15 @@ static void dir_reader_destroy(sqfs_object_t *obj)
 	if (rd->flags & SQFS_DIR_READER_DOT_ENTRIES)
 		rbtree_cleanup(&rd->dcache);
 
+	if (rd->flags & SQFS_DIR_READER_DENTRY_CACHE)
+		dentry_cache_cleanup(&rd->dentries);
+
+	if (rd->flags & SQFS_DIR_READER_INODE_INDEX)
+		inode_index_cleanup(rd);
+
 	sqfs_drop(rd->meta_inode);
 	sqfs_drop(rd->meta_dir);
+	sqfs_drop(rd->cache);
 	free(rd);
 }
 
@@ -90,6 +339,25 @@ static sqfs_object_t *dir_reader_copy(const sqfs_object_t *obj)
 			goto fail_cache;
 	}
 
+	/* the copy starts out with an empty dentry cache */
+	if (rd->flags & SQFS_DIR_READER_DENTRY_CACHE) {
+		if (dentry_cache_init(&copy->dentries))
+			goto fail_dentries;
+	}
+
+	if (rd->flags & SQFS_DIR_READER_INODE_INDEX) {
+		copy->inode_refs = alloc_array(sizeof(rd->inode_refs[0]),
+					       rd->super.inode_count);
+		if (copy->inode_refs == NULL)
+			goto fail_index;
+
+		memcpy(copy->inode_refs, rd->inode_refs,
+		       rd->super.inode_count * sizeof(rd->inode_refs[0]));
+
+		copy->cmp = sqfs_grab(rd->cmp);
+		copy->file = sqfs_grab(rd->file);
+	}
+
 	copy->meta_inode = sqfs_copy(rd->meta_inode);
 	if (copy->meta_inode == NULL)
 		goto fail_mino;
@@ -98,10 +366,25 @@ static sqfs_object_t *dir_reader_copy(const sqfs_object_t *obj)
 	if (copy->meta_dir == NULL)
 		goto fail_mdir;
 
+	/* the copy gets a cache of its own */
+	copy->cache = sqfs_copy(rd->cache);
+	if (copy->cache == NULL)
+		goto fail_cache_copy;
+
+	sqfs_meta_reader_set_cache(copy->meta_inode, copy->cache);
+	sqfs_meta_reader_set_cache(copy->meta_dir, copy->cache);
 	return (sqfs_object_t *)copy;
+fail_cache_copy:
+	sqfs_drop(copy->meta_dir);
 fail_mdir:
 	sqfs_drop(copy->meta_inode);
 fail_mino:
+	if (copy->flags & SQFS_DIR_READER_INODE_INDEX)
+		inode_index_cleanup(copy);
+fail_index:
+	if (copy->flags & SQFS_DIR_READER_DENTRY_CACHE)
+		dentry_cache_cleanup(&copy->dentries);
+fail_dentries:
 	if (copy->flags & SQFS_DIR_READER_DOT_ENTRIES)
 		rbtree_cleanup(&copy->dcache);
 fail_cache:
@@ -135,6 +418,21 @@ sqfs_dir_reader_t *sqfs_dir_reader_create(const sqfs_super_t *super,
 			goto fail_dcache;
 	}
 
+	if (flags & SQFS_DIR_READER_DENTRY_CACHE) {
+		if (dentry_cache_init(&rd->dentries))
+			goto fail_dentries;
+	}
+
+	if (flags & SQFS_DIR_READER_INODE_INDEX) {
+		rd->inode_refs = alloc_array(sizeof(rd->inode_refs[0]),
+					     super->inode_count);
+		if (rd->inode_refs == NULL)
+			goto fail_index;
+
+		rd->cmp = sqfs_grab(cmp);
+		rd->file = sqfs_grab(file);
+	}
+
 	start = super->inode_table_start;
 	limit = super->directory_table_start;
 
@@ -155,12 +453,27 @@ sqfs_dir_reader_t *sqfs_dir_reader_create(const sqfs_super_t *super,
 	if (rd->meta_dir == NULL)
 		goto fail_mdir;
 
+	rd->cache = sqfs_meta_cache_create(META_CACHE_SIZE);
+	if (rd->cache == NULL)
+		goto fail_cache;
+
+	sqfs_meta_reader_set_cache(rd->meta_inode, rd->cache);
+	sqfs_meta_reader_set_cache(rd->meta_dir, rd->cache);
+
 	rd->super = *super;
 	rd->flags = flags;
 	return rd;
+fail_cache:
+	sqfs_drop(rd->meta_dir);
 fail_mdir:
 	sqfs_drop(rd->meta_inode);
 fail_mino:
+	if (flags & SQFS_DIR_READER_INODE_INDEX)
+		inode_index_cleanup(rd);
+fail_index:
+	if (flags & SQFS_DIR_READER_DENTRY_CACHE)
+		dentry_cache_cleanup(&rd->dentries);
+fail_dentries:
 	if (flags & SQFS_DIR_READER_DOT_ENTRIES)
 		rbtree_cleanup(&rd->dcache);
 fail_dcache:
@@ -168,6 +481,12 @@ fail_dcache:
 	return NULL;
 }
 
+const sqfs_meta_cache_stats_t
+*sqfs_dir_reader_get_cache_stats(const sqfs_dir_reader_t *rd)
+{
+	return sqfs_meta_cache_get_stats(rd->cache);
+}
+
 int sqfs_dir_reader_open_dir(sqfs_dir_reader_t *rd,
 			     const sqfs_inode_generic_t *inode,
 			     sqfs_dir_reader_state_t *state,
@@ -213,15 +532,26 @@ int sqfs_dir_reader_open_dir(sqfs_dir_reader_t *rd,
 	return 0;
 }
 
-static int mk_dummy_entry(const char *str, sqfs_dir_node_t **out)
+static int mk_dummy_entry(const char *str, sqfs_dir_node_t **out,
+			  size_t *size)
 {
-	size_t len = strlen(str);
+	size_t len = strlen(str), needed = sizeof(sqfs_dir_node_t) + len + 1;
 	sqfs_dir_node_t *ent;
 
-	ent = calloc(1, sizeof(sqfs_dir_node_t) + len + 1);
+	if (size == NULL) {
+		ent = malloc(needed);
+	} else if (*out == NULL || *size < needed) {
+		ent = realloc(*out, needed);
+		if (ent != NULL)
+			*size = needed;
+	} else {
+		ent = *out;
+	}
+
 	if (ent == NULL)
 		return SQFS_ERROR_ALLOC;
 
+	memset(ent, 0, sizeof(*ent));
 	ent->type = SQFS_INODE_DIR;
 	ent->size = len - 1;
 
@@ -231,21 +561,22 @@ static int mk_dummy_entry(const char *str, sqfs_dir_node_t **out)
 	return 0;
 }
 
-int sqfs_dir_reader_read(sqfs_dir_reader_t *rd, sqfs_dir_reader_state_t *state,
-			 sqfs_dir_node_t **out)
+static int read_impl(sqfs_dir_reader_t *rd, sqfs_dir_reader_state_t *state,
+		     sqfs_dir_node_t **out, size_t *size)
 {
+	sqfs_u32 inum;
 	int err;
 
 	switch (state->state) {
 	case DIR_STATE_OPENED:
-		err = mk_dummy_entry(".", out);
+		err = mk_dummy_entry(".", out, size);
 		if (err == 0) {
 			state->state = DIR_STATE_DOT;
 			state->ent_ref = state->dir_ref;
 		}
 		return err;
 	case DIR_STATE_DOT:
-		err = mk_dummy_entry("..", out);
+		err = mk_dummy_entry("..", out, size);
 		if (err == 0) {
 			state->state = DIR_STATE_ENTRIES;
 			state->ent_ref = state->parent_ref;
@@ -257,8 +588,33 @@ int sqfs_dir_reader_read(sqfs_dir_reader_t *rd, sqfs_dir_reader_state_t *state,
 		return SQFS_ERROR_SEQUENCE;
 	}
 
-	return sqfs_meta_reader_readdir(rd->meta_dir, &state->cursor,
-					out, NULL, &state->ent_ref);
+	if (size == NULL) {
+		err = sqfs_meta_reader_readdir(rd->meta_dir, &state->cursor,
+					       out, &inum, &state->ent_ref);
+	} else {
+		err = sqfs_meta_reader_readdir_buffered(rd->meta_dir,
+							&state->cursor,
+							out, size, &inum,
+							&state->ent_ref);
+	}
+
+	if (err == 0)
+		inode_index_add(rd, inum, state->ent_ref);
+
+	return err;
+}
+
+int sqfs_dir_reader_read(sqfs_dir_reader_t *rd, sqfs_dir_reader_state_t *state,
+			 sqfs_dir_node_t **out)
+{
+	return read_impl(rd, state, out, NULL);
+}
+
+int sqfs_dir_reader_read_buffered(sqfs_dir_reader_t *rd,
+				  sqfs_dir_reader_state_t *state,
+				  sqfs_dir_node_t **out, size_t *size)
+{
+	return read_impl(rd, state, out, size);
 }
 
 int sqfs_dir_reader_get_inode(sqfs_dir_reader_t *rd, sqfs_u64 ref,
@@ -271,6 +627,7 @@ int sqfs_dir_reader_get_inode(sqfs_dir_reader_t *rd, sqfs_u64 ref,
 	if (ret != 0)
 		return ret;
 
+	inode_index_add(rd, (*inode)->base.inode_number, ref);
 	return dcache_add(rd, *inode, ref);
 }
 
@@ -284,8 +641,24 @@ int sqfs_dir_reader_resolve_inum(sqfs_dir_reader_t *rd,
 				 sqfs_u32 inode, sqfs_u64 *ref)
 {
 	rbtree_node_t *node;
+	int ret;
 
 	*ref = 0;
+
+	if (rd->inode_refs != NULL && inode >= 1 &&
+	    inode <= rd->super.inode_count) {
+		if (rd->inode_refs[inode - 1] == 0 && !rd->export_loaded) {
+			ret = inode_index_load_export(rd);
+			if (ret)
+				return ret;
+		}
+
+		if (rd->inode_refs[inode - 1] != 0) {
+			*ref = rd->inode_refs[inode - 1] - 1;
+			return 0;
+		}
+	}
+
 	if (!(rd->flags & SQFS_DIR_READER_DOT_ENTRIES))
 		return SQFS_ERROR_NO_ENTRY;
 
@@ -297,14 +670,243 @@ int sqfs_dir_reader_resolve_inum(sqfs_dir_reader_t *rd,
 	return 0;
 }
 
+/*
+  Compare the name of a directory entry against a path component, while
+  consuming it from the meta data reader. The name is read in small chunks,
+  so long names do not need an allocation.
+ */
+static int compare_name(sqfs_meta_reader_t *m, size_t size,
+			const char *name, size_t len, int *result)
+{
+	sqfs_u8 buffer[64];
+	size_t i, diff;
+	int ret;
+
+	*result = 0;
+
+	for (i = 0; i < size; i += diff) {
+		diff = size - i;
+		if (diff > sizeof(buffer))
+			diff = sizeof(buffer);
+
+		ret = sqfs_meta_reader_read(m, buffer, diff);
+		if (ret)
+			return ret;
+
+		if (*result == 0 && i < len) {
+			*result = memcmp(buffer, name + i,
+					 diff < (len - i) ? diff : (len - i));
+		}
+	}
+
+	if (*result == 0)
+		*result = size < len ? -1 : (size > len ? 1 : 0);
+
+	return 0;
+}
+
+static int compare_index_name(const sqfs_u8 *ptr, size_t size,
+			      const char *name, size_t len)
+{
+	int ret = memcmp(ptr, name, size < len ? size : len);
+
+	if (ret == 0)
+		ret = size < len ? -1 : (size > len ? 1 : 0);
+
+	return ret;
+}
+
+/*
+  Use the index of an extended directory inode to find the last header
+  whose first entry is not greater than the name we are looking for, and
+  point the directory state at that header.
+ */
+static int dir_index_seek(const sqfs_dir_reader_t *rd,
+			  const sqfs_inode_generic_t *inode,
+			  const char *name, size_t len,
+			  sqfs_readdir_state_t *state)
+{
+	const sqfs_u8 *ptr = (const sqfs_u8 *)inode->extra;
+	sqfs_u32 index = 0, block = 0;
+	size_t i, offset = 0;
+	sqfs_dir_index_t ent;
+
+	if (inode->base.type != SQFS_INODE_EXT_DIR)
+		return 0;
+
+	for (i = 0; i < inode->data.dir_ext.inodex_count; ++i) {
+		if (sizeof(ent) > (inode->payload_bytes_used - offset))
+			break;
+
+		memcpy(&ent, ptr + offset, sizeof(ent));
+		offset += sizeof(ent);
+
+		if ((size_t)ent.size + 1 > (inode->payload_bytes_used - offset))
+			return SQFS_ERROR_CORRUPTED;
+
+		if (compare_index_name(ptr + offset, ent.size + 1,
+				       name, len) > 0) {
+			break;
+		}
+
+		offset += ent.size + 1;
+		index = ent.index;
+		block = ent.start_block;
+	}
+
+	if (index == 0)
+		return 0;
+
+	if (index >= state->size)
+		return SQFS_ERROR_CORRUPTED;
+
+	state->block = rd->super.directory_table_start + block;
+	state->offset = (state->offset + index) % SQFS_META_BLOCK_SIZE;
+	state->size -= index;
+	return 0;
+}
+
+/*
+  Find an entry in a directory. Entries are sorted by name, so the search
+  can start at the header indicated by the directory index and stop as
+  soon as an entry with a greater name is encountered.
+ */
+static int find_entry(sqfs_dir_reader_t *rd,
+		      const sqfs_inode_generic_t *inode,
+		      const char *name, size_t len, sqfs_u64 *out)
+{
+	sqfs_readdir_state_t state;
+	sqfs_dir_header_t hdr;
+	sqfs_dir_node_t ent;
+	int ret, diff;
+	size_t count;
+
+	ret = sqfs_readdir_state_init(&state, &rd->super, inode);
+	if (ret)
+		return ret;
+
+	ret = dir_index_seek(rd, inode, name, len, &state);
+	if (ret)
+		return ret;
+
+	if (state.size <= sizeof(hdr))
+		return SQFS_ERROR_NO_ENTRY;
+
+	ret = sqfs_meta_reader_seek(rd->meta_dir, state.block, state.offset);
+	if (ret)
+		return ret;
+
+	while (state.size > sizeof(hdr)) {
+		ret = sqfs_meta_reader_read_dir_header(rd->meta_dir, &hdr);
+		if (ret)
+			return ret;
+
+		state.size -= sizeof(hdr);
+
+		for (count = hdr.count + 1; count > 0; --count) {
+			if (state.size <= sizeof(ent))
+				return SQFS_ERROR_NO_ENTRY;
+
+			ret = sqfs_meta_reader_read(rd->meta_dir, &ent,
+						    sizeof(ent));
+			if (ret)
+				return ret;
+
+			ent.offset = le16toh(ent.offset);
+			ent.size = le16toh(ent.size);
+
+			state.size -= sizeof(ent);
+			if ((size_t)ent.size + 1 >= state.size) {
+				state.size = 0;
+			} else {
+				state.size -= ent.size + 1;
+			}
+
+			ret = compare_name(rd->meta_dir, ent.size + 1,
+					   name, len, &diff);
+			if (ret)
+				return ret;
+
+			if (diff == 0) {
+				*out = (sqfs_u64)hdr.start_block << 16;
+				*out |= ent.offset;
+				return 0;
+			}
+
+			if (diff > 0)
+				return SQFS_ERROR_NO_ENTRY;
+		}
+	}
+
+	return SQFS_ERROR_NO_ENTRY;
+}
+
+static bool is_dot_entry(const char *name, size_t len)
+{
+	return name[0] == '.' && (len == 1 || (len == 2 && name[1] == '.'));
+}
+
+static int lookup_component(sqfs_dir_reader_t *rd,
+			    const sqfs_inode_generic_t *inode,
+			    const char *name, size_t len, sqfs_u64 *out)
+{
+	sqfs_dir_reader_state_t state;
+	int ret;
+
+	if ((rd->flags & SQFS_DIR_READER_DOT_ENTRIES) &&
+	    is_dot_entry(name, len)) {
+		ret = sqfs_dir_reader_open_dir(rd, inode, &state, 0);
+		if (ret)
+			return ret;
+
+		*out = len == 1 ? state.dir_ref : state.parent_ref;
+		return 0;
+	}
+
+	return find_entry(rd, inode, name, len, out);
+}
+
+/*
+  Look up a path component in the directory that ref points to and replace
+  ref with the reference of the entry, using the dentry cache if enabled.
+ */
+static int lookup_ref(sqfs_dir_reader_t *rd, const char *name, size_t len,
+		      sqfs_u64 *ref)
+{
+	sqfs_inode_generic_t *inode = NULL;
+	sqfs_u64 parent_ref = *ref;
+	bool use_cache;
+	int ret;
+
+	use_cache = (rd->flags & SQFS_DIR_READER_DENTRY_CACHE) &&
+		!is_dot_entry(name, len);
+
+	if (use_cache && dentry_lookup(&rd->dentries, parent_ref,
+				       name, len, ref)) {
+		return 0;
+	}
+
+	ret = sqfs_dir_reader_get_inode(rd, parent_ref, &inode);
+	if (ret == 0)
+		ret = lookup_component(rd, inode, name, len, ref);
+
+	sqfs_free(inode);
+
+	if (ret == 0 && use_cache)
+		dentry_add(&rd->dentries, parent_ref, name, len, *ref);
+
+	return ret;
+}
+
 int sqfs_dir_reader_resolve_path(sqfs_dir_reader_t *rd, const char *path,
 				 const sqfs_inode_generic_t *root,
 				 sqfs_u64 *out)
 {
-	bool is_first = true;
+	bool is_first = true, have_ref;
 
 	while (path != NULL && *path != '\0') {
-		sqfs_dir_reader_state_t state;
+		const char *end;
+		size_t len;
 		int ret;
 
 		if (*path == '/') {
@@ -313,49 +915,33 @@ int sqfs_dir_reader_resolve_path(sqfs_dir_reader_t *rd, const char *path,
 			continue;
 		}
 
-		if (is_first && root != NULL) {
-			ret = sqfs_dir_reader_open_dir(rd, root, &state, 0);
-		} else {
-			sqfs_inode_generic_t *inode = NULL;
+		end = strchr(path, '/');
+		len = end == NULL ? strlen(path) : (size_t)(end - path);
 
-			if (is_first)
-				*out = rd->super.root_inode_ref;
+		have_ref = !is_first;
 
-			ret = sqfs_dir_reader_get_inode(rd, *out, &inode);
-			if (ret == 0) {
-				ret = sqfs_dir_reader_open_dir(rd, inode,
-							       &state, 0);
-			}
+		if (is_first && root == NULL) {
+			*out = rd->super.root_inode_ref;
+			have_ref = true;
+		} else if (is_first &&
+			   (rd->flags & SQFS_DIR_READER_DENTRY_CACHE)) {
+			/* the cache is keyed on the inode reference */
+			have_ref = sqfs_dir_reader_resolve_inum(rd,
+						root->base.inode_number,
+						out) == 0;
+		}
 
-			sqfs_free(inode);
+		if (have_ref) {
+			ret = lookup_ref(rd, path, len, out);
+		} else {
+			ret = lookup_component(rd, root, path, len, out);
 		}
 
 		is_first = false;
 		if (ret != 0)
 			return ret;
 
-		for (;;) {
-			sqfs_dir_node_t *ent;
-			size_t len;
-
-			ret = sqfs_dir_reader_read(rd, &state, &ent);
-			if (ret < 0)
-				return ret;
-			if (ret > 0)
-				return SQFS_ERROR_NO_ENTRY;
-
-			len = ent->size + 1;
-			ret = strncmp((const char *)ent->name, path, len);
-			sqfs_free(ent);
-
-			if (ret == 0 &&
-			    (path[len] == '/' || path[len] == '\0')) {
-				path += len;
-				break;
-			}
-		}
-
-		*out = state.ent_ref;
+		path += len;
 	}
 
 	if (is_first) {
@@ -71,12 +71,19 @@ static sqfs_object_t *stdio_copy(const sqfs_object_t *base)
 }
 
 #if defined(_WIN32) || defined(__WINDOWS__)
+static void set_overlapped_offset(OVERLAPPED *ov, sqfs_u64 offset)
+{
+	memset(ov, 0, sizeof(*ov));
+	ov->Offset = (DWORD)(offset & 0xFFFFFFFF);
+	ov->OffsetHigh = (DWORD)(offset >> 32);
+}
+
 static int stdio_read_at(sqfs_file_t *base, sqfs_u64 offset,
 			 void *buffer, size_t size)
 {
 	sqfs_file_stdio_t *file = (sqfs_file_stdio_t *)base;
 	DWORD actually_read;
-	int ret;
+	OVERLAPPED ov;
 
 	if (offset >= file->size)
 		return SQFS_ERROR_OUT_OF_BOUNDS;
@@ -87,15 +94,22 @@ static int stdio_read_at(sqfs_file_t *base, sqfs_u64 offset,
 	if ((offset + size - 1) >= file->size)
 		return SQFS_ERROR_OUT_OF_BOUNDS;
 
-	ret = sqfs_native_file_seek(file->fd, offset, SQFS_FILE_SEEK_START);
-	if (ret)
-		return ret;
-
+	/*
+	  Pass the position with each read instead of seeking first, so
+	  concurrent reads through the same or a duplicated handle, which
+	  shares the file pointer, do not interfere with each other.
+	 */
 	while (size > 0) {
-		if (!ReadFile(file->fd, buffer, size, &actually_read, NULL))
+		set_overlapped_offset(&ov, offset);
+
+		if (!ReadFile(file->fd, buffer, size, &actually_read, &ov))
 			return SQFS_ERROR_IO;
 
+		if (actually_read == 0)
+			return SQFS_ERROR_OUT_OF_BOUNDS;
+
 		size -= actually_read;
+		offset += actually_read;
 		buffer = (char *)buffer + actually_read;
 	}
 
@@ -107,17 +121,12 @@ static int stdio_write_at(sqfs_file_t *base, sqfs_u64 offset,
 {
 	sqfs_file_stdio_t *file = (sqfs_file_stdio_t *)base;
 	DWORD actually_read;
-	int ret;
-
-	if (size == 0)
-		return 0;
-
-	ret = sqfs_native_file_seek(file->fd, offset, SQFS_FILE_SEEK_START);
-	if (ret)
-		return ret;
+	OVERLAPPED ov;
 
 	while (size > 0) {
-		if (!WriteFile(file->fd, buffer, size, &actually_read, NULL))
+		set_overlapped_offset(&ov, offset);
+
+		if (!WriteFile(file->fd, buffer, size, &actually_read, &ov))
 			return SQFS_ERROR_IO;
 
 		size -= actually_read;
@@ -17,9 +17,44 @@
 #include <stdlib.h>
 #include <string.h>
 
+/*
+  An uncompressed meta data block, identified by its location on disk.
+  Entries are kept in a hash table for lookup and in a doubly linked list,
+  ordered from most to least recently used.
+ */
+typedef struct meta_cache_entry_t {
+	struct meta_cache_entry_t *lru_prev;
+	struct meta_cache_entry_t *lru_next;
+	struct meta_cache_entry_t *hash_next;
+
+	sqfs_u64 location;
+	sqfs_u64 next_block;
+	size_t size;
+
+	sqfs_u8 data[SQFS_META_BLOCK_SIZE];
+} meta_cache_entry_t;
+
+struct sqfs_meta_cache_t {
+	sqfs_object_t base;
+
+	meta_cache_entry_t **buckets;
+	size_t bucket_mask;
+
+	meta_cache_entry_t *lru_head;
+	meta_cache_entry_t *lru_tail;
+
+	size_t count;
+	size_t max_count;
+
+	sqfs_meta_cache_stats_t stats;
+};
+
 struct sqfs_meta_reader_t {
 	sqfs_object_t base;
 
+	/* An optional cache for uncompressed blocks, possibly shared */
+	sqfs_meta_cache_t *cache;
+
 	sqfs_u64 start;
 	sqfs_u64 limit;
 	size_t data_used;
@@ -46,10 +81,179 @@ struct sqfs_meta_reader_t {
 	sqfs_u8 scratch[SQFS_META_BLOCK_SIZE];
 };
 
+static size_t hash_location(const sqfs_meta_cache_t *cache, sqfs_u64 location)
+{
+	location *= 0x9E3779B97F4A7C15ULL;
+
+	return (size_t)(location >> 32) & cache->bucket_mask;
+}
+
+static void lru_unlink(sqfs_meta_cache_t *cache, meta_cache_entry_t *ent)
+{
+	if (ent->lru_prev == NULL) {
+		cache->lru_head = ent->lru_next;
+	} else {
+		ent->lru_prev->lru_next = ent->lru_next;
+	}
+
+	if (ent->lru_next == NULL) {
+		cache->lru_tail = ent->lru_prev;
+	} else {
+		ent->lru_next->lru_prev = ent->lru_prev;
+	}
+
+	ent->lru_prev = ent->lru_next = NULL;
+}
+
+static void lru_push_front(sqfs_meta_cache_t *cache, meta_cache_entry_t *ent)
+{
+	ent->lru_prev = NULL;
+	ent->lru_next = cache->lru_head;
+
+	if (cache->lru_head == NULL) {
+		cache->lru_tail = ent;
+	} else {
+		cache->lru_head->lru_prev = ent;
+	}
+
+	cache->lru_head = ent;
+}
+
+static void hash_remove(sqfs_meta_cache_t *cache, meta_cache_entry_t *ent)
+{
+	meta_cache_entry_t **it;
+
+	it = cache->buckets + hash_location(cache, ent->location);
+
+	while (*it != NULL && *it != ent)
+		it = &((*it)->hash_next);
+
+	if (*it != NULL)
+		*it = ent->hash_next;
+
+	ent->hash_next = NULL;
+}
+
+static meta_cache_entry_t *cache_lookup(sqfs_meta_cache_t *cache,
+					sqfs_u64 location)
+{
+	meta_cache_entry_t *ent;
+
+	ent = cache->buckets[hash_location(cache, location)];
+
+	while (ent != NULL && ent->location != location)
+		ent = ent->hash_next;
+
+	if (ent == NULL) {
+		cache->stats.misses += 1;
+		return NULL;
+	}
+
+	if (ent != cache->lru_head) {
+		lru_unlink(cache, ent);
+		lru_push_front(cache, ent);
+	}
+
+	cache->stats.hits += 1;
+	return ent;
+}
+
+/* stores the current block of a meta data reader in the cache */
+static void cache_store(sqfs_meta_cache_t *cache, const sqfs_meta_reader_t *m)
+{
+	meta_cache_entry_t *ent;
+	size_t idx;
+
+	if (cache->count >= cache->max_count) {
+		ent = cache->lru_tail;
+		lru_unlink(cache, ent);
+		hash_remove(cache, ent);
+	} else {
+		/* failing to cache a block is not an error */
+		ent = calloc(1, sizeof(*ent));
+		if (ent == NULL)
+			return;
+
+		cache->count += 1;
+	}
+
+	ent->location = m->block_offset;
+	ent->next_block = m->next_block;
+	ent->size = m->data_used;
+	memcpy(ent->data, m->data, m->data_used);
+
+	idx = hash_location(cache, ent->location);
+	ent->hash_next = cache->buckets[idx];
+	cache->buckets[idx] = ent;
+
+	lru_push_front(cache, ent);
+}
+
+static void meta_cache_destroy(sqfs_object_t *obj)
+{
+	sqfs_meta_cache_t *cache = (sqfs_meta_cache_t *)obj;
+	meta_cache_entry_t *ent;
+
+	while (cache->lru_head != NULL) {
+		ent = cache->lru_head;
+		cache->lru_head = ent->lru_next;
+		free(ent);
+	}
+
+	free(cache->buckets);
+	free(cache);
+}
+
+static sqfs_object_t *meta_cache_copy(const sqfs_object_t *obj)
+{
+	const sqfs_meta_cache_t *cache = (const sqfs_meta_cache_t *)obj;
+
+	/* the copy starts out empty */
+	return (sqfs_object_t *)sqfs_meta_cache_create(cache->max_count);
+}
+
+sqfs_meta_cache_t *sqfs_meta_cache_create(size_t max_blocks)
+{
+	sqfs_meta_cache_t *cache;
+	size_t count = 1;
+
+	if (max_blocks == 0)
+		return NULL;
+
+	while (count < 2 * max_blocks)
+		count <<= 1;
+
+	cache = calloc(1, sizeof(*cache));
+	if (cache == NULL)
+		return NULL;
+
+	sqfs_object_init(cache, meta_cache_destroy, meta_cache_copy);
+
+	cache->buckets = alloc_array(sizeof(cache->buckets[0]), count);
+	if (cache->buckets == NULL) {
+		free(cache);
+		return NULL;
+	}
+
+	cache->bucket_mask = count - 1;
+	cache->max_count = max_blocks;
+	cache->stats.size = sizeof(cache->stats);
+	return cache;
+}
+
+const sqfs_meta_cache_stats_t
+*sqfs_meta_cache_get_stats(const sqfs_meta_cache_t *cache)
+{
+	return &cache->stats;
+}
+
+/*****************************************************************************/
+
 static void meta_reader_destroy(sqfs_object_t *m)
 {
 	sqfs_meta_reader_t *mr = (sqfs_meta_reader_t *)m;
 
+	sqfs_drop(mr->cache);
 	sqfs_drop(mr->file);
 	sqfs_drop(mr->cmp);
 	free(m);
@@ -66,6 +270,9 @@ static sqfs_object_t *meta_reader_copy(const sqfs_object_t *obj)
 		/* duplicate references */
 		copy->cmp = sqfs_grab(copy->cmp);
 		copy->file = sqfs_grab(copy->file);
+
+		/* the cache is not thread safe and must not be shared */
+		copy->cache = NULL;
 	}
 
 	return (sqfs_object_t *)copy;
@@ -90,9 +297,17 @@ sqfs_meta_reader_t *sqfs_meta_reader_create(sqfs_file_t *file,
 	return m;
 }
 
+void sqfs_meta_reader_set_cache(sqfs_meta_reader_t *m,
+				sqfs_meta_cache_t *cache)
+{
+	sqfs_drop(m->cache);
+	m->cache = sqfs_grab(cache);
+}
+
 int sqfs_meta_reader_seek(sqfs_meta_reader_t *m, sqfs_u64 block_start,
 			  size_t offset)
 {
+	meta_cache_entry_t *ent;
 	bool compressed;
 	sqfs_u16 header;
 	sqfs_u32 size;
@@ -110,6 +325,20 @@ int sqfs_meta_reader_seek(sqfs_meta_reader_t *m, sqfs_u64 block_start,
 		return 0;
 	}
 
+	ent = m->cache == NULL ? NULL : cache_lookup(m->cache, block_start);
+
+	if (ent != NULL) {
+		if (offset >= ent->size)
+			return SQFS_ERROR_OUT_OF_BOUNDS;
+
+		memcpy(m->data, ent->data, ent->size);
+		m->data_used = ent->size;
+		m->block_offset = block_start;
+		m->next_block = ent->next_block;
+		m->offset = offset;
+		return 0;
+	}
+
 	err = m->file->read_at(m->file, block_start, &header, 2);
 	if (err)
 		return err;
@@ -141,11 +370,15 @@ int sqfs_meta_reader_seek(sqfs_meta_reader_t *m, sqfs_u64 block_start,
 		m->data_used = size;
 	}
 
+	m->block_offset = block_start;
+	m->next_block = block_start + size + 2;
+
+	if (m->cache != NULL)
+		cache_store(m->cache, m);
+
 	if (offset >= m->data_used)
 		return SQFS_ERROR_OUT_OF_BOUNDS;
 
-	m->block_offset = block_start;
-	m->next_block = block_start + size + 2;
 	m->offset = offset;
 	return 0;
 }
@@ -34,11 +34,16 @@ int sqfs_meta_reader_read_dir_header(sqfs_meta_reader_t *m,
 	return 0;
 }
 
-int sqfs_meta_reader_read_dir_ent(sqfs_meta_reader_t *m,
-				  sqfs_dir_node_t **result)
+/*
+  If size is NULL, a new entry is allocated. Otherwise, *result points to a
+  buffer of *size bytes that is reused and grown as needed.
+ */
+static int read_dir_ent(sqfs_meta_reader_t *m, sqfs_dir_node_t **result,
+			size_t *size)
 {
 	sqfs_dir_node_t ent, *out;
 	sqfs_u16 *diff_u16;
+	size_t needed;
 	int err;
 
 	err = sqfs_meta_reader_read(m, &ent, sizeof(ent));
@@ -52,21 +57,49 @@ int sqfs_meta_reader_read_dir_ent(sqfs_meta_reader_t *m,
 	ent.type = le16toh(ent.type);
 	ent.size = le16toh(ent.size);
 
-	out = calloc(1, sizeof(*out) + ent.size + 2);
-	if (out == NULL)
-		return SQFS_ERROR_ALLOC;
+	needed = sizeof(*out) + ent.size + 2;
+
+	if (size == NULL) {
+		out = calloc(1, needed);
+		if (out == NULL)
+			return SQFS_ERROR_ALLOC;
+	} else if (*result == NULL || *size < needed) {
+		out = realloc(*result, needed);
+		if (out == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		*result = out;
+		*size = needed;
+	} else {
+		out = *result;
+	}
 
 	*out = ent;
 	err = sqfs_meta_reader_read(m, out->name, ent.size + 1);
 	if (err) {
-		free(out);
+		if (size == NULL)
+			free(out);
 		return err;
 	}
 
+	out->name[ent.size + 1] = '\0';
 	*result = out;
 	return 0;
 }
 
+int sqfs_meta_reader_read_dir_ent(sqfs_meta_reader_t *m,
+				  sqfs_dir_node_t **result)
+{
+	return read_dir_ent(m, result, NULL);
+}
+
+int sqfs_meta_reader_read_dir_ent_buffered(sqfs_meta_reader_t *m,
+					   sqfs_dir_node_t **result,
+					   size_t *size)
+{
+	return read_dir_ent(m, result, size);
+}
+
 int sqfs_readdir_state_init(sqfs_readdir_state_t *s, const sqfs_super_t *super,
 			    const sqfs_inode_generic_t *inode)
 {
@@ -88,9 +121,9 @@ int sqfs_readdir_state_init(sqfs_readdir_state_t *s, const sqfs_super_t *super,
 	return 0;
 }
 
-int sqfs_meta_reader_readdir(sqfs_meta_reader_t *m, sqfs_readdir_state_t *it,
-			     sqfs_dir_node_t **ent,
-			     sqfs_u32 *inum, sqfs_u64 *iref)
+static int readdir_impl(sqfs_meta_reader_t *m, sqfs_readdir_state_t *it,
+			sqfs_dir_node_t **ent, size_t *ent_size,
+			sqfs_u32 *inum, sqfs_u64 *iref)
 {
 	size_t count;
 	int ret;
@@ -124,7 +157,7 @@ int sqfs_meta_reader_readdir(sqfs_meta_reader_t *m, sqfs_readdir_state_t *it,
 	if (ret != 0)
 		return ret;
 
-	ret = sqfs_meta_reader_read_dir_ent(m, ent);
+	ret = read_dir_ent(m, ent, ent_size);
 	if (ret)
 		return ret;
 
@@ -155,3 +188,18 @@ out_eof:
 	it->entries = 0;
 	return 1;
 }
+
+int sqfs_meta_reader_readdir(sqfs_meta_reader_t *m, sqfs_readdir_state_t *it,
+			     sqfs_dir_node_t **ent,
+			     sqfs_u32 *inum, sqfs_u64 *iref)
+{
+	return readdir_impl(m, it, ent, NULL, inum, iref);
+}
+
+int sqfs_meta_reader_readdir_buffered(sqfs_meta_reader_t *m,
+				      sqfs_readdir_state_t *it,
+				      sqfs_dir_node_t **ent, size_t *ent_size,
+				      sqfs_u32 *inum, sqfs_u64 *iref)
+{
+	return readdir_impl(m, it, ent, ent_size, inum, iref);
+}
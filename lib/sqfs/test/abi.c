@@ -7,6 +7,8 @@
 #include "config.h"
 
 #include "sqfs/block_processor.h"
+#include "sqfs/data_reader.h"
+#include "sqfs/meta_reader.h"
 #include "sqfs/compressor.h"
 #include "sqfs/block.h"
 #include "util/test.h"
@@ -81,12 +83,15 @@ static void test_blockproc_stats(void)
 	TEST_EQUAL_UI(sizeof(stats.sparse_block_count), sizeof(sqfs_u64));
 	TEST_EQUAL_UI(sizeof(stats.total_frag_count), sizeof(sqfs_u64));
 	TEST_EQUAL_UI(sizeof(stats.actual_frag_count), sizeof(sqfs_u64));
+	TEST_EQUAL_UI(sizeof(stats.peak_memory_used), sizeof(sqfs_u64));
+	TEST_EQUAL_UI(sizeof(stats.incompressible_block_count),
+		      sizeof(sqfs_u64));
 
 	if (__alignof__(stats) == __alignof__(sqfs_u32)) {
 		TEST_ASSERT(sizeof(stats) >=
-			    (sizeof(sqfs_u32) + 7 * sizeof(sqfs_u64)));
+			    (sizeof(sqfs_u32) + 9 * sizeof(sqfs_u64)));
 	} else if (__alignof__(stats) == __alignof__(sqfs_u64)) {
-		TEST_ASSERT(sizeof(stats) >= (8 * sizeof(sqfs_u64)));
+		TEST_ASSERT(sizeof(stats) >= (10 * sizeof(sqfs_u64)));
 	}
 
 	TEST_EQUAL_UI(offsetof(sqfs_block_processor_stats_t, size), 0);
@@ -125,6 +130,14 @@ static void test_blockproc_stats(void)
 
 	TEST_EQUAL_UI(offsetof(sqfs_block_processor_stats_t,
 			       actual_frag_count), off);
+	off += sizeof(sqfs_u64);
+
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_stats_t,
+			       peak_memory_used), off);
+	off += sizeof(sqfs_u64);
+
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_stats_t,
+			       incompressible_block_count), off);
 }
 
 static void test_blockproc_desc(void)
@@ -143,6 +156,9 @@ static void test_blockproc_desc(void)
 	TEST_EQUAL_UI(sizeof(desc.tbl), sizeof(void *));
 	TEST_EQUAL_UI(sizeof(desc.file), sizeof(void *));
 	TEST_EQUAL_UI(sizeof(desc.uncmp), sizeof(void *));
+	TEST_EQUAL_UI(sizeof(desc.flags), sizeof(sqfs_u32));
+	TEST_EQUAL_UI(sizeof(desc.max_memory), sizeof(sqfs_u64));
+	TEST_EQUAL_UI(sizeof(desc.cache), sizeof(void *));
 
 	TEST_EQUAL_UI(offsetof(sqfs_block_processor_desc_t, size), 0);
 	TEST_EQUAL_UI(offsetof(sqfs_block_processor_desc_t, max_block_size),
@@ -161,6 +177,45 @@ static void test_blockproc_desc(void)
 		      (4 * sizeof(sqfs_u32) + 3 * sizeof(void *)));
 	TEST_EQUAL_UI(offsetof(sqfs_block_processor_desc_t, uncmp),
 		      (4 * sizeof(sqfs_u32) + 4 * sizeof(void *)));
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_desc_t, flags),
+		      (4 * sizeof(sqfs_u32) + 5 * sizeof(void *)));
+	TEST_ASSERT(offsetof(sqfs_block_processor_desc_t, max_memory) >=
+		    (5 * sizeof(sqfs_u32) + 5 * sizeof(void *)));
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_desc_t, cache),
+		      offsetof(sqfs_block_processor_desc_t, max_memory) +
+		      sizeof(sqfs_u64));
+}
+
+static void test_data_reader_stats(void)
+{
+	sqfs_data_reader_stats_t stats;
+
+	TEST_EQUAL_UI(sizeof(stats.size), sizeof(size_t));
+	TEST_EQUAL_UI(sizeof(stats.cache_hits), sizeof(sqfs_u64));
+	TEST_EQUAL_UI(sizeof(stats.cache_misses), sizeof(sqfs_u64));
+
+	TEST_EQUAL_UI(offsetof(sqfs_data_reader_stats_t, size), 0);
+	TEST_ASSERT(offsetof(sqfs_data_reader_stats_t, cache_hits) >=
+		    sizeof(size_t));
+	TEST_EQUAL_UI(offsetof(sqfs_data_reader_stats_t, cache_misses),
+		      offsetof(sqfs_data_reader_stats_t, cache_hits) +
+		      sizeof(sqfs_u64));
+}
+
+static void test_meta_cache_stats(void)
+{
+	sqfs_meta_cache_stats_t stats;
+
+	TEST_EQUAL_UI(sizeof(stats.size), sizeof(size_t));
+	TEST_EQUAL_UI(sizeof(stats.hits), sizeof(sqfs_u64));
+	TEST_EQUAL_UI(sizeof(stats.misses), sizeof(sqfs_u64));
+
+	TEST_EQUAL_UI(offsetof(sqfs_meta_cache_stats_t, size), 0);
+	TEST_ASSERT(offsetof(sqfs_meta_cache_stats_t, hits) >=
+		    sizeof(size_t));
+	TEST_EQUAL_UI(offsetof(sqfs_meta_cache_stats_t, misses),
+		      offsetof(sqfs_meta_cache_stats_t, hits) +
+		      sizeof(sqfs_u64));
 }
 
 int main(int argc, char **argv)
@@ -170,5 +225,7 @@ int main(int argc, char **argv)
 	test_compressor_names();
 	test_blockproc_stats();
 	test_blockproc_desc();
+	test_data_reader_stats();
+	test_meta_cache_stats();
 	return EXIT_SUCCESS;
 }
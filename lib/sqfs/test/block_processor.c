@@ -0,0 +1,923 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * block_processor.c
+ *
+ * Copyright (C) 2026 The squashfs-tools-ng contributors
+ */
+#include "config.h"
+#include "compat.h"
+#include "util/test.h"
+
+#include "sqfs/block_processor.h"
+#include "sqfs/block_writer.h"
+#include "sqfs/frag_table.h"
+#include "sqfs/compressor.h"
+#include "sqfs/inode.h"
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+#include "sqfs/io.h"
+
+#define BLOCK_SIZE (4096)
+#define MAX_FRAGMENTS (64)
+
+enum {
+	DATA_RANDOM = 0,
+	DATA_RUNS,
+	DATA_ZERO,
+	DATA_TEXT,
+	DATA_7BIT,
+};
+
+typedef struct {
+	sqfs_u32 seed;
+	sqfs_u32 size;
+	int type;
+} file_desc_t;
+
+static const file_desc_t files[] = {
+	{ 1, 3 * BLOCK_SIZE + 1000, DATA_RANDOM },
+	{ 2, 2 * BLOCK_SIZE + 1500, DATA_RUNS },
+	{ 3, BLOCK_SIZE, DATA_ZERO },
+	{ 1, 3 * BLOCK_SIZE + 1000, DATA_RANDOM },
+	{ 4, 5 * BLOCK_SIZE, DATA_RUNS },
+	{ 5, 1700, DATA_RUNS },
+	{ 6, 1100, DATA_RANDOM },
+	{ 7, 2900, DATA_RUNS },
+	{ 8, 900, DATA_RUNS },
+	{ 9, 2300, DATA_RANDOM },
+	{ 10, 3100, DATA_RUNS },
+	{ 11, 1300, DATA_RUNS },
+	{ 12, BLOCK_SIZE + 2500, DATA_RUNS },
+	{ 13, 2000, DATA_RANDOM },
+	{ 14, 3500, DATA_RUNS },
+};
+
+#define NUM_FILES (sizeof(files) / sizeof(files[0]))
+
+/*
+  The files are packed twice, with a sync in between. The second time
+  around, every file is a duplicate, and the fragment blocks they point
+  to have to be read back from the file for comparison.
+ */
+typedef struct {
+	sqfs_u8 *data;
+	size_t size;
+
+	sqfs_fragment_t frags[MAX_FRAGMENTS];
+	size_t num_frags;
+
+	sqfs_inode_generic_t *inodes[2 * NUM_FILES];
+
+	sqfs_block_processor_stats_t stats;
+	size_t reads;
+	size_t compressed;
+} image_t;
+
+static size_t compress_count = 0;
+static sqfs_u32 compress_level = 0;
+static sqfs_block_cache_t *block_cache = NULL;
+
+/*****************************************************************************/
+
+/*
+  A file in memory, that aborts if it is used from more than one thread
+  at the same time.
+ */
+typedef struct {
+	sqfs_file_t base;
+
+	sqfs_u8 *data;
+	size_t size;
+	size_t max_size;
+
+	size_t reads;
+	int users;
+} mem_file_t;
+
+static void file_enter(mem_file_t *file)
+{
+	TEST_EQUAL_I(__atomic_fetch_add(&file->users, 1, __ATOMIC_SEQ_CST), 0);
+}
+
+static void file_leave(mem_file_t *file)
+{
+	__atomic_fetch_sub(&file->users, 1, __ATOMIC_SEQ_CST);
+}
+
+static int mem_read_at(sqfs_file_t *base, sqfs_u64 offset,
+		       void *buffer, size_t size)
+{
+	mem_file_t *file = (mem_file_t *)base;
+	int ret = 0;
+
+	file_enter(file);
+	file->reads += 1;
+
+	if (offset > file->size || size > (file->size - offset)) {
+		ret = SQFS_ERROR_OUT_OF_BOUNDS;
+	} else {
+		memcpy(buffer, file->data + offset, size);
+	}
+
+	file_leave(file);
+	return ret;
+}
+
+static int mem_write_at(sqfs_file_t *base, sqfs_u64 offset,
+			const void *buffer, size_t size)
+{
+	mem_file_t *file = (mem_file_t *)base;
+	size_t new_size;
+	void *new;
+
+	file_enter(file);
+
+	if ((offset + size) > file->max_size) {
+		new_size = file->max_size ? file->max_size : 65536;
+
+		while (new_size < (offset + size))
+			new_size *= 2;
+
+		new = realloc(file->data, new_size);
+		TEST_NOT_NULL(new);
+
+		file->data = new;
+		file->max_size = new_size;
+	}
+
+	if (offset > file->size)
+		memset(file->data + file->size, 0, offset - file->size);
+
+	memcpy(file->data + offset, buffer, size);
+
+	if ((offset + size) > file->size)
+		file->size = offset + size;
+
+	file_leave(file);
+	return 0;
+}
+
+static sqfs_u64 mem_get_size(const sqfs_file_t *base)
+{
+	return ((const mem_file_t *)base)->size;
+}
+
+static int mem_truncate(sqfs_file_t *base, sqfs_u64 size)
+{
+	mem_file_t *file = (mem_file_t *)base;
+
+	file_enter(file);
+	TEST_ASSERT(size <= file->size);
+	file->size = size;
+	file_leave(file);
+	return 0;
+}
+
+static const char *mem_get_filename(sqfs_file_t *base)
+{
+	(void)base;
+	return "memfile";
+}
+
+static void mem_destroy(sqfs_object_t *obj)
+{
+	free(((mem_file_t *)obj)->data);
+	free(obj);
+}
+
+static mem_file_t *mem_file_create(void)
+{
+	mem_file_t *file = calloc(1, sizeof(*file));
+
+	TEST_NOT_NULL(file);
+	sqfs_object_init(file, mem_destroy, NULL);
+
+	((sqfs_file_t *)file)->read_at = mem_read_at;
+	((sqfs_file_t *)file)->write_at = mem_write_at;
+	((sqfs_file_t *)file)->get_size = mem_get_size;
+	((sqfs_file_t *)file)->truncate = mem_truncate;
+	((sqfs_file_t *)file)->get_filename = mem_get_filename;
+	return file;
+}
+
+/*****************************************************************************/
+
+/*
+  A run length encoder, i.e. something that is simple, deterministic and
+  shrinks some of the test data, but not all of it.
+ */
+static sqfs_s32 rle_compress(sqfs_compressor_t *cmp, const sqfs_u8 *in,
+			     sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
+{
+	sqfs_u32 i = 0, run, used = 0;
+	(void)cmp;
+
+	__atomic_add_fetch(&compress_count, 1, __ATOMIC_SEQ_CST);
+
+	while (i < size) {
+		run = 1;
+		while ((i + run) < size && in[i + run] == in[i] && run < 255)
+			++run;
+
+		if ((used + 2) >= size || (used + 2) > outsize)
+			return 0;
+
+		out[used++] = run;
+		out[used++] = in[i];
+		i += run;
+	}
+
+	return used;
+}
+
+static sqfs_s32 rle_uncompress(sqfs_compressor_t *cmp, const sqfs_u8 *in,
+			       sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
+{
+	sqfs_u32 i, used = 0;
+	(void)cmp;
+
+	if (size % 2)
+		return SQFS_ERROR_CORRUPTED;
+
+	for (i = 0; i < size; i += 2) {
+		if (in[i] > (outsize - used))
+			return SQFS_ERROR_OVERFLOW;
+
+		memset(out + used, in[i + 1], in[i]);
+		used += in[i];
+	}
+
+	return used;
+}
+
+static void rle_get_configuration(const sqfs_compressor_t *cmp,
+				  sqfs_compressor_config_t *cfg)
+{
+	(void)cmp;
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->block_size = BLOCK_SIZE;
+	cfg->level = compress_level;
+}
+
+static void rle_destroy(sqfs_object_t *obj)
+{
+	free(obj);
+}
+
+static sqfs_object_t *rle_copy(const sqfs_object_t *obj)
+{
+	sqfs_compressor_t *cmp = malloc(sizeof(*cmp));
+
+	TEST_NOT_NULL(cmp);
+	memcpy(cmp, obj, sizeof(*cmp));
+	((sqfs_object_t *)cmp)->refcount = 1;
+	return (sqfs_object_t *)cmp;
+}
+
+static sqfs_compressor_t *rle_create(bool uncompress)
+{
+	sqfs_compressor_t *cmp = calloc(1, sizeof(*cmp));
+
+	TEST_NOT_NULL(cmp);
+	sqfs_object_init(cmp, rle_destroy, rle_copy);
+
+	cmp->get_configuration = rle_get_configuration;
+	cmp->do_block = uncompress ? rle_uncompress : rle_compress;
+	return cmp;
+}
+
+/*****************************************************************************/
+
+/*
+  A block cache in memory. Lookups come from the worker threads, while
+  the main thread may store entries at the same time.
+ */
+#define MAX_CACHE_ENTRIES (128)
+#define MAX_KEY_SIZE (32)
+
+typedef struct {
+	sqfs_u8 key[MAX_KEY_SIZE];
+	sqfs_u8 data[BLOCK_SIZE];
+	size_t size;
+} cache_entry_t;
+
+typedef struct {
+	sqfs_block_cache_t base;
+
+	cache_entry_t entries[MAX_CACHE_ENTRIES];
+	size_t count;
+	size_t hits;
+	int lock;
+} mem_cache_t;
+
+static void cache_lock(mem_cache_t *cache)
+{
+	while (__atomic_exchange_n(&cache->lock, 1, __ATOMIC_ACQUIRE))
+		;
+}
+
+static void cache_unlock(mem_cache_t *cache)
+{
+	__atomic_store_n(&cache->lock, 0, __ATOMIC_RELEASE);
+}
+
+static cache_entry_t *cache_find(mem_cache_t *cache, const sqfs_u8 *key)
+{
+	size_t i;
+
+	for (i = 0; i < cache->count; ++i) {
+		if (memcmp(cache->entries[i].key, key, MAX_KEY_SIZE) == 0)
+			return cache->entries + i;
+	}
+
+	return NULL;
+}
+
+static int cache_lookup(sqfs_block_cache_t *base, const sqfs_u8 *key,
+			size_t key_size, sqfs_u8 *out, size_t out_max,
+			size_t *out_size)
+{
+	mem_cache_t *cache = (mem_cache_t *)base;
+	cache_entry_t *ent;
+	int ret = 0;
+
+	TEST_EQUAL_UI(key_size, MAX_KEY_SIZE);
+	cache_lock(cache);
+
+	ent = cache_find(cache, key);
+
+	if (ent != NULL && ent->size <= out_max) {
+		memcpy(out, ent->data, ent->size);
+		*out_size = ent->size;
+		cache->hits += 1;
+		ret = 1;
+	}
+
+	cache_unlock(cache);
+	return ret;
+}
+
+static int cache_store(sqfs_block_cache_t *base, const sqfs_u8 *key,
+		       size_t key_size, const sqfs_u8 *data, size_t size)
+{
+	mem_cache_t *cache = (mem_cache_t *)base;
+	cache_entry_t *ent;
+
+	TEST_EQUAL_UI(key_size, MAX_KEY_SIZE);
+	TEST_ASSERT(size <= BLOCK_SIZE);
+	cache_lock(cache);
+
+	ent = cache_find(cache, key);
+
+	if (ent == NULL) {
+		TEST_ASSERT(cache->count < MAX_CACHE_ENTRIES);
+		ent = cache->entries + cache->count++;
+		memcpy(ent->key, key, MAX_KEY_SIZE);
+	}
+
+	memcpy(ent->data, data, size);
+	ent->size = size;
+
+	cache_unlock(cache);
+	return 0;
+}
+
+static void cache_destroy(sqfs_object_t *obj)
+{
+	free(obj);
+}
+
+static mem_cache_t *cache_create(void)
+{
+	mem_cache_t *cache = calloc(1, sizeof(*cache));
+
+	TEST_NOT_NULL(cache);
+	sqfs_object_init(cache, cache_destroy, NULL);
+
+	cache->base.lookup = cache_lookup;
+	cache->base.store = cache_store;
+	return cache;
+}
+
+static sqfs_u32 xorshift(sqfs_u32 *state)
+{
+	sqfs_u32 x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	*state = x;
+	return x;
+}
+
+static void gen_data(sqfs_u8 *out, size_t size, sqfs_u32 seed, int type)
+{
+	sqfs_u32 state = 0xDEADBEEF ^ (seed * 0x9E3779B9);
+	size_t i, run;
+	sqfs_u8 value;
+
+	switch (type) {
+	case DATA_RANDOM:
+		for (i = 0; i < size; ++i)
+			out[i] = xorshift(&state) & 0xFF;
+		break;
+	case DATA_RUNS:
+		for (i = 0; i < size; i += run) {
+			run = 1 + xorshift(&state) % 32;
+			value = xorshift(&state) & 0xFF;
+
+			if (run > (size - i))
+				run = size - i;
+
+			memset(out + i, value, run);
+		}
+		break;
+	case DATA_TEXT:
+		/* 6 bits per byte */
+		for (i = 0; i < size; ++i)
+			out[i] = '0' + (xorshift(&state) & 0x3F);
+		break;
+	case DATA_7BIT:
+		for (i = 0; i < size; ++i)
+			out[i] = xorshift(&state) & 0x7F;
+		break;
+	default:
+		memset(out, 0, size);
+		break;
+	}
+}
+
+static void pack_file(sqfs_block_processor_t *proc, const file_desc_t *desc,
+		      sqfs_inode_generic_t **inode)
+{
+	sqfs_u8 *data = malloc(desc->size);
+	size_t i, diff;
+	int ret;
+
+	TEST_NOT_NULL(data);
+	gen_data(data, desc->size, desc->seed, desc->type);
+
+	ret = sqfs_block_processor_begin_file(proc, inode, NULL, 0);
+	TEST_EQUAL_I(ret, 0);
+
+	/* in uneven pieces, not aligned to the block size */
+	for (i = 0; i < desc->size; i += diff) {
+		diff = desc->size - i;
+		if (diff > 1000)
+			diff = 1000;
+
+		ret = sqfs_block_processor_append(proc, data + i, diff);
+		TEST_EQUAL_I(ret, 0);
+	}
+
+	ret = sqfs_block_processor_end_file(proc);
+	TEST_EQUAL_I(ret, 0);
+	free(data);
+}
+
+static void pack(image_t *img, sqfs_u32 flags, sqfs_u32 num_workers,
+		 sqfs_u64 max_memory)
+{
+	sqfs_block_processor_desc_t desc;
+	sqfs_compressor_t *cmp, *uncmp;
+	sqfs_block_processor_t *proc;
+	sqfs_frag_table_t *tbl;
+	sqfs_block_writer_t *wr;
+	mem_file_t *file;
+	size_t i;
+	int ret;
+
+	memset(img, 0, sizeof(*img));
+	compress_count = 0;
+
+	file = mem_file_create();
+	cmp = rle_create(false);
+	uncmp = rle_create(true);
+
+	/* the block writer does not read, so all reads are for fragments */
+	wr = sqfs_block_writer_create((sqfs_file_t *)file,
+				      SQFS_BLOCK_WRITER_HASH_COMPARE_ONLY);
+	TEST_NOT_NULL(wr);
+
+	tbl = sqfs_frag_table_create(0);
+	TEST_NOT_NULL(tbl);
+
+	memset(&desc, 0, sizeof(desc));
+	desc.size = sizeof(desc);
+	desc.max_block_size = BLOCK_SIZE;
+	desc.num_workers = num_workers;
+	desc.max_backlog = 10;
+	desc.cmp = cmp;
+	desc.wr = wr;
+	desc.tbl = tbl;
+	desc.file = (sqfs_file_t *)file;
+	desc.uncmp = uncmp;
+	desc.flags = flags;
+	desc.max_memory = max_memory;
+	desc.cache = block_cache;
+
+	ret = sqfs_block_processor_create_ex(&desc, &proc);
+	TEST_EQUAL_I(ret, 0);
+
+	for (i = 0; i < NUM_FILES; ++i)
+		pack_file(proc, files + i, img->inodes + i);
+
+	ret = sqfs_block_processor_sync(proc);
+	TEST_EQUAL_I(ret, 0);
+
+	for (i = 0; i < NUM_FILES; ++i)
+		pack_file(proc, files + i, img->inodes + NUM_FILES + i);
+
+	ret = sqfs_block_processor_finish(proc);
+	TEST_EQUAL_I(ret, 0);
+
+	img->stats = *sqfs_block_processor_get_stats(proc);
+	img->compressed = compress_count;
+
+	img->num_frags = sqfs_frag_table_get_size(tbl);
+	TEST_ASSERT(img->num_frags <= MAX_FRAGMENTS);
+
+	for (i = 0; i < img->num_frags; ++i) {
+		ret = sqfs_frag_table_lookup(tbl, i, img->frags + i);
+		TEST_EQUAL_I(ret, 0);
+	}
+
+	img->size = file->size;
+	img->data = malloc(file->size);
+	TEST_NOT_NULL(img->data);
+	memcpy(img->data, file->data, file->size);
+	img->reads = file->reads;
+
+	sqfs_drop(proc);
+	sqfs_drop(tbl);
+	sqfs_drop(wr);
+	sqfs_drop(uncmp);
+	sqfs_drop(cmp);
+	sqfs_drop(file);
+}
+
+static void image_cleanup(image_t *img)
+{
+	size_t i;
+
+	for (i = 0; i < 2 * NUM_FILES; ++i)
+		free(img->inodes[i]);
+
+	free(img->data);
+}
+
+/*****************************************************************************/
+
+static void check_inode_equal(const sqfs_inode_generic_t *a,
+			      const sqfs_inode_generic_t *b)
+{
+	sqfs_u64 start_a, start_b, size_a, size_b;
+	sqfs_u32 index_a, index_b, offset_a, offset_b;
+
+	TEST_EQUAL_UI(a->base.type, b->base.type);
+	TEST_EQUAL_UI(a->payload_bytes_used, b->payload_bytes_used);
+	TEST_ASSERT(memcmp(a->extra, b->extra, a->payload_bytes_used) == 0);
+
+	sqfs_inode_get_file_block_start(a, &start_a);
+	sqfs_inode_get_file_block_start(b, &start_b);
+	TEST_EQUAL_UI(start_a, start_b);
+
+	sqfs_inode_get_file_size(a, &size_a);
+	sqfs_inode_get_file_size(b, &size_b);
+	TEST_EQUAL_UI(size_a, size_b);
+
+	sqfs_inode_get_frag_location(a, &index_a, &offset_a);
+	sqfs_inode_get_frag_location(b, &index_b, &offset_b);
+	TEST_EQUAL_UI(index_a, index_b);
+	TEST_EQUAL_UI(offset_a, offset_b);
+}
+
+static void check_image_equal(const image_t *a, const image_t *b)
+{
+	size_t i;
+
+	TEST_EQUAL_UI(a->size, b->size);
+	TEST_ASSERT(memcmp(a->data, b->data, a->size) == 0);
+
+	TEST_EQUAL_UI(a->num_frags, b->num_frags);
+
+	for (i = 0; i < a->num_frags; ++i) {
+		TEST_EQUAL_UI(a->frags[i].start_offset,
+			      b->frags[i].start_offset);
+		TEST_EQUAL_UI(a->frags[i].size, b->frags[i].size);
+	}
+
+	for (i = 0; i < 2 * NUM_FILES; ++i)
+		check_inode_equal(a->inodes[i], b->inodes[i]);
+
+	TEST_EQUAL_UI(a->stats.data_block_count, b->stats.data_block_count);
+	TEST_EQUAL_UI(a->stats.frag_block_count, b->stats.frag_block_count);
+	TEST_EQUAL_UI(a->stats.sparse_block_count,
+		      b->stats.sparse_block_count);
+	TEST_EQUAL_UI(a->stats.actual_frag_count, b->stats.actual_frag_count);
+	TEST_EQUAL_UI(a->stats.incompressible_block_count,
+		      b->stats.incompressible_block_count);
+}
+
+static void check_duplicates(const image_t *img)
+{
+	size_t i;
+
+	/* the second time around, every file is a copy of the first one */
+	for (i = 0; i < NUM_FILES; ++i)
+		check_inode_equal(img->inodes[i], img->inodes[NUM_FILES + i]);
+
+	TEST_ASSERT(img->stats.frag_block_count > 1);
+	TEST_ASSERT(img->stats.actual_frag_count <
+		    img->stats.total_frag_count);
+
+	/* fragment blocks were read back and compared */
+	TEST_ASSERT(img->reads > 0);
+}
+
+/*****************************************************************************/
+
+static void test_io_thread(void)
+{
+	image_t ref, img;
+
+	pack(&ref, 0, 1, 0);
+	check_duplicates(&ref);
+
+	pack(&img, 0, 4, 0);
+	check_duplicates(&img);
+	check_image_equal(&ref, &img);
+	image_cleanup(&img);
+
+	/* the file is used from the I/O thread only, while it runs */
+	pack(&img, SQFS_BLOCK_PROCESSOR_IO_THREAD, 1, 0);
+	check_duplicates(&img);
+	check_image_equal(&ref, &img);
+	image_cleanup(&img);
+
+	pack(&img, SQFS_BLOCK_PROCESSOR_IO_THREAD, 4, 0);
+	check_duplicates(&img);
+	check_image_equal(&ref, &img);
+	image_cleanup(&img);
+
+	image_cleanup(&ref);
+}
+
+static void test_pre_dedup(sqfs_u32 flags)
+{
+	image_t ref, img;
+
+	pack(&ref, flags, 4, 0);
+	check_duplicates(&ref);
+
+	if (flags & SQFS_BLOCK_PROCESSOR_SKIP_INCOMPRESSIBLE)
+		TEST_ASSERT(ref.stats.incompressible_block_count > 0);
+
+	/* duplicate blocks are not compressed again, with the same result */
+	pack(&img, flags | SQFS_BLOCK_PROCESSOR_PRE_DEDUP, 4, 0);
+	check_duplicates(&img);
+	check_image_equal(&ref, &img);
+	TEST_ASSERT(img.compressed < ref.compressed);
+	image_cleanup(&img);
+
+	pack(&img, flags | SQFS_BLOCK_PROCESSOR_PRE_DEDUP, 1, 0);
+	check_duplicates(&img);
+	check_image_equal(&ref, &img);
+	TEST_ASSERT(img.compressed < ref.compressed);
+	image_cleanup(&img);
+
+	image_cleanup(&ref);
+}
+
+static void test_mem_limit(sqfs_u32 flags)
+{
+	sqfs_u64 limit;
+	image_t ref, img;
+
+	pack(&ref, flags, 4, 0);
+	check_duplicates(&ref);
+
+	for (limit = 10 * BLOCK_SIZE; limit <= 16 * BLOCK_SIZE;
+	     limit += 2 * BLOCK_SIZE) {
+		pack(&img, flags, 4, limit);
+		check_duplicates(&img);
+		check_image_equal(&ref, &img);
+
+		TEST_ASSERT(img.stats.peak_memory_used > 0);
+		TEST_ASSERT(img.stats.peak_memory_used <= limit);
+		TEST_ASSERT(img.stats.peak_memory_used <
+			    ref.stats.peak_memory_used);
+		image_cleanup(&img);
+	}
+
+	image_cleanup(&ref);
+}
+
+/*
+  A block writer that only records the flags of the blocks it gets, so the
+  blocks that were skipped by the entropy check can be told apart from
+  the ones where compression merely failed.
+ */
+#define MAX_WRITTEN (16)
+
+static sqfs_u32 written_flags[MAX_WRITTEN];
+static size_t written_count = 0;
+
+static int rec_write_data_block(sqfs_block_writer_t *wr, void *user,
+				sqfs_u32 size, sqfs_u32 checksum,
+				sqfs_u32 flags, const sqfs_u8 *data,
+				sqfs_u64 *location)
+{
+	(void)wr; (void)user; (void)size; (void)checksum; (void)data;
+
+	TEST_ASSERT(written_count < MAX_WRITTEN);
+	*location = written_count;
+	written_flags[written_count++] = flags;
+	return 0;
+}
+
+static sqfs_u64 rec_get_block_count(const sqfs_block_writer_t *wr)
+{
+	(void)wr;
+	return written_count;
+}
+
+static sqfs_block_writer_t rec_writer = {
+	{ 1, NULL, NULL },
+	rec_write_data_block,
+	rec_get_block_count,
+};
+
+static void test_incompressible(size_t block_size)
+{
+	static const int types[] = {
+		DATA_RANDOM, DATA_RUNS, DATA_TEXT, DATA_RANDOM, DATA_7BIT,
+	};
+	size_t i, num_blocks = sizeof(types) / sizeof(types[0]);
+	const sqfs_block_processor_stats_t *stats;
+	sqfs_block_processor_desc_t desc;
+	sqfs_inode_generic_t *inode;
+	sqfs_block_processor_t *proc;
+	sqfs_compressor_t *cmp;
+	sqfs_u8 *data;
+	int ret;
+
+	written_count = 0;
+	compress_count = 0;
+
+	cmp = rle_create(false);
+	data = malloc(block_size);
+	TEST_NOT_NULL(data);
+
+	memset(&desc, 0, sizeof(desc));
+	desc.size = sizeof(desc);
+	desc.max_block_size = block_size;
+	desc.num_workers = 2;
+	desc.max_backlog = 10;
+	desc.cmp = cmp;
+	desc.wr = &rec_writer;
+	desc.flags = SQFS_BLOCK_PROCESSOR_SKIP_INCOMPRESSIBLE;
+
+	ret = sqfs_block_processor_create_ex(&desc, &proc);
+	TEST_EQUAL_I(ret, 0);
+
+	ret = sqfs_block_processor_begin_file(proc, &inode, NULL,
+					      SQFS_BLK_DONT_FRAGMENT);
+	TEST_EQUAL_I(ret, 0);
+
+	for (i = 0; i < num_blocks; ++i) {
+		gen_data(data, block_size, i + 1, types[i]);
+
+		ret = sqfs_block_processor_append(proc, data, block_size);
+		TEST_EQUAL_I(ret, 0);
+	}
+
+	/* a random tail that is too small to be checked */
+	gen_data(data, 1000, 42, DATA_RANDOM);
+	ret = sqfs_block_processor_append(proc, data, 1000);
+	TEST_EQUAL_I(ret, 0);
+
+	ret = sqfs_block_processor_end_file(proc);
+	TEST_EQUAL_I(ret, 0);
+
+	ret = sqfs_block_processor_finish(proc);
+	TEST_EQUAL_I(ret, 0);
+
+	TEST_EQUAL_UI(written_count, num_blocks + 1);
+
+	for (i = 0; i < num_blocks; ++i) {
+		if (types[i] == DATA_RANDOM) {
+			TEST_ASSERT(written_flags[i] & SQFS_BLK_DONT_COMPRESS);
+		} else {
+			TEST_ASSERT(!(written_flags[i] &
+				      SQFS_BLK_DONT_COMPRESS));
+		}
+	}
+
+	TEST_ASSERT(!(written_flags[num_blocks] & SQFS_BLK_DONT_COMPRESS));
+
+	/* only the blocks that were not skipped went to the compressor */
+	stats = sqfs_block_processor_get_stats(proc);
+	TEST_EQUAL_UI(stats->incompressible_block_count, 2);
+	TEST_EQUAL_UI(compress_count, num_blocks + 1 - 2);
+
+	sqfs_drop(proc);
+	sqfs_drop(cmp);
+	free(inode);
+	free(data);
+}
+
+static void test_block_cache(void)
+{
+	size_t i, count, first;
+	mem_cache_t *cache;
+	image_t ref, img;
+
+	pack(&ref, 0, 4, 0);
+	TEST_ASSERT(ref.compressed > 0);
+
+	cache = cache_create();
+	block_cache = (sqfs_block_cache_t *)cache;
+
+	/*
+	  An empty cache. After the sync, the duplicates in the second round
+	  are found in the cache instead of being compressed again.
+	 */
+	pack(&img, 0, 4, 0);
+	check_image_equal(&ref, &img);
+	TEST_ASSERT(img.compressed > 0);
+	TEST_ASSERT(img.compressed < ref.compressed);
+	TEST_ASSERT(cache->count > 0);
+	TEST_ASSERT(cache->hits > 0);
+	first = img.compressed;
+	count = cache->count;
+	image_cleanup(&img);
+
+	/* everything is found the next time around */
+	pack(&img, 0, 4, 0);
+	check_image_equal(&ref, &img);
+	TEST_EQUAL_UI(img.compressed, 0);
+	TEST_EQUAL_UI(cache->count, count);
+	image_cleanup(&img);
+
+	/* a different compressor configuration uses different keys */
+	compress_level = 1;
+
+	pack(&img, 0, 4, 0);
+	check_image_equal(&ref, &img);
+	TEST_EQUAL_UI(img.compressed, first);
+	TEST_EQUAL_UI(cache->count, 2 * count);
+	image_cleanup(&img);
+
+	/* entries that cannot be valid are ignored and replaced */
+	for (i = 0; i < cache->count; ++i)
+		cache->entries[i].size = BLOCK_SIZE;
+
+	pack(&img, 0, 4, 0);
+	check_image_equal(&ref, &img);
+	TEST_EQUAL_UI(img.compressed, first);
+	TEST_EQUAL_UI(cache->count, 2 * count);
+	image_cleanup(&img);
+
+	/* entries that decompress to something else are not used either */
+	for (i = 0; i < cache->count; ++i) {
+		if (cache->entries[i].size > 0 &&
+		    cache->entries[i].size < BLOCK_SIZE) {
+			cache->entries[i].data[1] ^= 0xFF;
+		}
+	}
+
+	pack(&img, 0, 4, 0);
+	check_image_equal(&ref, &img);
+	TEST_ASSERT(img.compressed > 0);
+	image_cleanup(&img);
+
+	pack(&img, 0, 4, 0);
+	check_image_equal(&ref, &img);
+	TEST_EQUAL_UI(img.compressed, 0);
+	image_cleanup(&img);
+
+	compress_level = 0;
+	block_cache = NULL;
+	sqfs_drop(cache);
+	image_cleanup(&ref);
+}
+
+int main(int argc, char **argv)
+{
+	(void)argc; (void)argv;
+
+	test_io_thread();
+	test_incompressible(1024);
+	test_incompressible(2048);
+	test_incompressible(BLOCK_SIZE);
+	test_incompressible(16 * BLOCK_SIZE);
+	test_block_cache();
+	test_pre_dedup(0);
+	test_pre_dedup(SQFS_BLOCK_PROCESSOR_SKIP_INCOMPRESSIBLE);
+	test_mem_limit(0);
+	test_mem_limit(SQFS_BLOCK_PROCESSOR_IO_THREAD |
+		       SQFS_BLOCK_PROCESSOR_PRE_DEDUP);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,257 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * block_writer.c
+ *
+ * Copyright (C) 2026 The squashfs-tools-ng contributors
+ */
+#include "config.h"
+#include "compat.h"
+#include "util/test.h"
+
+#include "sqfs/block_writer.h"
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+#include "sqfs/io.h"
+
+#define BLOCK_SIZE (64)
+#define MAX_BLOCKS (32)
+
+static sqfs_u8 file_data[MAX_BLOCKS * BLOCK_SIZE];
+static sqfs_u64 file_size = 0;
+
+static int mem_read_at(sqfs_file_t *file, sqfs_u64 offset,
+		       void *buffer, size_t size)
+{
+	(void)file;
+
+	if (offset > file_size || size > (file_size - offset))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	memcpy(buffer, file_data + offset, size);
+	return 0;
+}
+
+static int mem_write_at(sqfs_file_t *file, sqfs_u64 offset,
+			const void *buffer, size_t size)
+{
+	(void)file;
+
+	TEST_ASSERT(offset == file_size);
+	TEST_ASSERT(size <= (sizeof(file_data) - offset));
+
+	memcpy(file_data + offset, buffer, size);
+	file_size += size;
+	return 0;
+}
+
+static sqfs_u64 mem_get_size(const sqfs_file_t *file)
+{
+	(void)file;
+	return file_size;
+}
+
+static int mem_truncate(sqfs_file_t *file, sqfs_u64 size)
+{
+	(void)file;
+
+	TEST_ASSERT(size <= file_size);
+	file_size = size;
+	return 0;
+}
+
+static sqfs_file_t mem_file = {
+	{ 1, NULL, NULL },
+	mem_read_at,
+	mem_write_at,
+	mem_get_size,
+	mem_truncate,
+	NULL,
+};
+
+/*****************************************************************************/
+
+/*
+  Writes a file, where each character of the string is one block filled
+  with that character. The checksum is the lower case character, so upper
+  and lower case blocks look the same until they are compared.
+ */
+static sqfs_u64 write_file(sqfs_block_writer_t *wr, const char *blocks)
+{
+	sqfs_u8 data[BLOCK_SIZE];
+	sqfs_u32 flags, checksum;
+	sqfs_u64 location;
+	size_t i, count;
+	int ret;
+
+	count = strlen(blocks);
+	flags = SQFS_BLK_FIRST_BLOCK;
+
+	for (i = 0; i < count; ++i) {
+		if (i == (count - 1))
+			flags |= SQFS_BLK_LAST_BLOCK;
+
+		memset(data, blocks[i], sizeof(data));
+		checksum = blocks[i] | 0x20;
+
+		ret = wr->write_data_block(wr, NULL, sizeof(data), checksum,
+					   flags, data, &location);
+		TEST_EQUAL_I(ret, 0);
+
+		flags = 0;
+	}
+
+	return location;
+}
+
+static sqfs_block_writer_t *create_writer(sqfs_u32 flags)
+{
+	sqfs_block_writer_t *wr;
+
+	file_size = 0;
+
+	wr = sqfs_block_writer_create(&mem_file, flags);
+	TEST_NOT_NULL(wr);
+	return wr;
+}
+
+static void check_writer(const sqfs_block_writer_t *wr, size_t count)
+{
+	TEST_EQUAL_UI(wr->get_block_count(wr), count);
+	TEST_EQUAL_UI(file_size, count * BLOCK_SIZE);
+}
+
+/*****************************************************************************/
+
+static void test_whole_file(sqfs_u32 flags)
+{
+	sqfs_block_writer_t *wr = create_writer(flags);
+
+	TEST_EQUAL_UI(write_file(wr, "abc"), 0);
+	TEST_EQUAL_UI(write_file(wr, "de"), 3 * BLOCK_SIZE);
+	check_writer(wr, 5);
+
+	TEST_EQUAL_UI(write_file(wr, "abc"), 0);
+	check_writer(wr, 5);
+
+	TEST_EQUAL_UI(write_file(wr, "de"), 3 * BLOCK_SIZE);
+	check_writer(wr, 5);
+
+	/* a prefix or a suffix of a file */
+	TEST_EQUAL_UI(write_file(wr, "ab"), 0);
+	TEST_EQUAL_UI(write_file(wr, "cd"), 2 * BLOCK_SIZE);
+	check_writer(wr, 5);
+
+	/* not a match, the sequence has a block more */
+	TEST_EQUAL_UI(write_file(wr, "abcf"), 5 * BLOCK_SIZE);
+	check_writer(wr, 9);
+
+	sqfs_drop(wr);
+}
+
+static void test_earliest_match(sqfs_u32 flags)
+{
+	sqfs_block_writer_t *wr = create_writer(flags);
+
+	TEST_EQUAL_UI(write_file(wr, "xab"), 0);
+	TEST_EQUAL_UI(write_file(wr, "aby"), 3 * BLOCK_SIZE);
+	check_writer(wr, 6);
+
+	/* both files contain it, the first one wins */
+	TEST_EQUAL_UI(write_file(wr, "ab"), BLOCK_SIZE);
+	check_writer(wr, 6);
+
+	TEST_EQUAL_UI(write_file(wr, "b"), 2 * BLOCK_SIZE);
+	check_writer(wr, 6);
+
+	sqfs_drop(wr);
+}
+
+static void test_collision(sqfs_u32 flags)
+{
+	sqfs_block_writer_t *wr = create_writer(flags);
+
+	TEST_EQUAL_UI(write_file(wr, "ab"), 0);
+
+	/* same checksums and sizes, different data */
+	TEST_EQUAL_UI(write_file(wr, "Ab"), 2 * BLOCK_SIZE);
+	check_writer(wr, 4);
+
+	TEST_EQUAL_UI(write_file(wr, "aB"), 4 * BLOCK_SIZE);
+	check_writer(wr, 6);
+
+	/* the earlier candidates do not match, later ones do */
+	TEST_EQUAL_UI(write_file(wr, "Ab"), 2 * BLOCK_SIZE);
+	TEST_EQUAL_UI(write_file(wr, "aB"), 4 * BLOCK_SIZE);
+	TEST_EQUAL_UI(write_file(wr, "ab"), 0);
+	check_writer(wr, 6);
+
+	sqfs_drop(wr);
+}
+
+static void test_dropped_blocks(sqfs_u32 flags)
+{
+	sqfs_block_writer_t *wr = create_writer(flags);
+
+	TEST_EQUAL_UI(write_file(wr, "xw"), 0);
+	TEST_EQUAL_UI(write_file(wr, "xw"), 0);
+	check_writer(wr, 2);
+
+	/* takes the place of the dropped blocks */
+	TEST_EQUAL_UI(write_file(wr, "z"), 2 * BLOCK_SIZE);
+	check_writer(wr, 3);
+
+	TEST_EQUAL_UI(write_file(wr, "xw"), 0);
+	TEST_EQUAL_UI(write_file(wr, "w"), BLOCK_SIZE);
+	TEST_EQUAL_UI(write_file(wr, "z"), 2 * BLOCK_SIZE);
+	check_writer(wr, 3);
+
+	sqfs_drop(wr);
+}
+
+static void test_overlap(sqfs_u32 flags)
+{
+	sqfs_block_writer_t *wr = create_writer(flags);
+
+	/* the match overlaps the file itself, only the tail is dropped */
+	TEST_EQUAL_UI(write_file(wr, "q"), 0);
+	TEST_EQUAL_UI(write_file(wr, "qq"), 0);
+	check_writer(wr, 2);
+
+	TEST_EQUAL_UI(write_file(wr, "qqq"), 0);
+	check_writer(wr, 3);
+
+	TEST_EQUAL_UI(write_file(wr, "r"), 3 * BLOCK_SIZE);
+	TEST_EQUAL_UI(write_file(wr, "qqqq"), 4 * BLOCK_SIZE);
+	check_writer(wr, 8);
+
+	TEST_EQUAL_UI(write_file(wr, "qqq"), 0);
+	TEST_EQUAL_UI(write_file(wr, "rqqqq"), 3 * BLOCK_SIZE);
+	check_writer(wr, 8);
+
+	sqfs_drop(wr);
+}
+
+int main(int argc, char **argv)
+{
+	(void)argc; (void)argv;
+
+	test_whole_file(0);
+	test_whole_file(SQFS_BLOCK_WRITER_STRONG_HASH);
+	test_whole_file(SQFS_BLOCK_WRITER_HASH_COMPARE_ONLY);
+
+	test_earliest_match(0);
+	test_earliest_match(SQFS_BLOCK_WRITER_STRONG_HASH);
+	test_earliest_match(SQFS_BLOCK_WRITER_HASH_COMPARE_ONLY);
+
+	test_collision(0);
+	test_collision(SQFS_BLOCK_WRITER_STRONG_HASH);
+
+	test_dropped_blocks(0);
+	test_dropped_blocks(SQFS_BLOCK_WRITER_STRONG_HASH);
+	test_dropped_blocks(SQFS_BLOCK_WRITER_HASH_COMPARE_ONLY);
+
+	test_overlap(0);
+	test_overlap(SQFS_BLOCK_WRITER_STRONG_HASH);
+	test_overlap(SQFS_BLOCK_WRITER_HASH_COMPARE_ONLY);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,285 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * block_writer_benchmark.c
+ *
+ * Copyright (C) 2026 The squashfs-tools-ng contributors
+ */
+#include "config.h"
+#include "compat.h"
+#include "common.h"
+
+#include "sqfs/block_writer.h"
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+#include "sqfs/io.h"
+
+#include "util/util.h"
+
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+  A file that only keeps track of its size. The benchmark uses hash
+  comparison only, so nothing is ever read back.
+ */
+typedef struct {
+	sqfs_file_t base;
+	sqfs_u64 size;
+} null_file_t;
+
+static struct option long_opts[] = {
+	{ "file-count", required_argument, NULL, 'n' },
+	{ "total-size", required_argument, NULL, 's' },
+	{ "block-size", required_argument, NULL, 'b' },
+	{ "duplicates", required_argument, NULL, 'd' },
+	{ "help", no_argument, NULL, 'h' },
+	{ NULL, 0, NULL, 0 },
+};
+
+static const char *short_opts = "n:s:b:d:h";
+
+static const char *help_string =
+"Usage: block_writer_benchmark [OPTIONS...]\n"
+"\n"
+"Feeds the block checksums of a synthetic file tree through the default\n"
+"block writer and measures how long whole-file deduplication takes. No\n"
+"data is actually written anywhere.\n"
+"\n"
+"Possible options:\n"
+"\n"
+"  --file-count, -n <count>  The number of files to generate.\n"
+"                            Default: 1000000.\n"
+"  --total-size, -s <size>   The approximate sum of all file sizes.\n"
+"                            Default: 100G.\n"
+"  --block-size, -b <size>   The data block size. Default: 128k.\n"
+"  --duplicates, -d <count>  Percentage of files that are a copy of an\n"
+"                            earlier file. Default: 10.\n"
+"\n";
+
+static int null_read_at(sqfs_file_t *file, sqfs_u64 offset,
+			void *buffer, size_t size)
+{
+	(void)file; (void)offset; (void)buffer; (void)size;
+	return SQFS_ERROR_IO;
+}
+
+static int null_write_at(sqfs_file_t *base, sqfs_u64 offset,
+			 const void *buffer, size_t size)
+{
+	null_file_t *file = (null_file_t *)base;
+	(void)buffer;
+
+	if ((offset + size) > file->size)
+		file->size = offset + size;
+	return 0;
+}
+
+static sqfs_u64 null_get_size(const sqfs_file_t *file)
+{
+	return ((const null_file_t *)file)->size;
+}
+
+static int null_truncate(sqfs_file_t *file, sqfs_u64 size)
+{
+	((null_file_t *)file)->size = size;
+	return 0;
+}
+
+static const char *null_get_filename(sqfs_file_t *file)
+{
+	(void)file;
+	return "null";
+}
+
+static void null_destroy(sqfs_object_t *obj)
+{
+	free(obj);
+}
+
+static sqfs_u32 xorshift(sqfs_u32 *state)
+{
+	sqfs_u32 x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	*state = x;
+	return x;
+}
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static int write_file(sqfs_block_writer_t *wr, const sqfs_u8 *data,
+		      sqfs_u32 seed, sqfs_u64 file_size, size_t block_size,
+		      sqfs_u64 *block_count)
+{
+	sqfs_u32 flags, size, state = seed;
+	sqfs_u64 location;
+	int ret;
+
+	flags = SQFS_BLK_FIRST_BLOCK;
+
+	while (file_size > 0) {
+		size = file_size > block_size ? block_size : file_size;
+		file_size -= size;
+
+		if (file_size == 0)
+			flags |= SQFS_BLK_LAST_BLOCK;
+
+		/* pretend the block compressed to somewhat less than that */
+		size -= xorshift(&state) % (size / 2 + 1);
+
+		ret = wr->write_data_block(wr, NULL, size, xorshift(&state),
+					   flags | SQFS_BLK_IS_COMPRESSED,
+					   data, &location);
+		if (ret != 0)
+			return ret;
+
+		flags = 0;
+		*block_count += 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	sqfs_u64 total_size = 100ULL * 1024 * 1024 * 1024, file_size;
+	size_t i, block_size = 131072, count = 1000000, dup_percent = 10;
+	sqfs_u64 avg_size, block_count = 0, dup_count = 0;
+	sqfs_u32 rng = 0xDEADBEEF, seed, *seeds;
+	sqfs_u64 *sizes;
+	sqfs_block_writer_t *wr;
+	double start, end;
+	null_file_t *file;
+	sqfs_u8 *data;
+	int ret;
+
+	for (;;) {
+		int opt = getopt_long(argc, argv, short_opts, long_opts, NULL);
+		if (opt == -1)
+			break;
+
+		switch (opt) {
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			if (parse_size("Total size", &i, optarg, 0))
+				return EXIT_FAILURE;
+			total_size = i;
+			break;
+		case 'b':
+			if (parse_size("Block size", &block_size, optarg, 0))
+				return EXIT_FAILURE;
+			break;
+		case 'd':
+			dup_percent = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			fputs(help_string, stdout);
+			return EXIT_SUCCESS;
+		default:
+			goto fail_arg;
+		}
+	}
+
+	if (count < 1 || block_size < 1 || dup_percent > 100) {
+		fputs("File count and block size must be at least 1, the "
+		      "duplicate percentage at most 100.\n", stderr);
+		goto fail_arg;
+	}
+
+	avg_size = total_size / count;
+	if (avg_size < 1)
+		avg_size = 1;
+
+	file = calloc(1, sizeof(*file));
+	data = calloc(1, block_size);
+	seeds = alloc_array(sizeof(seeds[0]), count);
+	sizes = alloc_array(sizeof(sizes[0]), count);
+
+	if (file == NULL || data == NULL || seeds == NULL || sizes == NULL) {
+		fputs("out of memory\n", stderr);
+		goto fail;
+	}
+
+	sqfs_object_init(file, null_destroy, NULL);
+	((sqfs_file_t *)file)->read_at = null_read_at;
+	((sqfs_file_t *)file)->write_at = null_write_at;
+	((sqfs_file_t *)file)->get_size = null_get_size;
+	((sqfs_file_t *)file)->truncate = null_truncate;
+	((sqfs_file_t *)file)->get_filename = null_get_filename;
+
+	wr = sqfs_block_writer_create((sqfs_file_t *)file,
+				      SQFS_BLOCK_WRITER_HASH_COMPARE_ONLY);
+	if (wr == NULL) {
+		fputs("error creating block writer\n", stderr);
+		goto fail;
+	}
+
+	start = get_time();
+
+	for (i = 0; i < count; ++i) {
+		if (i > 0 && (xorshift(&rng) % 100) < dup_percent) {
+			size_t src = xorshift(&rng) % i;
+
+			seed = seeds[src];
+			file_size = sizes[src];
+			dup_count += 1;
+		} else {
+			seed = xorshift(&rng);
+			file_size = 1 + (((sqfs_u64)xorshift(&rng) << 32) |
+					 xorshift(&rng)) % (2 * avg_size);
+		}
+
+		seeds[i] = seed;
+		sizes[i] = file_size;
+
+		ret = write_file(wr, data, seed, file_size, block_size,
+				 &block_count);
+		if (ret != 0) {
+			sqfs_perror("block_writer_benchmark",
+				    "writing blocks", ret);
+			sqfs_drop(wr);
+			goto fail;
+		}
+	}
+
+	end = get_time();
+
+	printf("Files:            %lu (%lu duplicates)\n",
+	       (unsigned long)count, (unsigned long)dup_count);
+	printf("Blocks submitted: %lu\n", (unsigned long)block_count);
+	printf("Blocks stored:    %lu\n",
+	       (unsigned long)wr->get_block_count(wr));
+	printf("Time:             %.3f s\n", end - start);
+	printf("Files per second: %.0f\n", (double)count / (end - start));
+
+	sqfs_drop(wr);
+	sqfs_drop(file);
+	free(sizes);
+	free(seeds);
+	free(data);
+	return EXIT_SUCCESS;
+fail:
+	free(sizes);
+	free(seeds);
+	free(data);
+	free(file);
+	return EXIT_FAILURE;
+fail_arg:
+	fputs("Try `block_writer_benchmark --help' for more information.\n",
+	      stderr);
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,528 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * data_reader.c
+ *
+ * Copyright (C) 2026 The squashfs-tools-ng contributors
+ */
+#include "config.h"
+#include "compat.h"
+#include "util/test.h"
+
+#include "sqfs/data_reader.h"
+#include "sqfs/compressor.h"
+#include "sqfs/inode.h"
+#include "sqfs/error.h"
+#include "sqfs/io.h"
+
+#define BLOCK_SIZE (4096)
+#define NUM_BLOCKS (6)
+
+static sqfs_u8 file_data[NUM_BLOCKS * BLOCK_SIZE];
+static size_t uncompress_count = 0;
+
+static int dummy_read_at(sqfs_file_t *file, sqfs_u64 offset,
+			 void *buffer, size_t size)
+{
+	(void)file;
+
+	if (offset >= sizeof(file_data))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	if (size > (sizeof(file_data) - offset))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	memcpy(buffer, file_data + offset, size);
+	return 0;
+}
+
+static sqfs_s32 dummy_uncompress(sqfs_compressor_t *cmp, const sqfs_u8 *in,
+				 sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
+{
+	(void)cmp;
+	if (outsize < size)
+		return 0;
+	memcpy(out, in, size);
+	uncompress_count += 1;
+	return size;
+}
+
+static sqfs_file_t dummy_file = {
+	{ 1, NULL, NULL },
+	dummy_read_at,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+};
+
+static sqfs_compressor_t dummy_uncompressor = {
+	{ 1, NULL, NULL },
+	NULL,
+	NULL,
+	NULL,
+	dummy_uncompress,
+};
+
+/* a stateless compressor that can be copied for the read-ahead workers */
+static sqfs_s32 copy_uncompress(sqfs_compressor_t *cmp, const sqfs_u8 *in,
+				sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
+{
+	(void)cmp;
+	if (outsize < size)
+		return 0;
+	memcpy(out, in, size);
+	return size;
+}
+
+static sqfs_object_t *copy_uncompressor_copy(const sqfs_object_t *obj);
+
+static void copy_uncompressor_destroy(sqfs_object_t *obj)
+{
+	free(obj);
+}
+
+static sqfs_compressor_t copy_uncompressor = {
+	{ 1, NULL, copy_uncompressor_copy },
+	NULL,
+	NULL,
+	NULL,
+	copy_uncompress,
+};
+
+static sqfs_object_t *copy_uncompressor_copy(const sqfs_object_t *obj)
+{
+	sqfs_compressor_t *cmp = malloc(sizeof(*cmp));
+	(void)obj;
+
+	if (cmp != NULL) {
+		*cmp = copy_uncompressor;
+		((sqfs_object_t *)cmp)->destroy = copy_uncompressor_destroy;
+	}
+
+	return (sqfs_object_t *)cmp;
+}
+
+/*****************************************************************************/
+
+/* A file with 3 "compressed" blocks, starting at the given block index. */
+static sqfs_inode_generic_t *create_inode(size_t first)
+{
+	sqfs_inode_generic_t *inode;
+	size_t i;
+
+	inode = calloc(1, sizeof(*inode) + 3 * sizeof(sqfs_u32));
+	TEST_NOT_NULL(inode);
+
+	inode->base.type = SQFS_INODE_FILE;
+	inode->payload_bytes_available = 3 * sizeof(sqfs_u32);
+	inode->payload_bytes_used = 3 * sizeof(sqfs_u32);
+	inode->data.file.blocks_start = first * BLOCK_SIZE;
+	inode->data.file.fragment_index = 0xFFFFFFFF;
+	inode->data.file.fragment_offset = 0xFFFFFFFF;
+	inode->data.file.file_size = 3 * BLOCK_SIZE;
+
+	for (i = 0; i < 3; ++i)
+		inode->extra[i] = BLOCK_SIZE;
+
+	return inode;
+}
+
+static void read_block(sqfs_data_reader_t *rd,
+		       const sqfs_inode_generic_t *inode, size_t first,
+		       size_t index)
+{
+	sqfs_u8 buffer[128];
+	sqfs_s32 ret;
+	size_t i;
+
+	ret = sqfs_data_reader_read(rd, inode, index * BLOCK_SIZE + 100,
+				    buffer, sizeof(buffer));
+	TEST_EQUAL_I(ret, sizeof(buffer));
+
+	for (i = 0; i < sizeof(buffer); ++i)
+		TEST_EQUAL_UI(buffer[i], (first + index));
+}
+
+static void check_stats(sqfs_data_reader_t *rd, sqfs_u64 hits,
+			sqfs_u64 misses)
+{
+	const sqfs_data_reader_stats_t *stats = sqfs_data_reader_get_stats(rd);
+
+	TEST_EQUAL_UI(stats->size, sizeof(*stats));
+	TEST_EQUAL_UI(stats->cache_hits, hits);
+	TEST_EQUAL_UI(stats->cache_misses, misses);
+	TEST_EQUAL_UI(uncompress_count, misses);
+}
+
+/*
+  A file with a sparse block, an uncompressed block and a short final
+  block, read through streams with read-ahead.
+ */
+static const sqfs_u8 stream_expect[NUM_BLOCKS] = { 0, 1, 0, 2, 3, 4 };
+
+static sqfs_inode_generic_t *create_stream_inode(void)
+{
+	sqfs_inode_generic_t *inode;
+	size_t i;
+
+	inode = calloc(1, sizeof(*inode) + NUM_BLOCKS * sizeof(sqfs_u32));
+	TEST_NOT_NULL(inode);
+
+	inode->base.type = SQFS_INODE_FILE;
+	inode->payload_bytes_available = NUM_BLOCKS * sizeof(sqfs_u32);
+	inode->payload_bytes_used = NUM_BLOCKS * sizeof(sqfs_u32);
+	inode->data.file.blocks_start = 0;
+	inode->data.file.fragment_index = 0xFFFFFFFF;
+	inode->data.file.fragment_offset = 0xFFFFFFFF;
+	inode->data.file.file_size = NUM_BLOCKS * BLOCK_SIZE - 100;
+
+	for (i = 0; i < NUM_BLOCKS; ++i)
+		inode->extra[i] = BLOCK_SIZE;
+
+	inode->extra[2] = 0;
+	inode->extra[3] |= 1 << 24;
+	inode->extra[NUM_BLOCKS - 1] = BLOCK_SIZE - 100;
+	return inode;
+}
+
+static void check_stream_block(sqfs_istream_t *strm, size_t index)
+{
+	sqfs_u8 buffer[BLOCK_SIZE];
+	size_t i, size = BLOCK_SIZE;
+	sqfs_s32 ret;
+
+	if (index == NUM_BLOCKS - 1)
+		size -= 100;
+
+	ret = sqfs_istream_read(strm, buffer, sizeof(buffer));
+	TEST_EQUAL_I(ret, size);
+
+	for (i = 0; i < size; ++i)
+		TEST_EQUAL_UI(buffer[i], stream_expect[index]);
+}
+
+static void test_read_ahead(void)
+{
+	sqfs_istream_t *strm[2];
+	sqfs_inode_generic_t *inode;
+	sqfs_data_reader_t *rd;
+	size_t i;
+	int ret;
+
+	inode = create_stream_inode();
+
+	rd = sqfs_data_reader_create(&dummy_file, BLOCK_SIZE,
+				     &copy_uncompressor, 0);
+	TEST_NOT_NULL(rd);
+
+	ret = sqfs_data_reader_set_read_ahead(rd, 2, 3);
+	TEST_EQUAL_I(ret, 0);
+
+	/* two streams share the worker pool */
+	ret = sqfs_data_reader_create_stream(rd, inode, "a", &strm[0]);
+	TEST_EQUAL_I(ret, 0);
+	ret = sqfs_data_reader_create_stream(rd, inode, "b", &strm[1]);
+	TEST_EQUAL_I(ret, 0);
+
+	ret = sqfs_data_reader_set_read_ahead(rd, 0, 0);
+	TEST_EQUAL_I(ret, SQFS_ERROR_SEQUENCE);
+
+	for (i = 0; i < NUM_BLOCKS; ++i) {
+		check_stream_block(strm[0], i);
+		if (i < 2)
+			check_stream_block(strm[1], i);
+	}
+
+	ret = sqfs_istream_read(strm[0], &i, sizeof(i));
+	TEST_EQUAL_I(ret, 0);
+
+	/* dropping a stream with blocks in flight must be safe */
+	sqfs_drop(strm[0]);
+	sqfs_drop(strm[1]);
+
+	ret = sqfs_data_reader_set_read_ahead(rd, 0, 0);
+	TEST_EQUAL_I(ret, 0);
+
+	ret = sqfs_data_reader_create_stream(rd, inode, "c", &strm[0]);
+	TEST_EQUAL_I(ret, 0);
+
+	for (i = 0; i < NUM_BLOCKS; ++i)
+		check_stream_block(strm[0], i);
+
+	sqfs_drop(strm[0]);
+	sqfs_drop(rd);
+	free(inode);
+}
+
+/*
+  A mostly sparse file with the given number of blocks. The blocks that
+  are not sparse are stored one after another, starting at the second
+  block of the data file.
+ */
+static sqfs_inode_generic_t *create_sparse_inode(size_t count,
+						 const size_t *used,
+						 size_t num_used)
+{
+	sqfs_inode_generic_t *inode;
+	size_t i;
+
+	inode = calloc(1, sizeof(*inode) + count * sizeof(sqfs_u32));
+	TEST_NOT_NULL(inode);
+
+	inode->base.type = SQFS_INODE_FILE;
+	inode->payload_bytes_available = count * sizeof(sqfs_u32);
+	inode->payload_bytes_used = count * sizeof(sqfs_u32);
+	inode->data.file.blocks_start = BLOCK_SIZE;
+	inode->data.file.fragment_index = 0xFFFFFFFF;
+	inode->data.file.fragment_offset = 0xFFFFFFFF;
+	inode->data.file.file_size = count * BLOCK_SIZE;
+
+	for (i = 0; i < num_used; ++i)
+		inode->extra[used[i]] = BLOCK_SIZE;
+
+	return inode;
+}
+
+static void check_sparse_block(sqfs_data_reader_t *rd,
+			       const sqfs_inode_generic_t *inode,
+			       size_t index, sqfs_u8 expect)
+{
+	sqfs_u8 buffer[64];
+	sqfs_s32 ret;
+	size_t i;
+
+	ret = sqfs_data_reader_read(rd, inode, index * BLOCK_SIZE + 32,
+				    buffer, sizeof(buffer));
+	TEST_EQUAL_I(ret, sizeof(buffer));
+
+	for (i = 0; i < sizeof(buffer); ++i)
+		TEST_EQUAL_UI(buffer[i], expect);
+}
+
+/*
+  A large, mostly sparse file, read backwards to go through the block
+  location table.
+ */
+static void test_block_index(void)
+{
+	static const size_t used[] = { 3, 10, 19 };
+	sqfs_inode_generic_t *inode;
+	sqfs_data_reader_t *rd;
+	sqfs_u8 buffer[64];
+	const sqfs_u8 *ptr;
+	size_t i, j, size;
+	sqfs_s32 ret;
+
+	inode = create_sparse_inode(20, used, sizeof(used) / sizeof(used[0]));
+
+	rd = sqfs_data_reader_create(&dummy_file, BLOCK_SIZE,
+				     &dummy_uncompressor, 0);
+	TEST_NOT_NULL(rd);
+
+	for (i = 20; i-- > 0; ) {
+		sqfs_u8 expect = 0;
+
+		for (j = 0; j < sizeof(used) / sizeof(used[0]); ++j) {
+			if (used[j] == i)
+				expect = j + 1;
+		}
+
+		check_sparse_block(rd, inode, i, expect);
+
+		ret = sqfs_data_reader_borrow_block(rd, inode, i, &size, &ptr);
+		TEST_EQUAL_I(ret, 0);
+		TEST_EQUAL_UI(size, BLOCK_SIZE);
+		TEST_EQUAL_UI(ptr[0], expect);
+		TEST_EQUAL_UI(ptr[BLOCK_SIZE - 1], expect);
+		sqfs_data_reader_release(rd, ptr);
+	}
+
+	/* reads that start exactly on a block boundary */
+	ret = sqfs_data_reader_read(rd, inode, 10 * BLOCK_SIZE,
+				    buffer, sizeof(buffer));
+	TEST_EQUAL_I(ret, sizeof(buffer));
+	TEST_EQUAL_UI(buffer[0], 2);
+
+	ret = sqfs_data_reader_borrow_block(rd, inode, 20, &size, &ptr);
+	TEST_EQUAL_I(ret, SQFS_ERROR_OUT_OF_BOUNDS);
+
+	sqfs_drop(rd);
+	free(inode);
+}
+
+/*
+  Two files with the same start, size and number of blocks, that only
+  differ in where the sparse blocks are (and in the inode number, as
+  they would in an image). They must not share a table.
+ */
+static void test_block_index_layout(void)
+{
+	static const size_t used_a[] = { 0, 1 };
+	static const size_t used_b[] = { 14, 15 };
+	sqfs_inode_generic_t *a, *b;
+	sqfs_data_reader_t *rd;
+
+	a = create_sparse_inode(16, used_a, 2);
+	b = create_sparse_inode(16, used_b, 2);
+	a->base.inode_number = 1;
+	b->base.inode_number = 2;
+
+	rd = sqfs_data_reader_create(&dummy_file, BLOCK_SIZE,
+				     &dummy_uncompressor, 0);
+	TEST_NOT_NULL(rd);
+
+	check_sparse_block(rd, a, 1, 2);
+	check_sparse_block(rd, b, 15, 2);
+	check_sparse_block(rd, b, 14, 1);
+	check_sparse_block(rd, a, 0, 1);
+	check_sparse_block(rd, a, 15, 0);
+	check_sparse_block(rd, b, 1, 0);
+
+	sqfs_drop(rd);
+	free(a);
+	free(b);
+}
+
+/* a copy has its own compressor and an empty cache of its own */
+static void test_copy(void)
+{
+	const sqfs_data_reader_stats_t *stats;
+	sqfs_data_reader_t *rd, *copy;
+	sqfs_inode_generic_t *inode;
+	size_t i, refcount;
+
+	inode = create_inode(0);
+
+	rd = sqfs_data_reader_create(&dummy_file, BLOCK_SIZE,
+				     &copy_uncompressor, 0);
+	TEST_NOT_NULL(rd);
+
+	read_block(rd, inode, 0, 0);
+	refcount = copy_uncompressor.base.refcount;
+
+	copy = sqfs_copy(rd);
+	TEST_NOT_NULL(copy);
+	TEST_EQUAL_UI(((sqfs_object_t *)copy)->refcount, 1);
+	TEST_EQUAL_UI(copy_uncompressor.base.refcount, refcount);
+
+	for (i = 0; i < 3; ++i)
+		read_block(copy, inode, 0, i);
+
+	stats = sqfs_data_reader_get_stats(copy);
+	TEST_EQUAL_UI(stats->cache_hits, 0);
+	TEST_EQUAL_UI(stats->cache_misses, 3);
+
+	sqfs_drop(rd);
+	TEST_EQUAL_UI(copy_uncompressor.base.refcount, 1);
+
+	read_block(copy, inode, 0, 0);
+	sqfs_drop(copy);
+	free(inode);
+}
+
+int main(int argc, char **argv)
+{
+	sqfs_inode_generic_t *a, *b;
+	sqfs_data_reader_t *rd;
+	const sqfs_u8 *ptr[3];
+	size_t i, size;
+	sqfs_u8 *blk;
+	int ret;
+	(void)argc; (void)argv;
+
+	for (i = 0; i < NUM_BLOCKS; ++i)
+		memset(file_data + i * BLOCK_SIZE, i, BLOCK_SIZE);
+
+	a = create_inode(0);
+	b = create_inode(3);
+
+	rd = sqfs_data_reader_create(&dummy_file, BLOCK_SIZE,
+				     &dummy_uncompressor, 0);
+	TEST_NOT_NULL(rd);
+	check_stats(rd, 0, 0);
+
+	/* interleaved reads from two files only decompress once */
+	for (i = 0; i < 3; ++i) {
+		read_block(rd, a, 0, 0);
+		read_block(rd, b, 3, 0);
+		read_block(rd, a, 0, 1);
+		read_block(rd, b, 3, 1);
+	}
+	check_stats(rd, 8, 4);
+
+	/* full blocks are taken from the cache as well */
+	ret = sqfs_data_reader_get_block(rd, b, 1, &size, &blk);
+	TEST_EQUAL_I(ret, 0);
+	TEST_EQUAL_UI(size, BLOCK_SIZE);
+	TEST_EQUAL_UI(blk[0], 4);
+	TEST_EQUAL_UI(blk[BLOCK_SIZE - 1], 4);
+	sqfs_free(blk);
+	check_stats(rd, 9, 4);
+
+	/* least recently used blocks are evicted first */
+	ret = sqfs_data_reader_set_cache_size(rd, 0);
+	TEST_EQUAL_I(ret, SQFS_ERROR_ARG_INVALID);
+
+	ret = sqfs_data_reader_set_cache_size(rd, 2);
+	TEST_EQUAL_I(ret, 0);
+
+	read_block(rd, a, 0, 0);
+	read_block(rd, a, 0, 1);
+	read_block(rd, a, 0, 0);
+	check_stats(rd, 10, 6);
+
+	read_block(rd, a, 0, 2);
+	read_block(rd, a, 0, 0);
+	check_stats(rd, 11, 7);
+
+	read_block(rd, a, 0, 1);
+	read_block(rd, a, 0, 2);
+	check_stats(rd, 11, 9);
+
+	/* borrowed blocks stay valid, even if the cache is too small */
+	ret = sqfs_data_reader_borrow_block(rd, b, 0, &size, &ptr[0]);
+	TEST_EQUAL_I(ret, 0);
+	TEST_EQUAL_UI(size, BLOCK_SIZE);
+
+	ret = sqfs_data_reader_borrow_block(rd, b, 1, &size, &ptr[1]);
+	TEST_EQUAL_I(ret, 0);
+	TEST_EQUAL_UI(size, BLOCK_SIZE);
+
+	ret = sqfs_data_reader_borrow_block(rd, b, 0, &size, &ptr[2]);
+	TEST_EQUAL_I(ret, 0);
+	TEST_ASSERT(ptr[0] == ptr[2]);
+	check_stats(rd, 12, 11);
+
+	for (i = 0; i < 3; ++i) {
+		read_block(rd, a, 0, i);
+		read_block(rd, b, 3, 2);
+	}
+	check_stats(rd, 12, 17);
+
+	TEST_EQUAL_UI(ptr[0][0], 3);
+	TEST_EQUAL_UI(ptr[0][BLOCK_SIZE - 1], 3);
+	TEST_EQUAL_UI(ptr[1][0], 4);
+	TEST_EQUAL_UI(ptr[1][BLOCK_SIZE - 1], 4);
+
+	/* once released, they are recycled again */
+	sqfs_data_reader_release(rd, ptr[0]);
+	sqfs_data_reader_release(rd, ptr[1]);
+	read_block(rd, b, 3, 0);
+	check_stats(rd, 13, 17);
+
+	sqfs_data_reader_release(rd, ptr[2]);
+	read_block(rd, a, 0, 0);
+	read_block(rd, a, 0, 1);
+	read_block(rd, b, 3, 0);
+	check_stats(rd, 13, 20);
+
+	sqfs_drop(rd);
+	free(a);
+	free(b);
+
+	test_read_ahead();
+	test_block_index();
+	test_block_index_layout();
+	test_copy();
+	return EXIT_SUCCESS;
+}
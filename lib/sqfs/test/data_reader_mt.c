@@ -0,0 +1,190 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * data_reader_mt.c
+ *
+ * Copyright (C) 2026 The squashfs-tools-ng contributors
+ */
+#include "config.h"
+#include "compat.h"
+#include "util/test.h"
+
+#include "sqfs/data_reader.h"
+#include "sqfs/compressor.h"
+#include "sqfs/inode.h"
+#include "sqfs/error.h"
+#include "sqfs/io.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#define BLOCK_SIZE (4096)
+#define NUM_BLOCKS (6)
+#define NUM_THREADS (4)
+#define NUM_ROUNDS (50)
+
+static sqfs_u8 file_data[NUM_BLOCKS * BLOCK_SIZE];
+static size_t uncompress_count = 0;
+
+static int dummy_read_at(sqfs_file_t *file, sqfs_u64 offset,
+			 void *buffer, size_t size)
+{
+	(void)file;
+
+	if (offset >= sizeof(file_data))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	if (size > (sizeof(file_data) - offset))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	memcpy(buffer, file_data + offset, size);
+	return 0;
+}
+
+static sqfs_s32 dummy_uncompress(sqfs_compressor_t *cmp, const sqfs_u8 *in,
+				 sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
+{
+	int i;
+	(void)cmp;
+
+	if (outsize < size)
+		return 0;
+
+	__atomic_add_fetch(&uncompress_count, 1, __ATOMIC_SEQ_CST);
+
+	/* give the other threads a chance to ask for the same block */
+	for (i = 0; i < 10; ++i)
+		sched_yield();
+
+	memcpy(out, in, size);
+	return size;
+}
+
+static sqfs_file_t dummy_file = {
+	{ 1, NULL, NULL },
+	dummy_read_at,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+};
+
+static sqfs_object_t *dummy_copy(const sqfs_object_t *obj);
+
+static void dummy_destroy(sqfs_object_t *obj)
+{
+	free(obj);
+}
+
+static sqfs_compressor_t dummy_uncompressor = {
+	{ 1, NULL, dummy_copy },
+	NULL,
+	NULL,
+	NULL,
+	dummy_uncompress,
+};
+
+static sqfs_object_t *dummy_copy(const sqfs_object_t *obj)
+{
+	sqfs_compressor_t *cmp = malloc(sizeof(*cmp));
+	(void)obj;
+
+	if (cmp != NULL) {
+		*cmp = dummy_uncompressor;
+		((sqfs_object_t *)cmp)->destroy = dummy_destroy;
+	}
+
+	return (sqfs_object_t *)cmp;
+}
+
+/*****************************************************************************/
+
+static sqfs_data_reader_t *rd;
+static sqfs_inode_generic_t *inode;
+
+static void *read_thread(void *arg)
+{
+	size_t i, j, idx, size, offset = (size_t)arg;
+	sqfs_u8 buffer[128];
+	const sqfs_u8 *ptr;
+	sqfs_s32 ret;
+
+	for (i = 0; i < NUM_ROUNDS; ++i) {
+		for (j = 0; j < NUM_BLOCKS; ++j) {
+			idx = (j + offset) % NUM_BLOCKS;
+
+			ret = sqfs_data_reader_read(rd, inode,
+						    idx * BLOCK_SIZE + 100,
+						    buffer, sizeof(buffer));
+			TEST_EQUAL_I(ret, sizeof(buffer));
+			TEST_EQUAL_UI(buffer[0], idx);
+			TEST_EQUAL_UI(buffer[sizeof(buffer) - 1], idx);
+
+			ret = sqfs_data_reader_borrow_block(rd, inode, idx,
+							    &size, &ptr);
+			TEST_EQUAL_I(ret, 0);
+			TEST_EQUAL_UI(size, BLOCK_SIZE);
+			TEST_EQUAL_UI(ptr[0], idx);
+			TEST_EQUAL_UI(ptr[BLOCK_SIZE - 1], idx);
+			sqfs_data_reader_release(rd, ptr);
+		}
+	}
+
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	const sqfs_data_reader_stats_t *stats;
+	pthread_t threads[NUM_THREADS];
+	size_t i;
+	int ret;
+	(void)argc; (void)argv;
+
+	for (i = 0; i < NUM_BLOCKS; ++i)
+		memset(file_data + i * BLOCK_SIZE, i, BLOCK_SIZE);
+
+	inode = calloc(1, sizeof(*inode) + NUM_BLOCKS * sizeof(sqfs_u32));
+	TEST_NOT_NULL(inode);
+
+	inode->base.type = SQFS_INODE_FILE;
+	inode->payload_bytes_available = NUM_BLOCKS * sizeof(sqfs_u32);
+	inode->payload_bytes_used = NUM_BLOCKS * sizeof(sqfs_u32);
+	inode->data.file.fragment_index = 0xFFFFFFFF;
+	inode->data.file.fragment_offset = 0xFFFFFFFF;
+	inode->data.file.file_size = NUM_BLOCKS * BLOCK_SIZE;
+
+	for (i = 0; i < NUM_BLOCKS; ++i)
+		inode->extra[i] = BLOCK_SIZE;
+
+	rd = sqfs_data_reader_create(&dummy_file, BLOCK_SIZE,
+				     &dummy_uncompressor,
+				     SQFS_DATA_READER_THREAD_SAFE);
+	TEST_NOT_NULL(rd);
+
+	ret = sqfs_data_reader_set_read_ahead(rd, 2, 0);
+	TEST_EQUAL_I(ret, SQFS_ERROR_UNSUPPORTED);
+
+	/* large enough that no shard ever has to evict anything */
+	ret = sqfs_data_reader_set_cache_size(rd, 8 * NUM_BLOCKS);
+	TEST_EQUAL_I(ret, 0);
+
+	for (i = 0; i < NUM_THREADS; ++i) {
+		ret = pthread_create(threads + i, NULL, read_thread,
+				     (void *)i);
+		TEST_EQUAL_I(ret, 0);
+	}
+
+	for (i = 0; i < NUM_THREADS; ++i)
+		pthread_join(threads[i], NULL);
+
+	/* every block was decompressed exactly once and shared */
+	stats = sqfs_data_reader_get_stats(rd);
+	TEST_EQUAL_UI(uncompress_count, NUM_BLOCKS);
+	TEST_EQUAL_UI(stats->cache_misses, NUM_BLOCKS);
+	TEST_EQUAL_UI(stats->cache_hits,
+		      2 * NUM_THREADS * NUM_ROUNDS * NUM_BLOCKS - NUM_BLOCKS);
+
+	sqfs_drop(rd);
+	free(inode);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,390 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * dir_lookup.c
+ *
+ * Copyright (C) 2026 The squashfs-tools-ng contributors
+ */
+#include "config.h"
+#include "compat.h"
+#include "util/test.h"
+
+#include "sqfs/meta_writer.h"
+#include "sqfs/dir_writer.h"
+#include "sqfs/dir_reader.h"
+#include "sqfs/compressor.h"
+#include "sqfs/super.h"
+#include "sqfs/inode.h"
+#include "sqfs/error.h"
+#include "sqfs/table.h"
+#include "sqfs/dir.h"
+#include "sqfs/io.h"
+
+#define NUM_ENTRIES (4000)
+
+static sqfs_u8 file_data[128 * 1024];
+static size_t file_used = 0;
+
+static int dummy_read_at(sqfs_file_t *file, sqfs_u64 offset,
+			 void *buffer, size_t size)
+{
+	(void)file;
+
+	if (offset >= file_used)
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	if (size > (file_used - offset))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	memcpy(buffer, file_data + offset, size);
+	return 0;
+}
+
+static int dummy_write_at(sqfs_file_t *file, sqfs_u64 offset,
+			  const void *buffer, size_t size)
+{
+	(void)file;
+
+	if (offset >= sizeof(file_data))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	if (size > (sizeof(file_data) - offset))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	if (offset > file_used)
+		memset(file_data + file_used, 0, offset - file_used);
+
+	if ((offset + size) > file_used)
+		file_used = offset + size;
+
+	memcpy(file_data + offset, buffer, size);
+	return 0;
+}
+
+static sqfs_u64 dummy_get_size(const sqfs_file_t *file)
+{
+	(void)file;
+	return file_used;
+}
+
+static sqfs_s32 dummy_compress(sqfs_compressor_t *cmp, const sqfs_u8 *in,
+			       sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
+{
+	(void)cmp; (void)in; (void)size; (void)out; (void)outsize;
+	return 0;
+}
+
+static sqfs_file_t dummy_file = {
+	{ 1, NULL, NULL },
+	dummy_read_at,
+	dummy_write_at,
+	dummy_get_size,
+	NULL,
+	NULL,
+};
+
+static sqfs_compressor_t dummy_compressor = {
+	{ 1, NULL, NULL },
+	NULL,
+	NULL,
+	NULL,
+	dummy_compress,
+};
+
+/*****************************************************************************/
+
+static sqfs_u64 entry_ref(size_t i)
+{
+	/* start a new header every now and then */
+	return ((sqfs_u64)(i / 100) << 16) | (i % 100);
+}
+
+static sqfs_inode_generic_t *write_image(sqfs_super_t *super)
+{
+	sqfs_u64 export_tbl[NUM_ENTRIES + 1];
+	sqfs_meta_writer_t *dm, *im;
+	sqfs_inode_generic_t *inode;
+	sqfs_dir_writer_t *dir;
+	char name[32];
+	size_t i;
+	int ret;
+
+	dm = sqfs_meta_writer_create(&dummy_file, &dummy_compressor,
+				     SQFS_META_WRITER_KEEP_IN_MEMORY);
+	TEST_NOT_NULL(dm);
+
+	dir = sqfs_dir_writer_create(dm, 0);
+	TEST_NOT_NULL(dir);
+
+	ret = sqfs_dir_writer_begin(dir, 0);
+	TEST_EQUAL_I(ret, 0);
+
+	for (i = 0; i < NUM_ENTRIES; ++i) {
+		sprintf(name, "file%05u", (unsigned int)(i * 2));
+
+		ret = sqfs_dir_writer_add_entry(dir, name, i + 2,
+						entry_ref(i), S_IFREG | 0644);
+		TEST_EQUAL_I(ret, 0);
+	}
+
+	ret = sqfs_dir_writer_end(dir);
+	TEST_EQUAL_I(ret, 0);
+
+	ret = sqfs_meta_writer_flush(dm);
+	TEST_EQUAL_I(ret, 0);
+
+	inode = sqfs_dir_writer_create_inode(dir, 0, 0xFFFFFFFF, 1);
+	TEST_NOT_NULL(inode);
+	TEST_EQUAL_UI(inode->base.type, SQFS_INODE_EXT_DIR);
+	TEST_ASSERT(inode->data.dir_ext.inodex_count > 1);
+	inode->base.mode = S_IFDIR | 0755;
+	inode->base.inode_number = 1;
+
+	/* the inode table only holds the root directory */
+	im = sqfs_meta_writer_create(&dummy_file, &dummy_compressor, 0);
+	TEST_NOT_NULL(im);
+
+	ret = sqfs_meta_writer_write_inode(im, inode);
+	TEST_EQUAL_I(ret, 0);
+
+	ret = sqfs_meta_writer_flush(im);
+	TEST_EQUAL_I(ret, 0);
+
+	memset(super, 0, sizeof(*super));
+	super->root_inode_ref = 0;
+	super->inode_table_start = 0;
+	super->directory_table_start = file_used;
+
+	ret = sqfs_meta_write_write_to_file(dm);
+	TEST_EQUAL_I(ret, 0);
+
+	/* root inode first, followed by the directory entries */
+	export_tbl[0] = htole64(0);
+
+	for (i = 0; i < NUM_ENTRIES; ++i)
+		export_tbl[i + 1] = htole64(entry_ref(i));
+
+	ret = sqfs_write_table(&dummy_file, &dummy_compressor, export_tbl,
+			       sizeof(export_tbl), &super->export_table_start);
+	TEST_EQUAL_I(ret, 0);
+
+	super->flags |= SQFS_FLAG_EXPORTABLE;
+	super->inode_count = NUM_ENTRIES + 1;
+	super->id_table_start = file_used;
+	super->fragment_table_start = file_used;
+
+	sqfs_drop(dir);
+	sqfs_drop(dm);
+	sqfs_drop(im);
+	return inode;
+}
+
+static void lookup_all(sqfs_dir_reader_t *rd,
+		       const sqfs_inode_generic_t *inode)
+{
+	char name[32];
+	sqfs_u64 ref;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < NUM_ENTRIES; ++i) {
+		sprintf(name, "file%05u", (unsigned int)(i * 2));
+
+		ref = 0;
+		ret = sqfs_dir_reader_resolve_path(rd, name, inode, &ref);
+		TEST_EQUAL_I(ret, 0);
+		TEST_EQUAL_UI(ref, entry_ref(i));
+
+		/* names in between and past the end do not exist */
+		sprintf(name, "file%05u", (unsigned int)(i * 2 + 1));
+		ret = sqfs_dir_reader_resolve_path(rd, name, inode, &ref);
+		TEST_EQUAL_I(ret, SQFS_ERROR_NO_ENTRY);
+
+		sprintf(name, "file%05ux", (unsigned int)(i * 2));
+		ret = sqfs_dir_reader_resolve_path(rd, name, inode, &ref);
+		TEST_EQUAL_I(ret, SQFS_ERROR_NO_ENTRY);
+	}
+
+	ret = sqfs_dir_reader_resolve_path(rd, "file", inode, &ref);
+	TEST_EQUAL_I(ret, SQFS_ERROR_NO_ENTRY);
+
+	ret = sqfs_dir_reader_resolve_path(rd, "aaa", inode, &ref);
+	TEST_EQUAL_I(ret, SQFS_ERROR_NO_ENTRY);
+
+	ret = sqfs_dir_reader_resolve_path(rd, "zzz", inode, &ref);
+	TEST_EQUAL_I(ret, SQFS_ERROR_NO_ENTRY);
+}
+
+static void read_all(sqfs_dir_reader_t *rd,
+		     const sqfs_inode_generic_t *inode)
+{
+	sqfs_dir_reader_state_t state;
+	sqfs_dir_node_t *ent = NULL;
+	const void *first = NULL;
+	size_t i, size = 0;
+	char name[32];
+	int ret;
+
+	ret = sqfs_dir_reader_open_dir(rd, inode, &state, 0);
+	TEST_EQUAL_I(ret, 0);
+
+	for (i = 0; i < NUM_ENTRIES; ++i) {
+		ret = sqfs_dir_reader_read_buffered(rd, &state, &ent, &size);
+		TEST_EQUAL_I(ret, 0);
+		TEST_NOT_NULL(ent);
+		TEST_ASSERT(size >= sizeof(*ent) + ent->size + 2);
+
+		sprintf(name, "file%05u", (unsigned int)(i * 2));
+		TEST_STR_EQUAL((const char *)ent->name, name);
+		TEST_EQUAL_UI(state.ent_ref, entry_ref(i));
+
+		/* all names have the same length, the buffer is reused */
+		if (first == NULL)
+			first = ent;
+		TEST_ASSERT(first == (const void *)ent);
+	}
+
+	ret = sqfs_dir_reader_read_buffered(rd, &state, &ent, &size);
+	TEST_ASSERT(ret > 0);
+
+	sqfs_free(ent);
+}
+
+static sqfs_u64 block_lookups(const sqfs_dir_reader_t *rd)
+{
+	const sqfs_meta_cache_stats_t *stats;
+
+	stats = sqfs_dir_reader_get_cache_stats(rd);
+	return stats->hits + stats->misses;
+}
+
+static void lookup_root(sqfs_dir_reader_t *rd, bool cached)
+{
+	sqfs_u64 ref, count;
+	char name[32];
+	size_t i, j;
+	int ret;
+
+	for (i = 0; i < 2; ++i) {
+		count = block_lookups(rd);
+
+		for (j = 0; j < NUM_ENTRIES; j += 10) {
+			sprintf(name, "/file%05u", (unsigned int)(j * 2));
+
+			ret = sqfs_dir_reader_resolve_path(rd, name,
+							   NULL, &ref);
+			TEST_EQUAL_I(ret, 0);
+			TEST_EQUAL_UI(ref, entry_ref(j));
+		}
+
+		/* with a dentry cache, no meta data is read again */
+		if (i > 0 && cached) {
+			TEST_EQUAL_UI(block_lookups(rd), count);
+		} else {
+			TEST_ASSERT(block_lookups(rd) > count);
+		}
+	}
+
+	/* failed lookups are not cached */
+	for (i = 0; i < 2; ++i) {
+		ret = sqfs_dir_reader_resolve_path(rd, "/file00001",
+						   NULL, &ref);
+		TEST_EQUAL_I(ret, SQFS_ERROR_NO_ENTRY);
+	}
+}
+
+static void check_inum(sqfs_dir_reader_t *rd)
+{
+	sqfs_u64 ref;
+	size_t i;
+	int ret;
+
+	ret = sqfs_dir_reader_resolve_inum(rd, 1, &ref);
+	TEST_EQUAL_I(ret, 0);
+	TEST_EQUAL_UI(ref, 0);
+
+	for (i = 0; i < NUM_ENTRIES; ++i) {
+		ret = sqfs_dir_reader_resolve_inum(rd, i + 2, &ref);
+		TEST_EQUAL_I(ret, 0);
+		TEST_EQUAL_UI(ref, entry_ref(i));
+	}
+
+	ret = sqfs_dir_reader_resolve_inum(rd, 0, &ref);
+	TEST_EQUAL_I(ret, SQFS_ERROR_NO_ENTRY);
+
+	ret = sqfs_dir_reader_resolve_inum(rd, NUM_ENTRIES + 2, &ref);
+	TEST_EQUAL_I(ret, SQFS_ERROR_NO_ENTRY);
+}
+
+static void inode_index(sqfs_super_t *super)
+{
+	sqfs_inode_generic_t *root;
+	sqfs_dir_reader_t *rd;
+	sqfs_u64 ref;
+	int ret;
+
+	/* loaded from the export table */
+	rd = sqfs_dir_reader_create(super, NULL, &dummy_file,
+				    SQFS_DIR_READER_INODE_INDEX);
+	TEST_NOT_NULL(rd);
+	check_inum(rd);
+	sqfs_drop(rd);
+
+	/* learned while reading inodes and directories */
+	super->flags &= ~SQFS_FLAG_EXPORTABLE;
+
+	rd = sqfs_dir_reader_create(super, NULL, &dummy_file,
+				    SQFS_DIR_READER_INODE_INDEX);
+	TEST_NOT_NULL(rd);
+
+	ret = sqfs_dir_reader_resolve_inum(rd, 1, &ref);
+	TEST_EQUAL_I(ret, SQFS_ERROR_NO_ENTRY);
+	ret = sqfs_dir_reader_resolve_inum(rd, 2, &ref);
+	TEST_EQUAL_I(ret, SQFS_ERROR_NO_ENTRY);
+
+	ret = sqfs_dir_reader_get_root_inode(rd, &root);
+	TEST_EQUAL_I(ret, 0);
+	read_all(rd, root);
+	sqfs_free(root);
+
+	check_inum(rd);
+	sqfs_drop(rd);
+
+	super->flags |= SQFS_FLAG_EXPORTABLE;
+}
+
+int main(int argc, char **argv)
+{
+	sqfs_inode_generic_t *inode;
+	sqfs_dir_reader_t *rd;
+	sqfs_super_t super;
+	(void)argc; (void)argv;
+
+	inode = write_image(&super);
+
+	rd = sqfs_dir_reader_create(&super, NULL, &dummy_file, 0);
+	TEST_NOT_NULL(rd);
+
+	read_all(rd, inode);
+
+	/* using the directory index */
+	lookup_all(rd, inode);
+
+	/* resolving paths with the root inode read from the image */
+	lookup_root(rd, false);
+	sqfs_drop(rd);
+
+	rd = sqfs_dir_reader_create(&super, NULL, &dummy_file,
+				    SQFS_DIR_READER_DENTRY_CACHE);
+	TEST_NOT_NULL(rd);
+	lookup_root(rd, true);
+
+	inode_index(&super);
+
+	/* same thing, but with a linear search */
+	inode->data.dir_ext.inodex_count = 0;
+	lookup_all(rd, inode);
+
+	sqfs_drop(rd);
+	free(inode);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * meta_cache.c
+ *
+ * Copyright (C) 2026 The squashfs-tools-ng contributors
+ */
+#include "config.h"
+#include "compat.h"
+#include "util/test.h"
+
+#include "sqfs/meta_reader.h"
+#include "sqfs/error.h"
+#include "sqfs/io.h"
+
+#define NUM_BLOCKS (4)
+#define BLOCK_DATA (100)
+#define BLOCK_SIZE (BLOCK_DATA + 2)
+
+static sqfs_u8 file_data[NUM_BLOCKS * BLOCK_SIZE];
+/* header and payload of a block are read separately */
+static size_t read_count = 0;
+
+static int dummy_read_at(sqfs_file_t *file, sqfs_u64 offset,
+			 void *buffer, size_t size)
+{
+	(void)file;
+
+	if (offset >= sizeof(file_data))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	if (size > (sizeof(file_data) - offset))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	memcpy(buffer, file_data + offset, size);
+	read_count += 1;
+	return 0;
+}
+
+static sqfs_file_t dummy_file = {
+	{ 1, NULL, NULL },
+	dummy_read_at,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+};
+
+static void check_read(sqfs_meta_reader_t *m, size_t index)
+{
+	sqfs_u8 buffer[10];
+	size_t i;
+	int ret;
+
+	ret = sqfs_meta_reader_seek(m, index * BLOCK_SIZE, 50);
+	TEST_EQUAL_I(ret, 0);
+
+	ret = sqfs_meta_reader_read(m, buffer, sizeof(buffer));
+	TEST_EQUAL_I(ret, 0);
+
+	for (i = 0; i < sizeof(buffer); ++i)
+		TEST_EQUAL_UI(buffer[i], index);
+}
+
+static void check_stats(sqfs_meta_cache_t *cache, sqfs_u64 hits,
+			sqfs_u64 misses)
+{
+	const sqfs_meta_cache_stats_t *stats = sqfs_meta_cache_get_stats(cache);
+
+	TEST_EQUAL_UI(stats->size, sizeof(*stats));
+	TEST_EQUAL_UI(stats->hits, hits);
+	TEST_EQUAL_UI(stats->misses, misses);
+}
+
+int main(int argc, char **argv)
+{
+	sqfs_meta_reader_t *a, *b, *copy;
+	sqfs_meta_cache_t *cache;
+	sqfs_u16 header;
+	size_t i;
+	(void)argc; (void)argv;
+
+	/* a sequence of uncompressed meta data blocks */
+	header = htole16(0x8000 | BLOCK_DATA);
+
+	for (i = 0; i < NUM_BLOCKS; ++i) {
+		memcpy(file_data + i * BLOCK_SIZE, &header, sizeof(header));
+		memset(file_data + i * BLOCK_SIZE + 2, i, BLOCK_DATA);
+	}
+
+	TEST_NULL(sqfs_meta_cache_create(0));
+
+	cache = sqfs_meta_cache_create(2);
+	TEST_NOT_NULL(cache);
+	check_stats(cache, 0, 0);
+
+	a = sqfs_meta_reader_create(&dummy_file, NULL, 0, sizeof(file_data));
+	TEST_NOT_NULL(a);
+	b = sqfs_meta_reader_create(&dummy_file, NULL, 0, sizeof(file_data));
+	TEST_NOT_NULL(b);
+
+	sqfs_meta_reader_set_cache(a, cache);
+	sqfs_meta_reader_set_cache(b, cache);
+
+	/* alternating between readers only reads each block once */
+	for (i = 0; i < 3; ++i) {
+		check_read(a, 0);
+		check_read(b, 1);
+		check_read(a, 1);
+		check_read(b, 0);
+	}
+	check_stats(cache, 10, 2);
+	TEST_EQUAL_UI(read_count, 4);
+
+	/* least recently used blocks are evicted */
+	check_read(a, 2);
+	check_read(a, 0);
+	check_read(b, 1);
+	check_stats(cache, 11, 4);
+	TEST_EQUAL_UI(read_count, 8);
+
+	/* reading across a block boundary caches the next block too */
+	TEST_EQUAL_I(sqfs_meta_reader_seek(a, 2 * BLOCK_SIZE, 95), 0);
+	{
+		sqfs_u8 buffer[10];
+
+		TEST_EQUAL_I(sqfs_meta_reader_read(a, buffer,
+						   sizeof(buffer)), 0);
+		TEST_EQUAL_UI(buffer[0], 2);
+		TEST_EQUAL_UI(buffer[9], 3);
+	}
+	check_stats(cache, 11, 6);
+	check_read(b, 3);
+	check_stats(cache, 12, 6);
+
+	/* copies do not share the cache */
+	copy = sqfs_copy(a);
+	TEST_NOT_NULL(copy);
+	check_read(copy, 0);
+	check_stats(cache, 12, 6);
+
+	sqfs_drop(copy);
+	sqfs_drop(a);
+	sqfs_drop(b);
+	sqfs_drop(cache);
+	return EXIT_SUCCESS;
+}
@@ -366,6 +366,7 @@ sqfs_dir_iterator_t *tar_open_stream(sqfs_istream_t *strm,
 	tar_iterator_t *tar = calloc(1, sizeof(*tar));
 	sqfs_dir_iterator_t *it = (sqfs_dir_iterator_t *)tar;
 	xfrm_stream_t *xfrm = NULL;
+	size_t num_jobs = 0;
 	const sqfs_u8 *ptr;
 	size_t size;
 	int ret;
@@ -384,6 +385,7 @@ sqfs_dir_iterator_t *tar_open_stream(sqfs_istream_t *strm,
 	if (opts) {
 		tar->excludedirs = opts->excludedirs;
 		tar->num_excludedirs = opts->num_excludedirs;
+		num_jobs = opts->num_jobs;
 	}
 
 	/* proble if the stream is compressed */
@@ -401,15 +403,25 @@ sqfs_dir_iterator_t *tar_open_stream(sqfs_istream_t *strm,
 		goto out_strm;
 
 	/* auto-wrap a compressed source stream */
-	xfrm = decompressor_stream_create(ret);
-	if (xfrm == NULL) {
-		sqfs_drop(it);
-		return NULL;
+	if (num_jobs > 1) {
+		tar->stream = istream_xfrm_create_mt(strm, ret, num_jobs);
+	} else {
+		xfrm = decompressor_stream_create(ret);
+		if (xfrm == NULL) {
+			sqfs_drop(it);
+			return NULL;
+		}
+
+		if (num_jobs > 0) {
+			tar->stream = istream_xfrm_create_threaded(strm, xfrm);
+		} else {
+			tar->stream = istream_xfrm_create(strm, xfrm);
+		}
+
+		sqfs_drop(xfrm);
 	}
 
-	tar->stream = istream_xfrm_create(strm, xfrm);
 	if (tar->stream == NULL) {
-		sqfs_drop(xfrm);
 		sqfs_drop(it);
 		return NULL;
 	}
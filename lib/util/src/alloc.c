@@ -11,6 +11,10 @@
 #include <stdlib.h>
 #include <errno.h>
 
+#if defined(_WIN32) || defined(__WINDOWS__)
+#include <malloc.h>
+#endif
+
 void *alloc_flex(size_t base_size, size_t item_size, size_t nmemb)
 {
 	size_t size;
@@ -35,3 +39,30 @@ void *alloc_array(size_t item_size, size_t nmemb)
 
 	return calloc(1, size);
 }
+
+void *alloc_aligned(size_t alignment, size_t size)
+{
+#if defined(_WIN32) || defined(__WINDOWS__)
+	return _aligned_malloc(size, alignment);
+#else
+	void *ptr;
+	int ret;
+
+	ret = posix_memalign(&ptr, alignment, size);
+	if (ret != 0) {
+		errno = ret;
+		return NULL;
+	}
+
+	return ptr;
+#endif
+}
+
+void free_aligned(void *ptr)
+{
+#if defined(_WIN32) || defined(__WINDOWS__)
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
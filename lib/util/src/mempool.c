@@ -19,8 +19,11 @@
 #endif
 
 #define DEF_POOL_SIZE (65536)
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
 #define MEM_ALIGN (8)
 
+#define BITS_PER_WORD (sizeof(unsigned int) * CHAR_BIT)
+
 typedef struct pool_t {
 	struct pool_t *next;
 
@@ -36,69 +39,112 @@ typedef struct pool_t {
 
 struct mem_pool_t {
 	size_t obj_size;
+	size_t obj_count;
 	size_t pool_size;
 	size_t bitmap_count;
+	size_t free_pools;
+	int flags;
 	pool_t *pool_list;
 };
 
-static size_t pool_size_from_bitmap_count(size_t count, size_t obj_size)
+static size_t pool_header_size(size_t obj_count)
 {
-	size_t size, byte_count, bit_count;
+	size_t size, words;
 
 	size = sizeof(pool_t);
 	if (size % sizeof(unsigned int))
 		size += sizeof(unsigned int) - size % sizeof(unsigned int);
 
-	byte_count = count * sizeof(unsigned int);
-	bit_count = byte_count * CHAR_BIT;
+	words = (obj_count + BITS_PER_WORD - 1) / BITS_PER_WORD;
+	size += words * sizeof(unsigned int);
 
-	size += byte_count;
-	if (size % obj_size)
-		size += obj_size - size % obj_size;
+	if (size % MEM_ALIGN)
+		size += MEM_ALIGN - size % MEM_ALIGN;
 
-	size += bit_count * obj_size;
 	return size;
 }
 
-static pool_t *create_pool(const mem_pool_t *mem)
+static size_t obj_count_from_pool_size(size_t pool_size, size_t obj_size)
 {
-	unsigned char *ptr;
-	pool_t *pool;
+	size_t count = pool_size / obj_size;
 
-#if defined(_WIN32) || defined(__WINDOWS__)
-	pool = VirtualAlloc(NULL, mem->pool_size, MEM_RESERVE | MEM_COMMIT,
-			    PAGE_READWRITE);
+	while (count > 0 &&
+	       (pool_header_size(count) + count * obj_size) > pool_size) {
+		--count;
+	}
 
-	if (pool == NULL)
-		return NULL;
+	return count;
+}
+
+static void *map_pool_memory(const mem_pool_t *mem)
+{
+	void *ptr;
+
+#if defined(_WIN32) || defined(__WINDOWS__)
+	ptr = VirtualAlloc(NULL, mem->pool_size, MEM_RESERVE | MEM_COMMIT,
+			   PAGE_READWRITE);
 #else
-	pool = mmap(NULL, mem->pool_size, PROT_READ | PROT_WRITE,
-		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MAP_HUGETLB
+	if (mem->flags & MEM_POOL_HUGE_PAGES) {
+		ptr = mmap(NULL, mem->pool_size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
 
-	if (pool == MAP_FAILED)
+		if (ptr != MAP_FAILED)
+			return ptr;
+	}
+#endif
+	ptr = mmap(NULL, mem->pool_size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (ptr == MAP_FAILED)
 		return NULL;
+
+#ifdef MADV_HUGEPAGE
+	/* no huge pages reserved? Ask for transparent huge pages instead. */
+	if (mem->flags & MEM_POOL_HUGE_PAGES)
+		madvise(ptr, mem->pool_size, MADV_HUGEPAGE);
 #endif
-	pool->bitmap = pool->blob;
-	pool->obj_free = mem->bitmap_count * sizeof(unsigned int) * CHAR_BIT;
+#endif
+	return ptr;
+}
 
-	ptr = (unsigned char *)(pool->bitmap + mem->bitmap_count);
+static void unmap_pool_memory(const mem_pool_t *mem, pool_t *pool)
+{
+#if defined(_WIN32) || defined(__WINDOWS__)
+	(void)mem;
+	VirtualFree(pool, 0, MEM_RELEASE);
+#else
+	munmap(pool, mem->pool_size);
+#endif
+}
 
-	if (((uintptr_t)ptr) % mem->obj_size) {
-		ptr += mem->obj_size;
-		ptr -= ((uintptr_t)ptr) % mem->obj_size;
-	}
+static pool_t *create_pool(const mem_pool_t *mem)
+{
+	size_t i;
+	pool_t *pool;
+
+	pool = map_pool_memory(mem);
+	if (pool == NULL)
+		return NULL;
 
-	pool->data = ptr;
-	pool->limit = pool->data + pool->obj_free * mem->obj_size - 1;
+	pool->bitmap = pool->blob;
+	pool->obj_free = mem->obj_count;
 
 	memset(pool->bitmap, 0, mem->bitmap_count * sizeof(unsigned int));
+
+	/* mark the unused bits at the end of the bitmap as allocated */
+	for (i = mem->obj_count; i < mem->bitmap_count * BITS_PER_WORD; ++i)
+		pool->bitmap[i / BITS_PER_WORD] |= 1U << (i % BITS_PER_WORD);
+
+	pool->data = (unsigned char *)pool + pool_header_size(mem->obj_count);
+	pool->limit = pool->data + mem->obj_count * mem->obj_size;
 	return pool;
 }
 
-mem_pool_t *mem_pool_create(size_t obj_size)
+mem_pool_t *mem_pool_create_ex(size_t obj_size, size_t min_count, int flags)
 {
 	mem_pool_t *mem = calloc(1, sizeof(*mem));
-	size_t count = 1, total;
+	size_t pool_size;
 
 	if (mem == NULL)
 		return NULL;
@@ -106,32 +152,40 @@ mem_pool_t *mem_pool_create(size_t obj_size)
 	if (obj_size % MEM_ALIGN)
 		obj_size += MEM_ALIGN - obj_size % MEM_ALIGN;
 
-	for (;;) {
-		total = pool_size_from_bitmap_count(count, obj_size);
-		if (total > DEF_POOL_SIZE)
-			break;
-		++count;
-	}
+	if (min_count < 1)
+		min_count = 1;
 
-	--count;
+	pool_size = (flags & MEM_POOL_HUGE_PAGES) ? HUGE_PAGE_SIZE :
+		DEF_POOL_SIZE;
+
+	while (obj_count_from_pool_size(pool_size, obj_size) < min_count) {
+		if (SZ_MUL_OV(pool_size, 2, &pool_size)) {
+			free(mem);
+			return NULL;
+		}
+	}
 
 	mem->obj_size = obj_size;
-	mem->pool_size = DEF_POOL_SIZE;
-	mem->bitmap_count = count;
+	mem->obj_count = obj_count_from_pool_size(pool_size, obj_size);
+	mem->pool_size = pool_size;
+	mem->bitmap_count = (mem->obj_count + BITS_PER_WORD - 1) /
+		BITS_PER_WORD;
+	mem->flags = flags;
 	return mem;
 }
 
+mem_pool_t *mem_pool_create(size_t obj_size)
+{
+	return mem_pool_create_ex(obj_size, 1, 0);
+}
+
 void mem_pool_destroy(mem_pool_t *mem)
 {
 	while (mem->pool_list != NULL) {
 		pool_t *pool = mem->pool_list;
 		mem->pool_list = pool->next;
 
-#if defined(_WIN32) || defined(__WINDOWS__)
-		VirtualFree(pool, mem->pool_size, MEM_RELEASE);
-#else
-		munmap(pool, mem->pool_size);
-#endif
+		unmap_pool_memory(mem, pool);
 	}
 
 	free(mem);
@@ -155,6 +209,8 @@ retry_pool:
 
 		it->next = mem->pool_list;
 		mem->pool_list = it;
+	} else if (it->obj_free == mem->obj_count) {
+		mem->free_pools -= 1;
 	}
 
 	for (i = 0; i < mem->bitmap_count; ++i) {
@@ -168,7 +224,7 @@ retry_pool:
 	}
 
 	for (j = 0; j < (sizeof(it->bitmap[i]) * CHAR_BIT); ++j) {
-		if (!(it->bitmap[i] & (1UL << j)))
+		if (!(it->bitmap[i] & (1U << j)))
 			break;
 	}
 
@@ -180,23 +236,25 @@ retry_pool:
 	idx = i * sizeof(unsigned int) * CHAR_BIT + j;
 	ptr = it->data + idx * mem->obj_size;
 
-	it->bitmap[i] |= (1UL << j);
+	it->bitmap[i] |= (1U << j);
 	it->obj_free -= 1;
 
-	memset(ptr, 0, mem->obj_size);
+	if (!(mem->flags & MEM_POOL_NO_CLEAR))
+		memset(ptr, 0, mem->obj_size);
 	return ptr;
 }
 
 void mem_pool_free(mem_pool_t *mem, void *ptr)
 {
+	pool_t *it, *prev = NULL;
 	size_t idx, i, j;
-	pool_t *it;
 
 	for (it = mem->pool_list; it != NULL; it = it->next) {
 		if ((unsigned char *)ptr >= it->data &&
 		    (unsigned char *)ptr < it->limit) {
 			break;
 		}
+		prev = it;
 	}
 
 	assert(it != NULL);
@@ -209,8 +267,64 @@ void mem_pool_free(mem_pool_t *mem, void *ptr)
 	i = idx / (sizeof(unsigned int) * CHAR_BIT);
 	j = idx % (sizeof(unsigned int) * CHAR_BIT);
 
-	assert((it->bitmap[i] & (1 << j)) != 0);
+	assert((it->bitmap[i] & (1U << j)) != 0);
 
-	it->bitmap[i] &= ~(1 << j);
+	it->bitmap[i] &= ~(1U << j);
 	it->obj_free += 1;
+
+	if (it->obj_free < mem->obj_count)
+		return;
+
+	/*
+	  Keep one completely unused region around, so that a caller
+	  freeing and allocating right at a region boundary does not map
+	  and unmap memory every time. Any further ones are given back.
+	 */
+	if (mem->free_pools == 0) {
+		mem->free_pools = 1;
+		return;
+	}
+
+	if (prev == NULL) {
+		mem->pool_list = it->next;
+	} else {
+		prev->next = it->next;
+	}
+
+	unmap_pool_memory(mem, it);
+}
+
+void mem_pool_trim(mem_pool_t *mem)
+{
+	pool_t *it = mem->pool_list, *prev = NULL, *next;
+
+	while (it != NULL && mem->free_pools > 0) {
+		next = it->next;
+
+		if (it->obj_free == mem->obj_count) {
+			if (prev == NULL) {
+				mem->pool_list = next;
+			} else {
+				prev->next = next;
+			}
+
+			unmap_pool_memory(mem, it);
+			mem->free_pools -= 1;
+		} else {
+			prev = it;
+		}
+
+		it = next;
+	}
+}
+
+size_t mem_pool_mapped_size(const mem_pool_t *mem)
+{
+	const pool_t *it;
+	size_t count = 0;
+
+	for (it = mem->pool_list; it != NULL; it = it->next)
+		++count;
+
+	return count * mem->pool_size;
 }
@@ -0,0 +1,435 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * threadpool_ring.c
+ *
+ * Copyright (C) 2026 The squashfs-tools-ng contributors
+ */
+#include "util/threadpool.h"
+#include "util/util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32) || defined(__WINDOWS__)
+#include "util/w32threadwrap.h"
+
+#define THREAD_FUN(funname, argname) DWORD WINAPI funname(LPVOID argname)
+#define THREAD_EXIT_SUCCESS (0)
+#else
+#include <pthread.h>
+#include <signal.h>
+
+#define THREAD_FUN(funname, argname) void *funname(void *argname)
+#define THREAD_EXIT_SUCCESS NULL
+#endif
+
+/*
+  How often a thread polls a ticket counter or completion flag, before
+  going to sleep on a condition variable.
+ */
+#define SPIN_COUNT (256)
+
+/* Minimum number of ring slots, regardless of the number of workers. */
+#define MIN_RING_SIZE (64)
+
+/* Keep the counters that are hammered by different threads apart. */
+#define CACHE_LINE_SIZE (64)
+
+#define LOAD(ptr) __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#define LOAD_ACQ(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define STORE(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_SEQ_CST)
+
+typedef struct ring_pool_t ring_pool_t;
+
+typedef struct work_item_t {
+	struct work_item_t *next;
+	void *data;
+	int done;
+} work_item_t;
+
+typedef struct {
+	pthread_t thread;
+	ring_pool_t *pool;
+
+	thread_pool_worker_t fun;
+	void *user;
+} worker_t;
+
+struct ring_pool_t {
+	thread_pool_t base;
+
+	/* only touched by the thread that submits & dequeues */
+	size_t dequeue_ticket;
+	size_t item_count;
+
+	work_item_t *overflow;
+	work_item_t *overflow_last;
+	work_item_t *recycle;
+
+	size_t ring_mask;
+	work_item_t **ring;
+
+	/* published by the submitting thread, read by the workers */
+	char pad0[CACHE_LINE_SIZE];
+	size_t submit_ticket;
+
+	/* atomically incremented by the workers to claim a ticket */
+	char pad1[CACHE_LINE_SIZE];
+	size_t pickup_ticket;
+
+	char pad2[CACHE_LINE_SIZE];
+	int status;
+	int shutdown;
+	unsigned int idle_workers;
+	int main_waiting;
+
+	/* only used for sleeping if there is nothing to do */
+	pthread_mutex_t mtx;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+
+	size_t num_workers;
+	worker_t workers[];
+};
+
+/*****************************************************************************/
+
+static work_item_t *claim_item(ring_pool_t *pool)
+{
+	size_t ticket;
+	int spin = 0;
+
+	for (;;) {
+		if (LOAD(&pool->shutdown))
+			return NULL;
+
+		ticket = LOAD_ACQ(&pool->pickup_ticket);
+
+		if (ticket != LOAD_ACQ(&pool->submit_ticket)) {
+			if (__atomic_compare_exchange_n(&pool->pickup_ticket,
+							&ticket, ticket + 1,
+							true, __ATOMIC_ACQ_REL,
+							__ATOMIC_RELAXED)) {
+				return LOAD_ACQ(&pool->ring[ticket &
+							    pool->ring_mask]);
+			}
+			continue;
+		}
+
+		if (spin++ < SPIN_COUNT)
+			continue;
+
+		pthread_mutex_lock(&pool->mtx);
+		__atomic_add_fetch(&pool->idle_workers, 1, __ATOMIC_SEQ_CST);
+
+		while (LOAD(&pool->pickup_ticket) == LOAD(&pool->submit_ticket)
+		       && !LOAD(&pool->shutdown)) {
+			pthread_cond_wait(&pool->work_cond, &pool->mtx);
+		}
+
+		__atomic_sub_fetch(&pool->idle_workers, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&pool->mtx);
+		spin = 0;
+	}
+}
+
+static THREAD_FUN(worker_proc, arg)
+{
+	worker_t *worker = arg;
+	ring_pool_t *pool = worker->pool;
+	work_item_t *item;
+	int expected, ret;
+
+	for (;;) {
+		item = claim_item(pool);
+		if (item == NULL)
+			break;
+
+		if (LOAD(&pool->status) == 0) {
+			ret = worker->fun(worker->user, item->data);
+
+			if (ret != 0) {
+				expected = 0;
+				__atomic_compare_exchange_n(&pool->status,
+							    &expected, ret,
+							    false,
+							    __ATOMIC_SEQ_CST,
+							    __ATOMIC_SEQ_CST);
+			}
+		}
+
+		STORE(&item->done, 1);
+
+		if (LOAD(&pool->main_waiting)) {
+			pthread_mutex_lock(&pool->mtx);
+			pthread_cond_broadcast(&pool->done_cond);
+			pthread_mutex_unlock(&pool->mtx);
+		}
+	}
+
+	return THREAD_EXIT_SUCCESS;
+}
+
+/*****************************************************************************/
+
+static void wait_item_done(ring_pool_t *pool, work_item_t *item)
+{
+	int spin;
+
+	for (spin = 0; spin < SPIN_COUNT; ++spin) {
+		if (LOAD_ACQ(&item->done))
+			return;
+	}
+
+	pthread_mutex_lock(&pool->mtx);
+	STORE(&pool->main_waiting, 1);
+
+	while (!LOAD(&item->done))
+		pthread_cond_wait(&pool->done_cond, &pool->mtx);
+
+	STORE(&pool->main_waiting, 0);
+	pthread_mutex_unlock(&pool->mtx);
+}
+
+static work_item_t *pop_ring_item(ring_pool_t *pool)
+{
+	work_item_t *item = pool->ring[pool->dequeue_ticket & pool->ring_mask];
+
+	wait_item_done(pool, item);
+	pool->dequeue_ticket += 1;
+	return item;
+}
+
+static void free_item_list(work_item_t *list)
+{
+	while (list != NULL) {
+		work_item_t *item = list;
+		list = list->next;
+		free(item);
+	}
+}
+
+static void shutdown_workers(ring_pool_t *pool, size_t count)
+{
+	size_t i;
+
+	STORE(&pool->shutdown, 1);
+
+	pthread_mutex_lock(&pool->mtx);
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mtx);
+
+	for (i = 0; i < count; ++i)
+		pthread_join(pool->workers[i].thread, NULL);
+}
+
+static void destroy(thread_pool_t *interface)
+{
+	ring_pool_t *pool = (ring_pool_t *)interface;
+	size_t i;
+
+	shutdown_workers(pool, pool->num_workers);
+
+	for (i = pool->dequeue_ticket; i != pool->submit_ticket; ++i)
+		free(pool->ring[i & pool->ring_mask]);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->mtx);
+
+	free_item_list(pool->overflow);
+	free_item_list(pool->recycle);
+	free(pool->ring);
+	free(pool);
+}
+
+static size_t get_worker_count(thread_pool_t *interface)
+{
+	ring_pool_t *pool = (ring_pool_t *)interface;
+
+	return pool->num_workers;
+}
+
+static void set_worker_ptr(thread_pool_t *interface, size_t idx, void *ptr)
+{
+	ring_pool_t *pool = (ring_pool_t *)interface;
+
+	if (idx >= pool->num_workers)
+		return;
+
+	pthread_mutex_lock(&pool->mtx);
+	pool->workers[idx].user = ptr;
+	pthread_mutex_unlock(&pool->mtx);
+}
+
+static int submit(thread_pool_t *interface, void *ptr)
+{
+	ring_pool_t *pool = (ring_pool_t *)interface;
+	work_item_t *item = NULL;
+	size_t ticket;
+	int status;
+
+	status = LOAD(&pool->status);
+	if (status != 0)
+		return status;
+
+	if (pool->recycle != NULL) {
+		item = pool->recycle;
+		pool->recycle = item->next;
+		item->next = NULL;
+	}
+
+	if (item == NULL) {
+		item = calloc(1, sizeof(*item));
+		if (item == NULL)
+			return -1;
+	}
+
+	/*
+	  If the ring is full, move the oldest item over to the list of
+	  completed items. It has to be handed out first anyway, so this
+	  does not break the ordering guarantee.
+	 */
+	ticket = pool->submit_ticket;
+
+	if ((ticket - pool->dequeue_ticket) > pool->ring_mask) {
+		work_item_t *done = pop_ring_item(pool);
+
+		if (pool->overflow_last == NULL) {
+			pool->overflow = done;
+		} else {
+			pool->overflow_last->next = done;
+		}
+
+		pool->overflow_last = done;
+	}
+
+	item->data = ptr;
+	item->done = 0;
+
+	__atomic_store_n(&pool->ring[ticket & pool->ring_mask], item,
+			 __ATOMIC_RELEASE);
+	STORE(&pool->submit_ticket, ticket + 1);
+
+	pool->item_count += 1;
+
+	if (LOAD(&pool->idle_workers) > 0) {
+		pthread_mutex_lock(&pool->mtx);
+		pthread_cond_broadcast(&pool->work_cond);
+		pthread_mutex_unlock(&pool->mtx);
+	}
+
+	return 0;
+}
+
+static void *dequeue(thread_pool_t *interface)
+{
+	ring_pool_t *pool = (ring_pool_t *)interface;
+	work_item_t *out;
+	void *ptr;
+
+	if (pool->item_count == 0)
+		return NULL;
+
+	if (pool->overflow != NULL) {
+		out = pool->overflow;
+
+		pool->overflow = out->next;
+		if (pool->overflow == NULL)
+			pool->overflow_last = NULL;
+	} else {
+		out = pop_ring_item(pool);
+	}
+
+	ptr = out->data;
+
+	out->data = NULL;
+	out->done = 0;
+	out->next = pool->recycle;
+	pool->recycle = out;
+
+	pool->item_count -= 1;
+	return ptr;
+}
+
+static int get_status(thread_pool_t *interface)
+{
+	ring_pool_t *pool = (ring_pool_t *)interface;
+
+	return LOAD(&pool->status);
+}
+
+thread_pool_t *thread_pool_create_ring(size_t num_jobs,
+				       thread_pool_worker_t worker)
+{
+	thread_pool_t *interface;
+	sigset_t set, oldset;
+	size_t i, ring_size;
+	ring_pool_t *pool;
+	int ret;
+
+	if (num_jobs < 1)
+		num_jobs = 1;
+
+	pool = alloc_flex(sizeof(*pool), sizeof(pool->workers[0]), num_jobs);
+	if (pool == NULL)
+		return NULL;
+
+	ring_size = MIN_RING_SIZE;
+	while (ring_size < (4 * num_jobs))
+		ring_size *= 2;
+
+	pool->ring = alloc_array(sizeof(pool->ring[0]), ring_size);
+	if (pool->ring == NULL)
+		goto fail_free;
+
+	pool->ring_mask = ring_size - 1;
+
+	if (pthread_mutex_init(&pool->mtx, NULL) != 0)
+		goto fail_free;
+
+	if (pthread_cond_init(&pool->work_cond, NULL) != 0)
+		goto fail_mtx;
+
+	if (pthread_cond_init(&pool->done_cond, NULL) != 0)
+		goto fail_wcond;
+
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+
+	pool->num_workers = num_jobs;
+
+	for (i = 0; i < num_jobs; ++i) {
+		pool->workers[i].fun = worker;
+		pool->workers[i].pool = pool;
+
+		ret = pthread_create(&pool->workers[i].thread, NULL,
+				     worker_proc, pool->workers + i);
+
+		if (ret != 0)
+			goto fail;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	interface = (thread_pool_t *)pool;
+	interface->destroy = destroy;
+	interface->get_worker_count = get_worker_count;
+	interface->set_worker_ptr = set_worker_ptr;
+	interface->submit = submit;
+	interface->dequeue = dequeue;
+	interface->get_status = get_status;
+	return interface;
+fail:
+	shutdown_workers(pool, i);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	pthread_cond_destroy(&pool->done_cond);
+fail_wcond:
+	pthread_cond_destroy(&pool->work_cond);
+fail_mtx:
+	pthread_mutex_destroy(&pool->mtx);
+fail_free:
+	free(pool->ring);
+	free(pool);
+	return NULL;
+}
@@ -110,3 +110,368 @@ sqfs_u32 xxh32(const void *input, const size_t len)
 	h32 ^= h32 >> 16;
 	return h32;
 }
+
+static const sqfs_u64 PRIME64_1 = 11400714785074694791ULL;
+static const sqfs_u64 PRIME64_2 = 14029467366897019727ULL;
+static const sqfs_u64 PRIME64_3 =  1609587929392839161ULL;
+static const sqfs_u64 PRIME64_4 =  9650029242287828579ULL;
+static const sqfs_u64 PRIME64_5 =  2870177450012600261ULL;
+
+static sqfs_u64 XXH_readLE64(const sqfs_u8 *ptr)
+{
+	sqfs_u64 value;
+	memcpy(&value, ptr, sizeof(value));
+	return le64toh(value);
+}
+
+/*
+ * XXH3, 128 bit variant, with the default secret and a seed of zero.
+ * This is a portable scalar version, following the reference
+ * implementation of xxHash 0.8.
+ */
+#define XXH3_STRIPE_LEN (64)
+#define XXH3_SECRET_CONSUME_RATE (8)
+#define XXH3_ACC_NB (8)
+#define XXH3_MIDSIZE_STARTOFFSET (3)
+#define XXH3_MIDSIZE_LASTOFFSET (17)
+#define XXH3_SECRET_SIZE_MIN (136)
+#define XXH3_SECRET_LASTACC_START (7)
+#define XXH3_SECRET_MERGEACCS_START (11)
+
+static const sqfs_u64 PRIME_MX1 = 0x165667919E3779F9ULL;
+static const sqfs_u64 PRIME_MX2 = 0x9FB21C651E98DF25ULL;
+
+static const sqfs_u8 xxh3_secret[192] = {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe,
+	0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+	0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78,
+	0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e,
+	0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+	0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e,
+	0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f,
+	0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+	0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3,
+	0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49,
+	0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+	0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28,
+	0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static sqfs_u32 xxh_swap32(sqfs_u32 x)
+{
+	return ((x << 24) & 0xff000000) | ((x << 8) & 0x00ff0000) |
+		((x >> 8) & 0x0000ff00) | ((x >> 24) & 0x000000ff);
+}
+
+static sqfs_u64 xxh_swap64(sqfs_u64 x)
+{
+	return ((sqfs_u64)xxh_swap32((sqfs_u32)x) << 32) |
+		xxh_swap32((sqfs_u32)(x >> 32));
+}
+
+static void xxh_mult64to128(sqfs_u64 lhs, sqfs_u64 rhs, hash128_t *out)
+{
+	sqfs_u64 lo_lo = (lhs & 0xFFFFFFFF) * (rhs & 0xFFFFFFFF);
+	sqfs_u64 hi_lo = (lhs >> 32) * (rhs & 0xFFFFFFFF);
+	sqfs_u64 lo_hi = (lhs & 0xFFFFFFFF) * (rhs >> 32);
+	sqfs_u64 hi_hi = (lhs >> 32) * (rhs >> 32);
+	sqfs_u64 cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+
+	out->high = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+	out->low = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+}
+
+static sqfs_u64 xxh_mul128_fold64(sqfs_u64 lhs, sqfs_u64 rhs)
+{
+	hash128_t product;
+
+	xxh_mult64to128(lhs, rhs, &product);
+	return product.low ^ product.high;
+}
+
+static sqfs_u64 xxh64_avalanche(sqfs_u64 h64)
+{
+	h64 ^= h64 >> 33;
+	h64 *= PRIME64_2;
+	h64 ^= h64 >> 29;
+	h64 *= PRIME64_3;
+	h64 ^= h64 >> 32;
+	return h64;
+}
+
+static sqfs_u64 xxh3_avalanche(sqfs_u64 h64)
+{
+	h64 ^= h64 >> 37;
+	h64 *= PRIME_MX1;
+	h64 ^= h64 >> 32;
+	return h64;
+}
+
+static void xxh3_len_1to3(const sqfs_u8 *in, size_t len, hash128_t *out)
+{
+	const sqfs_u8 *secret = xxh3_secret;
+	sqfs_u32 combinedl, combinedh;
+	sqfs_u64 bitflipl, bitfliph;
+
+	combinedl = ((sqfs_u32)in[0] << 16) | ((sqfs_u32)in[len >> 1] << 24) |
+		((sqfs_u32)in[len - 1] << 0) | ((sqfs_u32)len << 8);
+	combinedh = xxh_swap32(combinedl);
+	combinedh = xxh_rotl32(combinedh, 13);
+
+	bitflipl = XXH_readLE32(secret) ^ XXH_readLE32(secret + 4);
+	bitfliph = XXH_readLE32(secret + 8) ^ XXH_readLE32(secret + 12);
+
+	out->low = xxh64_avalanche((sqfs_u64)combinedl ^ bitflipl);
+	out->high = xxh64_avalanche((sqfs_u64)combinedh ^ bitfliph);
+}
+
+static void xxh3_len_4to8(const sqfs_u8 *in, size_t len, hash128_t *out)
+{
+	const sqfs_u8 *secret = xxh3_secret;
+	sqfs_u64 input_lo, input_hi, bitflip, keyed;
+	hash128_t m128;
+
+	input_lo = XXH_readLE32(in);
+	input_hi = XXH_readLE32(in + len - 4);
+	bitflip = XXH_readLE64(secret + 16) ^ XXH_readLE64(secret + 24);
+	keyed = (input_lo + (input_hi << 32)) ^ bitflip;
+
+	xxh_mult64to128(keyed, PRIME64_1 + ((sqfs_u64)len << 2), &m128);
+
+	m128.high += m128.low << 1;
+	m128.low ^= m128.high >> 3;
+	m128.low ^= m128.low >> 35;
+	m128.low *= PRIME_MX2;
+	m128.low ^= m128.low >> 28;
+
+	out->low = m128.low;
+	out->high = xxh3_avalanche(m128.high);
+}
+
+static void xxh3_len_9to16(const sqfs_u8 *in, size_t len, hash128_t *out)
+{
+	const sqfs_u8 *secret = xxh3_secret;
+	sqfs_u64 bitflipl, bitfliph, input_lo, input_hi;
+	hash128_t m128, h128;
+
+	bitflipl = XXH_readLE64(secret + 32) ^ XXH_readLE64(secret + 40);
+	bitfliph = XXH_readLE64(secret + 48) ^ XXH_readLE64(secret + 56);
+	input_lo = XXH_readLE64(in);
+	input_hi = XXH_readLE64(in + len - 8);
+
+	xxh_mult64to128(input_lo ^ input_hi ^ bitflipl, PRIME64_1, &m128);
+
+	m128.low += (sqfs_u64)(len - 1) << 54;
+	input_hi ^= bitfliph;
+	m128.high += input_hi +
+		(input_hi & 0xFFFFFFFF) * (sqfs_u64)(PRIME32_2 - 1);
+	m128.low ^= xxh_swap64(m128.high);
+
+	xxh_mult64to128(m128.low, PRIME64_2, &h128);
+	h128.high += m128.high * PRIME64_2;
+
+	out->low = xxh3_avalanche(h128.low);
+	out->high = xxh3_avalanche(h128.high);
+}
+
+static sqfs_u64 xxh3_mix16(const sqfs_u8 *in, const sqfs_u8 *secret,
+			   sqfs_u64 seed)
+{
+	return xxh_mul128_fold64(XXH_readLE64(in) ^
+				 (XXH_readLE64(secret) + seed),
+				 XXH_readLE64(in + 8) ^
+				 (XXH_readLE64(secret + 8) - seed));
+}
+
+static void xxh3_mix32(hash128_t *acc, const sqfs_u8 *in1,
+		       const sqfs_u8 *in2, const sqfs_u8 *secret,
+		       sqfs_u64 seed)
+{
+	acc->low += xxh3_mix16(in1, secret, seed);
+	acc->low ^= XXH_readLE64(in2) + XXH_readLE64(in2 + 8);
+	acc->high += xxh3_mix16(in2, secret + 16, seed);
+	acc->high ^= XXH_readLE64(in1) + XXH_readLE64(in1 + 8);
+}
+
+static void xxh3_finalize_mid(const hash128_t *acc, size_t len,
+			      hash128_t *out)
+{
+	sqfs_u64 low = acc->low + acc->high;
+	sqfs_u64 high = acc->low * PRIME64_1 + acc->high * PRIME64_4 +
+		(sqfs_u64)len * PRIME64_2;
+
+	out->low = xxh3_avalanche(low);
+	out->high = (sqfs_u64)0 - xxh3_avalanche(high);
+}
+
+static void xxh3_len_17to128(const sqfs_u8 *in, size_t len, hash128_t *out)
+{
+	const sqfs_u8 *secret = xxh3_secret;
+	hash128_t acc;
+
+	acc.low = (sqfs_u64)len * PRIME64_1;
+	acc.high = 0;
+
+	if (len > 32) {
+		if (len > 64) {
+			if (len > 96) {
+				xxh3_mix32(&acc, in + 48, in + len - 64,
+					   secret + 96, 0);
+			}
+			xxh3_mix32(&acc, in + 32, in + len - 48,
+				   secret + 64, 0);
+		}
+		xxh3_mix32(&acc, in + 16, in + len - 32, secret + 32, 0);
+	}
+	xxh3_mix32(&acc, in, in + len - 16, secret, 0);
+
+	xxh3_finalize_mid(&acc, len, out);
+}
+
+static void xxh3_len_129to240(const sqfs_u8 *in, size_t len, hash128_t *out)
+{
+	const sqfs_u8 *secret = xxh3_secret;
+	size_t i, rounds = len / 32;
+	hash128_t acc;
+
+	acc.low = (sqfs_u64)len * PRIME64_1;
+	acc.high = 0;
+
+	for (i = 0; i < 4; ++i)
+		xxh3_mix32(&acc, in + 32 * i, in + 32 * i + 16,
+			   secret + 32 * i, 0);
+
+	acc.low = xxh3_avalanche(acc.low);
+	acc.high = xxh3_avalanche(acc.high);
+
+	for (i = 4; i < rounds; ++i) {
+		xxh3_mix32(&acc, in + 32 * i, in + 32 * i + 16,
+			   secret + XXH3_MIDSIZE_STARTOFFSET + 32 * (i - 4), 0);
+	}
+
+	xxh3_mix32(&acc, in + len - 16, in + len - 32,
+		   secret + XXH3_SECRET_SIZE_MIN - XXH3_MIDSIZE_LASTOFFSET - 16,
+		   0);
+
+	xxh3_finalize_mid(&acc, len, out);
+}
+
+static void xxh3_accumulate_512(sqfs_u64 *acc, const sqfs_u8 *in,
+				const sqfs_u8 *secret)
+{
+	sqfs_u64 data_val, data_key;
+	size_t i;
+
+	for (i = 0; i < XXH3_ACC_NB; ++i) {
+		data_val = XXH_readLE64(in + 8 * i);
+		data_key = data_val ^ XXH_readLE64(secret + 8 * i);
+		acc[i ^ 1] += data_val;
+		acc[i] += (data_key & 0xFFFFFFFF) * (data_key >> 32);
+	}
+}
+
+static void xxh3_accumulate(sqfs_u64 *acc, const sqfs_u8 *in,
+			    const sqfs_u8 *secret, size_t stripes)
+{
+	size_t i;
+
+	for (i = 0; i < stripes; ++i) {
+		xxh3_accumulate_512(acc, in + i * XXH3_STRIPE_LEN,
+				    secret + i * XXH3_SECRET_CONSUME_RATE);
+	}
+}
+
+static void xxh3_scramble(sqfs_u64 *acc, const sqfs_u8 *secret)
+{
+	size_t i;
+
+	for (i = 0; i < XXH3_ACC_NB; ++i) {
+		acc[i] ^= acc[i] >> 47;
+		acc[i] ^= XXH_readLE64(secret + 8 * i);
+		acc[i] *= PRIME32_1;
+	}
+}
+
+static sqfs_u64 xxh3_merge_accs(const sqfs_u64 *acc, const sqfs_u8 *secret,
+				sqfs_u64 start)
+{
+	size_t i;
+
+	for (i = 0; i < 4; ++i) {
+		start += xxh_mul128_fold64(acc[2 * i] ^
+					   XXH_readLE64(secret + 16 * i),
+					   acc[2 * i + 1] ^
+					   XXH_readLE64(secret + 16 * i + 8));
+	}
+
+	return xxh3_avalanche(start);
+}
+
+static void xxh3_long(const sqfs_u8 *in, size_t len, hash128_t *out)
+{
+	const size_t secret_size = sizeof(xxh3_secret);
+	const size_t stripes_per_block = (secret_size - XXH3_STRIPE_LEN) /
+		XXH3_SECRET_CONSUME_RATE;
+	const size_t block_len = XXH3_STRIPE_LEN * stripes_per_block;
+	const size_t blocks = (len - 1) / block_len;
+	const sqfs_u8 *secret = xxh3_secret;
+	size_t i, stripes;
+	sqfs_u64 acc[XXH3_ACC_NB] = {
+		PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3,
+		PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1,
+	};
+
+	for (i = 0; i < blocks; ++i) {
+		xxh3_accumulate(acc, in + i * block_len, secret,
+				stripes_per_block);
+		xxh3_scramble(acc, secret + secret_size - XXH3_STRIPE_LEN);
+	}
+
+	stripes = ((len - 1) - block_len * blocks) / XXH3_STRIPE_LEN;
+	xxh3_accumulate(acc, in + blocks * block_len, secret, stripes);
+
+	xxh3_accumulate_512(acc, in + len - XXH3_STRIPE_LEN,
+			    secret + secret_size - XXH3_STRIPE_LEN -
+			    XXH3_SECRET_LASTACC_START);
+
+	out->low = xxh3_merge_accs(acc, secret + XXH3_SECRET_MERGEACCS_START,
+				   (sqfs_u64)len * PRIME64_1);
+	out->high = xxh3_merge_accs(acc, secret + secret_size -
+				    sizeof(acc) - XXH3_SECRET_MERGEACCS_START,
+				    ~((sqfs_u64)len * PRIME64_2));
+}
+
+void hash128(const void *input, const size_t len, hash128_t *out)
+{
+	const sqfs_u8 *in = input;
+
+	if (len == 0) {
+		out->low = xxh64_avalanche(XXH_readLE64(xxh3_secret + 64) ^
+					   XXH_readLE64(xxh3_secret + 72));
+		out->high = xxh64_avalanche(XXH_readLE64(xxh3_secret + 80) ^
+					    XXH_readLE64(xxh3_secret + 88));
+	} else if (len <= 3) {
+		xxh3_len_1to3(in, len, out);
+	} else if (len <= 8) {
+		xxh3_len_4to8(in, len, out);
+	} else if (len <= 16) {
+		xxh3_len_9to16(in, len, out);
+	} else if (len <= 128) {
+		xxh3_len_17to128(in, len, out);
+	} else if (len <= 240) {
+		xxh3_len_129to240(in, len, out);
+	} else {
+		xxh3_long(in, len, out);
+	}
+}
@@ -0,0 +1,141 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * mempool.c
+ *
+ * Copyright (C) 2026 The squashfs-tools-ng contributors
+ */
+#include "config.h"
+
+#include "util/mempool.h"
+#include "util/test.h"
+
+#define SMALL_COUNT (10000)
+#define LARGE_SIZE (300000)
+#define LARGE_COUNT (16)
+
+static void test_pool(mem_pool_t *pool, size_t obj_size, size_t count)
+{
+	unsigned char **ptrs;
+	size_t i, j;
+
+	ptrs = calloc(count, sizeof(ptrs[0]));
+	TEST_NOT_NULL(ptrs);
+
+	for (i = 0; i < count; ++i) {
+		ptrs[i] = mem_pool_allocate(pool);
+		TEST_NOT_NULL(ptrs[i]);
+		TEST_EQUAL_UI(((size_t)ptrs[i]) % 8, 0);
+
+		for (j = 0; j < obj_size; ++j)
+			TEST_EQUAL_UI(ptrs[i][j], 0);
+
+		memset(ptrs[i], (int)(i & 0xFF), obj_size);
+	}
+
+	for (i = 0; i < count; ++i) {
+		for (j = 0; j < obj_size; ++j)
+			TEST_EQUAL_UI(ptrs[i][j], (i & 0xFF));
+	}
+
+	/* free every other object and make sure they are handed out again */
+	for (i = 0; i < count; i += 2)
+		mem_pool_free(pool, ptrs[i]);
+
+	for (i = 0; i < count; i += 2) {
+		ptrs[i] = mem_pool_allocate(pool);
+		TEST_NOT_NULL(ptrs[i]);
+		TEST_EQUAL_UI(ptrs[i][0], 0);
+		memset(ptrs[i], (int)(i & 0xFF), obj_size);
+	}
+
+	for (i = 0; i < count; ++i) {
+		TEST_EQUAL_UI(ptrs[i][0], (i & 0xFF));
+		TEST_EQUAL_UI(ptrs[i][obj_size - 1], (i & 0xFF));
+	}
+
+	for (i = 0; i < count; ++i)
+		mem_pool_free(pool, ptrs[i]);
+
+	free(ptrs);
+}
+
+static void test_release(mem_pool_t *pool, size_t count)
+{
+	size_t i, peak;
+	void **ptrs;
+
+	ptrs = calloc(count, sizeof(ptrs[0]));
+	TEST_NOT_NULL(ptrs);
+
+	/* at most one unused region may be left over from earlier tests */
+	mem_pool_trim(pool);
+	TEST_EQUAL_UI(mem_pool_mapped_size(pool), 0);
+
+	for (i = 0; i < count; ++i) {
+		ptrs[i] = mem_pool_allocate(pool);
+		TEST_NOT_NULL(ptrs[i]);
+	}
+
+	peak = mem_pool_mapped_size(pool);
+	TEST_ASSERT(peak > 0);
+
+	/* fully unused regions are unmapped, except for one spare */
+	for (i = 0; i < count; ++i)
+		mem_pool_free(pool, ptrs[i]);
+
+	TEST_ASSERT(mem_pool_mapped_size(pool) < peak);
+
+	mem_pool_trim(pool);
+	TEST_EQUAL_UI(mem_pool_mapped_size(pool), 0);
+
+	free(ptrs);
+}
+
+static void test_no_clear(void)
+{
+	unsigned char *ptr;
+	mem_pool_t *pool;
+
+	pool = mem_pool_create_ex(LARGE_SIZE, 1, MEM_POOL_NO_CLEAR);
+	TEST_NOT_NULL(pool);
+
+	ptr = mem_pool_allocate(pool);
+	TEST_NOT_NULL(ptr);
+	memset(ptr, 0xAA, LARGE_SIZE);
+	mem_pool_free(pool, ptr);
+
+	/* the spare region is reused, its contents are left as they were */
+	ptr = mem_pool_allocate(pool);
+	TEST_NOT_NULL(ptr);
+	TEST_EQUAL_UI(ptr[0], 0xAA);
+	TEST_EQUAL_UI(ptr[LARGE_SIZE - 1], 0xAA);
+	mem_pool_free(pool, ptr);
+
+	mem_pool_destroy(pool);
+}
+
+int main(int argc, char **argv)
+{
+	mem_pool_t *pool;
+	(void)argc; (void)argv;
+
+	pool = mem_pool_create(24);
+	TEST_NOT_NULL(pool);
+	test_pool(pool, 24, SMALL_COUNT);
+	test_release(pool, SMALL_COUNT);
+	mem_pool_destroy(pool);
+
+	pool = mem_pool_create_ex(LARGE_SIZE, 4, 0);
+	TEST_NOT_NULL(pool);
+	test_pool(pool, LARGE_SIZE, LARGE_COUNT);
+	test_release(pool, LARGE_COUNT);
+	mem_pool_destroy(pool);
+
+	pool = mem_pool_create_ex(LARGE_SIZE, 3, MEM_POOL_HUGE_PAGES);
+	TEST_NOT_NULL(pool);
+	test_pool(pool, LARGE_SIZE, LARGE_COUNT);
+	mem_pool_destroy(pool);
+
+	test_no_clear();
+	return EXIT_SUCCESS;
+}
@@ -148,6 +148,34 @@ static void test_case(thread_pool_t *pool)
 	TEST_NULL(ptr);
 }
 
+static void test_overflow(thread_pool_t *pool)
+{
+	unsigned int values[1000];
+	unsigned int *ptr;
+	size_t i;
+	int ret;
+
+	/* submit more items than any internal ring buffer can hold */
+	for (i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+		values[i] = i;
+
+		ret = pool->submit(pool, values + i);
+		TEST_EQUAL_I(ret, 0);
+	}
+
+	/* items must still dequeue in the same order */
+	for (i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+		ptr = pool->dequeue(pool);
+
+		TEST_NOT_NULL(ptr);
+		TEST_ASSERT(ptr == (values + i));
+		TEST_EQUAL_UI(*ptr, 42);
+	}
+
+	ptr = pool->dequeue(pool);
+	TEST_NULL(ptr);
+}
+
 int main(int argc, char **argv)
 {
 	thread_pool_t *pool;
@@ -159,6 +187,17 @@ int main(int argc, char **argv)
 	test_case(pool);
 	pool->destroy(pool);
 
+	/* test the lock-free ring buffer implementation */
+	pool = thread_pool_create_ring(10, worker);
+	TEST_NOT_NULL(pool);
+	test_case(pool);
+	pool->destroy(pool);
+
+	pool = thread_pool_create_ring(4, worker_serial);
+	TEST_NOT_NULL(pool);
+	test_overflow(pool);
+	pool->destroy(pool);
+
 	/* repeate the test with the serial reference implementation */
 	pool = thread_pool_create_serial(worker_serial);
 	TEST_NOT_NULL(pool);
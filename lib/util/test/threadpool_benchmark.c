@@ -0,0 +1,193 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * threadpool_benchmark.c
+ *
+ * Copyright (C) 2026 The squashfs-tools-ng contributors
+ */
+#include "config.h"
+#include "compat.h"
+
+#include "util/threadpool.h"
+#include "util/util.h"
+
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+typedef struct {
+	sqfs_u32 hash;
+	sqfs_u32 seed;
+} work_t;
+
+static struct option long_opts[] = {
+	{ "item-count", required_argument, NULL, 'n' },
+	{ "item-size", required_argument, NULL, 's' },
+	{ "backlog", required_argument, NULL, 'b' },
+	{ "max-jobs", required_argument, NULL, 'j' },
+	{ "help", no_argument, NULL, 'h' },
+	{ NULL, 0, NULL, 0 },
+};
+
+static const char *short_opts = "n:s:b:j:h";
+
+static const char *help_string =
+"Usage: threadpool_benchmark [OPTIONS...]\n"
+"\n"
+"Pushes a number of work items through the mutex based and the lock-free\n"
+"thread pool, using 1, 2, 4, ... up to the maximum number of worker\n"
+"threads and prints the resulting throughput.\n"
+"\n"
+"Possible options:\n"
+"\n"
+"  --item-count, -n <count>  The number of work items to process.\n"
+"                            Default: 200000.\n"
+"  --item-size, -s <size>    The number of bytes each work item hashes.\n"
+"                            Default: 4096.\n"
+"  --backlog, -b <count>     Maximum number of items in flight. Defaults to\n"
+"                            10 times the number of worker threads.\n"
+"  --max-jobs, -j <count>    Maximum number of worker threads. Default: 64.\n"
+"\n";
+
+static sqfs_u8 *buffer;
+static size_t item_size = 4096;
+
+static int worker(void *user, void *work_item)
+{
+	work_t *item = work_item;
+	(void)user;
+
+	item->hash = xxh32(buffer, item_size) ^ item->seed;
+	return 0;
+}
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static double run_benchmark(thread_pool_t *pool, work_t *items,
+			    size_t count, size_t backlog)
+{
+	size_t submitted = 0, done = 0;
+	double start, end;
+	work_t *item;
+
+	start = get_time();
+
+	while (done < count) {
+		while (submitted < count && (submitted - done) < backlog) {
+			items[submitted].seed = submitted;
+
+			if (pool->submit(pool, items + submitted) != 0)
+				return -1.0;
+
+			++submitted;
+		}
+
+		item = pool->dequeue(pool);
+		if (item != (items + done))
+			return -1.0;
+
+		++done;
+	}
+
+	end = get_time();
+	return end - start;
+}
+
+int main(int argc, char **argv)
+{
+	size_t jobs, max_jobs = 64, count = 200000, backlog = 0;
+	double t_mutex, t_ring;
+	thread_pool_t *pool;
+	work_t *items;
+
+	for (;;) {
+		int i = getopt_long(argc, argv, short_opts, long_opts, NULL);
+		if (i == -1)
+			break;
+
+		switch (i) {
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			item_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			backlog = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			max_jobs = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			fputs(help_string, stdout);
+			return EXIT_SUCCESS;
+		default:
+			goto fail_arg;
+		}
+	}
+
+	if (count < 1 || item_size < 1 || max_jobs < 1) {
+		fputs("Item count, size and job count must be at least 1.\n",
+		      stderr);
+		goto fail_arg;
+	}
+
+	buffer = malloc(item_size);
+	items = alloc_array(sizeof(items[0]), count);
+
+	if (buffer == NULL || items == NULL) {
+		fputs("out of memory\n", stderr);
+		free(buffer);
+		free(items);
+		return EXIT_FAILURE;
+	}
+
+	memset(buffer, 0x5A, item_size);
+
+	printf("%8s %16s %16s\n", "jobs", "mutex [items/s]", "ring [items/s]");
+
+	for (jobs = 1; jobs <= max_jobs; jobs *= 2) {
+		size_t bl = backlog ? backlog : (10 * jobs);
+
+		pool = thread_pool_create(jobs, worker);
+		if (pool == NULL)
+			goto fail_pool;
+		t_mutex = run_benchmark(pool, items, count, bl);
+		pool->destroy(pool);
+
+		pool = thread_pool_create_ring(jobs, worker);
+		if (pool == NULL)
+			goto fail_pool;
+		t_ring = run_benchmark(pool, items, count, bl);
+		pool->destroy(pool);
+
+		if (t_mutex <= 0.0 || t_ring <= 0.0) {
+			fputs("work items dequeued out of order!\n", stderr);
+			goto fail;
+		}
+
+		printf("%8lu %16.0f %16.0f\n", (unsigned long)jobs,
+		       (double)count / t_mutex, (double)count / t_ring);
+	}
+
+	free(items);
+	free(buffer);
+	return EXIT_SUCCESS;
+fail_pool:
+	fputs("error creating thread pool\n", stderr);
+fail:
+	free(items);
+	free(buffer);
+	return EXIT_FAILURE;
+fail_arg:
+	fputs("Try `threadpool_benchmark --help' for more information.\n",
+	      stderr);
+	return EXIT_FAILURE;
+}
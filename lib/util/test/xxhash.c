@@ -44,8 +44,62 @@ static const struct {
 	},
 };
 
+/*
+  XXH3-128 reference digests, computed with python-xxhash 4.0.1 over the
+  first `len` bytes of the pseudo random sequence from fill_buffer(). The
+  lengths cover every size class of the implementation, as well as the
+  stripe and block (1024 byte) boundaries of the long input path.
+ */
+static const struct {
+	size_t len;
+	sqfs_u64 low;
+	sqfs_u64 high;
+} test_vectors128[] = {
+	{    0, 0x6001C324468D497FULL, 0x99AA06D3014798D8ULL },
+	{    1, 0xE5E62017E96F839CULL, 0x9A0F174AE92E6DF2ULL },
+	{    2, 0xE99F8BA75698EC0FULL, 0x13A82070861B3B8CULL },
+	{    3, 0xD3BCC83C6F14E70FULL, 0xDA47C2149249DB69ULL },
+	{    4, 0xE267CF807951FE26ULL, 0x504303785D7B5AC9ULL },
+	{    7, 0xE7537349B8E5AA3DULL, 0x14BE62CB833AED42ULL },
+	{    8, 0xEC0B5B60D4670D0EULL, 0xE4F1BC54C38ED231ULL },
+	{    9, 0x3B1764B161F03ECDULL, 0x046E647369565965ULL },
+	{   15, 0x021189E8E7DF5EB0ULL, 0x96D4055AE6DF085DULL },
+	{   16, 0x0C85C3B7B344CFAFULL, 0x82D56864B86D4655ULL },
+	{   17, 0xEE80C12E2EAA110DULL, 0xE07226299D418421ULL },
+	{   32, 0xF852B8182FEBEF65ULL, 0x064AD1B44CE81EC6ULL },
+	{   33, 0xB28082A9AAD3B9D5ULL, 0x79222B34B5DC6369ULL },
+	{   64, 0xF2A2091B45BBD9CFULL, 0x960FCA3C66B39991ULL },
+	{   65, 0x841F3AD04F518AC7ULL, 0x4B9F9E58C4D9EEFFULL },
+	{   96, 0xE9B8A9102806D5C0ULL, 0x1BF14E85181E761EULL },
+	{   97, 0xB0673DE5AD089029ULL, 0x98434FE44BE46805ULL },
+	{  128, 0x08D61631B87E5395ULL, 0x4A4E39FCFA4515AAULL },
+	{  129, 0x11B15591BB767E79ULL, 0x5D41BB88EE7F7E45ULL },
+	{  160, 0xE72A6D6E8527B950ULL, 0x601F389DCFF5CB81ULL },
+	{  240, 0x4627A2B0D94E7351ULL, 0xF92B835ADD69C25DULL },
+	{  241, 0x5C56141C894CD97EULL, 0x80610486EDF872DFULL },
+	{ 1024, 0x0551DEA22E104EA8ULL, 0xDCC4B2941CB5E5E4ULL },
+	{ 1025, 0xDBE2ED3C377D9922ULL, 0x2E457D89ED1973D3ULL },
+	{ 2048, 0x0E137A69A82B62C0ULL, 0x700FC6DC214EA9E4ULL },
+	{ 4096, 0x869423345AF97371ULL, 0xDB9050E2FEB61A33ULL },
+	{ 5000, 0x80B0120FC87DBF6EULL, 0xB52A8229CAAE39C4ULL },
+};
+
+static sqfs_u8 buffer128[5000];
+
+static void fill_buffer(void)
+{
+	sqfs_u32 x = 1;
+	size_t i;
+
+	for (i = 0; i < sizeof(buffer128); ++i) {
+		x = x * 1103515245U + 12345U;
+		buffer128[i] = (x >> 16) & 0xFF;
+	}
+}
+
 int main(int argc, char **argv)
 {
+	hash128_t hash128_out;
 	sqfs_u32 hash;
 	size_t i;
 	(void)argc; (void)argv;
@@ -62,5 +116,26 @@ int main(int argc, char **argv)
 		}
 	}
 
+	fill_buffer();
+
+	for (i = 0; i < sizeof(test_vectors128) /
+		     sizeof(test_vectors128[0]); ++i) {
+		hash128(buffer128, test_vectors128[i].len, &hash128_out);
+
+		if (hash128_out.low != test_vectors128[i].low ||
+		    hash128_out.high != test_vectors128[i].high) {
+			fprintf(stderr, "XXH3-128 test case " PRI_SZ
+				" (length " PRI_SZ ") failed!\n",
+				i, test_vectors128[i].len);
+			fprintf(stderr, "Expected result: 0x%016llX%016llX\n",
+				(unsigned long long)test_vectors128[i].high,
+				(unsigned long long)test_vectors128[i].low);
+			fprintf(stderr, "Actual result:   0x%016llX%016llX\n",
+				(unsigned long long)hash128_out.high,
+				(unsigned long long)hash128_out.low);
+			return EXIT_FAILURE;
+		}
+	}
+
 	return EXIT_SUCCESS;
 }
@@ -10,6 +10,7 @@
 #include "sqfs/error.h"
 #include "xfrm/compress.h"
 #include "xfrm/wrap.h"
+#include "util/threadpool.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -19,34 +20,48 @@
 
 #define BUFSZ (262144)
 
+/*
+  Buffers filled by the worker. The reader works directly on one of them,
+  while the other one is being filled. The worker decompresses behind a
+  headroom of BUFSZ bytes. If a request spans two buffers, the unread rest
+  of the old one is moved in front of the data in the new one.
+ */
+#define NUM_BUFFERS_THREADED (2)
+
+typedef struct {
+	size_t used;
+	int status;
+	sqfs_u8 data[2 * BUFSZ];
+} xfrm_buffer_t;
+
 typedef struct istream_xfrm_t {
 	sqfs_istream_t base;
 
 	sqfs_istream_t *wrapped;
 	xfrm_stream_t *xfrm;
 
+	/* if set, a single worker decompresses into the buffers */
+	thread_pool_t *pool;
+	xfrm_buffer_t *buffers;
+
+	/* the worker buffer the reader is currently working on */
+	xfrm_buffer_t *current;
+
+	/* the data returned to the reader */
+	sqfs_u8 *data;
 	size_t buffer_offset;
 	size_t buffer_used;
-	sqfs_u8 uncompressed[BUFSZ];
+
+	/* the buffer of the single threaded version */
+	sqfs_u8 storage[];
 } istream_xfrm_t;
 
-static int precache(sqfs_istream_t *base)
+static int decompress(istream_xfrm_t *xfrm, sqfs_u8 *out, size_t *used)
 {
-	istream_xfrm_t *xfrm = (istream_xfrm_t *)base;
 	int ret;
 
-	if (xfrm->buffer_offset > 0 &&
-	    xfrm->buffer_offset < xfrm->buffer_used) {
-		memmove(xfrm->uncompressed,
-			xfrm->uncompressed + xfrm->buffer_offset,
-			xfrm->buffer_used - xfrm->buffer_offset);
-	}
-
-	xfrm->buffer_used -= xfrm->buffer_offset;
-	xfrm->buffer_offset = 0;
-
 	for (;;) {
-		sqfs_u32 in_off = 0, out_off = xfrm->buffer_used;
+		sqfs_u32 in_off = 0, out_off = *used;
 		int mode = XFRM_STREAM_FLUSH_NONE;
 		const sqfs_u8 *ptr;
 		size_t avail;
@@ -60,14 +75,13 @@ static int precache(sqfs_istream_t *base)
 
 		ret = xfrm->xfrm->process_data(xfrm->xfrm,
 					       ptr, avail,
-					       xfrm->uncompressed + out_off,
-					       BUFSZ - out_off,
+					       out + out_off, BUFSZ - out_off,
 					       &in_off, &out_off, mode);
 
 		if (ret == XFRM_STREAM_ERROR)
 			return SQFS_ERROR_COMPRESSOR;
 
-		xfrm->buffer_used = out_off;
+		*used = out_off;
 		xfrm->wrapped->advance_buffer(xfrm->wrapped, in_off);
 
 		if (ret == XFRM_STREAM_BUFFER_FULL || out_off >= BUFSZ)
@@ -80,22 +94,107 @@ static int precache(sqfs_istream_t *base)
 	return 0;
 }
 
+static int fill_buffer(void *user, void *item)
+{
+	istream_xfrm_t *xfrm = user;
+	xfrm_buffer_t *buf = item;
+
+	/* the reader gets to the status after the data decoded before it */
+	buf->used = 0;
+	buf->status = decompress(xfrm, buf->data + BUFSZ, &buf->used);
+	return 0;
+}
+
+static int next_buffer(istream_xfrm_t *xfrm)
+{
+	xfrm_buffer_t *old = xfrm->current, *buf;
+	size_t tail;
+
+	if (old != NULL) {
+		/* stick to the end of the stream, or a previous error */
+		if (old->status != 0)
+			return old->status;
+		if (old->used == 0)
+			return 1;
+	}
+
+	buf = xfrm->pool->dequeue(xfrm->pool);
+	if (buf == NULL)
+		return SQFS_ERROR_INTERNAL;
+
+	tail = xfrm->buffer_used - xfrm->buffer_offset;
+	if (tail > 0) {
+		memcpy(buf->data + BUFSZ - tail,
+		       xfrm->data + xfrm->buffer_offset, tail);
+	}
+
+	xfrm->current = buf;
+	xfrm->data = buf->data;
+	xfrm->buffer_offset = BUFSZ - tail;
+	xfrm->buffer_used = BUFSZ + buf->used;
+
+	if (old != NULL && xfrm->pool->submit(xfrm->pool, old))
+		return SQFS_ERROR_ALLOC;
+
+	if (buf->used > 0)
+		return 0;
+
+	return buf->status != 0 ? buf->status : 1;
+}
+
+static int wait_for_data(istream_xfrm_t *xfrm, size_t want)
+{
+	size_t avail;
+	int ret;
+
+	do {
+		ret = next_buffer(xfrm);
+		avail = xfrm->buffer_used - xfrm->buffer_offset;
+
+		/* data decoded before an error is still handed out first */
+		if (ret != 0)
+			return (ret < 0 && avail == 0) ? ret : 0;
+	} while (avail < want);
+
+	return 0;
+}
+
+static int precache(istream_xfrm_t *xfrm, size_t want)
+{
+	sqfs_u8 *data = xfrm->data;
+
+	if (xfrm->pool != NULL)
+		return wait_for_data(xfrm, want);
+
+	if (xfrm->buffer_offset > 0 &&
+	    xfrm->buffer_offset < xfrm->buffer_used) {
+		memmove(data, data + xfrm->buffer_offset,
+			xfrm->buffer_used - xfrm->buffer_offset);
+	}
+
+	xfrm->buffer_used -= xfrm->buffer_offset;
+	xfrm->buffer_offset = 0;
+
+	return decompress(xfrm, data, &xfrm->buffer_used);
+}
+
 static int xfrm_get_buffered_data(sqfs_istream_t *strm, const sqfs_u8 **out,
 				  size_t *size, size_t want)
 {
 	istream_xfrm_t *xfrm = (istream_xfrm_t *)strm;
+	int ret;
 
 	if (want > BUFSZ)
 		want = BUFSZ;
 
 	if (xfrm->buffer_used == 0 ||
 	    (xfrm->buffer_used - xfrm->buffer_offset) < want) {
-		int ret = precache(strm);
+		ret = precache(xfrm, want);
 		if (ret)
 			return ret;
 	}
 
-	*out = xfrm->uncompressed + xfrm->buffer_offset;
+	*out = xfrm->data + xfrm->buffer_offset;
 	*size = xfrm->buffer_used - xfrm->buffer_offset;
 	return (*size == 0) ? 1 : 0;
 }
@@ -122,30 +221,84 @@ static void xfrm_destroy(sqfs_object_t *obj)
 {
 	istream_xfrm_t *xfrm = (istream_xfrm_t *)obj;
 
+	/* wait for the worker to let go of the streams and buffers */
+	if (xfrm->pool != NULL)
+		xfrm->pool->destroy(xfrm->pool);
+
+	free(xfrm->buffers);
 	sqfs_drop(xfrm->xfrm);
 	sqfs_drop(xfrm->wrapped);
 	free(xfrm);
 }
 
-sqfs_istream_t *istream_xfrm_create(sqfs_istream_t *strm, xfrm_stream_t *xfrm)
+static istream_xfrm_t *create_stream(sqfs_istream_t *strm, xfrm_stream_t *xfrm,
+				     size_t storage_size)
 {
-	istream_xfrm_t *stream = calloc(1, sizeof(*stream));
-	sqfs_istream_t *base = (sqfs_istream_t *)stream;
+	istream_xfrm_t *stream;
+	sqfs_istream_t *base;
 
+	stream = calloc(1, sizeof(*stream) + storage_size);
 	if (stream == NULL)
-		goto fail;
+		return NULL;
 
+	base = (sqfs_istream_t *)stream;
 	sqfs_object_init(stream, xfrm_destroy, NULL);
 
 	stream->wrapped = sqfs_grab(strm);
 	stream->xfrm = sqfs_grab(xfrm);
+	stream->data = stream->storage;
 
 	base->get_buffered_data = xfrm_get_buffered_data;
 	base->advance_buffer = xfrm_advance_buffer;
 	base->get_filename = xfrm_get_filename;
-	return base;
+	return stream;
+}
+
+sqfs_istream_t *istream_xfrm_create(sqfs_istream_t *strm, xfrm_stream_t *xfrm)
+{
+	istream_xfrm_t *stream = create_stream(strm, xfrm, BUFSZ);
+
+	if (stream == NULL)
+		goto fail;
+
+	return (sqfs_istream_t *)stream;
 fail:
 	fprintf(stderr, "%s: error initializing decompressor stream.\n",
 		strm->get_filename(strm));
 	return NULL;
 }
+
+sqfs_istream_t *istream_xfrm_create_threaded(sqfs_istream_t *strm,
+					     xfrm_stream_t *xfrm)
+{
+	istream_xfrm_t *stream;
+	size_t i;
+
+	stream = create_stream(strm, xfrm, 0);
+	if (stream == NULL)
+		goto fail;
+
+	stream->buffers = calloc(NUM_BUFFERS_THREADED,
+				 sizeof(stream->buffers[0]));
+	if (stream->buffers == NULL)
+		goto fail;
+
+	stream->pool = thread_pool_create(1, fill_buffer);
+	if (stream->pool == NULL)
+		goto fail;
+
+	stream->pool->set_worker_ptr(stream->pool, 0, stream);
+
+	for (i = 0; i < NUM_BUFFERS_THREADED; ++i) {
+		if (stream->pool->submit(stream->pool, stream->buffers + i)) {
+			goto fail;
+		}
+	}
+
+	return (sqfs_istream_t *)stream;
+fail:
+	fprintf(stderr, "%s: error initializing decompressor thread.\n",
+		strm->get_filename(strm));
+	sqfs_drop(stream);
+	return NULL;
+}
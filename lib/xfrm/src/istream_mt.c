@@ -0,0 +1,988 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * istream_mt.c
+ *
+ * Copyright (C) 2026 The squashfs-tools-ng contributors
+ */
+#include "config.h"
+#include "compat.h"
+#include "sqfs/io.h"
+#include "sqfs/error.h"
+#include "xfrm/compress.h"
+#include "xfrm/wrap.h"
+#include "util/threadpool.h"
+#include "util/util.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/* minimum amount of compressed data handed to a worker at once */
+#define CHUNK_SIZE (1024 * 1024)
+
+/*
+  If no possible member start turns up within that much data, the input
+  is most likely a single stream and is decompressed serially.
+ */
+#define MAX_CHUNK_SIZE (16 * 1024 * 1024)
+
+/* larger output means the data is treated as not splittable */
+#define MAX_CHUNK_OUTPUT (64 * 1024 * 1024)
+
+/* the last read for a chunk can go past MAX_CHUNK_SIZE by that much */
+#define MAX_CHUNK_INPUT (MAX_CHUNK_SIZE + CHUNK_SIZE)
+
+/* number of chunks per worker that can be in flight at the same time */
+#define MAX_BACKLOG_PER_JOB (2)
+
+/*
+  Limit for the buffers of all chunks together. Input buffers are counted
+  as they are allocated. For the output, the expected size (a multiple of
+  the input size) is reserved before a chunk is submitted. Above the limit,
+  no more chunks are submitted until some of the ones in flight have been
+  consumed, and the buffers of consumed chunks are freed instead of being
+  kept for reuse. A worker can only grow an output buffer beyond its
+  reservation if that fits into the limit, otherwise the chunk is decoded
+  serially by the reader instead.
+
+  The reader itself can go over the limit by at most one chunk, since it
+  always has to be able to submit at least one.
+ */
+#define MAX_TOTAL_MEMORY (1024 * 1024 * 1024)
+
+/* the output reserved for a chunk, relative to its input size */
+#define OUTPUT_RESERVE_FACTOR (4)
+
+/* size of the output buffer for serially decoding chunks */
+#define SERIAL_BUFSZ (262144)
+
+/* enough bytes to recognize the header of a member in any format */
+#define MAX_MAGIC_SIZE (10)
+
+/*
+  A piece of compressed input, starting at a possible member boundary,
+  that is decompressed independently by one of the workers.
+ */
+typedef struct chunk_t {
+	struct chunk_t *next;
+
+	sqfs_u8 *in;
+	size_t in_used;
+	size_t in_max;
+
+	/* offset from which to continue searching for a member start */
+	size_t scan;
+
+	sqfs_u8 *out;
+	size_t out_used;
+	size_t out_max;
+
+	/* counted against the memory limit for the output, >= out_max */
+	size_t out_reserved;
+
+	/* set if the data ended exactly at the end of a member */
+	bool valid;
+	int status;
+} chunk_t;
+
+typedef struct {
+	xfrm_stream_t *xfrm;
+	int comp_id;
+
+	/* the memory counter of the stream, updated atomically */
+	size_t *mem_used;
+} chunk_worker_t;
+
+/*
+  Replays the data of a list of chunks and continues with the wrapped
+  stream, used for serial decompression once splitting failed.
+ */
+typedef struct {
+	sqfs_istream_t base;
+
+	sqfs_istream_t *wrapped;
+	chunk_t *list;
+	size_t offset;
+} istream_replay_t;
+
+typedef struct {
+	sqfs_istream_t base;
+
+	sqfs_istream_t *wrapped;
+	int comp_id;
+
+	/* the first byte of a member header */
+	sqfs_u8 magic;
+
+	thread_pool_t *pool;
+	chunk_worker_t *workers;
+	size_t num_workers;
+
+	chunk_t *chunks;
+	chunk_t *free_list;
+	size_t num_chunks;
+
+	/* the chunk that input data is currently appended to */
+	chunk_t *filling;
+
+	/* the chunk that the decompressed data is currently read from */
+	chunk_t *current;
+	size_t offset;
+
+	size_t in_flight;
+	size_t max_in_flight;
+
+	/* bytes allocated for chunk buffers, workers also change this */
+	size_t mem_used;
+
+	/* once set, all reads are forwarded to this stream */
+	sqfs_istream_t *fallback;
+
+	/*
+	  Set while chunks are decoded serially by the reader, after a chunk
+	  failed to decode on its own. The chunk input is fed to it in order,
+	  until a member ends exactly at the end of a chunk. The next chunk
+	  then starts on a verified member boundary and the parallel results
+	  are used again.
+	 */
+	xfrm_stream_t *serial;
+	chunk_t *serial_in;
+	size_t serial_in_offset;
+	bool serial_done;
+
+	sqfs_u8 *serial_out;
+	size_t serial_used;
+	size_t serial_offset;
+
+	/* number of chunks decoded by the workers and handed out */
+	size_t chunks_used;
+
+	bool eof;
+	bool split_failed;
+	int status;
+} istream_xfrm_mt_t;
+
+static bool is_member_start(int comp_id, const sqfs_u8 *ptr)
+{
+	switch (comp_id) {
+	case XFRM_COMPRESSOR_GZIP:
+		/* deflate method, no reserved flags */
+		return ptr[0] == 0x1F && ptr[1] == 0x8B && ptr[2] == 0x08 &&
+			(ptr[3] & 0xE0) == 0;
+	case XFRM_COMPRESSOR_XZ:
+		return memcmp(ptr, "\xFD" "7zXZ\0", 6) == 0;
+	case XFRM_COMPRESSOR_ZSTD:
+		return memcmp(ptr, "\x28\xB5\x2F\xFD", 4) == 0;
+	case XFRM_COMPRESSOR_BZIP2:
+		/* stream header, followed by the first block header */
+		return memcmp(ptr, "BZh", 3) == 0 &&
+			ptr[3] >= '1' && ptr[3] <= '9' &&
+			memcmp(ptr + 4, "1AY&SY", 6) == 0;
+	default:
+		return false;
+	}
+}
+
+static sqfs_u8 member_magic(int comp_id)
+{
+	switch (comp_id) {
+	case XFRM_COMPRESSOR_GZIP:
+		return 0x1F;
+	case XFRM_COMPRESSOR_XZ:
+		return 0xFD;
+	case XFRM_COMPRESSOR_ZSTD:
+		return 0x28;
+	default:
+		return 'B';
+	}
+}
+
+/*****************************************************************************/
+
+static bool try_reserve(size_t *mem_used, size_t size)
+{
+	size_t old = __atomic_load_n(mem_used, __ATOMIC_RELAXED);
+
+	do {
+		if (old > MAX_TOTAL_MEMORY || size > (MAX_TOTAL_MEMORY - old))
+			return false;
+	} while (!__atomic_compare_exchange_n(mem_used, &old, old + size, true,
+					      __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+
+	return true;
+}
+
+static int grow_output(size_t *mem_used, chunk_t *c, size_t min_size)
+{
+	size_t new_sz = c->out_max > 0 ? c->out_max : 65536;
+	void *new;
+
+	if (c->out_max >= min_size)
+		return 0;
+
+	if (c->out_max >= MAX_CHUNK_OUTPUT)
+		return 1;
+
+	while (new_sz < min_size)
+		new_sz *= 2;
+
+	if (new_sz > MAX_CHUNK_OUTPUT)
+		new_sz = MAX_CHUNK_OUTPUT;
+
+	/* beyond the reservation, give up if the memory limit is reached */
+	if (new_sz > c->out_reserved) {
+		if (!try_reserve(mem_used, new_sz - c->out_reserved))
+			return 1;
+
+		c->out_reserved = new_sz;
+	}
+
+	new = realloc(c->out, new_sz);
+	if (new == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	c->out = new;
+	c->out_max = new_sz;
+	return 0;
+}
+
+static int reset_decoder(chunk_worker_t *w)
+{
+	sqfs_drop(w->xfrm);
+
+	w->xfrm = decompressor_stream_create(w->comp_id);
+	return w->xfrm == NULL ? SQFS_ERROR_ALLOC : 0;
+}
+
+enum {
+	CHUNK_VALID = 0,
+	CHUNK_INVALID,
+	CHUNK_RETRY,
+};
+
+static int run_decoder(chunk_worker_t *w, chunk_t *c)
+{
+	sqfs_u32 in_off = 0, out_off = 0, old_in, old_out;
+	int ret = XFRM_STREAM_OK;
+
+	while (in_off < c->in_used) {
+		if (out_off == c->out_max) {
+			ret = grow_output(w->mem_used, c, c->out_max + 1);
+			if (ret < 0)
+				c->status = ret;
+			if (ret != 0)
+				return CHUNK_INVALID;
+		}
+
+		old_in = in_off;
+		old_out = out_off;
+
+		ret = w->xfrm->process_data(w->xfrm, c->in + in_off,
+					    c->in_used - in_off,
+					    c->out + out_off,
+					    c->out_max - out_off,
+					    &in_off, &out_off,
+					    XFRM_STREAM_FLUSH_NONE);
+
+		if (ret == XFRM_STREAM_ERROR)
+			return CHUNK_INVALID;
+
+		if (in_off == old_in && out_off == old_out)
+			return CHUNK_INVALID;
+	}
+
+	c->out_used = out_off;
+
+	if (ret == XFRM_STREAM_END)
+		return CHUNK_VALID;
+
+	/*
+	  If the last input byte filled up the buffer, the decoder might
+	  hold back more data, but cannot be asked for it without input.
+	 */
+	return out_off == c->out_max ? CHUNK_RETRY : CHUNK_INVALID;
+}
+
+static int decode_chunk(void *user, void *item)
+{
+	chunk_worker_t *w = user;
+	chunk_t *c = item;
+	int ret;
+
+	/* an invalid chunk makes the reader fall back to serial decoding */
+	c->valid = false;
+	c->out_used = 0;
+	c->status = grow_output(w->mem_used, c,
+				OUTPUT_RESERVE_FACTOR * c->in_used);
+	if (c->status < 0)
+		return 0;
+
+	c->status = 0;
+
+	for (;;) {
+		ret = run_decoder(w, c);
+		if (ret == CHUNK_VALID) {
+			c->valid = true;
+			return 0;
+		}
+
+		/* the decoder is stuck in the middle of a member */
+		if (reset_decoder(w)) {
+			c->status = SQFS_ERROR_ALLOC;
+			return 0;
+		}
+
+		if (ret == CHUNK_INVALID || c->status != 0)
+			return 0;
+
+		ret = grow_output(w->mem_used, c, c->out_max + 1);
+		if (ret < 0)
+			c->status = ret;
+		if (ret != 0)
+			return 0;
+	}
+}
+
+/*****************************************************************************/
+
+static int replay_get_buffered_data(sqfs_istream_t *strm, const sqfs_u8 **out,
+				    size_t *size, size_t want)
+{
+	istream_replay_t *replay = (istream_replay_t *)strm;
+
+	if (replay->list == NULL) {
+		return replay->wrapped->get_buffered_data(replay->wrapped,
+							  out, size, want);
+	}
+
+	*out = replay->list->in + replay->offset;
+	*size = replay->list->in_used - replay->offset;
+	return 0;
+}
+
+static void replay_advance_buffer(sqfs_istream_t *strm, size_t count)
+{
+	istream_replay_t *replay = (istream_replay_t *)strm;
+
+	if (replay->list == NULL) {
+		replay->wrapped->advance_buffer(replay->wrapped, count);
+		return;
+	}
+
+	replay->offset += count;
+
+	if (replay->offset >= replay->list->in_used) {
+		replay->list = replay->list->next;
+		replay->offset = 0;
+	}
+}
+
+static const char *replay_get_filename(sqfs_istream_t *strm)
+{
+	istream_replay_t *replay = (istream_replay_t *)strm;
+
+	return replay->wrapped->get_filename(replay->wrapped);
+}
+
+static void replay_destroy(sqfs_object_t *obj)
+{
+	istream_replay_t *replay = (istream_replay_t *)obj;
+
+	sqfs_drop(replay->wrapped);
+	free(replay);
+}
+
+static sqfs_istream_t *replay_create(sqfs_istream_t *strm, chunk_t *list)
+{
+	istream_replay_t *replay = calloc(1, sizeof(*replay));
+	sqfs_istream_t *base = (sqfs_istream_t *)replay;
+
+	if (replay == NULL)
+		return NULL;
+
+	sqfs_object_init(replay, replay_destroy, NULL);
+	replay->wrapped = sqfs_grab(strm);
+	replay->list = list;
+
+	base->get_buffered_data = replay_get_buffered_data;
+	base->advance_buffer = replay_advance_buffer;
+	base->get_filename = replay_get_filename;
+	return base;
+}
+
+/*****************************************************************************/
+
+static chunk_t *get_free_chunk(istream_xfrm_mt_t *strm)
+{
+	chunk_t *c = strm->free_list;
+
+	strm->free_list = c->next;
+	c->next = NULL;
+	c->in_used = 0;
+	c->out_used = 0;
+	c->scan = 0;
+	return c;
+}
+
+static bool over_memory_limit(istream_xfrm_mt_t *strm)
+{
+	return __atomic_load_n(&strm->mem_used, __ATOMIC_RELAXED) >
+		MAX_TOTAL_MEMORY;
+}
+
+static void release_chunk(istream_xfrm_mt_t *strm, chunk_t *c)
+{
+	if (over_memory_limit(strm)) {
+		__atomic_sub_fetch(&strm->mem_used, c->in_max + c->out_reserved,
+				   __ATOMIC_RELAXED);
+		free(c->in);
+		free(c->out);
+		c->in = c->out = NULL;
+		c->in_max = c->out_max = c->out_reserved = 0;
+	} else if (c->out_reserved > c->out_max) {
+		/* only keep what is actually allocated */
+		__atomic_sub_fetch(&strm->mem_used,
+				   c->out_reserved - c->out_max,
+				   __ATOMIC_RELAXED);
+		c->out_reserved = c->out_max;
+	}
+
+	c->next = strm->free_list;
+	strm->free_list = c;
+}
+
+static int append_input(istream_xfrm_mt_t *strm, chunk_t *c,
+			const sqfs_u8 *data, size_t size)
+{
+	size_t new_sz = c->in_max > 0 ? c->in_max : CHUNK_SIZE;
+	void *new;
+
+	if (size > (c->in_max - c->in_used)) {
+		while (new_sz - c->in_used < size)
+			new_sz *= 2;
+
+		if (new_sz > MAX_CHUNK_INPUT)
+			new_sz = MAX_CHUNK_INPUT;
+
+		if (new_sz - c->in_used < size)
+			return SQFS_ERROR_OVERFLOW;
+
+		new = realloc(c->in, new_sz);
+		if (new == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		__atomic_add_fetch(&strm->mem_used, new_sz - c->in_max,
+				   __ATOMIC_RELAXED);
+		c->in = new;
+		c->in_max = new_sz;
+	}
+
+	memcpy(c->in + c->in_used, data, size);
+	c->in_used += size;
+	return 0;
+}
+
+/*
+  Returns the offset of the first possible member start after the minimum
+  chunk size, or 0 if there is none in the data read so far.
+ */
+static size_t find_split(istream_xfrm_mt_t *strm, chunk_t *c)
+{
+	const sqfs_u8 *ptr, *end;
+
+	if (c->scan < CHUNK_SIZE)
+		c->scan = CHUNK_SIZE;
+
+	if ((c->scan + MAX_MAGIC_SIZE) > c->in_used)
+		return 0;
+
+	ptr = c->in + c->scan;
+	end = c->in + c->in_used - MAX_MAGIC_SIZE + 1;
+
+	while (ptr < end) {
+		ptr = memchr(ptr, strm->magic, end - ptr);
+		if (ptr == NULL)
+			break;
+
+		if (is_member_start(strm->comp_id, ptr))
+			return ptr - c->in;
+
+		++ptr;
+	}
+
+	c->scan = end - c->in;
+	return 0;
+}
+
+static int submit_chunk(istream_xfrm_mt_t *strm, chunk_t *c)
+{
+	size_t want = OUTPUT_RESERVE_FACTOR * c->in_used;
+
+	if (want > MAX_CHUNK_OUTPUT)
+		want = MAX_CHUNK_OUTPUT;
+
+	if (want > c->out_reserved) {
+		__atomic_add_fetch(&strm->mem_used, want - c->out_reserved,
+				   __ATOMIC_RELAXED);
+		c->out_reserved = want;
+	}
+
+	if (strm->pool->submit(strm->pool, c) != 0) {
+		release_chunk(strm, c);
+		return SQFS_ERROR_ALLOC;
+	}
+
+	strm->in_flight += 1;
+	return 0;
+}
+
+/* reads input until a chunk can be submitted or splitting is hopeless */
+static int read_chunk(istream_xfrm_mt_t *strm)
+{
+	const sqfs_u8 *ptr;
+	chunk_t *c, *next;
+	size_t size, pos;
+	int ret;
+
+	if (strm->filling == NULL)
+		strm->filling = get_free_chunk(strm);
+
+	c = strm->filling;
+
+	for (;;) {
+		ret = strm->wrapped->get_buffered_data(strm->wrapped, &ptr,
+						       &size, CHUNK_SIZE);
+		if (ret < 0)
+			return ret;
+
+		if (ret > 0) {
+			strm->eof = true;
+			strm->filling = NULL;
+
+			if (c->in_used == 0) {
+				release_chunk(strm, c);
+				return 0;
+			}
+
+			return submit_chunk(strm, c);
+		}
+
+		if (size > CHUNK_SIZE)
+			size = CHUNK_SIZE;
+
+		ret = append_input(strm, c, ptr, size);
+		if (ret)
+			return ret;
+
+		strm->wrapped->advance_buffer(strm->wrapped, size);
+
+		pos = find_split(strm, c);
+		if (pos > 0)
+			break;
+
+		if (c->in_used >= MAX_CHUNK_SIZE) {
+			strm->split_failed = true;
+			return 0;
+		}
+	}
+
+	/* the possible member start begins the next chunk */
+	next = get_free_chunk(strm);
+
+	ret = append_input(strm, next, c->in + pos, c->in_used - pos);
+	if (ret) {
+		release_chunk(strm, next);
+		return ret;
+	}
+
+	c->in_used = pos;
+	strm->filling = next;
+	return submit_chunk(strm, c);
+}
+
+/*
+  Continue decompressing serially, starting with the input of the chunk
+  that is being filled, which begins on a member boundary. Used once no
+  possible member start is found for a while, so the rest of the input is
+  most likely a single stream. There are no chunks in flight at this point.
+ */
+static int start_fallback(istream_xfrm_mt_t *strm)
+{
+	chunk_t *list = strm->filling;
+	sqfs_istream_t *replay;
+	xfrm_stream_t *xfrm;
+	size_t i;
+
+	strm->filling = NULL;
+	list->next = NULL;
+
+	/* the workers are no longer needed */
+	strm->pool->destroy(strm->pool);
+	strm->pool = NULL;
+
+	for (i = 0; i < strm->num_workers; ++i) {
+		sqfs_drop(strm->workers[i].xfrm);
+		strm->workers[i].xfrm = NULL;
+	}
+
+	replay = replay_create(strm->wrapped, list);
+	if (replay == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	xfrm = decompressor_stream_create(strm->comp_id);
+	if (xfrm == NULL) {
+		sqfs_drop(replay);
+		return SQFS_ERROR_ALLOC;
+	}
+
+	strm->fallback = istream_xfrm_create_threaded(replay, xfrm);
+	sqfs_drop(replay);
+	sqfs_drop(xfrm);
+
+	return strm->fallback == NULL ? SQFS_ERROR_ALLOC : 0;
+}
+
+/* keeps the workers busy, as far as the limits allow */
+static int fill_pipeline(istream_xfrm_mt_t *strm)
+{
+	int ret;
+
+	while (!strm->eof && !strm->split_failed &&
+	       strm->in_flight < strm->max_in_flight &&
+	       (strm->in_flight == 0 || !over_memory_limit(strm))) {
+		ret = read_chunk(strm);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* the next chunk in order, for serial decoding, returns > 0 at the end */
+static int next_serial_input(istream_xfrm_mt_t *strm)
+{
+	chunk_t *c;
+	int ret;
+
+	ret = fill_pipeline(strm);
+	if (ret)
+		return ret;
+
+	if (strm->in_flight > 0) {
+		c = strm->pool->dequeue(strm->pool);
+		if (c == NULL)
+			return SQFS_ERROR_INTERNAL;
+
+		strm->in_flight -= 1;
+
+		if (c->status != 0) {
+			ret = c->status;
+			release_chunk(strm, c);
+			return ret;
+		}
+	} else if (strm->filling != NULL && strm->filling->in_used > 0) {
+		/*
+		  No member start was found in the data of the chunk, we are
+		  still inside a member, so it is fed to the decoder as is.
+		 */
+		c = strm->filling;
+		strm->filling = NULL;
+		strm->split_failed = false;
+	} else {
+		return 1;
+	}
+
+	strm->serial_in = c;
+	strm->serial_in_offset = 0;
+	return 0;
+}
+
+static int serial_decode(istream_xfrm_mt_t *strm)
+{
+	sqfs_u32 in_off, out_off;
+	chunk_t *c;
+	int ret;
+
+	strm->serial_used = 0;
+	strm->serial_offset = 0;
+
+	while (strm->serial_used < SERIAL_BUFSZ) {
+		if (strm->serial_in == NULL) {
+			ret = next_serial_input(strm);
+			if (ret < 0)
+				return ret;
+
+			/* end of the input, hand out what we got */
+			if (ret > 0)
+				return strm->serial_used > 0 ? 0 : 1;
+		}
+
+		c = strm->serial_in;
+		in_off = out_off = 0;
+
+		ret = strm->serial->process_data(strm->serial,
+					c->in + strm->serial_in_offset,
+					c->in_used - strm->serial_in_offset,
+					strm->serial_out + strm->serial_used,
+					SERIAL_BUFSZ - strm->serial_used,
+					&in_off, &out_off,
+					XFRM_STREAM_FLUSH_NONE);
+
+		if (ret == XFRM_STREAM_ERROR)
+			return SQFS_ERROR_COMPRESSOR;
+
+		if (in_off == 0 && out_off == 0)
+			return SQFS_ERROR_CORRUPTED;
+
+		strm->serial_in_offset += in_off;
+		strm->serial_used += out_off;
+
+		if (strm->serial_in_offset < c->in_used)
+			continue;
+
+		release_chunk(strm, c);
+		strm->serial_in = NULL;
+
+		/* a member ends with the chunk, the next one is safe to use */
+		if (ret == XFRM_STREAM_END) {
+			strm->serial_done = true;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static int start_serial(istream_xfrm_mt_t *strm, chunk_t *c)
+{
+	if (strm->serial_out == NULL) {
+		strm->serial_out = malloc(SERIAL_BUFSZ);
+		if (strm->serial_out == NULL)
+			goto fail;
+	}
+
+	strm->serial = decompressor_stream_create(strm->comp_id);
+	if (strm->serial == NULL)
+		goto fail;
+
+	strm->serial_in = c;
+	strm->serial_in_offset = 0;
+	strm->serial_used = 0;
+	strm->serial_offset = 0;
+	strm->serial_done = false;
+	return 0;
+fail:
+	release_chunk(strm, c);
+	return SQFS_ERROR_ALLOC;
+}
+
+/* returns > 0 if there is no more data */
+static int next_chunk(istream_xfrm_mt_t *strm)
+{
+	chunk_t *c;
+	int ret;
+
+	if (strm->current != NULL) {
+		release_chunk(strm, strm->current);
+		strm->current = NULL;
+	}
+
+	ret = fill_pipeline(strm);
+	if (ret)
+		return ret;
+
+	if (strm->in_flight == 0) {
+		if (strm->filling != NULL && strm->filling->in_used > 0)
+			return start_fallback(strm);
+		return 1;
+	}
+
+	c = strm->pool->dequeue(strm->pool);
+	if (c == NULL)
+		return SQFS_ERROR_INTERNAL;
+
+	strm->in_flight -= 1;
+
+	if (c->status != 0) {
+		ret = c->status;
+		release_chunk(strm, c);
+		return ret;
+	}
+
+	if (!c->valid)
+		return start_serial(strm, c);
+
+	strm->current = c;
+	strm->offset = 0;
+	strm->chunks_used += 1;
+	return 0;
+}
+
+static int xfrm_get_buffered_data(sqfs_istream_t *base, const sqfs_u8 **out,
+				  size_t *size, size_t want)
+{
+	istream_xfrm_mt_t *strm = (istream_xfrm_mt_t *)base;
+	int ret;
+
+	*out = NULL;
+	*size = 0;
+
+	if (strm->status)
+		return strm->status;
+
+	for (;;) {
+		if (strm->fallback != NULL) {
+			return strm->fallback->get_buffered_data(strm->fallback,
+								 out, size,
+								 want);
+		}
+
+		if (strm->serial != NULL) {
+			if (strm->serial_offset < strm->serial_used) {
+				*out = strm->serial_out + strm->serial_offset;
+				*size = strm->serial_used - strm->serial_offset;
+				return 0;
+			}
+
+			if (strm->serial_done) {
+				sqfs_drop(strm->serial);
+				strm->serial = NULL;
+				continue;
+			}
+
+			ret = serial_decode(strm);
+		} else if (strm->current != NULL &&
+			   strm->offset < strm->current->out_used) {
+			break;
+		} else {
+			ret = next_chunk(strm);
+		}
+
+		if (ret < 0)
+			strm->status = ret;
+		if (ret)
+			return ret;
+	}
+
+	*out = strm->current->out + strm->offset;
+	*size = strm->current->out_used - strm->offset;
+	return 0;
+}
+
+static void xfrm_advance_buffer(sqfs_istream_t *base, size_t count)
+{
+	istream_xfrm_mt_t *strm = (istream_xfrm_mt_t *)base;
+
+	if (strm->fallback != NULL) {
+		strm->fallback->advance_buffer(strm->fallback, count);
+	} else if (strm->serial != NULL) {
+		strm->serial_offset += count;
+	} else {
+		strm->offset += count;
+	}
+}
+
+static const char *xfrm_get_filename(sqfs_istream_t *base)
+{
+	istream_xfrm_mt_t *strm = (istream_xfrm_mt_t *)base;
+
+	return strm->wrapped->get_filename(strm->wrapped);
+}
+
+static void xfrm_destroy(sqfs_object_t *obj)
+{
+	istream_xfrm_mt_t *strm = (istream_xfrm_mt_t *)obj;
+	size_t i;
+
+	/* the fallback stream reads from the chunk buffers */
+	sqfs_drop(strm->fallback);
+	sqfs_drop(strm->serial);
+	free(strm->serial_out);
+
+	if (strm->pool != NULL)
+		strm->pool->destroy(strm->pool);
+
+	if (strm->workers != NULL) {
+		for (i = 0; i < strm->num_workers; ++i)
+			sqfs_drop(strm->workers[i].xfrm);
+		free(strm->workers);
+	}
+
+	if (strm->chunks != NULL) {
+		for (i = 0; i < strm->num_chunks; ++i) {
+			free(strm->chunks[i].in);
+			free(strm->chunks[i].out);
+		}
+		free(strm->chunks);
+	}
+
+	sqfs_drop(strm->wrapped);
+	free(strm);
+}
+
+sqfs_istream_t *istream_xfrm_create_mt(sqfs_istream_t *strm, int comp_id,
+				       size_t num_jobs)
+{
+	istream_xfrm_mt_t *stream = calloc(1, sizeof(*stream));
+	sqfs_istream_t *base = (sqfs_istream_t *)stream;
+	chunk_worker_t *w;
+	size_t i;
+
+	if (stream == NULL)
+		goto fail_alloc;
+
+	sqfs_object_init(stream, xfrm_destroy, NULL);
+	stream->wrapped = sqfs_grab(strm);
+	stream->comp_id = comp_id;
+	stream->magic = member_magic(comp_id);
+
+	stream->pool = thread_pool_create(num_jobs, decode_chunk);
+	if (stream->pool == NULL)
+		goto fail_alloc;
+
+	stream->num_workers = stream->pool->get_worker_count(stream->pool);
+	stream->workers = alloc_array(sizeof(stream->workers[0]),
+				      stream->num_workers);
+	if (stream->workers == NULL)
+		goto fail_alloc;
+
+	for (i = 0; i < stream->num_workers; ++i) {
+		w = stream->workers + i;
+		w->comp_id = comp_id;
+		w->mem_used = &stream->mem_used;
+		w->xfrm = decompressor_stream_create(comp_id);
+		if (w->xfrm == NULL)
+			goto fail;
+
+		stream->pool->set_worker_ptr(stream->pool, i, w);
+	}
+
+	/* in addition, one is being read from and one is being filled */
+	stream->max_in_flight = stream->num_workers * MAX_BACKLOG_PER_JOB;
+	stream->num_chunks = stream->max_in_flight + 2;
+	stream->chunks = alloc_array(sizeof(stream->chunks[0]),
+				     stream->num_chunks);
+	if (stream->chunks == NULL)
+		goto fail_alloc;
+
+	for (i = 0; i < stream->num_chunks; ++i)
+		release_chunk(stream, stream->chunks + i);
+
+	base->get_buffered_data = xfrm_get_buffered_data;
+	base->advance_buffer = xfrm_advance_buffer;
+	base->get_filename = xfrm_get_filename;
+	return base;
+fail_alloc:
+	perror("creating parallel decompressor");
+fail:
+	fprintf(stderr, "%s: error initializing decompressor stream.\n",
+		strm->get_filename(strm));
+	sqfs_drop(stream);
+	return NULL;
+}
+
+size_t istream_xfrm_mt_get_chunk_count(sqfs_istream_t *strm)
+{
+	return ((istream_xfrm_mt_t *)strm)->chunks_used;
+}
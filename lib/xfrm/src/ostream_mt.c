@@ -0,0 +1,342 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * ostream_mt.c
+ *
+ * Copyright (C) 2026 The squashfs-tools-ng contributors
+ */
+#include "config.h"
+#include "compat.h"
+#include "sqfs/io.h"
+#include "sqfs/error.h"
+#include "xfrm/compress.h"
+#include "xfrm/wrap.h"
+#include "util/threadpool.h"
+#include "util/util.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/* number of members per worker that can be in flight at the same time */
+#define MAX_BACKLOG_PER_JOB (2)
+
+/*
+  A chunk of input data that is compressed into a complete, independent
+  stream by one of the workers. Decompressors treat a sequence of those
+  as one continuous stream.
+ */
+typedef struct member_t {
+	struct member_t *next;
+
+	sqfs_u8 *in;
+	sqfs_u8 *out;
+
+	size_t in_used;
+	size_t out_used;
+	size_t out_max;
+
+	int status;
+} member_t;
+
+typedef struct {
+	sqfs_ostream_t base;
+
+	sqfs_ostream_t *wrapped;
+	thread_pool_t *pool;
+
+	xfrm_stream_t **workers;
+	size_t num_workers;
+
+	member_t *members;
+	member_t *free_list;
+	member_t *current;
+
+	size_t num_members;
+	size_t in_flight;
+	size_t member_size;
+
+	int status;
+} ostream_xfrm_mt_t;
+
+/*
+  Larger members compress better, but cost memory. Every member has an
+  input buffer of that size, and an output buffer that is about 25% larger
+  to make room for incompressible data. With MAX_BACKLOG_PER_JOB members
+  per worker, that is roughly 36 MiB per worker for xz and zstd, and
+  4.5 MiB for the other formats. For xz and zstd, the member size is in
+  the range of the default dictionary or window size.
+ */
+static size_t member_size_from_id(int id)
+{
+	switch (id) {
+	case XFRM_COMPRESSOR_XZ:
+	case XFRM_COMPRESSOR_ZSTD:
+		return 8 * 1024 * 1024;
+	default:
+		return 1024 * 1024;
+	}
+}
+
+static int compress_member(void *user, void *item)
+{
+	xfrm_stream_t *xfrm = user;
+	member_t *m = item;
+	sqfs_u32 in_off = 0, out_off = 0;
+	int ret;
+
+	m->status = 0;
+
+	/*
+	  The output buffer has room for incompressible data, so a member is
+	  always completed in a single call. Not all stream wrappers can
+	  resume finishing a stream once the input is consumed, so anything
+	  short of the end of the stream is treated as an error, rather than
+	  writing out a truncated member.
+	 */
+	ret = xfrm->process_data(xfrm, m->in, m->in_used, m->out, m->out_max,
+				 &in_off, &out_off, XFRM_STREAM_FLUSH_FULL);
+
+	if (ret != XFRM_STREAM_END || in_off != m->in_used) {
+		m->status = SQFS_ERROR_COMPRESSOR;
+		return 0;
+	}
+
+	m->out_used = out_off;
+	return 0;
+}
+
+static int write_member(ostream_xfrm_mt_t *strm)
+{
+	member_t *m = strm->pool->dequeue(strm->pool);
+	int ret;
+
+	if (m == NULL)
+		return SQFS_ERROR_INTERNAL;
+
+	strm->in_flight -= 1;
+
+	ret = m->status;
+	if (ret == 0)
+		ret = strm->wrapped->append(strm->wrapped, m->out, m->out_used);
+
+	m->in_used = 0;
+	m->out_used = 0;
+	m->next = strm->free_list;
+	strm->free_list = m;
+	return ret;
+}
+
+static int submit_current(ostream_xfrm_mt_t *strm)
+{
+	member_t *m = strm->current;
+
+	strm->current = NULL;
+
+	if (m->in_used == 0) {
+		m->next = strm->free_list;
+		strm->free_list = m;
+		return 0;
+	}
+
+	if (strm->pool->submit(strm->pool, m) != 0) {
+		m->next = strm->free_list;
+		strm->free_list = m;
+		return SQFS_ERROR_ALLOC;
+	}
+
+	strm->in_flight += 1;
+	return 0;
+}
+
+static int get_current(ostream_xfrm_mt_t *strm)
+{
+	int ret;
+
+	if (strm->current != NULL)
+		return 0;
+
+	if (strm->free_list == NULL) {
+		ret = write_member(strm);
+		if (ret)
+			return ret;
+	}
+
+	strm->current = strm->free_list;
+	strm->free_list = strm->current->next;
+	strm->current->next = NULL;
+	return 0;
+}
+
+static int xfrm_append(sqfs_ostream_t *base, const void *data, size_t size)
+{
+	ostream_xfrm_mt_t *strm = (ostream_xfrm_mt_t *)base;
+	member_t *m;
+	size_t diff;
+	int ret;
+
+	if (strm->status)
+		return strm->status;
+
+	while (size > 0) {
+		ret = get_current(strm);
+		if (ret)
+			goto fail;
+
+		m = strm->current;
+		diff = strm->member_size - m->in_used;
+		if (diff > size)
+			diff = size;
+
+		if (data == NULL) {
+			memset(m->in + m->in_used, 0, diff);
+		} else {
+			memcpy(m->in + m->in_used, data, diff);
+			data = (const char *)data + diff;
+		}
+
+		m->in_used += diff;
+		size -= diff;
+
+		if (m->in_used == strm->member_size) {
+			ret = submit_current(strm);
+			if (ret)
+				goto fail;
+		}
+	}
+
+	return 0;
+fail:
+	strm->status = ret;
+	return ret;
+}
+
+static int xfrm_flush(sqfs_ostream_t *base)
+{
+	ostream_xfrm_mt_t *strm = (ostream_xfrm_mt_t *)base;
+	int ret;
+
+	if (strm->status)
+		return strm->status;
+
+	if (strm->current != NULL) {
+		ret = submit_current(strm);
+		if (ret)
+			goto fail;
+	}
+
+	while (strm->in_flight > 0) {
+		ret = write_member(strm);
+		if (ret)
+			goto fail;
+	}
+
+	return strm->wrapped->flush(strm->wrapped);
+fail:
+	strm->status = ret;
+	return ret;
+}
+
+static const char *xfrm_get_filename(sqfs_ostream_t *base)
+{
+	ostream_xfrm_mt_t *strm = (ostream_xfrm_mt_t *)base;
+
+	return strm->wrapped->get_filename(strm->wrapped);
+}
+
+static void xfrm_destroy(sqfs_object_t *obj)
+{
+	ostream_xfrm_mt_t *strm = (ostream_xfrm_mt_t *)obj;
+	size_t i;
+
+	/* the workers must let go of the members first */
+	if (strm->pool != NULL)
+		strm->pool->destroy(strm->pool);
+
+	if (strm->workers != NULL) {
+		for (i = 0; i < strm->num_workers; ++i)
+			sqfs_drop(strm->workers[i]);
+		free(strm->workers);
+	}
+
+	if (strm->members != NULL) {
+		for (i = 0; i < strm->num_members; ++i) {
+			free(strm->members[i].in);
+			free(strm->members[i].out);
+		}
+		free(strm->members);
+	}
+
+	sqfs_drop(strm->wrapped);
+	free(strm);
+}
+
+sqfs_ostream_t *ostream_xfrm_create_mt(sqfs_ostream_t *strm, int comp_id,
+				       const compressor_config_t *cfg,
+				       size_t num_jobs)
+{
+	ostream_xfrm_mt_t *stream = calloc(1, sizeof(*stream));
+	sqfs_ostream_t *base = (sqfs_ostream_t *)stream;
+	member_t *m;
+	size_t i;
+
+	if (stream == NULL)
+		goto fail_alloc;
+
+	sqfs_object_init(stream, xfrm_destroy, NULL);
+	stream->wrapped = sqfs_grab(strm);
+	stream->member_size = member_size_from_id(comp_id);
+
+	stream->pool = thread_pool_create(num_jobs, compress_member);
+	if (stream->pool == NULL)
+		goto fail_alloc;
+
+	stream->num_workers = stream->pool->get_worker_count(stream->pool);
+	stream->workers = alloc_array(sizeof(stream->workers[0]),
+				      stream->num_workers);
+	if (stream->workers == NULL)
+		goto fail_alloc;
+
+	for (i = 0; i < stream->num_workers; ++i) {
+		stream->workers[i] = compressor_stream_create(comp_id, cfg);
+		if (stream->workers[i] == NULL)
+			goto fail;
+
+		stream->pool->set_worker_ptr(stream->pool, i,
+					     stream->workers[i]);
+	}
+
+	/* one more than in flight, for the member that is being filled */
+	stream->num_members = stream->num_workers * MAX_BACKLOG_PER_JOB + 1;
+	stream->members = alloc_array(sizeof(stream->members[0]),
+				      stream->num_members);
+	if (stream->members == NULL)
+		goto fail_alloc;
+
+	for (i = 0; i < stream->num_members; ++i) {
+		m = stream->members + i;
+
+		/* enough for incompressible data with any of the formats */
+		m->out_max = stream->member_size + stream->member_size / 4 +
+			65536;
+		m->in = malloc(stream->member_size);
+		m->out = malloc(m->out_max);
+
+		if (m->in == NULL || m->out == NULL)
+			goto fail_alloc;
+
+		m->next = stream->free_list;
+		stream->free_list = m;
+	}
+
+	base->append = xfrm_append;
+	base->flush = xfrm_flush;
+	base->get_filename = xfrm_get_filename;
+	return base;
+fail_alloc:
+	perror("creating parallel compressor");
+fail:
+	fprintf(stderr, "%s: error initializing compressor.\n",
+		strm->get_filename(strm));
+	sqfs_drop(stream);
+	return NULL;
+}
@@ -39,7 +39,16 @@ static int process_data(xfrm_stream_t *stream, const void *in,
 	if (flush_mode < 0 || flush_mode >= XFRM_STREAM_FLUSH_COUNT)
 		flush_mode = XFRM_STREAM_FLUSH_NONE;
 
-	while (in_size > 0 && out_size > 0) {
+	while (out_size > 0) {
+		/*
+		  When finishing a frame, keep going after all input is
+		  consumed, until the compressor has nothing left to flush.
+		 */
+		if (in_size == 0 && (!zstd->compress ||
+				     flush_mode == XFRM_STREAM_FLUSH_NONE)) {
+			break;
+		}
+
 		memset(&in_desc, 0, sizeof(in_desc));
 		in_desc.src = in;
 		in_desc.size = in_size;
@@ -67,15 +76,35 @@ static int process_data(xfrm_stream_t *stream, const void *in,
 		out = (char *)out + out_desc.pos;
 		out_size -= out_desc.pos;
 		*out_written += out_desc.pos;
+
+		/*
+		  For decompression, a frame has been completely decoded
+		  and flushed. For compression, ret is the number of bytes
+		  that still have to be flushed, and all input is consumed.
+		 */
+		if (ret == 0) {
+			if (!zstd->compress)
+				return XFRM_STREAM_END;
+
+			if (flush_mode != XFRM_STREAM_FLUSH_NONE &&
+			    in_size == 0) {
+				return XFRM_STREAM_END;
+			}
+		}
 	}
 
-	if (flush_mode != XFRM_STREAM_FLUSH_NONE) {
-		if (in_size == 0)
+	if (zstd->compress) {
+		if (out_size == 0 && (in_size > 0 ||
+				      flush_mode != XFRM_STREAM_FLUSH_NONE)) {
+			return XFRM_STREAM_BUFFER_FULL;
+		}
+	} else {
+		if (flush_mode != XFRM_STREAM_FLUSH_NONE && in_size == 0)
 			return XFRM_STREAM_END;
-	}
 
-	if (in_size > 0 && out_size == 0)
-		return XFRM_STREAM_BUFFER_FULL;
+		if (in_size > 0 && out_size == 0)
+			return XFRM_STREAM_BUFFER_FULL;
+	}
 
 	return XFRM_STREAM_OK;
 }
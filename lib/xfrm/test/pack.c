@@ -53,6 +53,73 @@ static const char *comp_name = "zstd";
 #error build configuration broken
 #endif
 
+#if defined(DO_ZSTD)
+static sqfs_u8 noise[65536];
+static sqfs_u8 noise_cmp[sizeof(noise) + 1024];
+static sqfs_u8 noise_plain[sizeof(noise)];
+
+/*
+  Finishing a stream with incompressible input that is bigger than the
+  output buffer must not report the end of the stream before all of the
+  compressed data has been handed out.
+ */
+static void test_finish_in_pieces(void)
+{
+	sqfs_u32 in_off = 0, out_off = 0, out_max, x = 1;
+	bool buffer_full = false;
+	xfrm_stream_t *xfrm;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < sizeof(noise); ++i) {
+		x = x * 1103515245U + 12345U;
+		noise[i] = (x >> 16) & 0xFF;
+	}
+
+	xfrm = mkcompressor(NULL);
+	TEST_NOT_NULL(xfrm);
+
+	do {
+		out_max = sizeof(noise_cmp) - out_off;
+		if (out_max > 4096)
+			out_max = 4096;
+
+		ret = xfrm->process_data(xfrm, noise + in_off,
+					 sizeof(noise) - in_off,
+					 noise_cmp + out_off, out_max,
+					 &in_off, &out_off,
+					 XFRM_STREAM_FLUSH_FULL);
+		TEST_ASSERT(ret != XFRM_STREAM_ERROR);
+
+		if (ret == XFRM_STREAM_BUFFER_FULL)
+			buffer_full = true;
+
+		TEST_ASSERT(out_off < sizeof(noise_cmp));
+	} while (ret != XFRM_STREAM_END);
+
+	TEST_ASSERT(buffer_full);
+	TEST_EQUAL_UI(in_off, sizeof(noise));
+	TEST_ASSERT(out_off > sizeof(noise));
+	sqfs_drop(xfrm);
+
+	xfrm = mkdecompressor();
+	TEST_NOT_NULL(xfrm);
+
+	i = out_off;
+	in_off = out_off = 0;
+
+	ret = xfrm->process_data(xfrm, noise_cmp, i,
+				 noise_plain, sizeof(noise_plain),
+				 &in_off, &out_off, 0);
+	TEST_EQUAL_I(ret, XFRM_STREAM_END);
+	TEST_EQUAL_UI(in_off, i);
+	TEST_EQUAL_UI(out_off, sizeof(noise));
+	TEST_ASSERT(memcmp(noise, noise_plain, sizeof(noise)) == 0);
+
+	sqfs_drop(xfrm);
+}
+#endif
+
 int main(int argc, char **argv)
 {
 	sqfs_u32 in_diff = 0, out_diff = 0;
@@ -161,5 +228,8 @@ int main(int argc, char **argv)
 	TEST_EQUAL_I(ret, 0);
 
 	sqfs_drop(xfrm);
+#if defined(DO_ZSTD)
+	test_finish_in_pieces();
+#endif
 	return EXIT_SUCCESS;
 }
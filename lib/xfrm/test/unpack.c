@@ -20,8 +20,8 @@ static size_t out_stop = 221;
 
 #define mkdecompressor decompressor_stream_bzip2_create
 #elif defined(DO_ZSTD)
-static size_t in_stop = 319;
-static size_t out_stop = 446;
+static size_t in_stop = 155;
+static size_t out_stop = 221;
 
 #define mkdecompressor decompressor_stream_zstd_create
 #elif defined(DO_GZIP)
@@ -0,0 +1,193 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * unpack_mt.c
+ *
+ * Copyright (C) 2026 The squashfs-tools-ng contributors
+ */
+#include "xfrm/compress.h"
+#include "xfrm/stream.h"
+#include "xfrm/wrap.h"
+#include "util/test.h"
+#include "sqfs/io.h"
+#include "common.h"
+
+#if defined(DO_XZ)
+#define COMP_ID XFRM_COMPRESSOR_XZ
+#elif defined(DO_BZIP2)
+#define COMP_ID XFRM_COMPRESSOR_BZIP2
+#elif defined(DO_ZSTD)
+#define COMP_ID XFRM_COMPRESSOR_ZSTD
+#elif defined(DO_GZIP)
+#define COMP_ID XFRM_COMPRESSOR_GZIP
+#endif
+
+/* large enough that the compressed members get split into chunks */
+#define MEMBER_SIZE (1280 * 1024)
+#define NUM_MEMBERS (4)
+#define DATA_SIZE (MEMBER_SIZE * NUM_MEMBERS)
+
+static sqfs_u8 data[DATA_SIZE];
+
+static sqfs_u8 *packed = NULL;
+static size_t packed_used = 0;
+
+/*****************************************************************************/
+
+static void init_data(void)
+{
+	/* member headers that do not mark the start of a member */
+	static const char *magic[] = {
+		"\x1F\x8B\x08\x00\x00\x00\x00\x00\x00\x00",
+		"\xFD" "7zXZ\0\0\0\0\0",
+		"\x28\xB5\x2F\xFD\x00\x00\x00\x00\x00\x00",
+		"BZh91AY&SY",
+	};
+	sqfs_u32 state = 0xDEADBEEF;
+	size_t i;
+
+	/* incompressible, so the data ends up in the output as is */
+	for (i = 0; i < DATA_SIZE; ++i) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		data[i] = state & 0xFF;
+	}
+
+	for (i = 0; i < sizeof(magic) / sizeof(magic[0]); ++i) {
+		memcpy(data + (i + 2) * MEMBER_SIZE / 2, magic[i], 10);
+	}
+}
+
+/*
+  Put a member header of the format into the second member, far enough
+  in to be picked as a split point. The chunk before it fails to decode
+  on its own, so the reader has to decode serially until the next real
+  member boundary, and can then use the parallel results again.
+ */
+static void add_false_split(void)
+{
+	static const char *magic =
+#if defined(DO_XZ)
+		"\xFD" "7zXZ\0\0\0\0\0";
+#elif defined(DO_ZSTD)
+		"\x28\xB5\x2F\xFD\x00\x00\x00\x00\x00\x00";
+#else
+		"\x1F\x8B\x08\x00\x00\x00\x00\x00\x00\x00";
+#endif
+
+	memcpy(data + MEMBER_SIZE + 1152 * 1024 + 1000, magic, 10);
+}
+
+static void pack(size_t member_size)
+{
+	sqfs_u32 in_off, out_off;
+	xfrm_stream_t *xfrm;
+	size_t i, out_max;
+	int ret;
+
+	/* enough for incompressible data, so every member is done at once */
+	out_max = DATA_SIZE + DATA_SIZE / 4 + 65536;
+
+	free(packed);
+	packed = malloc(out_max);
+	TEST_NOT_NULL(packed);
+	packed_used = 0;
+
+	for (i = 0; i < DATA_SIZE; i += member_size) {
+		xfrm = compressor_stream_create(COMP_ID, NULL);
+		TEST_NOT_NULL(xfrm);
+
+		in_off = 0;
+		out_off = 0;
+
+		ret = xfrm->process_data(xfrm, data + i, member_size,
+					 packed + packed_used,
+					 out_max - packed_used,
+					 &in_off, &out_off,
+					 XFRM_STREAM_FLUSH_FULL);
+
+		TEST_EQUAL_I(ret, XFRM_STREAM_END);
+		TEST_EQUAL_UI(in_off, member_size);
+
+		packed_used += out_off;
+		sqfs_drop(xfrm);
+	}
+}
+
+static void run_unpack_test(size_t num_jobs, size_t num_chunks)
+{
+	sqfs_istream_t *istream, *mem_istream;
+	sqfs_u8 buffer[7777];
+	size_t offset = 0;
+	sqfs_s32 ret;
+
+	mem_istream = istream_memory_create("memstream", 65536,
+					    packed, packed_used);
+	TEST_NOT_NULL(mem_istream);
+
+	istream = istream_xfrm_create_mt(mem_istream, COMP_ID, num_jobs);
+	TEST_NOT_NULL(istream);
+	TEST_EQUAL_UI(((sqfs_object_t *)mem_istream)->refcount, 2);
+
+	for (;;) {
+		ret = sqfs_istream_read(istream, buffer, sizeof(buffer));
+		TEST_ASSERT(ret >= 0);
+		if (ret == 0)
+			break;
+
+		TEST_ASSERT((size_t)ret <= (DATA_SIZE - offset));
+		TEST_ASSERT(memcmp(buffer, data + offset, ret) == 0);
+		offset += ret;
+	}
+
+	TEST_EQUAL_UI(offset, DATA_SIZE);
+
+	ret = sqfs_istream_read(istream, buffer, sizeof(buffer));
+	TEST_EQUAL_I(ret, 0);
+
+	/* make sure the members were split up, instead of decoded serially */
+	if (num_chunks > 0)
+		TEST_EQUAL_UI(istream_xfrm_mt_get_chunk_count(istream),
+			      num_chunks);
+
+	sqfs_drop(istream);
+	TEST_EQUAL_UI(((sqfs_object_t *)mem_istream)->refcount, 1);
+	sqfs_drop(mem_istream);
+}
+
+int main(int argc, char **argv)
+{
+	(void)argc; (void)argv;
+
+	init_data();
+
+	/* independently compressed members, decoded in parallel */
+	pack(MEMBER_SIZE);
+	run_unpack_test(1, NUM_MEMBERS);
+	run_unpack_test(3, NUM_MEMBERS);
+
+	/* more jobs than there are members */
+	run_unpack_test(64, NUM_MEMBERS);
+
+#if !defined(DO_BZIP2)
+	/*
+	  A false split point in the second member. The chunk after it
+	  covers the rest of the second and all of the third member, so
+	  those are decoded serially. The first and the last member are
+	  still decoded in parallel. Not possible with bzip2, the header
+	  does not survive compression.
+	 */
+	add_false_split();
+	pack(MEMBER_SIZE);
+	run_unpack_test(1, NUM_MEMBERS - 2);
+	run_unpack_test(3, NUM_MEMBERS - 2);
+#endif
+
+	/* a single stream with misleading member headers in the data */
+	pack(DATA_SIZE);
+	run_unpack_test(1, 0);
+	run_unpack_test(3, 0);
+
+	free(packed);
+	return EXIT_SUCCESS;
+}
@@ -15,21 +15,35 @@
 #if defined(DO_XZ)
 #define mkdecompressor decompressor_stream_xz_create
 #define mkcompressor compressor_stream_xz_create
+#define COMP_ID XFRM_COMPRESSOR_XZ
 #elif defined(DO_BZIP2)
 #define mkdecompressor decompressor_stream_bzip2_create
 #define mkcompressor compressor_stream_bzip2_create
+#define COMP_ID XFRM_COMPRESSOR_BZIP2
 #elif defined(DO_ZSTD)
 #define mkdecompressor decompressor_stream_zstd_create
 #define mkcompressor compressor_stream_zstd_create
+#define COMP_ID XFRM_COMPRESSOR_ZSTD
 #elif defined(DO_GZIP)
 #define mkdecompressor decompressor_stream_gzip_create
 #define mkcompressor compressor_stream_gzip_create
+#define COMP_ID XFRM_COMPRESSOR_GZIP
 #endif
 
+/* the member size of the parallel compressor, see ostream_mt.c */
+#if defined(DO_XZ) || defined(DO_ZSTD)
+#define MEMBER_SIZE (8 * 1024 * 1024)
+#else
+#define MEMBER_SIZE (1024 * 1024)
+#endif
+
+#define MT_DATA_SIZE (3 * MEMBER_SIZE + MEMBER_SIZE / 2)
+#define MT_NUM_MEMBERS (4)
+
 /*****************************************************************************/
 
 static size_t mo_written = 0;
-static sqfs_u8 mo_buffer[1024];
+static sqfs_u8 mo_buffer[256 * 1024];
 static bool mo_flushed = false;
 
 static int mem_append(sqfs_ostream_t *strm, const void *data, size_t size);
@@ -70,7 +84,7 @@ static int mem_flush(sqfs_ostream_t *strm)
 
 /*****************************************************************************/
 
-static void run_unpack_test(const void *blob, size_t size)
+static void run_unpack_test(const void *blob, size_t size, bool threaded)
 {
 	sqfs_istream_t *istream, *mem_istream;
 	xfrm_stream_t *xfrm;
@@ -86,7 +100,11 @@ static void run_unpack_test(const void *blob, size_t size)
 	TEST_EQUAL_UI(((sqfs_object_t *)xfrm)->refcount, 1);
 	TEST_EQUAL_UI(((sqfs_object_t *)mem_istream)->refcount, 1);
 
-	istream = istream_xfrm_create(mem_istream, xfrm);
+	if (threaded) {
+		istream = istream_xfrm_create_threaded(mem_istream, xfrm);
+	} else {
+		istream = istream_xfrm_create(mem_istream, xfrm);
+	}
 
 	TEST_NOT_NULL(istream);
 	TEST_EQUAL_UI(((sqfs_object_t *)istream)->refcount, 1);
@@ -153,16 +171,165 @@ static void run_pack_test(void)
 	sqfs_drop(xfrm);
 }
 
+/*
+  Decompress a sequence of independent streams, returning the number of
+  streams that were found.
+ */
+static size_t unpack_members(const sqfs_u8 *in, size_t in_size,
+			     sqfs_u8 *out, size_t out_max)
+{
+	sqfs_u32 in_off = 0, out_off = 0, old_in, old_out;
+	size_t count = 0;
+	xfrm_stream_t *xfrm;
+	int ret;
+
+	xfrm = mkdecompressor();
+	TEST_NOT_NULL(xfrm);
+
+	while (in_off < in_size) {
+		old_in = in_off;
+		old_out = out_off;
+
+		ret = xfrm->process_data(xfrm, in + in_off, in_size - in_off,
+					 out + out_off, out_max - out_off,
+					 &in_off, &out_off,
+					 XFRM_STREAM_FLUSH_NONE);
+		TEST_ASSERT(ret != XFRM_STREAM_ERROR);
+
+		if (ret == XFRM_STREAM_END) {
+			count += 1;
+		} else {
+			TEST_ASSERT(in_off != old_in || out_off != old_out);
+		}
+	}
+
+	TEST_EQUAL_UI(out_off, MT_DATA_SIZE);
+	sqfs_drop(xfrm);
+	return count;
+}
+
+/*
+  Read the packed data back through the threaded reader, asking for more
+  than is left over after each step, so requests span the buffers that are
+  filled by the worker.
+ */
+static void run_unpack_want_test(const sqfs_u8 *data, size_t size)
+{
+	sqfs_istream_t *istream, *mem_istream;
+	size_t total = 0, avail, want = 100000;
+	const sqfs_u8 *ptr;
+	xfrm_stream_t *xfrm;
+	int ret;
+
+	mem_istream = istream_memory_create("memstream", 7, mo_buffer,
+					    mo_written);
+	TEST_NOT_NULL(mem_istream);
+
+	xfrm = mkdecompressor();
+	TEST_NOT_NULL(xfrm);
+
+	istream = istream_xfrm_create_threaded(mem_istream, xfrm);
+	TEST_NOT_NULL(istream);
+
+	for (;;) {
+		ret = istream->get_buffered_data(istream, &ptr, &avail, want);
+		TEST_ASSERT(ret >= 0);
+		if (ret > 0)
+			break;
+
+		TEST_ASSERT(avail <= (size - total));
+		if ((size - total) >= want)
+			TEST_ASSERT(avail >= want);
+
+		TEST_ASSERT(memcmp(ptr, data + total, avail) == 0);
+
+		if (avail > 65537)
+			avail = 65537;
+
+		istream->advance_buffer(istream, avail);
+		total += avail;
+	}
+
+	TEST_EQUAL_UI(total, size);
+
+	sqfs_drop(istream);
+	sqfs_drop(xfrm);
+	sqfs_drop(mem_istream);
+}
+
+static void run_pack_mt_test(int id)
+{
+	sqfs_ostream_t *ostream;
+	sqfs_u8 *data, *out;
+	size_t i, diff;
+	int ret;
+
+	mo_written = 0;
+	mo_flushed = false;
+
+	/* compressible, but different in every member */
+	data = malloc(MT_DATA_SIZE);
+	out = malloc(MT_DATA_SIZE);
+	TEST_NOT_NULL(data);
+	TEST_NOT_NULL(out);
+
+	for (i = 0; i < MT_DATA_SIZE; ++i)
+		data[i] = orig[i % (sizeof(orig) - 1)];
+
+	for (i = 0; i < MT_DATA_SIZE; i += 4096) {
+		data[i] = (i / 4096) & 0xFF;
+		data[i + 1] = (i / 4096) >> 8;
+	}
+
+	ostream = ostream_xfrm_create_mt(&mem_ostream, id, NULL, 2);
+
+	TEST_NOT_NULL(ostream);
+	TEST_EQUAL_UI(((sqfs_object_t *)ostream)->refcount, 1);
+	TEST_EQUAL_UI(((sqfs_object_t *)&mem_ostream)->refcount, 2);
+
+	/* in pieces that do not line up with the members */
+	for (i = 0; i < MT_DATA_SIZE; i += diff) {
+		diff = MT_DATA_SIZE - i;
+		if (diff > 100000)
+			diff = 100000;
+
+		ret = ostream->append(ostream, data + i, diff);
+		TEST_EQUAL_I(ret, 0);
+	}
+
+	ret = ostream->flush(ostream);
+	TEST_EQUAL_I(ret, 0);
+
+	TEST_ASSERT(mo_flushed);
+	TEST_ASSERT(mo_written < MT_DATA_SIZE);
+
+	sqfs_drop(ostream);
+	TEST_EQUAL_UI(((sqfs_object_t *)&mem_ostream)->refcount, 1);
+
+	TEST_EQUAL_UI(unpack_members(mo_buffer, mo_written, out, MT_DATA_SIZE),
+		      MT_NUM_MEMBERS);
+	TEST_ASSERT(memcmp(out, data, MT_DATA_SIZE) == 0);
+
+	run_unpack_want_test(data, MT_DATA_SIZE);
+
+	free(data);
+	free(out);
+}
+
 int main(int argc, char **argv)
 {
 	(void)argc; (void)argv;
 
 	/* normal stream */
-	run_unpack_test(blob_in, sizeof(blob_in));
+	run_unpack_test(blob_in, sizeof(blob_in), false);
+
+	/* decompressed on a background thread */
+	run_unpack_test(blob_in, sizeof(blob_in), true);
 
 	/* concatenated streams */
 #if !defined(DO_GZIP)
-	run_unpack_test(blob_in_concat, sizeof(blob_in_concat));
+	run_unpack_test(blob_in_concat, sizeof(blob_in_concat), false);
+	run_unpack_test(blob_in_concat, sizeof(blob_in_concat), true);
 #else
 	(void)blob_in_concat;
 #endif
@@ -170,6 +337,9 @@ int main(int argc, char **argv)
 	run_pack_test();
 
 	/* restore from compressed */
-	run_unpack_test(mo_buffer, mo_written);
+	run_unpack_test(mo_buffer, mo_written, false);
+
+	/* compress on a thread pool, into several independent members */
+	run_pack_mt_test(COMP_ID);
 	return EXIT_SUCCESS;
 }